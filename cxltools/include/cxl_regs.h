@@ -0,0 +1,197 @@
+/*************************************************************************
+@File Name: cxl_regs.h
+@Desc: CXL register block layout shared by the cxltools.
+
+    Offsets follow CXL 3.x section 8.2. The BAR layout (component
+    registers at 0, device registers at REGS_DEV_BASE) is the one our
+    cards expose on BAR2 and the one cxl_regemu builds. It is also what
+    test_mb.sh and sfx-hdmdecoder-dump.py assume.
+************************************************************************/
+
+#ifndef CXL_REGS_H
+#define CXL_REGS_H
+
+#include <stdint.h>
+
+/* BAR2 layout */
+#define REGS_BAR_SIZE               0x20000
+#define REGS_CM_BASE                0x1000      /* CXL.cache/mem component registers */
+#define REGS_DEV_BASE               0x10000     /* device register block */
+
+/* CXL.cache/mem capability header and array (8.2.4) */
+#define CM_CAP_HDR_ID(v)            ((v) & 0xffff)
+#define CM_CAP_HDR_ARRAY_SIZE(v)    (((v) >> 24) & 0xff)
+#define CM_CAP_ENTRY_ID(v)          ((v) & 0xffff)
+#define CM_CAP_ENTRY_PTR(v)         (((v) >> 20) & 0xfff)
+
+#define CM_CAP_ID_HDR               0x1
+#define CM_CAP_ID_RAS               0x2
+#define CM_CAP_ID_LINK              0x4
+#define CM_CAP_ID_HDM               0x5
+
+/* RAS capability (8.2.4.17) */
+#define RAS_UNCOR_STATUS            0x00
+#define RAS_UNCOR_MASK              0x04
+#define RAS_UNCOR_SEVERITY          0x08
+#define RAS_COR_STATUS              0x0c
+#define RAS_COR_MASK                0x10
+#define RAS_UNCOR_STATUS_BITS       0x0001cfffu /* 16:14, 11:0 */
+#define RAS_COR_STATUS_BITS         0x0000007fu
+#define RAS_CAP_CTRL                0x14
+#define RAS_FIRST_ERR_PTR(v)        ((v) & 0x3f)
+#define RAS_HEADER_LOG              0x18
+#define RAS_HEADER_LOG_DW           16
+#define RAS_CAP_LEN                 0x58
+
+/* HDM decoder capability (8.2.4.20) */
+#define HDM_CAP                     0x00
+#define HDM_CAP_COUNT(v)            ((v) & 0xf)
+#define HDM_GLOBAL_CTRL             0x04
+#define HDM_GLOBAL_CTRL_ENABLE      (1u << 1)
+#define HDM_DECODER(n)              (0x10 + 0x20 * (n))
+#define HDM_DEC_BASE_LO             0x00
+#define HDM_DEC_BASE_HI             0x04
+#define HDM_DEC_SIZE_LO             0x08
+#define HDM_DEC_SIZE_HI             0x0c
+#define HDM_DEC_CTRL                0x10
+#define HDM_DEC_SKIP_LO             0x14        /* type 3: DPA skip */
+#define HDM_DEC_SKIP_HI             0x18
+#define HDM_CTRL_IG(v)              ((v) & 0xf)
+#define HDM_CTRL_IW(v)              (((v) >> 4) & 0xf)
+#define HDM_CTRL_LOCK_ON_COMMIT     (1u << 8)
+#define HDM_CTRL_COMMIT             (1u << 9)
+#define HDM_CTRL_COMMITTED          (1u << 10)
+#define HDM_CTRL_ERR_NOT_COMMITTED  (1u << 11)
+#define HDM_DEC_ALIGN               (256ULL << 20)
+
+/* Decoder count field to number of decoders (8.2.4.20.1) */
+static inline int hdm_decoder_count(uint32_t cap)
+{
+    uint32_t v = HDM_CAP_COUNT(cap);
+
+    return v == 0 ? 1 : (int)v * 2;
+}
+
+/* Interleave ways encoding to ways, 0 when reserved */
+static inline int hdm_ways(uint32_t eniw)
+{
+    if (eniw <= 4) {
+        return 1 << eniw;
+    }
+    if (eniw >= 8 && eniw <= 10) {
+        return 3 << (eniw - 8);
+    }
+    return 0;
+}
+
+/* Interleave granularity encoding to bytes */
+static inline uint64_t hdm_granularity(uint32_t eig)
+{
+    return 256ULL << eig;
+}
+
+/* Device capabilities array (8.2.8.1) */
+#define DEV_CAP_ARRAY               0x00        /* 64 bit */
+#define DEV_CAP_ARRAY_COUNT(v)      (((v) >> 32) & 0xffff)
+#define DEV_CAP_ENTRY(n)            (0x10 + 0x10 * (n))
+#define DEV_CAP_ENTRY_ID(v)         ((v) & 0xffff)
+#define DEV_CAP_ENTRY_OFFSET        0x04
+#define DEV_CAP_ENTRY_LENGTH        0x08
+
+#define DEV_CAP_ID_STATUS           0x0001
+#define DEV_CAP_ID_PRIMARY_MBOX     0x0002
+#define DEV_CAP_ID_MEMDEV           0x4000
+
+/* Device status (8.2.8.3) */
+#define DEV_STATUS_EVENT            0x00        /* 64 bit */
+
+/* Mailbox (8.2.8.4) */
+#define MBOX_CAPS                   0x00
+#define MBOX_CAPS_PAYLOAD_SHIFT(v)  ((v) & 0x1f)
+#define MBOX_CAPS_BG_IRQ            (1u << 6)
+#define MBOX_CTRL                   0x04
+#define MBOX_CTRL_DOORBELL          (1u << 0)
+#define MBOX_CMD                    0x08        /* 64 bit */
+#define MBOX_CMD_OPCODE(v)          ((uint16_t)((v) & 0xffff))
+#define MBOX_CMD_LEN(v)             ((uint32_t)(((v) >> 16) & 0x1fffff))
+#define MBOX_CMD_MAKE(op, len)      ((uint64_t)(op) | (uint64_t)(len) << 16)
+#define MBOX_STATUS                 0x10        /* 64 bit */
+#define MBOX_STATUS_BG              (1ULL << 0)
+#define MBOX_STATUS_RC(v)           ((uint16_t)(((v) >> 32) & 0xffff))
+#define MBOX_BG_STATUS              0x18        /* 64 bit */
+#define MBOX_BG_OPCODE(v)           ((uint16_t)((v) & 0xffff))
+#define MBOX_BG_PCT(v)              ((uint32_t)(((v) >> 16) & 0x7f))
+#define MBOX_BG_RC(v)               ((uint16_t)(((v) >> 32) & 0xffff))
+#define MBOX_PAYLOAD                0x20
+
+/* Mailbox return codes (8.2.9) */
+#define MBOX_RC_SUCCESS             0x0000
+#define MBOX_RC_BACKGROUND          0x0001
+#define MBOX_RC_INVALID_INPUT       0x0002
+#define MBOX_RC_UNSUPPORTED         0x0003
+#define MBOX_RC_BUSY                0x0006
+#define MBOX_RC_INVALID_LEN         0x0016
+
+/* Opcodes the emulator answers */
+#define MBOX_OP_GET_FW_INFO         0x0200
+#define MBOX_OP_TRANSFER_FW         0x0201
+#define MBOX_OP_GET_SUPPORTED_LOGS  0x0400
+#define MBOX_OP_IDENTIFY            0x4000
+#define MBOX_OP_GET_HEALTH_INFO     0x4200
+#define MBOX_OP_SANITIZE            0x4400
+
+/* Memory device status (8.2.8.5) */
+#define MEMDEV_STATUS               0x00        /* 64 bit */
+#define MEMDEV_STATUS_MEDIA_READY   (1ULL << 2)
+#define MEMDEV_STATUS_MBOX_READY    (1ULL << 4)
+
+/*
+ * Register accessors for a mapped BAR, real (resourceN) or emulated.
+ * Accesses are single aligned loads and stores. The acquire/release
+ * variants order the mailbox handshake against the payload when the
+ * "device" is another process.
+ */
+static inline uint32_t regs_read32(volatile uint8_t *bar, uint32_t off)
+{
+    return *(volatile uint32_t *)(bar + off);
+}
+
+static inline void regs_write32(volatile uint8_t *bar, uint32_t off, uint32_t val)
+{
+    *(volatile uint32_t *)(bar + off) = val;
+}
+
+static inline uint64_t regs_read64(volatile uint8_t *bar, uint32_t off)
+{
+    return *(volatile uint64_t *)(bar + off);
+}
+
+static inline void regs_write64(volatile uint8_t *bar, uint32_t off, uint64_t val)
+{
+    *(volatile uint64_t *)(bar + off) = val;
+}
+
+static inline uint32_t regs_load_acquire32(volatile uint8_t *bar, uint32_t off)
+{
+    return __atomic_load_n((uint32_t *)(bar + off), __ATOMIC_ACQUIRE);
+}
+
+static inline void regs_store_release32(volatile uint8_t *bar, uint32_t off, uint32_t val)
+{
+    __atomic_store_n((uint32_t *)(bar + off), val, __ATOMIC_RELEASE);
+}
+
+/*
+ * Map the first REGS_BAR_SIZE bytes of @path, a sysfs resourceN file or
+ * a cxl_regemu file, read-only unless @writable. Prints why and returns
+ * NULL on failure; unmap with munmap(bar, REGS_BAR_SIZE).
+ */
+volatile uint8_t *regs_map(const char *path, int writable);
+
+/* Offset of CXL.cache/mem capability @id from REGS_CM_BASE, 0 if absent */
+uint32_t cm_find_cap(volatile uint8_t *bar, uint16_t id);
+
+/* Offset of device capability @id from REGS_DEV_BASE, 0 if absent */
+uint32_t dev_find_cap(volatile uint8_t *bar, uint16_t id);
+
+#endif /* CXL_REGS_H */
@@ -0,0 +1,124 @@
+/*************************************************************************
+@File Name: cxl_telem.h
+@Desc: Shared-memory ring written by cxltelem, for readers to include.
+
+    One writer (cxltelem run) and any number of readers mapping the same
+    file, default /dev/shm/cxl_telem. Each slot has a sequence word: odd
+    while the writer fills it, 2 * (index + 1) once complete. A reader
+    copies the slot and accepts it only if the word matched before and
+    after the copy. No locks, and the writer never waits for a reader; a
+    reader that falls more than nslots behind just loses the oldest
+    samples (telem_read() says so).
+
+    A benchmark lines its own timeline up with the samples through
+    ts_ns, CLOCK_MONOTONIC.
+************************************************************************/
+
+#ifndef CXL_TELEM_H
+#define CXL_TELEM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define TELEM_DEFAULT_FILE      "/dev/shm/cxl_telem"
+#define TELEM_MAGIC             0x4d4c4554u     /* "TELM" */
+#define TELEM_VERSION           1
+#define TELEM_MAX_DEVS          16
+
+/* telem_sample.valid */
+#define TELEM_HAS_LINK          (1u << 0)
+#define TELEM_HAS_DVSEC         (1u << 1)
+#define TELEM_HAS_AER           (1u << 2)
+#define TELEM_HAS_RAS           (1u << 3)
+#define TELEM_DEV_GONE          (1u << 4)       /* config reads returned all ones */
+
+typedef struct telem_dev telem_dev;
+typedef struct telem_sample telem_sample;
+typedef struct telem_slot telem_slot;
+typedef struct telem_ring telem_ring;
+
+struct telem_dev {
+    char bdf[16];
+    uint16_t lnkcap_speed;      /* max speed and width, to spot downtraining */
+    uint16_t lnkcap_width;
+    uint32_t reserved;
+};
+
+struct telem_sample {
+    uint64_t ts_ns;
+    uint16_t dev;               /* index into telem_ring.devs */
+    uint16_t lnksta;            /* PCIe Link Status */
+    uint16_t dvsec_ctrl;        /* CXL DVSEC Control, Mem_Enable is bit 2 */
+    uint16_t dvsec_status;
+    uint32_t dvsec_range1_lo;   /* Mem_Info_Valid, Mem_Active */
+    uint32_t aer_uncor;
+    uint32_t aer_cor;
+    uint32_t ras_uncor;         /* CXL RAS capability */
+    uint32_t ras_cor;
+    uint32_t valid;
+};
+
+struct telem_slot {
+    uint64_t seq;
+    telem_sample s;
+} __attribute__((aligned(64)));
+
+struct telem_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;            /* power of two */
+    uint32_t ndevs;
+    uint64_t interval_ns;
+    uint64_t head;              /* samples written so far */
+    telem_dev devs[TELEM_MAX_DEVS];
+    telem_slot slots[] __attribute__((aligned(64)));
+};
+
+static inline uint64_t telem_ring_size(uint32_t nslots)
+{
+    return sizeof(telem_ring) + (uint64_t)nslots * sizeof(telem_slot);
+}
+
+/* Index of the next sample the writer will publish */
+static inline uint64_t telem_head(const telem_ring *r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Copy sample @pos into @out. Returns 0, -EAGAIN when it is not written
+ * yet, or -ESTALE when the writer has already reused its slot; skip
+ * ahead to telem_head() - nslots in that case.
+ */
+static inline int telem_read(const telem_ring *r, uint64_t pos, telem_sample *out)
+{
+    const telem_slot *slot = &r->slots[pos & (r->nslots - 1)];
+    uint64_t want = 2 * (pos + 1), seq;
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq < want) {
+        return -EAGAIN;
+    }
+    if (seq != want) {
+        return -ESTALE;
+    }
+    memcpy(out, (const void *)&slot->s, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == want ? 0 : -ESTALE;
+}
+
+/* Writer side: the only caller is cxltelem */
+static inline void telem_publish(telem_ring *r, const telem_sample *s)
+{
+    uint64_t pos = r->head;
+    telem_slot *slot = &r->slots[pos & (r->nslots - 1)];
+
+    __atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->s, s, sizeof(*s));
+    __atomic_store_n(&slot->seq, 2 * (pos + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&r->head, pos + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* CXL_TELEM_H */
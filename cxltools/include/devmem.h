@@ -0,0 +1,22 @@
+/*************************************************************************
+@File Name: devmem.h
+@Desc: Mapping a range of device memory: /dev/mem, /dev/dax*, a PCI
+    resourceN file or any ordinary file.
+************************************************************************/
+
+#ifndef DEVMEM_H
+#define DEVMEM_H
+
+#include <stdint.h>
+
+/*
+ * Map *@len bytes at offset @off of @path, MAP_SHARED; @off need not be
+ * page aligned. With *@len 0 the range runs to the end: the size sysfs
+ * gives for a /dev/dax* character device, else the file size. A range
+ * past that size is refused rather than mapped, as touching it would
+ * fault. Returns the address of @off, or NULL after printing why.
+ */
+uint8_t *devmem_map(const char *path, uint64_t off, uint64_t *len, int writable);
+void devmem_unmap(uint8_t *addr, uint64_t len);
+
+#endif /* DEVMEM_H */
@@ -0,0 +1,57 @@
+/*************************************************************************
+@File Name: pcicfg.h
+@Desc: PCI config space through a held sysfs config file descriptor.
+
+    pcicfg_open() keeps /sys/bus/pci/devices/<bdf>/config open so that
+    polling a register is one pread() of that register, not an lspci
+    run parsing the whole config space. Capability offsets are looked up
+    once by the caller and reused.
+************************************************************************/
+
+#ifndef PCICFG_H
+#define PCICFG_H
+
+#include <stdint.h>
+
+#define PCI_VENDOR_ID_SFX           0xcc53
+#define PCI_VENDOR_ID_CXL           0x1e98
+
+#define PCI_CAP_ID_EXP              0x10
+#define PCI_EXP_LNKCAP              0x0c
+#define PCI_EXP_LNKCTL              0x10
+#define PCI_EXP_LNKSTA              0x12
+#define PCI_EXP_LNKSTA_SPEED(v)     ((v) & 0xf)
+#define PCI_EXP_LNKSTA_WIDTH(v)     (((v) >> 4) & 0x3f)
+#define PCI_EXP_LNKSTA_TRAINING     (1u << 11)
+#define PCI_EXP_LNKSTA_DLLLA        (1u << 13)
+
+#define PCI_EXT_CAP_ID_AER          0x0001
+#define PCI_EXT_CAP_ID_DVSEC        0x0023
+#define PCI_ERR_UNCOR_STATUS        0x04
+#define PCI_ERR_COR_STATUS          0x10
+
+/* CXL PCIe DVSEC for CXL devices, DVSEC ID 0 (CXL 3.x 8.1.3) */
+#define CXL_DVSEC_PCIE_DEVICE       0
+#define CXL_DVSEC_CTRL              0x0c
+#define CXL_DVSEC_CTRL_MEM_ENABLE   (1u << 2)
+#define CXL_DVSEC_STATUS            0x0e
+#define CXL_DVSEC_RANGE1_SIZE_LO    0x1c
+#define CXL_DVSEC_MEM_INFO_VALID    (1u << 0)
+#define CXL_DVSEC_MEM_ACTIVE        (1u << 1)
+
+/* BDFs of the functions with @vendor, like lspci -d <vendor>:; count */
+int pcicfg_scan(uint16_t vendor, char (*bdfs)[16], int max);
+
+/* Open the device's config file (under sysfs_root); fd or -errno */
+int pcicfg_open(const char *bdf);
+
+/* Aligned reads; all ones when the device does not answer */
+uint32_t pcicfg_read32(int fd, uint32_t off);
+uint16_t pcicfg_read16(int fd, uint32_t off);
+
+/* Capability offsets, 0 when absent */
+uint32_t pcicfg_find_cap(int fd, uint8_t id);
+uint32_t pcicfg_find_ext_cap(int fd, uint16_t id);
+uint32_t pcicfg_find_dvsec(int fd, uint16_t vendor, uint16_t id);
+
+#endif /* PCICFG_H */
@@ -0,0 +1,44 @@
+/*************************************************************************
+@File Name: sysfs.h
+@Desc: Small sysfs / procfs readers shared by the cxltools.
+
+    Every path goes through sysfs_root first. It is empty on a live
+    system. Set it to a copied tree (e.g. from -R) to run a tool against
+    a saved snapshot of another host's /sys and /proc.
+************************************************************************/
+
+#ifndef SYSFS_H
+#define SYSFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern const char *sysfs_root;
+
+/* Build sysfs_root + the formatted path into @buf; returns @buf */
+char *sysfs_path(char *buf, size_t len, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/*
+ * Read an attribute into @buf with the trailing newline dropped. Returns
+ * the length or a negative errno, in which case @buf is "".
+ */
+int sysfs_read(char *buf, size_t len, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* Parse an attribute as a number, decimal or 0x hex; -errno on failure */
+int sysfs_read_u64(uint64_t *val, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Write @val to an attribute in one write(); 0 or a negative errno */
+int sysfs_write(const char *val, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Last path component of a symlink's target, e.g. a driver name */
+int sysfs_link_name(char *buf, size_t len, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* Nonzero when the path exists */
+int sysfs_exists(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif /* SYSFS_H */
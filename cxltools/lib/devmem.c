@@ -0,0 +1,72 @@
+/*************************************************************************
+@File Name: devmem.c
+@Desc: Mapping a range of device memory, see devmem.h.
+************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "devmem.h"
+#include "sysfs.h"
+
+uint8_t *devmem_map(const char *path, uint64_t off, uint64_t *len, int writable)
+{
+    uint64_t page = sysconf(_SC_PAGESIZE), delta = off & (page - 1), size = 0;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, writable ? O_RDWR | O_SYNC : O_RDONLY | O_SYNC);
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    /* 0 for a character device without a sysfs size, e.g. /dev/mem */
+    if (S_ISCHR(st.st_mode)) {
+        sysfs_read_u64(&size, "/sys/dev/char/%u:%u/size", major(st.st_rdev),
+                       minor(st.st_rdev));
+    } else {
+        size = st.st_size;
+    }
+    if (!*len) {
+        *len = size > off ? size - off : 0;
+    }
+    /* touching a page past the end of a file or device is a SIGBUS */
+    if ((S_ISREG(st.st_mode) || size) && (off >= size || *len > size - off)) {
+        fprintf(stderr, "%s: 0x%llx bytes at 0x%llx run past its end (0x%llx)\n", path,
+                (unsigned long long)*len, (unsigned long long)off,
+                (unsigned long long)size);
+        close(fd);
+        return NULL;
+    }
+    if (!*len) {
+        fprintf(stderr, "%s: size unknown, give a length\n", path);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, *len + delta, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, fd, off - delta);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mmap %s at 0x%llx: %s\n", path, (unsigned long long)off,
+                strerror(errno));
+        return NULL;
+    }
+    return (uint8_t *)map + delta;
+}
+
+void devmem_unmap(uint8_t *addr, uint64_t len)
+{
+    uint64_t delta = (uintptr_t)addr & (sysconf(_SC_PAGESIZE) - 1);
+
+    munmap(addr - delta, len + delta);
+}
@@ -0,0 +1,125 @@
+/*************************************************************************
+@File Name: pcicfg.c
+@Desc: PCI config space through a held sysfs config fd, see pcicfg.h.
+************************************************************************/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "pcicfg.h"
+#include "sysfs.h"
+
+#define PCI_CAPABILITY_LIST         0x34
+#define PCI_EXT_CAP_START           0x100
+#define PCI_CFG_SPACE_EXP_SIZE      0x1000
+
+int pcicfg_scan(uint16_t vendor, char (*bdfs)[16], int max)
+{
+    char path[512];
+    struct dirent *de;
+    uint64_t v;
+    DIR *d;
+    int n = 0;
+
+    d = opendir(sysfs_path(path, sizeof(path), "/sys/bus/pci/devices"));
+    if (!d) {
+        return 0;
+    }
+    while (n < max && (de = readdir(d))) {
+        if (de->d_name[0] != '.' &&
+            !sysfs_read_u64(&v, "/sys/bus/pci/devices/%s/vendor", de->d_name) &&
+            v == vendor) {
+            snprintf(bdfs[n++], sizeof(bdfs[0]), "%s", de->d_name);
+        }
+    }
+    closedir(d);
+    return n;
+}
+
+int pcicfg_open(const char *bdf)
+{
+    char path[512];
+    int fd;
+
+    fd = open(sysfs_path(path, sizeof(path), "/sys/bus/pci/devices/%s/config", bdf),
+              O_RDONLY);
+    return fd < 0 ? -errno : fd;
+}
+
+uint32_t pcicfg_read32(int fd, uint32_t off)
+{
+    uint32_t v;
+
+    if (pread(fd, &v, sizeof(v), off) != sizeof(v)) {
+        return ~0u;
+    }
+    return v;
+}
+
+uint16_t pcicfg_read16(int fd, uint32_t off)
+{
+    uint16_t v;
+
+    if (pread(fd, &v, sizeof(v), off) != sizeof(v)) {
+        return 0xffff;
+    }
+    return v;
+}
+
+uint32_t pcicfg_find_cap(int fd, uint8_t id)
+{
+    uint32_t off = pcicfg_read32(fd, PCI_CAPABILITY_LIST) & 0xfc, hdr;
+    int ttl = 48;
+
+    while (off && ttl--) {
+        hdr = pcicfg_read16(fd, off);
+        if ((hdr & 0xff) == id) {
+            return off;
+        }
+        off = (hdr >> 8) & 0xfc;
+    }
+    return 0;
+}
+
+/* Walk the extended capabilities from @off; header dword in *@hdr */
+static uint32_t ext_cap_next(int fd, uint32_t off, uint16_t id, uint32_t *hdr)
+{
+    int ttl = (PCI_CFG_SPACE_EXP_SIZE - PCI_EXT_CAP_START) / 8;
+
+    while (off >= PCI_EXT_CAP_START && ttl--) {
+        *hdr = pcicfg_read32(fd, off);
+        if (*hdr == ~0u || !*hdr) {
+            return 0;
+        }
+        if ((*hdr & 0xffff) == id) {
+            return off;
+        }
+        off = *hdr >> 20;
+    }
+    return 0;
+}
+
+uint32_t pcicfg_find_ext_cap(int fd, uint16_t id)
+{
+    uint32_t hdr;
+
+    return ext_cap_next(fd, PCI_EXT_CAP_START, id, &hdr);
+}
+
+uint32_t pcicfg_find_dvsec(int fd, uint16_t vendor, uint16_t id)
+{
+    uint32_t off = PCI_EXT_CAP_START, hdr, hdr1, hdr2;
+
+    while ((off = ext_cap_next(fd, off, PCI_EXT_CAP_ID_DVSEC, &hdr))) {
+        hdr1 = pcicfg_read32(fd, off + 4);
+        hdr2 = pcicfg_read16(fd, off + 8);
+        if ((hdr1 & 0xffff) == vendor && hdr2 == id) {
+            return off;
+        }
+        off = hdr >> 20;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*************************************************************************
+@File Name: regs.c
+@Desc: Mapping a CXL BAR and walking its capability arrays, see cxl_regs.h.
+************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cxl_regs.h"
+
+volatile uint8_t *regs_map(const char *path, int writable)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, writable ? O_RDWR | O_SYNC : O_RDONLY | O_SYNC);
+    if (fd < 0) {
+        fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < REGS_BAR_SIZE) {
+        fprintf(stderr, "%s: smaller than 0x%x bytes, not a CXL BAR\n", path,
+                REGS_BAR_SIZE);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, REGS_BAR_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mmap %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    return map;
+}
+
+uint32_t cm_find_cap(volatile uint8_t *bar, uint16_t id)
+{
+    uint32_t hdr = regs_read32(bar, REGS_CM_BASE), ent;
+    int i;
+
+    if (CM_CAP_HDR_ID(hdr) != CM_CAP_ID_HDR) {
+        return 0;
+    }
+    for (i = 1; i <= (int)CM_CAP_HDR_ARRAY_SIZE(hdr); i++) {
+        ent = regs_read32(bar, REGS_CM_BASE + 4 * i);
+        if (CM_CAP_ENTRY_ID(ent) == id) {
+            return CM_CAP_ENTRY_PTR(ent);
+        }
+    }
+    return 0;
+}
+
+uint32_t dev_find_cap(volatile uint8_t *bar, uint16_t id)
+{
+    uint64_t arr = regs_read64(bar, REGS_DEV_BASE + DEV_CAP_ARRAY);
+    uint32_t ent;
+    int i;
+
+    for (i = 0; i < (int)DEV_CAP_ARRAY_COUNT(arr); i++) {
+        ent = REGS_DEV_BASE + DEV_CAP_ENTRY(i);
+        if (DEV_CAP_ENTRY_ID(regs_read32(bar, ent)) == id) {
+            return regs_read32(bar, ent + DEV_CAP_ENTRY_OFFSET);
+        }
+    }
+    return 0;
+}
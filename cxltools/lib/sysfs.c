@@ -0,0 +1,150 @@
+/*************************************************************************
+@File Name: sysfs.c
+@Desc: Small sysfs / procfs readers, see sysfs.h.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sysfs.h"
+
+const char *sysfs_root = "";
+
+static char *sysfs_vpath(char *buf, size_t len, const char *fmt, va_list ap)
+{
+    int n = snprintf(buf, len, "%s", sysfs_root);
+
+    if (n >= 0 && (size_t)n < len) {
+        vsnprintf(buf + n, len - n, fmt, ap);
+    }
+    return buf;
+}
+
+char *sysfs_path(char *buf, size_t len, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    sysfs_vpath(buf, len, fmt, ap);
+    va_end(ap);
+    return buf;
+}
+
+static int sysfs_vread(char *buf, size_t len, const char *fmt, va_list ap)
+{
+    char path[512];
+    ssize_t n;
+    int fd;
+
+    buf[0] = 0;
+    fd = open(sysfs_vpath(path, sizeof(path), fmt, ap), O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    n = read(fd, buf, len - 1);
+    if (n < 0) {
+        n = -errno;
+        close(fd);
+        return n;
+    }
+    close(fd);
+
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' ')) {
+        n--;
+    }
+    buf[n] = 0;
+    return n;
+}
+
+int sysfs_read(char *buf, size_t len, const char *fmt, ...)
+{
+    va_list ap;
+    int rc;
+
+    va_start(ap, fmt);
+    rc = sysfs_vread(buf, len, fmt, ap);
+    va_end(ap);
+    return rc;
+}
+
+int sysfs_read_u64(uint64_t *val, const char *fmt, ...)
+{
+    char buf[64], *e;
+    va_list ap;
+    int rc;
+
+    va_start(ap, fmt);
+    rc = sysfs_vread(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (rc < 0) {
+        return rc;
+    }
+    errno = 0;
+    *val = strtoull(buf, &e, 0);
+    if (errno || e == buf) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int sysfs_write(const char *val, const char *fmt, ...)
+{
+    char path[512];
+    size_t len = strlen(val);
+    va_list ap;
+    int fd, rc = 0;
+
+    va_start(ap, fmt);
+    sysfs_vpath(path, sizeof(path), fmt, ap);
+    va_end(ap);
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    errno = 0;
+    if (write(fd, val, len) != (ssize_t)len) {
+        rc = errno ? -errno : -EIO;
+    }
+    close(fd);
+    return rc;
+}
+
+int sysfs_link_name(char *buf, size_t len, const char *fmt, ...)
+{
+    char path[512], target[512], *base;
+    va_list ap;
+    ssize_t n;
+
+    buf[0] = 0;
+    va_start(ap, fmt);
+    sysfs_vpath(path, sizeof(path), fmt, ap);
+    va_end(ap);
+
+    n = readlink(path, target, sizeof(target) - 1);
+    if (n < 0) {
+        return -errno;
+    }
+    target[n] = 0;
+    base = strrchr(target, '/');
+    snprintf(buf, len, "%s", base ? base + 1 : target);
+    return 0;
+}
+
+int sysfs_exists(const char *fmt, ...)
+{
+    char path[512];
+    struct stat st;
+    va_list ap;
+
+    va_start(ap, fmt);
+    sysfs_vpath(path, sizeof(path), fmt, ap);
+    va_end(ap);
+    return !stat(path, &st);
+}
@@ -0,0 +1,829 @@
+/*************************************************************************
+@File Name: cxl_regemu.c
+@Desc: CXL register block emulator and mailbox / HDM decoder benchmarks.
+
+    "serve" builds a file shaped like our BAR2, the component registers
+    with RAS and HDM decoder capabilities at 0x1000 and the device
+    registers with the primary mailbox at 0x10000, and keeps it alive:
+    it polls the mailbox doorbell and runs the command, starts and
+    advances background commands, commits HDM decoders and injects RAS
+    errors. Anything that mmaps a sysfs resourceN file can map that file
+    instead.
+
+    "mbox-bench" and "hdm-xlate" run against either the emulated file or
+    a real /sys/bus/pci/devices/<bdf>/resource2. Do not run mbox-bench on
+    a card with the cxl_pci driver bound. It would race the kernel for
+    the mailbox.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cxl_regs.h"
+
+#define REGEMU_DEFAULT_FILE     "/dev/shm/cxl_regemu"
+#define REGEMU_FW_REV           "SFX-REGEMU 1.0"
+#define REGEMU_MBOX_TIMEOUT_NS  2000000000ULL
+
+/* Where serve puts things; clients find them through the capability arrays */
+#define EMU_RAS_PTR             0x100
+#define EMU_LINK_PTR            0x200
+#define EMU_HDM_PTR             0x300
+#define EMU_HDM_DECODERS        2
+#define EMU_DEV_STATUS_OFF      0x40
+#define EMU_MEMDEV_OFF          0x80
+#define EMU_MBOX_OFF            0x100
+#define EMU_MBOX_PAYLOAD_SHIFT  11
+
+/*
+ * The file cannot trap stores, so write-1-to-clear is emulated by
+ * comparison. A RAS status register that has bits set also carries this
+ * reserved bit. A clear that writes back only the defined status bits,
+ * as the kernel does, then differs from the published value, and the
+ * written bits are cleared. Writing back the raw value read is invisible.
+ */
+#define EMU_RW1C_MARK           (1u << 31)
+
+typedef struct regemu regemu;
+
+struct regemu {
+    volatile uint8_t *bar;
+    volatile uint8_t *cm;
+    volatile uint8_t *ras;
+    volatile uint8_t *hdm;
+    volatile uint8_t *mbox;
+    /* background command */
+    uint16_t bg_op;
+    uint64_t bg_start;
+    uint64_t bg_end;
+    /* RW1C shadows */
+    uint32_t ras_uncor;
+    uint32_t ras_cor;
+    uint32_t ras_injected;
+    uint64_t ras_next;
+};
+
+static struct {
+    const char *file;
+    uint32_t cmd_us;
+    uint32_t bg_ms;
+    uint32_t poll_us;
+    uint32_t ras_ms;
+    int ras_uncor;
+    uint64_t hdm_base;
+    uint64_t hdm_size;
+    uint32_t hdm_eiw;
+    uint32_t hdm_eig;
+    long count;
+    uint16_t opcode;
+} opt = {
+    .file = REGEMU_DEFAULT_FILE,
+    .bg_ms = 1000,
+    .poll_us = 10,
+    .hdm_base = 0x4000000000ULL,
+    .hdm_size = 256ULL << 20,
+    .count = 100000,
+    .opcode = MBOX_OP_IDENTIFY,
+};
+
+static volatile sig_atomic_t stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_us(uint32_t us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+    nanosleep(&ts, NULL);
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t parse_size(const char *val)
+{
+    char *e;
+    uint64_t n = strtoull(val, &e, 0);
+
+    switch (*e) {
+    case 'T': case 't': n <<= 10; /* fall through */
+    case 'G': case 'g': n <<= 10; /* fall through */
+    case 'M': case 'm': n <<= 10; /* fall through */
+    case 'K': case 'k': n <<= 10; break;
+    default: break;
+    }
+    return n;
+}
+
+/* serve: register file layout */
+
+static void emu_layout(regemu *emu)
+{
+    volatile uint8_t *bar = emu->bar, *dec, *dev = bar + REGS_DEV_BASE;
+    uint32_t ctrl;
+
+    emu->cm = bar + REGS_CM_BASE;
+    emu->ras = emu->cm + EMU_RAS_PTR;
+    emu->hdm = emu->cm + EMU_HDM_PTR;
+    emu->mbox = dev + EMU_MBOX_OFF;
+
+    /* cap header: version 1, cache/mem version 1, three entries */
+    regs_write32(emu->cm, 0x0, CM_CAP_ID_HDR | 1 << 16 | 1 << 20 | 3 << 24);
+    regs_write32(emu->cm, 0x4, CM_CAP_ID_RAS | 2 << 16 | EMU_RAS_PTR << 20);
+    regs_write32(emu->cm, 0x8, CM_CAP_ID_LINK | 2 << 16 | EMU_LINK_PTR << 20);
+    regs_write32(emu->cm, 0xc, CM_CAP_ID_HDM | 3 << 16 | EMU_HDM_PTR << 20);
+
+    /* two decoders, one target, A11:8 interleave */
+    regs_write32(emu->hdm, HDM_CAP, 1 | 1 << 4 | 1 << 8);
+    regs_write32(emu->hdm, HDM_GLOBAL_CTRL, HDM_GLOBAL_CTRL_ENABLE);
+    if (opt.hdm_size) {
+        dec = emu->hdm + HDM_DECODER(0);
+        ctrl = opt.hdm_eig | opt.hdm_eiw << 4 | HDM_CTRL_COMMIT | HDM_CTRL_COMMITTED;
+        regs_write32(dec, HDM_DEC_BASE_LO, (uint32_t)opt.hdm_base);
+        regs_write32(dec, HDM_DEC_BASE_HI, (uint32_t)(opt.hdm_base >> 32));
+        regs_write32(dec, HDM_DEC_SIZE_LO, (uint32_t)opt.hdm_size);
+        regs_write32(dec, HDM_DEC_SIZE_HI, (uint32_t)(opt.hdm_size >> 32));
+        regs_write32(dec, HDM_DEC_CTRL, ctrl);
+    }
+
+    /* device capabilities array: version 1, three capabilities */
+    regs_write64(dev, DEV_CAP_ARRAY, 1 << 16 | 3ULL << 32);
+    regs_write32(dev, DEV_CAP_ENTRY(0), DEV_CAP_ID_STATUS | 2 << 16);
+    regs_write32(dev, DEV_CAP_ENTRY(0) + DEV_CAP_ENTRY_OFFSET, EMU_DEV_STATUS_OFF);
+    regs_write32(dev, DEV_CAP_ENTRY(0) + DEV_CAP_ENTRY_LENGTH, 0x8);
+    regs_write32(dev, DEV_CAP_ENTRY(1), DEV_CAP_ID_PRIMARY_MBOX | 1 << 16);
+    regs_write32(dev, DEV_CAP_ENTRY(1) + DEV_CAP_ENTRY_OFFSET, EMU_MBOX_OFF);
+    regs_write32(dev, DEV_CAP_ENTRY(1) + DEV_CAP_ENTRY_LENGTH,
+                 MBOX_PAYLOAD + (1 << EMU_MBOX_PAYLOAD_SHIFT));
+    regs_write32(dev, DEV_CAP_ENTRY(2), DEV_CAP_ID_MEMDEV | 1 << 16);
+    regs_write32(dev, DEV_CAP_ENTRY(2) + DEV_CAP_ENTRY_OFFSET, EMU_MEMDEV_OFF);
+    regs_write32(dev, DEV_CAP_ENTRY(2) + DEV_CAP_ENTRY_LENGTH, 0x8);
+
+    regs_write64(dev + EMU_MEMDEV_OFF, MEMDEV_STATUS,
+                 MEMDEV_STATUS_MEDIA_READY | MEMDEV_STATUS_MBOX_READY);
+    regs_write32(emu->mbox, MBOX_CAPS, EMU_MBOX_PAYLOAD_SHIFT | MBOX_CAPS_BG_IRQ);
+}
+
+/* serve: mailbox */
+
+static void put16(volatile uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(volatile uint8_t *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(volatile uint8_t *p, uint64_t v)
+{
+    put32(p, v);
+    put32(p + 4, v >> 32);
+}
+
+static void put_str(volatile uint8_t *p, const char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        p[i] = *s ? *s++ : 0;
+    }
+}
+
+static void zero(volatile uint8_t *p, size_t len)
+{
+    while (len--) {
+        *p++ = 0;
+    }
+}
+
+static uint16_t mbox_identify(regemu *emu, volatile uint8_t *pl, uint32_t *len)
+{
+    uint64_t cap = (opt.hdm_size ? opt.hdm_size : HDM_DEC_ALIGN) / HDM_DEC_ALIGN;
+
+    (void)emu;
+    zero(pl, 0x43);
+    put_str(pl, REGEMU_FW_REV, 16);
+    put64(pl + 0x10, cap);          /* total capacity, 256 MiB units */
+    put64(pl + 0x18, cap);          /* volatile only */
+    put32(pl + 0x36, 0);            /* LSA size */
+    *len = 0x43;
+    return MBOX_RC_SUCCESS;
+}
+
+static uint16_t mbox_fw_info(regemu *emu, volatile uint8_t *pl, uint32_t *len)
+{
+    (void)emu;
+    zero(pl, 0x50);
+    pl[0] = 2;                      /* slots */
+    pl[1] = 1 | 1 << 3;             /* active slot 1, staged slot 1 */
+    put_str(pl + 0x10, REGEMU_FW_REV, 16);
+    *len = 0x50;
+    return MBOX_RC_SUCCESS;
+}
+
+static uint16_t mbox_health(regemu *emu, volatile uint8_t *pl, uint32_t *len)
+{
+    zero(pl, 0x12);
+    pl[3] = 1;                      /* life used % */
+    put16(pl + 4, 45);              /* temperature, C */
+    put32(pl + 10, emu->ras_injected);
+    *len = 0x12;
+    return MBOX_RC_SUCCESS;
+}
+
+static uint16_t mbox_supported_logs(regemu *emu, volatile uint8_t *pl, uint32_t *len)
+{
+    /* Command Effects Log, 0da9c0b5-bf41-4b78-8f79-96b1623b3f17 */
+    static const uint8_t cel[16] = {
+        0x0d, 0xa9, 0xc0, 0xb5, 0xbf, 0x41, 0x4b, 0x78,
+        0x8f, 0x79, 0x96, 0xb1, 0x62, 0x3b, 0x3f, 0x17,
+    };
+    int i;
+
+    (void)emu;
+    zero(pl, 0x1c);
+    put16(pl, 1);
+    for (i = 0; i < 16; i++) {
+        pl[8 + i] = cel[i];
+    }
+    put32(pl + 0x18, 6 * 4);        /* six opcodes */
+    *len = 0x1c;
+    return MBOX_RC_SUCCESS;
+}
+
+/* Sanitize and Transfer FW run in the background for bg_ms */
+static uint16_t mbox_background(regemu *emu, uint16_t op, uint64_t now)
+{
+    if (emu->bg_op) {
+        return MBOX_RC_BUSY;
+    }
+    emu->bg_op = op;
+    emu->bg_start = now;
+    emu->bg_end = now + opt.bg_ms * 1000000ULL;
+    regs_write64(emu->mbox, MBOX_BG_STATUS, op);
+    return MBOX_RC_BACKGROUND;
+}
+
+static void mbox_poll(regemu *emu, uint64_t now)
+{
+    volatile uint8_t *pl = emu->mbox + MBOX_PAYLOAD;
+    uint32_t ctrl, in_len, out_len = 0;
+    uint64_t cmd;
+    uint16_t op, rc;
+
+    ctrl = regs_load_acquire32(emu->mbox, MBOX_CTRL);
+    if (!(ctrl & MBOX_CTRL_DOORBELL)) {
+        return;
+    }
+
+    cmd = regs_read64(emu->mbox, MBOX_CMD);
+    op = MBOX_CMD_OPCODE(cmd);
+    in_len = MBOX_CMD_LEN(cmd);
+    if (opt.cmd_us) {
+        sleep_us(opt.cmd_us);
+    }
+
+    if (in_len > 1u << EMU_MBOX_PAYLOAD_SHIFT) {
+        rc = MBOX_RC_INVALID_LEN;
+    } else {
+        switch (op) {
+        case MBOX_OP_IDENTIFY:
+            rc = mbox_identify(emu, pl, &out_len);
+            break;
+        case MBOX_OP_GET_FW_INFO:
+            rc = mbox_fw_info(emu, pl, &out_len);
+            break;
+        case MBOX_OP_GET_HEALTH_INFO:
+            rc = mbox_health(emu, pl, &out_len);
+            break;
+        case MBOX_OP_GET_SUPPORTED_LOGS:
+            rc = mbox_supported_logs(emu, pl, &out_len);
+            break;
+        case MBOX_OP_SANITIZE:
+        case MBOX_OP_TRANSFER_FW:
+            rc = mbox_background(emu, op, now);
+            break;
+        default:
+            rc = MBOX_RC_UNSUPPORTED;
+            break;
+        }
+    }
+
+    regs_write64(emu->mbox, MBOX_CMD, MBOX_CMD_MAKE(op, out_len));
+    regs_write64(emu->mbox, MBOX_STATUS,
+                 (uint64_t)rc << 32 | (emu->bg_op ? MBOX_STATUS_BG : 0));
+    regs_store_release32(emu->mbox, MBOX_CTRL, ctrl & ~MBOX_CTRL_DOORBELL);
+}
+
+static void bg_poll(regemu *emu, uint64_t now)
+{
+    uint64_t pct;
+
+    if (!emu->bg_op) {
+        return;
+    }
+    if (now < emu->bg_end) {
+        pct = (now - emu->bg_start) * 100 / (emu->bg_end - emu->bg_start);
+        regs_write64(emu->mbox, MBOX_BG_STATUS, emu->bg_op | pct << 16);
+        return;
+    }
+    regs_write64(emu->mbox, MBOX_BG_STATUS,
+                 emu->bg_op | 100 << 16 | (uint64_t)MBOX_RC_SUCCESS << 32);
+    regs_write64(emu->mbox, MBOX_STATUS,
+                 regs_read64(emu->mbox, MBOX_STATUS) & ~MBOX_STATUS_BG);
+    emu->bg_op = 0;
+}
+
+/* serve: HDM decoder commit */
+
+static int hdm_commit_ok(regemu *emu, int n, uint32_t ctrl)
+{
+    volatile uint8_t *dec = emu->hdm + HDM_DECODER(n);
+    uint64_t base, size;
+
+    base = regs_read32(dec, HDM_DEC_BASE_LO) |
+           (uint64_t)regs_read32(dec, HDM_DEC_BASE_HI) << 32;
+    size = regs_read32(dec, HDM_DEC_SIZE_LO) |
+           (uint64_t)regs_read32(dec, HDM_DEC_SIZE_HI) << 32;
+
+    /* decoders commit in order, each on 256 MiB boundaries */
+    if (n && !(regs_read32(emu->hdm, HDM_DECODER(n - 1) + HDM_DEC_CTRL) &
+               HDM_CTRL_COMMITTED)) {
+        return 0;
+    }
+    return size && !(base % HDM_DEC_ALIGN) && !(size % HDM_DEC_ALIGN) &&
+           hdm_ways(HDM_CTRL_IW(ctrl)) && HDM_CTRL_IG(ctrl) <= 6;
+}
+
+static void hdm_poll(regemu *emu)
+{
+    uint32_t *reg, ctrl, next;
+    int n;
+
+    for (n = 0; n < EMU_HDM_DECODERS; n++) {
+        reg = (uint32_t *)(emu->hdm + HDM_DECODER(n) + HDM_DEC_CTRL);
+        ctrl = __atomic_load_n(reg, __ATOMIC_ACQUIRE);
+
+        if ((ctrl & HDM_CTRL_COMMIT) &&
+            !(ctrl & (HDM_CTRL_COMMITTED | HDM_CTRL_ERR_NOT_COMMITTED))) {
+            next = ctrl | (hdm_commit_ok(emu, n, ctrl) ? HDM_CTRL_COMMITTED
+                                                       : HDM_CTRL_ERR_NOT_COMMITTED);
+        } else if (!(ctrl & HDM_CTRL_COMMIT) &&
+                   (ctrl & (HDM_CTRL_COMMITTED | HDM_CTRL_ERR_NOT_COMMITTED))) {
+            if (ctrl & HDM_CTRL_LOCK_ON_COMMIT && ctrl & HDM_CTRL_COMMITTED) {
+                next = ctrl | HDM_CTRL_COMMIT;
+            } else {
+                next = ctrl & ~(HDM_CTRL_COMMITTED | HDM_CTRL_ERR_NOT_COMMITTED);
+            }
+        } else {
+            continue;
+        }
+        /* lose to a concurrent write rather than overwrite it */
+        __atomic_compare_exchange_n(reg, &ctrl, next, 0, __ATOMIC_RELEASE,
+                                    __ATOMIC_RELAXED);
+    }
+}
+
+/* serve: RAS status */
+
+static uint32_t rw1c_sync(volatile uint8_t *ras, uint32_t off, uint32_t *shadow)
+{
+    uint32_t published = *shadow ? *shadow | EMU_RW1C_MARK : 0;
+    uint32_t v = regs_read32(ras, off);
+
+    /*
+     * Whatever was written replaced the value in the file; only the set
+     * bits written back as 1 clear, a 0 or a bit that was not set does
+     * nothing, and the published value is put back.
+     */
+    if (v != published) {
+        *shadow &= ~(v & *shadow);
+        published = *shadow ? *shadow | EMU_RW1C_MARK : 0;
+        regs_write32(ras, off, published);
+    }
+    return published;
+}
+
+static void ras_publish(volatile uint8_t *ras, uint32_t off, uint32_t shadow)
+{
+    regs_write32(ras, off, shadow ? shadow | EMU_RW1C_MARK : 0);
+}
+
+static void ras_poll(regemu *emu, uint64_t now)
+{
+    uint32_t bit;
+    int i;
+
+    rw1c_sync(emu->ras, RAS_UNCOR_STATUS, &emu->ras_uncor);
+    rw1c_sync(emu->ras, RAS_COR_STATUS, &emu->ras_cor);
+
+    if (!opt.ras_ms || now < emu->ras_next) {
+        return;
+    }
+    emu->ras_next = now + opt.ras_ms * 1000000ULL;
+
+    if (opt.ras_uncor) {
+        /* walk bits 0-11, the ones that also set First Error Pointer */
+        bit = emu->ras_injected % 12;
+        if (!emu->ras_uncor) {
+            regs_write32(emu->ras, RAS_CAP_CTRL, bit);
+            for (i = 0; i < RAS_HEADER_LOG_DW; i++) {
+                regs_write32(emu->ras, RAS_HEADER_LOG + 4 * i,
+                             emu->ras_injected << 8 | i);
+            }
+        }
+        emu->ras_uncor |= 1u << bit;
+        ras_publish(emu->ras, RAS_UNCOR_STATUS, emu->ras_uncor);
+    } else {
+        emu->ras_cor |= 1u << (emu->ras_injected % 7);
+        ras_publish(emu->ras, RAS_COR_STATUS, emu->ras_cor);
+    }
+    emu->ras_injected++;
+}
+
+static int cmd_serve(void)
+{
+    regemu emu = { 0 };
+    uint64_t now;
+    int fd;
+
+    fd = open(opt.file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || ftruncate(fd, REGS_BAR_SIZE)) {
+        fprintf(stderr, "create %s: %s\n", opt.file, strerror(errno));
+        return 1;
+    }
+    close(fd);
+    emu.bar = regs_map(opt.file, 1);
+    if (!emu.bar) {
+        return 1;
+    }
+    emu_layout(&emu);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("%s: mailbox at 0x%x, HDM decoders at 0x%x, RAS at 0x%x\n", opt.file,
+           REGS_DEV_BASE + EMU_MBOX_OFF, REGS_CM_BASE + EMU_HDM_PTR,
+           REGS_CM_BASE + EMU_RAS_PTR);
+    fflush(stdout);
+
+    while (!stop) {
+        now = now_ns();
+        mbox_poll(&emu, now);
+        bg_poll(&emu, now);
+        hdm_poll(&emu);
+        ras_poll(&emu, now);
+        if (opt.poll_us) {
+            sleep_us(opt.poll_us);
+        }
+    }
+
+    munmap((void *)emu.bar, REGS_BAR_SIZE);
+    unlink(opt.file);
+    return 0;
+}
+
+/* mbox-bench */
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Ring the doorbell for @op with no input; returns the return code or -1 */
+static int mbox_exec(volatile uint8_t *mbox, uint16_t op)
+{
+    uint64_t deadline = now_ns() + REGEMU_MBOX_TIMEOUT_NS;
+
+    while (regs_load_acquire32(mbox, MBOX_CTRL) & MBOX_CTRL_DOORBELL) {
+        if (now_ns() > deadline) {
+            return -1;
+        }
+    }
+    regs_write64(mbox, MBOX_CMD, MBOX_CMD_MAKE(op, 0));
+    regs_store_release32(mbox, MBOX_CTRL, MBOX_CTRL_DOORBELL);
+    while (regs_load_acquire32(mbox, MBOX_CTRL) & MBOX_CTRL_DOORBELL) {
+        if (now_ns() > deadline) {
+            return -1;
+        }
+    }
+    return MBOX_STATUS_RC(regs_read64(mbox, MBOX_STATUS));
+}
+
+static int cmd_mbox_bench(void)
+{
+    volatile uint8_t *bar, *mbox;
+    uint64_t *lat, start, t0, total;
+    uint32_t off;
+    long i, fail = 0;
+    int rc;
+
+    bar = regs_map(opt.file, 1);
+    if (!bar) {
+        return 1;
+    }
+    off = dev_find_cap(bar, DEV_CAP_ID_PRIMARY_MBOX);
+    if (!off) {
+        fprintf(stderr, "%s: no primary mailbox\n", opt.file);
+        return 1;
+    }
+    mbox = bar + REGS_DEV_BASE + off;
+
+    lat = calloc(opt.count, sizeof(*lat));
+    if (!lat) {
+        return 1;
+    }
+    start = now_ns();
+    for (i = 0; i < opt.count && !stop; i++) {
+        t0 = now_ns();
+        rc = mbox_exec(mbox, opt.opcode);
+        lat[i] = now_ns() - t0;
+        if (rc < 0) {
+            fprintf(stderr, "command %ld timed out\n", i);
+            fail++;
+            break;
+        }
+        fail += rc != MBOX_RC_SUCCESS && rc != MBOX_RC_BACKGROUND;
+    }
+    total = now_ns() - start;
+
+    qsort(lat, i, sizeof(*lat), cmp_u64);
+    printf("opcode 0x%04x: %ld commands, %ld failed, %.0f cmd/s\n", opt.opcode, i,
+           fail, total ? i * 1e9 / total : 0.0);
+    if (i) {
+        printf("latency us: min %.2f p50 %.2f p99 %.2f max %.2f\n", lat[0] / 1e3,
+               lat[i / 2] / 1e3, lat[i * 99 / 100] / 1e3, lat[i - 1] / 1e3);
+    }
+    free(lat);
+    munmap((void *)bar, REGS_BAR_SIZE);
+    return fail ? 1 : 0;
+}
+
+/* hdm-xlate */
+
+typedef struct hdm_dec hdm_dec;
+
+struct hdm_dec {
+    uint64_t base;
+    uint64_t size;
+    uint64_t dpa_base;
+    uint64_t gran;
+    uint32_t ways;
+};
+
+/* Committed decoders, in order, with the DPA each one starts at */
+static int hdm_load(volatile uint8_t *bar, hdm_dec *dec, int max)
+{
+    volatile uint8_t *hdm, *d;
+    uint64_t dpa = 0, skip;
+    uint32_t off, ctrl;
+    int i, n = 0, count;
+
+    off = cm_find_cap(bar, CM_CAP_ID_HDM);
+    if (!off) {
+        return -1;
+    }
+    hdm = bar + REGS_CM_BASE + off;
+    count = hdm_decoder_count(regs_read32(hdm, HDM_CAP));
+
+    for (i = 0; i < count && n < max; i++) {
+        d = hdm + HDM_DECODER(i);
+        ctrl = regs_read32(d, HDM_DEC_CTRL);
+        if (!(ctrl & HDM_CTRL_COMMITTED)) {
+            break;
+        }
+        dec[n].base = regs_read32(d, HDM_DEC_BASE_LO) |
+                      (uint64_t)regs_read32(d, HDM_DEC_BASE_HI) << 32;
+        dec[n].size = regs_read32(d, HDM_DEC_SIZE_LO) |
+                      (uint64_t)regs_read32(d, HDM_DEC_SIZE_HI) << 32;
+        skip = regs_read32(d, HDM_DEC_SKIP_LO) |
+               (uint64_t)regs_read32(d, HDM_DEC_SKIP_HI) << 32;
+        dec[n].ways = hdm_ways(HDM_CTRL_IW(ctrl));
+        dec[n].gran = hdm_granularity(HDM_CTRL_IG(ctrl));
+        if (!dec[n].ways) {
+            break;
+        }
+        dpa += skip;
+        dec[n].dpa_base = dpa;
+        dpa += dec[n].size / dec[n].ways;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * HPA to DPA for a type 3 device (CXL 3.x 9.13.1.1): drop the interleave
+ * way selection bits above the granule offset. Division covers the 3, 6
+ * and 12 way encodings as well as powers of two. Returns 0 and sets @dpa,
+ * or -1 when no decoder claims @hpa.
+ */
+static int hdm_xlate(const hdm_dec *dec, int n, uint64_t hpa, uint64_t *dpa)
+{
+    uint64_t off;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (hpa < dec[i].base || hpa - dec[i].base >= dec[i].size) {
+            continue;
+        }
+        off = hpa - dec[i].base;
+        *dpa = dec[i].dpa_base + off / (dec[i].gran * dec[i].ways) * dec[i].gran +
+               off % dec[i].gran;
+        return 0;
+    }
+    return -1;
+}
+
+static int cmd_hdm_xlate(int argc, char **argv)
+{
+    hdm_dec dec[16];
+    volatile uint8_t *bar;
+    uint64_t hpa, dpa, span = 0, sum = 0, x = 88172645463325252ULL, t0, t;
+    long i, miss = 0;
+    int n, j, rc = 0;
+
+    bar = regs_map(opt.file, 0);
+    if (!bar) {
+        return 1;
+    }
+    n = hdm_load(bar, dec, 16);
+    munmap((void *)bar, REGS_BAR_SIZE);
+    if (n <= 0) {
+        fprintf(stderr, "%s: no committed HDM decoders\n", opt.file);
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        printf("decoder %ld: hpa 0x%llx-0x%llx, %u way, %llu B granule, dpa 0x%llx\n", i,
+               (unsigned long long)dec[i].base,
+               (unsigned long long)(dec[i].base + dec[i].size - 1), dec[i].ways,
+               (unsigned long long)dec[i].gran, (unsigned long long)dec[i].dpa_base);
+        span += dec[i].size;
+    }
+
+    /* translate the addresses given, or time random ones */
+    if (argc) {
+        for (i = 0; i < argc; i++) {
+            hpa = strtoull(argv[i], NULL, 0);
+            if (hdm_xlate(dec, n, hpa, &dpa)) {
+                printf("hpa 0x%llx: not decoded\n", (unsigned long long)hpa);
+                rc = 1;
+            } else {
+                printf("hpa 0x%llx: dpa 0x%llx\n", (unsigned long long)hpa,
+                       (unsigned long long)dpa);
+            }
+        }
+        return rc;
+    }
+
+    t0 = now_ns();
+    for (i = 0; i < opt.count; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        hpa = x % span;
+        for (j = 0; hpa >= dec[j].size; j++) {
+            hpa -= dec[j].size;
+        }
+        hpa += dec[j].base;
+        if (hdm_xlate(dec, n, hpa, &dpa)) {
+            miss++;
+        } else {
+            sum += dpa;
+        }
+    }
+    t = now_ns() - t0;
+    printf("%ld translations, %ld missed, %.1f ns each (sum 0x%llx)\n", opt.count,
+           miss, opt.count ? (double)t / opt.count : 0.0, (unsigned long long)sum);
+    return miss ? 1 : 0;
+}
+
+static void usage(void)
+{
+    printf("Usage: cxl_regemu serve [-f <file>] [-c <cmd_us>] [-b <bg_ms>] [-p <poll_us>]\n"
+           "                        [-r <ras_ms>] [-u] [-H <base>:<size>[:<eiw>:<eig>]]\n"
+           "       cxl_regemu mbox-bench [-f <file>] [-n <count>] [-o <opcode>]\n"
+           "       cxl_regemu hdm-xlate [-f <file>] [-n <count>] [<hpa>...]\n");
+    printf("  -f  register file, default " REGEMU_DEFAULT_FILE "; the clients also\n"
+           "      take a real /sys/bus/pci/devices/<bdf>/resource2\n"
+           "  -c  extra time each mailbox command takes, us\n"
+           "  -b  time Sanitize and Transfer FW run in the background, default 1000 ms\n"
+           "  -p  doorbell poll interval, default 10 us, 0 to spin\n"
+           "  -r  inject a RAS error every <ras_ms>, correctable unless -u\n"
+           "  -H  decoder 0 at start, default 0x4000000000:256M:0:0; size 0 leaves\n"
+           "      it uncommitted\n"
+           "  -n  commands or random translations to time, default 100000\n"
+           "  -o  mailbox opcode to time, default 0x4000 (Identify)\n");
+}
+
+static int parse_hdm(char *arg)
+{
+    char *s = strtok(arg, ":");
+
+    if (!s) {
+        return -1;
+    }
+    opt.hdm_base = strtoull(s, NULL, 0);
+    s = strtok(NULL, ":");
+    if (!s) {
+        return -1;
+    }
+    opt.hdm_size = parse_size(s);
+    s = strtok(NULL, ":");
+    opt.hdm_eiw = s ? strtoul(s, NULL, 0) : 0;
+    s = s ? strtok(NULL, ":") : NULL;
+    opt.hdm_eig = s ? strtoul(s, NULL, 0) : 0;
+    if (opt.hdm_base % HDM_DEC_ALIGN || opt.hdm_size % HDM_DEC_ALIGN ||
+        !hdm_ways(opt.hdm_eiw) || opt.hdm_eig > 6) {
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    int c;
+
+    if (argc < 2 || !strcmp(argv[1], "-h")) {
+        usage();
+        return argc < 2;
+    }
+    cmd = argv[1];
+    argc--;
+    argv++;
+
+    while ((c = getopt(argc, argv, "hf:c:b:p:r:uH:n:o:")) != -1) {
+        switch (c) {
+        case 'f':
+            opt.file = optarg;
+            break;
+        case 'c':
+            opt.cmd_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            opt.bg_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            opt.poll_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            opt.ras_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            opt.ras_uncor = 1;
+            break;
+        case 'H':
+            if (parse_hdm(optarg)) {
+                fprintf(stderr, "-H: want 256 MiB aligned <base>:<size>[:<eiw>:<eig>]\n");
+                return 1;
+            }
+            break;
+        case 'n':
+            opt.count = strtol(optarg, NULL, 0);
+            break;
+        case 'o':
+            opt.opcode = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+
+    if (!strcmp(cmd, "serve")) {
+        return cmd_serve();
+    }
+    signal(SIGINT, on_signal);
+    if (!strcmp(cmd, "mbox-bench")) {
+        return cmd_mbox_bench();
+    }
+    if (!strcmp(cmd, "hdm-xlate")) {
+        return cmd_hdm_xlate(argc - optind, argv + optind);
+    }
+    usage();
+    return 1;
+}
@@ -0,0 +1,731 @@
+/*************************************************************************
+@File Name: cxldump.c
+@Desc: Sparse dumps of device memory, a non-zero region scanner and a
+    hexdump viewer.
+
+    "dump" streams a range of /dev/mem, a /dev/dax*, a resourceN file
+    or any file into a compact file. The range is cut into chunks
+    (default 4 KiB), and all CPUs classify each chunk with SIMD as zero,
+    fill (one 8-byte word repeated, e.g. all ones or a poison pattern)
+    or data. Runs of the same class become one record. Zero and fill
+    records carry no payload, so the file is about as big as the data
+    that is really there.
+
+    "scan" prints the non-zero regions of a source, or of a dump file
+    from its record headers alone.
+
+    "hexdump" prints a range of a dump file or a source, 16 bytes a line
+    like dump_devmem.py, with repeated lines folded into "*".
+
+    -4 reads the source with aligned 32-bit loads only, for register
+    space that does not take wide reads (same as pci_bar_dump.py).
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <immintrin.h>
+
+#include "devmem.h"
+
+#define DUMP_MAGIC              0x504d4443u     /* "CDMP" */
+#define DUMP_VERSION            1
+#define DUMP_WINDOW             (256ULL << 20)  /* classified in parallel, then written */
+#define DUMP_IOBUF              (8 << 20)
+
+enum {
+    REC_ZERO,
+    REC_FILL,
+    REC_DATA,
+    REC_END,
+};
+
+static const char *const rec_names[] = {
+    "zero", "fill", "data", "end",
+};
+
+typedef struct dump_hdr dump_hdr;
+typedef struct dump_rec dump_rec;
+typedef struct dump_run dump_run;
+typedef struct dump_window dump_window;
+
+/* File: this header, then records up to REC_END; data records carry len bytes */
+struct dump_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t base;              /* source address of offset 0 */
+    uint64_t len;
+    uint32_t chunk;
+    uint32_t reserved;
+    char src[64];
+};
+
+struct dump_rec {
+    uint64_t off;
+    uint64_t len;
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t fill;              /* the repeated word of REC_FILL */
+};
+
+/* Run of same-class chunks being built up */
+struct dump_run {
+    dump_rec rec;
+    int open;
+    uint64_t bytes[3];          /* per class */
+    uint64_t out;               /* bytes written */
+};
+
+struct dump_window {
+    const uint8_t *base;        /* mapping of the whole range */
+    uint64_t start;             /* first offset of this window */
+    uint64_t len;
+    uint64_t nchunks;
+    uint8_t *cls;
+    uint64_t *fill;
+    uint64_t next;
+};
+
+static struct {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t chunk;
+    int threads;
+    int narrow;
+    const char *out;
+} opt = {
+    .chunk = 4096,
+};
+
+static int (*chunk_class)(const uint8_t *p, uint64_t len, uint64_t *fill);
+static FILE *out;
+static const uint8_t *src_base;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* source access */
+
+/* Aligned 32-bit loads, for -4 */
+static void copy_narrow(void *dst, const uint8_t *src, uint64_t len)
+{
+    const volatile uint32_t *s = (const volatile uint32_t *)src;
+    uint32_t *d = dst;
+    uint64_t i;
+
+    for (i = 0; i < len / 4; i++) {
+        d[i] = s[i];
+    }
+}
+
+/* chunk classification: compare every word with the first one */
+
+static int class_of(uint64_t w)
+{
+    return w ? REC_FILL : REC_ZERO;
+}
+
+static int chunk_class_sse2(const uint8_t *p, uint64_t len, uint64_t *fill)
+{
+    uint64_t w = *(const uint64_t *)p, i;
+    __m128i v = _mm_set1_epi64x(w), acc = _mm_setzero_si128(), z = _mm_setzero_si128();
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), v));
+        acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i + 16)),
+                                              v));
+        acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i + 32)),
+                                              v));
+        acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i + 48)),
+                                              v));
+        /* data chunks stop at the first differing line */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, z)) != 0xffff) {
+            return REC_DATA;
+        }
+    }
+    for (; i < len; i += 8) {
+        if (*(const uint64_t *)(p + i) != w) {
+            return REC_DATA;
+        }
+    }
+    *fill = w;
+    return class_of(w);
+}
+
+static __attribute__((target("avx2"))) int chunk_class_avx2(const uint8_t *p, uint64_t len,
+                                                           uint64_t *fill)
+{
+    uint64_t w = *(const uint64_t *)p, i;
+    __m256i v = _mm256_set1_epi64x(w), acc = _mm256_setzero_si256();
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        acc = _mm256_or_si256(acc, _mm256_xor_si256(
+                  _mm256_loadu_si256((const __m256i *)(p + i)), v));
+        acc = _mm256_or_si256(acc, _mm256_xor_si256(
+                  _mm256_loadu_si256((const __m256i *)(p + i + 32)), v));
+        if (!_mm256_testz_si256(acc, acc)) {
+            return REC_DATA;
+        }
+    }
+    for (; i < len; i += 8) {
+        if (*(const uint64_t *)(p + i) != w) {
+            return REC_DATA;
+        }
+    }
+    *fill = w;
+    return class_of(w);
+}
+
+static void *classify_worker(void *arg)
+{
+    dump_window *win = arg;
+    uint8_t *buf = NULL;
+    const uint8_t *p;
+    uint64_t i, off, len;
+
+    if (opt.narrow) {
+        buf = aligned_alloc(64, opt.chunk);
+        if (!buf) {
+            return NULL;
+        }
+    }
+    for (;;) {
+        i = __atomic_fetch_add(&win->next, 1, __ATOMIC_RELAXED);
+        if (i >= win->nchunks) {
+            break;
+        }
+        off = i * opt.chunk;
+        len = win->len - off < opt.chunk ? win->len - off : opt.chunk;
+        p = win->base + win->start + off;
+        if (buf) {
+            copy_narrow(buf, p, len);
+            p = buf;
+        }
+        win->cls[i] = chunk_class(p, len, &win->fill[i]);
+    }
+    free(buf);
+    return NULL;
+}
+
+static void classify(dump_window *win)
+{
+    pthread_t tids[256];
+    int i, n = opt.threads < 256 ? opt.threads : 256;
+
+    win->next = 0;
+    win->nchunks = (win->len + opt.chunk - 1) / opt.chunk;
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&tids[i], NULL, classify_worker, win)) {
+            break;
+        }
+    }
+    if (!i) {
+        classify_worker(win);
+    }
+    n = i;
+    for (i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+/* runs */
+
+static void write_payload(uint64_t off, uint64_t len)
+{
+    static uint8_t *buf;
+    uint64_t n;
+
+    if (!opt.narrow) {
+        fwrite(src_base + off, 1, len, out);
+        return;
+    }
+    if (!buf) {
+        buf = aligned_alloc(64, DUMP_IOBUF);
+    }
+    while (len) {
+        n = len < DUMP_IOBUF ? len : DUMP_IOBUF;
+        copy_narrow(buf, src_base + off, n);
+        fwrite(buf, 1, n, out);
+        off += n;
+        len -= n;
+    }
+}
+
+static void run_flush(dump_run *run)
+{
+    dump_rec *r = &run->rec;
+
+    if (!run->open) {
+        return;
+    }
+    run->open = 0;
+    run->bytes[r->type] += r->len;
+    if (out) {
+        fwrite(r, sizeof(*r), 1, out);
+        run->out += sizeof(*r);
+        if (r->type == REC_DATA) {
+            write_payload(r->off, r->len);
+            run->out += r->len;
+        }
+    } else if (r->type != REC_ZERO) {
+        printf("  0x%012llx-0x%012llx %10llu %s", (unsigned long long)(opt.addr + r->off),
+               (unsigned long long)(opt.addr + r->off + r->len - 1),
+               (unsigned long long)r->len, rec_names[r->type]);
+        if (r->type == REC_FILL) {
+            printf(" 0x%016llx", (unsigned long long)r->fill);
+        }
+        printf("\n");
+    }
+}
+
+static void run_add(dump_run *run, int type, uint64_t fill, uint64_t off, uint64_t len)
+{
+    dump_rec *r = &run->rec;
+
+    if (run->open && r->type == (uint32_t)type && (type != REC_FILL || r->fill == fill)) {
+        r->len += len;
+        return;
+    }
+    run_flush(run);
+    memset(r, 0, sizeof(*r));
+    r->off = off;
+    r->len = len;
+    r->type = type;
+    r->fill = type == REC_FILL ? fill : 0;
+    run->open = 1;
+}
+
+/* Classify the mapped range window by window and feed the runs */
+static int walk(const uint8_t *base, uint64_t len, dump_run *run)
+{
+    uint64_t wchunks = DUMP_WINDOW / opt.chunk, i, off;
+    dump_window win = { .base = base };
+
+    win.cls = malloc(wchunks);
+    win.fill = malloc(wchunks * sizeof(*win.fill));
+    if (!win.cls || !win.fill) {
+        return -1;
+    }
+    for (win.start = 0; win.start < len; win.start += win.len) {
+        win.len = len - win.start < wchunks * opt.chunk ? len - win.start
+                                                        : wchunks * opt.chunk;
+        classify(&win);
+        for (i = 0; i < win.nchunks; i++) {
+            off = win.start + i * opt.chunk;
+            run_add(run, win.cls[i], win.fill[i], off,
+                    len - off < opt.chunk ? len - off : opt.chunk);
+        }
+    }
+    run_flush(run);
+    free(win.cls);
+    free(win.fill);
+    return 0;
+}
+
+/*
+ * Map -a/-l of @src. dump and scan classify whole 8-byte words, so for
+ * them (@words) a length that is not a multiple of 8 is an error rather
+ * than a silently shortened range; hexdump takes any length.
+ */
+static const uint8_t *src_map(const char *src, uint64_t *len, int words)
+{
+    uint8_t *base;
+
+    *len = opt.len;
+    base = devmem_map(src, opt.addr, len, 0);
+    if (!base) {
+        return NULL;
+    }
+    if (!*len || (words && *len % 8)) {
+        fprintf(stderr, "%s: length %llu is %s, pass -l with a multiple of 8\n",
+                src, (unsigned long long)*len, *len ? "not a multiple of 8 bytes" : "empty");
+        devmem_unmap(base, *len);
+        return NULL;
+    }
+    return base;
+}
+
+static void summary(const dump_run *run, uint64_t len, uint64_t ns)
+{
+    fflush(stdout);
+    fprintf(stderr, "%llu bytes in %.2f s, %.1f GB/s: %llu data, %llu fill, %llu zero",
+            (unsigned long long)len, ns / 1e9, ns ? len / (double)ns : 0.0,
+            (unsigned long long)run->bytes[REC_DATA], (unsigned long long)run->bytes[REC_FILL],
+            (unsigned long long)run->bytes[REC_ZERO]);
+    if (out) {
+        fprintf(stderr, ", %llu bytes written", (unsigned long long)run->out);
+    }
+    fprintf(stderr, "\n");
+}
+
+/* commands */
+
+static int cmd_dump(const char *src)
+{
+    dump_hdr hdr = {
+        .magic = DUMP_MAGIC,
+        .version = DUMP_VERSION,
+        .base = opt.addr,
+        .chunk = opt.chunk,
+    };
+    dump_rec end = { .type = REC_END };
+    dump_run run = { .out = sizeof(hdr) + sizeof(end) };
+    uint64_t len, t0;
+
+    if (!opt.out) {
+        fprintf(stderr, "dump needs -o <file>, - for stdout\n");
+        return 1;
+    }
+    src_base = src_map(src, &len, 1);
+    if (!src_base) {
+        return 1;
+    }
+    out = strcmp(opt.out, "-") ? fopen(opt.out, "w") : stdout;
+    if (!out) {
+        perror(opt.out);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, DUMP_IOBUF);
+    hdr.len = len;
+    snprintf(hdr.src, sizeof(hdr.src), "%s", src);
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    t0 = now_ns();
+    if (walk(src_base, len, &run)) {
+        return 1;
+    }
+    end.off = len;
+    fwrite(&end, sizeof(end), 1, out);
+    if (fflush(out) || ferror(out) || (out != stdout && fclose(out))) {
+        fprintf(stderr, "write %s failed\n", opt.out);
+        return 1;
+    }
+    out = NULL;
+    summary(&run, len, now_ns() - t0);
+    return 0;
+}
+
+/* Dump file index: records with their payload positions */
+typedef struct dump_index dump_index;
+
+struct dump_index {
+    FILE *f;
+    dump_hdr hdr;
+    dump_rec *recs;
+    long *pos;
+    uint64_t nrecs;
+};
+
+/* Past a payload; a pipe from "dump -o -" cannot seek */
+static int skip(FILE *f, uint64_t len)
+{
+    char buf[65536];
+    uint64_t n;
+
+    if (!fseek(f, len, SEEK_CUR)) {
+        return 0;
+    }
+    for (; len; len -= n) {
+        n = len < sizeof(buf) ? len : sizeof(buf);
+        if (fread(buf, 1, n, f) != n) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int index_load(const char *path, dump_index *idx)
+{
+    uint64_t cap = 0;
+    dump_rec r = { .type = REC_END };
+
+    memset(idx, 0, sizeof(*idx));
+    idx->f = fopen(path, "r");
+    if (!idx->f || fread(&idx->hdr, sizeof(idx->hdr), 1, idx->f) != 1 ||
+        idx->hdr.magic != DUMP_MAGIC) {
+        if (idx->f) {
+            fclose(idx->f);
+        }
+        return -1;
+    }
+    while (fread(&r, sizeof(r), 1, idx->f) == 1 && r.type != REC_END) {
+        if (idx->nrecs == cap) {
+            cap = cap ? cap * 2 : 1024;
+            idx->recs = realloc(idx->recs, cap * sizeof(*idx->recs));
+            idx->pos = realloc(idx->pos, cap * sizeof(*idx->pos));
+            if (!idx->recs || !idx->pos) {
+                return -1;
+            }
+        }
+        idx->recs[idx->nrecs] = r;
+        idx->pos[idx->nrecs++] = ftell(idx->f);
+        if (r.type == REC_DATA && skip(idx->f, r.len)) {
+            break;
+        }
+    }
+    if (r.type != REC_END) {
+        fprintf(stderr, "%s: truncated after %llu records\n", path,
+                (unsigned long long)idx->nrecs);
+    }
+    return 0;
+}
+
+/* Bytes [off, off + len) of the dumped range; 0 if none */
+static uint64_t index_read(dump_index *idx, uint64_t off, uint8_t *buf, uint64_t len)
+{
+    uint64_t lo = 0, hi = idx->nrecs, mid, n, i;
+    dump_rec *r;
+
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (idx->recs[mid].off <= off) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (!idx->nrecs || off < idx->recs[lo].off ||
+        off >= idx->recs[lo].off + idx->recs[lo].len) {
+        return 0;
+    }
+    r = &idx->recs[lo];
+    n = r->off + r->len - off < len ? r->off + r->len - off : len;
+    if (r->type == REC_ZERO) {
+        memset(buf, 0, n);
+    } else if (r->type == REC_FILL) {
+        for (i = 0; i < n; i++) {
+            buf[i] = r->fill >> ((off - r->off + i) % 8 * 8);
+        }
+    } else if (fseek(idx->f, idx->pos[lo] + (off - r->off), SEEK_SET) ||
+               fread(buf, 1, n, idx->f) != n) {
+        return 0;
+    }
+    return n;
+}
+
+static int cmd_scan(const char *src)
+{
+    dump_run run = { 0 };
+    dump_index idx;
+    uint64_t len, i, t0;
+    const uint8_t *base;
+
+    /* a dump file: its record headers are the answer */
+    if (!index_load(src, &idx)) {
+        opt.addr = idx.hdr.base;
+        for (i = 0; i < idx.nrecs; i++) {
+            run.rec = idx.recs[i];
+            run.open = 1;
+            run_flush(&run);
+        }
+        fprintf(stderr, "%s: %llu bytes from %s at 0x%llx: %llu data, %llu fill, %llu zero\n",
+                src, (unsigned long long)idx.hdr.len, idx.hdr.src,
+                (unsigned long long)idx.hdr.base, (unsigned long long)run.bytes[REC_DATA],
+                (unsigned long long)run.bytes[REC_FILL],
+                (unsigned long long)run.bytes[REC_ZERO]);
+        return 0;
+    }
+
+    base = src_map(src, &len, 1);
+    if (!base) {
+        return 1;
+    }
+    t0 = now_ns();
+    if (walk(base, len, &run)) {
+        return 1;
+    }
+    summary(&run, len, now_ns() - t0);
+    return 0;
+}
+
+static void hex_line(uint64_t addr, const uint8_t *b, int n)
+{
+    int i;
+
+    printf("%012llx:", (unsigned long long)addr);
+    for (i = 0; i < 16; i++) {
+        if (i < n) {
+            printf(" %02x", b[i]);
+        } else {
+            printf("   ");
+        }
+    }
+    printf("  ");
+    for (i = 0; i < n; i++) {
+        putchar(b[i] >= 32 && b[i] <= 126 ? b[i] : '.');
+    }
+    putchar('\n');
+}
+
+static int cmd_hexdump(const char *src)
+{
+    uint8_t line[16], prev[16];
+    const uint8_t *base = NULL;
+    uint64_t start, len, off, got;
+    dump_index idx;
+    int is_dump, folded = 0, have_prev = 0, n;
+
+    is_dump = !index_load(src, &idx);
+    if (is_dump) {
+        /* -a is a source address, as printed by scan */
+        start = opt.addr > idx.hdr.base ? opt.addr - idx.hdr.base : 0;
+        len = opt.len ? opt.len : idx.hdr.len;
+        if (start >= idx.hdr.len) {
+            fprintf(stderr, "%s: holds 0x%llx-0x%llx\n", src,
+                    (unsigned long long)idx.hdr.base,
+                    (unsigned long long)(idx.hdr.base + idx.hdr.len - 1));
+            return 1;
+        }
+        len = idx.hdr.len - start < len ? idx.hdr.len - start : len;
+        opt.addr = idx.hdr.base;
+    } else {
+        base = src_map(src, &len, 0);
+        if (!base) {
+            return 1;
+        }
+        start = 0;
+    }
+
+    for (off = start; off < start + len; off += n) {
+        n = start + len - off < 16 ? start + len - off : 16;
+        if (is_dump) {
+            for (got = 0; got < (uint64_t)n; ) {
+                uint64_t k = index_read(&idx, off + got, line + got, n - got);
+
+                if (!k) {
+                    break;
+                }
+                got += k;
+            }
+            n = got;
+            if (!n) {
+                break;
+            }
+        } else if (opt.narrow && !(off % 4) && n == 16) {
+            copy_narrow(line, base + off, 16);
+        } else {
+            memcpy(line, base + off, n);
+        }
+        /* fold repeated lines like hexdump(1) */
+        if (have_prev && n == 16 && !memcmp(line, prev, 16)) {
+            if (!folded) {
+                printf("*\n");
+                folded = 1;
+            }
+            continue;
+        }
+        folded = 0;
+        hex_line(opt.addr + off, line, n);
+        memcpy(prev, line, 16);
+        have_prev = n == 16;
+    }
+    if (folded) {
+        hex_line(opt.addr + off - 16, prev, 16);
+    }
+    return 0;
+}
+
+static uint64_t parse_size(const char *s)
+{
+    char *end;
+    uint64_t v = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'G': case 'g':
+        v <<= 10;
+        /* fall through */
+    case 'M': case 'm':
+        v <<= 10;
+        /* fall through */
+    case 'K': case 'k':
+        v <<= 10;
+    }
+    return v;
+}
+
+static void usage(void)
+{
+    printf("Usage: cxldump dump [-a <addr>] [-l <len>] [-c <chunk>] [-t <threads>] [-4]\n"
+           "                    -o <file> <src>\n"
+           "       cxldump scan [-a <addr>] [-l <len>] [-c <chunk>] [-4] <src | dump>\n"
+           "       cxldump hexdump [-a <addr>] [-l <len>] [-4] <src | dump>\n");
+    printf("  <src> is /dev/mem, a /dev/dax*, a resourceN file or any file\n"
+           "  -a  start address in <src>, e.g. a physical address for /dev/mem\n"
+           "  -l  length, default to the end of <src> (needed for /dev/mem); dump\n"
+           "      and scan take a multiple of 8 bytes\n"
+           "  -c  chunk size, a multiple of 64, default 4K\n"
+           "  -t  threads, default one per online CPU\n"
+           "  -4  aligned 32-bit reads only, for registers\n"
+           "  -o  dump file, - for stdout\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    int c;
+
+    if (argc < 2 || !strcmp(argv[1], "-h")) {
+        usage();
+        return argc < 2;
+    }
+    cmd = argv[1];
+    argc--;
+    argv++;
+
+    while ((c = getopt(argc, argv, "ha:l:c:t:4o:")) != -1) {
+        switch (c) {
+        case 'a':
+            opt.addr = strtoull(optarg, NULL, 0);
+            break;
+        case 'l':
+            opt.len = parse_size(optarg);
+            break;
+        case 'c':
+            opt.chunk = parse_size(optarg);
+            break;
+        case 't':
+            opt.threads = atoi(optarg);
+            break;
+        case '4':
+            opt.narrow = 1;
+            break;
+        case 'o':
+            opt.out = optarg;
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+    if (optind != argc - 1 || !opt.chunk || opt.chunk % 64 || opt.chunk > DUMP_WINDOW) {
+        usage();
+        return 1;
+    }
+    if (opt.threads <= 0) {
+        opt.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    __builtin_cpu_init();
+    chunk_class = __builtin_cpu_supports("avx2") ? chunk_class_avx2 : chunk_class_sse2;
+
+    if (!strcmp(cmd, "dump")) {
+        return cmd_dump(argv[optind]);
+    }
+    if (!strcmp(cmd, "scan")) {
+        return cmd_scan(argv[optind]);
+    }
+    if (!strcmp(cmd, "hexdump")) {
+        return cmd_hexdump(argv[optind]);
+    }
+    usage();
+    return 1;
+}
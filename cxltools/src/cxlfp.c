@@ -0,0 +1,606 @@
+/*************************************************************************
+@File Name: cxlfp.c
+@Desc: Whole-device content fingerprints for power-cycle persistence checks.
+
+    "write" fills the device (a /dev/dax* or any file) with a pattern
+    stamped with a generation number. It uses streaming stores from all
+    CPUs and fingerprints the generated data in the same pass, so no
+    read-back is needed. "snap" fingerprints whatever the device holds.
+    "verify" fingerprints it again and compares, chunk by chunk, against
+    a snapshot file, the pattern of a generation (-g) or zeroes (-z,
+    after a sanitize).
+
+    The fingerprint of a chunk (default 1 MiB) is crc32c over four
+    interleaved 8-byte lanes, folded into one crc32c. The lanes hide the
+    crc32 instruction latency, so one thread hashes at about memory
+    speed. A 256 GiB device gives a 1 MiB snapshot. Mismatched chunks
+    are classified as zeroed, stale (still holding the previous
+    generation's pattern) or corrupt.
+
+    verify exits 1 when chunks do not match and 2 when it could not
+    check at all, e.g. a missing snapshot or a -S larger than the
+    device, so a script can tell a bad device from a bad run.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+
+#include "devmem.h"
+
+#define FP_MAGIC                0x50465843u     /* "CXFP" */
+#define FP_VERSION              1
+#define FP_NO_GEN               UINT64_MAX
+#define FP_EXIT_ERROR           2               /* verify could not check */
+#define FP_CRC32C_POLY          0x82f63b78u     /* reflected */
+#define FP_PATTERN_MUL          0x9e3779b97f4a7c15ULL
+
+enum {
+    FP_CHUNK_OK,
+    FP_CHUNK_ZEROED,
+    FP_CHUNK_STALE,
+    FP_CHUNK_CORRUPT,
+};
+
+static const char *const chunk_state[] = {
+    "ok", "zeroed", "stale", "corrupt",
+};
+
+typedef struct fp_hdr fp_hdr;
+typedef struct fp_job fp_job;
+
+/* Snapshot file: this header, then one uint32_t per chunk */
+struct fp_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t gen;               /* FP_NO_GEN when taken by snap */
+    uint64_t size;
+    uint64_t chunk;
+    uint64_t nchunks;
+    uint64_t time;              /* CLOCK_REALTIME seconds */
+    char dev[64];
+};
+
+struct fp_job {
+    uint8_t *base;
+    uint64_t size;
+    uint64_t chunk;
+    uint64_t nchunks;
+    uint64_t gen;
+    int write;
+    const uint32_t *expect;     /* from the file, or NULL */
+    int expect_zero;
+    uint32_t *crc;              /* out */
+    uint8_t *state;             /* out, verify */
+    uint64_t next;              /* next chunk to claim */
+};
+
+static struct {
+    uint64_t gen;
+    uint64_t chunk;
+    uint64_t size;
+    int threads;
+    int zero;
+    const char *file;
+} opt = {
+    .gen = FP_NO_GEN,
+    .chunk = 1 << 20,
+};
+
+static uint32_t crc_table[256];
+static uint32_t (*chunk_crc)(const uint64_t *p, uint64_t n);
+static uint32_t (*chunk_fill)(uint64_t *p, uint64_t n, uint64_t word, uint64_t gen,
+                              int store);
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* pattern: every word differs, and from the same word of other generations */
+
+static inline uint64_t pattern_seed(uint64_t gen)
+{
+    uint64_t z = gen + FP_PATTERN_MUL;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t pattern_word(uint64_t seed, uint64_t word)
+{
+    return word * FP_PATTERN_MUL ^ seed;
+}
+
+/* crc32c, the same function as the SSE4.2 crc32 instruction */
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ FP_CRC32C_POLY : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static inline uint64_t crc_sw64(uint64_t crc, uint64_t v)
+{
+    uint32_t c = crc;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        c = crc_table[(c ^ v) & 0xff] ^ (c >> 8);
+        v >>= 8;
+    }
+    return c;
+}
+
+#define CRC_HW64(c, v)          _mm_crc32_u64(c, v)
+#define CRC_SW64(c, v)          crc_sw64(c, v)
+
+/*
+ * Four lanes over words 4i, 4i+1, 4i+2, 4i+3, folded in order. Chunks
+ * are a multiple of 32 bytes, so there is no tail.
+ */
+#define FP_KERNELS(sfx, attr, CRC64)                                            \
+static attr uint32_t chunk_crc_##sfx(const uint64_t *p, uint64_t n)             \
+{                                                                               \
+    uint64_t c0 = ~0u, c1 = ~0u, c2 = ~0u, c3 = ~0u, c = ~0u, i;                \
+                                                                                \
+    for (i = 0; i < n; i += 4) {                                                \
+        c0 = CRC64(c0, p[i]);                                                   \
+        c1 = CRC64(c1, p[i + 1]);                                               \
+        c2 = CRC64(c2, p[i + 2]);                                               \
+        c3 = CRC64(c3, p[i + 3]);                                               \
+    }                                                                           \
+    c = CRC64(c, c0 << 32 | c1);                                                \
+    c = CRC64(c, c2 << 32 | c3);                                                \
+    return ~(uint32_t)c;                                                        \
+}                                                                               \
+                                                                                \
+/* Fingerprint of generation @gen's pattern from @word on; @store writes it */ \
+static attr uint32_t chunk_fill_##sfx(uint64_t *p, uint64_t n, uint64_t word,   \
+                                      uint64_t gen, int store)                  \
+{                                                                               \
+    uint64_t c0 = ~0u, c1 = ~0u, c2 = ~0u, c3 = ~0u, c = ~0u, i, w[4];          \
+    uint64_t seed = pattern_seed(gen);                                          \
+                                                                                \
+    for (i = 0; i < n; i += 4, word += 4) {                                     \
+        w[0] = pattern_word(seed, word);                                        \
+        w[1] = pattern_word(seed, word + 1);                                    \
+        w[2] = pattern_word(seed, word + 2);                                    \
+        w[3] = pattern_word(seed, word + 3);                                    \
+        if (store) {                                                            \
+            _mm_stream_si128((__m128i *)(p + i), _mm_loadu_si128((__m128i *)w));\
+            _mm_stream_si128((__m128i *)(p + i + 2),                            \
+                             _mm_loadu_si128((__m128i *)(w + 2)));              \
+        }                                                                       \
+        c0 = CRC64(c0, w[0]);                                                   \
+        c1 = CRC64(c1, w[1]);                                                   \
+        c2 = CRC64(c2, w[2]);                                                   \
+        c3 = CRC64(c3, w[3]);                                                   \
+    }                                                                           \
+    c = CRC64(c, c0 << 32 | c1);                                                \
+    c = CRC64(c, c2 << 32 | c3);                                                \
+    return ~(uint32_t)c;                                                        \
+}
+
+FP_KERNELS(hw, __attribute__((target("sse4.2"))), CRC_HW64)
+FP_KERNELS(sw, , CRC_SW64)
+
+static uint32_t zero_crc(uint64_t n)
+{
+    uint64_t c0 = ~0u, c = ~0u, i;
+
+    /* all four lanes see the same zero words */
+    for (i = 0; i < n / 4; i++) {
+        c0 = crc_sw64(c0, 0);
+    }
+    c = crc_sw64(c, c0 << 32 | c0);
+    c = crc_sw64(c, c0 << 32 | c0);
+    return ~(uint32_t)c;
+}
+
+/* workers */
+
+static uint8_t classify(const fp_job *job, uint64_t i, uint64_t len, uint32_t crc)
+{
+    uint64_t word = i * job->chunk / 8;
+
+    if (crc == zero_crc(len / 8)) {
+        return FP_CHUNK_ZEROED;
+    }
+    if (job->gen != FP_NO_GEN && job->gen &&
+        crc == chunk_fill(NULL, len / 8, word, job->gen - 1, 0)) {
+        return FP_CHUNK_STALE;
+    }
+    return FP_CHUNK_CORRUPT;
+}
+
+static void *worker(void *arg)
+{
+    fp_job *job = arg;
+    uint64_t i, off, len, expect;
+    uint32_t zcrc = 0;
+    uint64_t zlen = 0;
+
+    for (;;) {
+        i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->nchunks) {
+            break;
+        }
+        off = i * job->chunk;
+        len = job->size - off < job->chunk ? job->size - off : job->chunk;
+
+        if (job->write) {
+            job->crc[i] = chunk_fill((uint64_t *)(job->base + off), len / 8, off / 8,
+                                     job->gen, 1);
+            continue;
+        }
+        job->crc[i] = chunk_crc((const uint64_t *)(job->base + off), len / 8);
+        if (!job->state) {
+            continue;
+        }
+
+        if (job->expect) {
+            expect = job->expect[i];
+        } else if (job->expect_zero) {
+            if (zlen != len) {
+                zcrc = zero_crc(len / 8);
+                zlen = len;
+            }
+            expect = zcrc;
+        } else {
+            expect = chunk_fill(NULL, len / 8, off / 8, job->gen, 0);
+        }
+        job->state[i] = job->crc[i] == expect ? FP_CHUNK_OK :
+                        classify(job, i, len, job->crc[i]);
+    }
+    if (job->write) {
+        _mm_sfence();
+    }
+    return NULL;
+}
+
+static int run_job(fp_job *job)
+{
+    pthread_t *tids;
+    uint64_t t0, ns;
+    int i, n = opt.threads;
+
+    tids = calloc(n, sizeof(*tids));
+    if (!tids) {
+        return -1;
+    }
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&tids[i], NULL, worker, job)) {
+            n = i;
+            break;
+        }
+    }
+    if (!n) {
+        worker(job);
+    }
+    for (i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    ns = now_ns() - t0;
+    free(tids);
+
+    if (job->write) {
+        /* the streaming stores are fenced; make a file target durable too */
+        msync(job->base, job->size, MS_SYNC);
+    }
+    printf("%.1f GiB in %.2f s, %.1f GB/s, %d threads\n", job->size / (double)(1 << 30),
+           ns / 1e9, ns ? job->size / (double)ns : 0.0, n ? n : 1);
+    return 0;
+}
+
+/* snapshot files */
+
+static uint8_t *dev_map(const char *path, int writable, uint64_t *size)
+{
+    uint64_t len = opt.size;
+    uint8_t *map;
+
+    map = devmem_map(path, 0, &len, writable);
+    if (!map) {
+        return NULL;
+    }
+    *size = len & ~31ULL;
+    if (!*size) {
+        fprintf(stderr, "%s: smaller than 32 bytes\n", path);
+        devmem_unmap(map, len);
+        return NULL;
+    }
+    return map;
+}
+
+static int snap_save(const char *path, const fp_job *job, const char *dev)
+{
+    fp_hdr hdr = {
+        .magic = FP_MAGIC,
+        .version = FP_VERSION,
+        .gen = job->gen,
+        .size = job->size,
+        .chunk = job->chunk,
+        .nchunks = job->nchunks,
+        .time = time(NULL),
+    };
+    FILE *f;
+    int rc;
+
+    snprintf(hdr.dev, sizeof(hdr.dev), "%s", dev);
+    f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    rc = fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+         fwrite(job->crc, sizeof(*job->crc), job->nchunks, f) != job->nchunks;
+    /* the snapshot has to survive the power cycle it is checking */
+    rc |= fflush(f) || fsync(fileno(f));
+    rc |= fclose(f);
+    if (rc) {
+        fprintf(stderr, "write %s failed\n", path);
+        return -1;
+    }
+    printf("%s: %llu chunks of %llu KiB", path, (unsigned long long)job->nchunks,
+           (unsigned long long)job->chunk >> 10);
+    if (job->gen != FP_NO_GEN) {
+        printf(", generation %llu", (unsigned long long)job->gen);
+    }
+    printf("\n");
+    return 0;
+}
+
+static uint32_t *snap_load(const char *path, fp_hdr *hdr)
+{
+    uint32_t *crc;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    if (fread(hdr, sizeof(*hdr), 1, f) != 1 || hdr->magic != FP_MAGIC ||
+        hdr->version != FP_VERSION || !hdr->chunk || hdr->chunk % 32 ||
+        hdr->nchunks != (hdr->size + hdr->chunk - 1) / hdr->chunk) {
+        fprintf(stderr, "%s: not a cxlfp snapshot\n", path);
+        fclose(f);
+        return NULL;
+    }
+    crc = calloc(hdr->nchunks, sizeof(*crc));
+    if (!crc || fread(crc, sizeof(*crc), hdr->nchunks, f) != hdr->nchunks) {
+        fprintf(stderr, "%s: truncated\n", path);
+        free(crc);
+        crc = NULL;
+    }
+    fclose(f);
+    return crc;
+}
+
+/* commands */
+
+static int job_init(fp_job *job, const char *dev, int writable)
+{
+    memset(job, 0, sizeof(*job));
+    job->base = dev_map(dev, writable, &job->size);
+    if (!job->base) {
+        return -1;
+    }
+    job->chunk = opt.chunk;
+    job->nchunks = (job->size + job->chunk - 1) / job->chunk;
+    job->gen = opt.gen;
+    job->crc = calloc(job->nchunks, sizeof(*job->crc));
+    return job->crc ? 0 : -1;
+}
+
+static int cmd_write(const char *dev)
+{
+    fp_job job;
+
+    if (opt.gen == FP_NO_GEN) {
+        fprintf(stderr, "write needs -g <generation>\n");
+        return 1;
+    }
+    if (job_init(&job, dev, 1)) {
+        return 1;
+    }
+    job.write = 1;
+    printf("%s: writing generation %llu\n", dev, (unsigned long long)opt.gen);
+    if (run_job(&job)) {
+        return 1;
+    }
+    return opt.file && snap_save(opt.file, &job, dev) ? 1 : 0;
+}
+
+static int cmd_snap(const char *dev)
+{
+    fp_job job;
+
+    if (!opt.file) {
+        fprintf(stderr, "snap needs -f <snapshot>\n");
+        return 1;
+    }
+    if (job_init(&job, dev, 0) || run_job(&job)) {
+        return 1;
+    }
+    return snap_save(opt.file, &job, dev) ? 1 : 0;
+}
+
+static int cmd_verify(const char *dev)
+{
+    uint64_t i, j, count[4] = { 0 };
+    uint32_t *expect = NULL;
+    fp_hdr hdr;
+    fp_job job;
+
+    if (!opt.file && opt.gen == FP_NO_GEN && !opt.zero) {
+        fprintf(stderr, "verify needs -f <snapshot>, -g <generation> or -z\n");
+        return FP_EXIT_ERROR;
+    }
+    if (opt.file) {
+        expect = snap_load(opt.file, &hdr);
+        if (!expect) {
+            return FP_EXIT_ERROR;
+        }
+        opt.chunk = hdr.chunk;
+        opt.gen = hdr.gen;
+        if (!opt.size) {
+            opt.size = hdr.size;
+        }
+    }
+    if (job_init(&job, dev, 0)) {
+        return FP_EXIT_ERROR;
+    }
+    if (expect && job.nchunks != hdr.nchunks) {
+        fprintf(stderr, "%s: %llu bytes, the snapshot has %llu\n", dev,
+                (unsigned long long)job.size, (unsigned long long)hdr.size);
+        return FP_EXIT_ERROR;
+    }
+    job.expect = expect;
+    job.expect_zero = opt.zero;
+    job.state = calloc(job.nchunks, 1);
+    if (!job.state || run_job(&job)) {
+        return FP_EXIT_ERROR;
+    }
+
+    /* print runs of chunks in the same state */
+    for (i = 0; i < job.nchunks; i = j) {
+        for (j = i; j < job.nchunks && job.state[j] == job.state[i]; j++) {
+            count[job.state[i]]++;
+        }
+        if (job.state[i] != FP_CHUNK_OK) {
+            printf("  0x%012llx-0x%012llx %s\n", (unsigned long long)(i * job.chunk),
+                   (unsigned long long)(j * job.chunk < job.size ? j * job.chunk
+                                                                 : job.size) - 1,
+                   chunk_state[job.state[i]]);
+        }
+    }
+    printf("%s: %llu chunks ok, %llu zeroed, %llu stale, %llu corrupt\n", dev,
+           (unsigned long long)count[FP_CHUNK_OK], (unsigned long long)count[FP_CHUNK_ZEROED],
+           (unsigned long long)count[FP_CHUNK_STALE],
+           (unsigned long long)count[FP_CHUNK_CORRUPT]);
+    return count[FP_CHUNK_OK] != job.nchunks;
+}
+
+static uint64_t parse_size(const char *s)
+{
+    char *end;
+    uint64_t v = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'G': case 'g':
+        v <<= 10;
+        /* fall through */
+    case 'M': case 'm':
+        v <<= 10;
+        /* fall through */
+    case 'K': case 'k':
+        v <<= 10;
+    }
+    return v;
+}
+
+static void usage(void)
+{
+    printf("Usage: cxlfp write -g <gen> [-f <snapshot>] <dev>\n"
+           "       cxlfp snap -f <snapshot> <dev>\n"
+           "       cxlfp verify -f <snapshot> | -g <gen> | -z <dev>\n");
+    printf("  <dev> is a /dev/dax* or any file\n"
+           "  -g  generation stamped into the pattern, e.g. the power cycle count\n"
+           "  -f  snapshot file\n"
+           "  -z  verify expects zeroes, e.g. after a sanitize\n"
+           "  -c  chunk size, default 1M\n"
+           "  -t  threads, default one per online CPU\n"
+           "  -S  size, default the whole device; larger than the device is an error\n"
+           "verify exits 1 on mismatched chunks, 2 when it could not check\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    int c;
+
+    if (argc < 2 || !strcmp(argv[1], "-h")) {
+        usage();
+        return argc < 2;
+    }
+    cmd = argv[1];
+    argc--;
+    argv++;
+
+    while ((c = getopt(argc, argv, "hg:f:zc:t:S:")) != -1) {
+        switch (c) {
+        case 'g':
+            opt.gen = strtoull(optarg, NULL, 0);
+            break;
+        case 'f':
+            opt.file = optarg;
+            break;
+        case 'z':
+            opt.zero = 1;
+            break;
+        case 'c':
+            opt.chunk = parse_size(optarg);
+            break;
+        case 't':
+            opt.threads = atoi(optarg);
+            break;
+        case 'S':
+            opt.size = parse_size(optarg);
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+    if (optind != argc - 1 || !opt.chunk || opt.chunk % 32) {
+        usage();
+        return 1;
+    }
+    if (opt.threads <= 0) {
+        opt.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    crc_init();
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        chunk_crc = chunk_crc_hw;
+        chunk_fill = chunk_fill_hw;
+    } else {
+        chunk_crc = chunk_crc_sw;
+        chunk_fill = chunk_fill_sw;
+    }
+
+    if (!strcmp(cmd, "write")) {
+        return cmd_write(argv[optind]);
+    }
+    if (!strcmp(cmd, "snap")) {
+        return cmd_snap(argv[optind]);
+    }
+    if (!strcmp(cmd, "verify")) {
+        return cmd_verify(argv[optind]);
+    }
+    usage();
+    return 1;
+}
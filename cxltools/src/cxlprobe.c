@@ -0,0 +1,622 @@
+/*************************************************************************
+@File Name: cxlprobe.c
+@Desc: Reset/rescan loop timing how long the device takes to come back.
+
+    Each iteration triggers a remove + rescan, or a reset through the
+    device's sysfs reset attribute with the chosen reset_method (bus for
+    a secondary bus reset, flr, cxl_bus, ...). It then polls every -p us
+    and timestamps, relative to the trigger, when each stage is reached:
+
+        trigger   the remove/rescan or reset write returned
+        driver    the device is bound to its driver again (remove only)
+        online    the dax devices and regions are back: dax bound to its
+                  driver, region committed
+
+    The sysfs writes are synchronous: the kernel has waited for the link
+    and for config space, and restored the saved state, before the reset
+    write returns, and a rescan has enumerated the device by then. Link
+    and config readiness therefore end up inside "trigger" and are not
+    stages of their own. Remove + rescan never takes the link down, and a
+    reset leaves the driver bound, so that stage is only timed for
+    remove, where the probe can run asynchronously. DVSEC Mem_Enable is
+    not timed either: a reset clears it and the kernel does not set it
+    again, and remove + rescan never clears it.
+
+    Only stages that hold before the first iteration are waited for, so
+    a host without a region just skips "online". "ready" is the latest
+    stage of an iteration. At the end every stage gets percentiles and
+    the ready time a histogram, which a1_test_cxl_probe.sh's sleeps
+    could not give.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcicfg.h"
+#include "sysfs.h"
+
+#define PROBE_MAX_ONLINE        16
+
+enum {
+    STAGE_TRIGGER,
+    STAGE_DRIVER,
+    STAGE_ONLINE,
+    STAGE_READY,
+    NR_STAGES,
+};
+
+static const char *const stage_names[NR_STAGES] = {
+    "trigger", "driver", "online", "ready",
+};
+
+typedef struct probe_dev probe_dev;
+
+/* What the device looked like before the first iteration */
+struct probe_dev {
+    char bdf[16];
+    char parent[16];            /* upstream port, "" at the root */
+    uint16_t vendor;
+    char driver[64];
+    char reset_method[128];     /* restored on exit */
+    int nonline;
+    char online[PROBE_MAX_ONLINE][32];
+    char online_driver[PROBE_MAX_ONLINE][64];
+    int enabled[NR_STAGES];
+};
+
+static struct {
+    const char *bdf;
+    const char *method;
+    long iterations;
+    uint32_t timeout_ms;
+    uint32_t poll_us;
+    uint32_t gap_ms;
+    int keep_going;
+    int verbose;
+    int all_hist;
+    const char *csv;
+    int nonline;
+    const char *online[PROBE_MAX_ONLINE];
+} opt = {
+    .method = "remove",
+    .iterations = 100,
+    .timeout_ms = 30000,
+    .poll_us = 100,
+};
+
+static probe_dev dev;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* stages */
+
+static int stage_driver(void)
+{
+    char drv[64];
+
+    return !sysfs_link_name(drv, sizeof(drv), "/sys/bus/pci/devices/%s/driver", dev.bdf) &&
+           !strcmp(drv, dev.driver);
+}
+
+/* dax devices bound to a driver, regions committed; @drv gets the driver */
+static int online_one(const char *name, char *drv, size_t len)
+{
+    uint64_t commit;
+
+    if (!strncmp(name, "region", 6)) {
+        snprintf(drv, len, "committed");
+        return !sysfs_read_u64(&commit, "/sys/bus/cxl/devices/%s/commit", name) && commit;
+    }
+    return !sysfs_link_name(drv, len, "/sys/bus/dax/devices/%s/driver", name);
+}
+
+static int stage_online(void)
+{
+    char drv[64];
+    int i;
+
+    for (i = 0; i < dev.nonline; i++) {
+        if (!online_one(dev.online[i], drv, sizeof(drv)) ||
+            strcmp(drv, dev.online_driver[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int (*const stage_check[NR_STAGES])(void) = {
+    [STAGE_DRIVER] = stage_driver,
+    [STAGE_ONLINE] = stage_online,
+};
+
+static void online_add(const char *name)
+{
+    char drv[64];
+
+    if (dev.nonline == PROBE_MAX_ONLINE || !online_one(name, drv, sizeof(drv))) {
+        return;
+    }
+    snprintf(dev.online[dev.nonline], sizeof(dev.online[0]), "%s", name);
+    snprintf(dev.online_driver[dev.nonline], sizeof(dev.online_driver[0]), "%s", drv);
+    dev.nonline++;
+}
+
+static void online_scan(const char *dir, const char *prefix)
+{
+    char path[512];
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(sysfs_path(path, sizeof(path), "%s", dir));
+    while (d && (de = readdir(d))) {
+        if (!strncmp(de->d_name, prefix, strlen(prefix))) {
+            online_add(de->d_name);
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+}
+
+/* Parent port from the device's sysfs path, .../0000:00:01.1/0000:0d:00.0 */
+static void find_parent(void)
+{
+    char path[512], target[512], *p;
+    unsigned int dom, bus, slot, fn;
+    ssize_t n;
+
+    n = readlink(sysfs_path(path, sizeof(path), "/sys/bus/pci/devices/%s", dev.bdf),
+                 target, sizeof(target) - 1);
+    if (n < 0) {
+        return;
+    }
+    target[n] = 0;
+    p = strrchr(target, '/');
+    if (!p) {
+        return;
+    }
+    *p = 0;
+    p = strrchr(target, '/');
+    p = p ? p + 1 : target;
+    if (sscanf(p, "%x:%x:%x.%x", &dom, &bus, &slot, &fn) == 4) {
+        snprintf(dev.parent, sizeof(dev.parent), "%s", p);
+    }
+}
+
+static int baseline(void)
+{
+    int fd, i;
+
+    fd = pcicfg_open(dev.bdf);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", dev.bdf, strerror(-fd));
+        return -1;
+    }
+    dev.vendor = pcicfg_read16(fd, 0);
+    close(fd);
+    sysfs_link_name(dev.driver, sizeof(dev.driver), "/sys/bus/pci/devices/%s/driver",
+                    dev.bdf);
+    find_parent();
+
+    if (opt.nonline) {
+        for (i = 0; i < opt.nonline; i++) {
+            if (strcmp(opt.online[i], "-")) {
+                online_add(opt.online[i]);
+            }
+        }
+    } else {
+        online_scan("/sys/bus/cxl/devices", "region");
+        online_scan("/sys/bus/dax/devices", "dax");
+    }
+
+    dev.enabled[STAGE_TRIGGER] = 1;
+    dev.enabled[STAGE_READY] = 1;
+    /* a reset keeps the driver bound, see the top of the file */
+    dev.enabled[STAGE_DRIVER] = dev.driver[0] != 0 && !strcmp(opt.method, "remove");
+    dev.enabled[STAGE_ONLINE] = dev.nonline > 0;
+
+    printf("%s: vendor %04x, upstream %s, driver %s, reset %s\n", dev.bdf,
+           dev.vendor, dev.parent[0] ? dev.parent : "-", dev.driver[0] ? dev.driver : "-",
+           opt.method);
+    printf("online:");
+    for (i = 0; i < dev.nonline; i++) {
+        printf(" %s(%s)", dev.online[i], dev.online_driver[i]);
+    }
+    printf("%s\nwaiting for:", dev.nonline ? "" : " -");
+    for (i = 0; i < NR_STAGES; i++) {
+        if (dev.enabled[i]) {
+            printf(" %s", stage_names[i]);
+        }
+    }
+    printf("\n");
+    return 0;
+}
+
+/* triggers */
+
+static int trigger(void)
+{
+    int rc;
+
+    if (strcmp(opt.method, "remove")) {
+        rc = sysfs_write("1", "/sys/bus/pci/devices/%s/reset", dev.bdf);
+        if (rc) {
+            fprintf(stderr, "%s reset: %s\n", dev.bdf, strerror(-rc));
+        }
+        return rc;
+    }
+
+    rc = sysfs_write("1", "/sys/bus/pci/devices/%s/remove", dev.bdf);
+    if (rc) {
+        fprintf(stderr, "%s remove: %s\n", dev.bdf, strerror(-rc));
+        return rc;
+    }
+    if (dev.parent[0]) {
+        rc = sysfs_write("1", "/sys/bus/pci/devices/%s/rescan", dev.parent);
+    } else {
+        rc = sysfs_write("1", "/sys/bus/pci/rescan");
+    }
+    if (rc) {
+        fprintf(stderr, "rescan: %s\n", strerror(-rc));
+    }
+    return rc;
+}
+
+static int set_reset_method(void)
+{
+    int rc;
+
+    if (!strcmp(opt.method, "remove")) {
+        return 0;
+    }
+    sysfs_read(dev.reset_method, sizeof(dev.reset_method),
+               "/sys/bus/pci/devices/%s/reset_method", dev.bdf);
+    rc = sysfs_write(opt.method, "/sys/bus/pci/devices/%s/reset_method", dev.bdf);
+    if (rc) {
+        fprintf(stderr, "%s: reset_method %s: %s (supported: %s)\n", dev.bdf, opt.method,
+                strerror(-rc), dev.reset_method[0] ? dev.reset_method : "none");
+    }
+    return rc;
+}
+
+static void restore_reset_method(void)
+{
+    if (dev.reset_method[0]) {
+        sysfs_write(dev.reset_method, "/sys/bus/pci/devices/%s/reset_method", dev.bdf);
+    }
+}
+
+/* One iteration: stage times in ns from the trigger, UINT64_MAX if missed */
+static int iterate(uint64_t *t)
+{
+    uint64_t t0, now, deadline;
+    struct timespec ts = { 0, opt.poll_us * 1000L };
+    int i, pending;
+
+    for (i = 0; i < NR_STAGES; i++) {
+        t[i] = UINT64_MAX;
+    }
+    t0 = now_ns();
+    if (trigger()) {
+        return -1;
+    }
+    now = now_ns();
+    t[STAGE_TRIGGER] = now - t0;
+    deadline = t0 + opt.timeout_ms * 1000000ULL;
+
+    for (;;) {
+        pending = 0;
+        for (i = STAGE_DRIVER; i < STAGE_READY; i++) {
+            if (!dev.enabled[i] || t[i] != UINT64_MAX) {
+                continue;
+            }
+            if (stage_check[i]()) {
+                t[i] = now_ns() - t0;
+            } else {
+                pending++;
+            }
+        }
+        if (!pending) {
+            break;
+        }
+        if (now_ns() > deadline || stop) {
+            return -1;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    t[STAGE_READY] = 0;
+    for (i = 0; i < STAGE_READY; i++) {
+        if (dev.enabled[i] && t[i] > t[STAGE_READY]) {
+            t[STAGE_READY] = t[i];
+        }
+    }
+    return 0;
+}
+
+/* report */
+
+static void print_iteration(FILE *f, long iter, const uint64_t *t, const char *sep)
+{
+    int i;
+
+    fprintf(f, "%ld", iter);
+    for (i = 0; i < NR_STAGES; i++) {
+        if (!dev.enabled[i]) {
+            continue;
+        }
+        if (t[i] == UINT64_MAX) {
+            fprintf(f, "%s%s", sep, *sep == ',' ? "" : "-");
+        } else {
+            fprintf(f, "%s%.3f", sep, t[i] / 1e6);
+        }
+    }
+    fprintf(f, "\n");
+}
+
+static void print_hist(const char *name, const uint64_t *lat, long n)
+{
+    long count[64] = { 0 };
+    int b, lo = 63, hi = 0, w;
+    long i, max = 0;
+
+    /* power-of-two buckets in us */
+    for (i = 0; i < n; i++) {
+        b = lat[i] < 1000 ? 0 : 63 - __builtin_clzll(lat[i] / 1000);
+        count[b]++;
+        lo = b < lo ? b : lo;
+        hi = b > hi ? b : hi;
+    }
+    for (b = lo; b <= hi; b++) {
+        max = count[b] > max ? count[b] : max;
+    }
+    printf("%s histogram (ms):\n", name);
+    for (b = lo; b <= hi; b++) {
+        w = max ? (int)(count[b] * 50 / max) : 0;
+        printf("  %9.3f - %9.3f %7ld %.*s\n", b ? (1ULL << b) / 1e3 : 0.0,
+               (2ULL << b) / 1e3, count[b], w,
+               "##################################################");
+    }
+}
+
+static void report(uint64_t **t, long n, long failed)
+{
+    uint64_t *lat;
+    long i, k;
+    int s;
+
+    printf("\n%ld iterations, %ld failed\n", n + failed, failed);
+    printf("trigger includes the link and config space coming back; Mem_Enable "
+           "is not timed%s\n", strcmp(opt.method, "remove") ? ", nor the driver" : "");
+    lat = calloc(n ? n : 1, sizeof(*lat));
+    if (!lat || !n) {
+        free(lat);
+        return;
+    }
+    printf("%-8s %8s %9s %9s %9s %9s %9s %9s  (ms)\n", "stage", "n", "min", "p50", "p90",
+           "p99", "p99.9", "max");
+    for (s = 0; s < NR_STAGES; s++) {
+        if (!dev.enabled[s]) {
+            continue;
+        }
+        for (i = k = 0; i < n; i++) {
+            if (t[s][i] != UINT64_MAX) {
+                lat[k++] = t[s][i];
+            }
+        }
+        qsort(lat, k, sizeof(*lat), cmp_u64);
+        if (!k) {
+            continue;
+        }
+        printf("%-8s %8ld %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", stage_names[s], k,
+               lat[0] / 1e6, lat[k / 2] / 1e6, lat[k * 9 / 10] / 1e6,
+               lat[k * 99 / 100] / 1e6, lat[k * 999 / 1000] / 1e6, lat[k - 1] / 1e6);
+    }
+    for (s = 0; s < NR_STAGES; s++) {
+        if (!dev.enabled[s] || (!opt.all_hist && s != STAGE_READY)) {
+            continue;
+        }
+        for (i = k = 0; i < n; i++) {
+            if (t[s][i] != UINT64_MAX) {
+                lat[k++] = t[s][i];
+            }
+        }
+        print_hist(stage_names[s], lat, k);
+    }
+    free(lat);
+}
+
+static void usage(void)
+{
+    printf("Usage: cxlprobe -s <bdf> [-m remove|bus|flr|cxl_bus|...] [-n <iterations>]\n"
+           "                [-t <timeout_ms>] [-p <poll_us>] [-d <gap_ms>] [-D <dev>]...\n"
+           "                [-o <csv>] [-k] [-v] [-H] [-R <root>]\n");
+    printf("  -s  device, default the first cc53 function\n"
+           "  -m  remove + rescan (default), or a reset_method for the reset\n"
+           "      attribute: bus is a secondary bus reset, flr a function level reset\n"
+           "      Stages: trigger (the sysfs write, which already includes link and\n"
+           "      config space coming back), driver (remove only), online\n"
+           "  -n  iterations, default 100\n"
+           "  -t  give up on an iteration after this long, default 30000 ms\n"
+           "  -p  poll period, default 100 us\n"
+           "  -d  wait this long between a ready device and the next trigger\n"
+           "  -D  dax device or region that must be back online, repeat for more;\n"
+           "      default every one online at the start, - for none\n"
+           "  -o  write every iteration's stage times to <csv>\n"
+           "  -k  keep going after an iteration times out\n"
+           "  -v  print every iteration\n"
+           "  -H  a histogram for every stage, not only ready\n"
+           "  -R  read sys under <root>\n");
+}
+
+int main(int argc, char **argv)
+{
+    char bdfs[1][16];
+    uint64_t *t[NR_STAGES], cur[NR_STAGES];
+    FILE *csv = NULL;
+    long n = 0, failed = 0, iter;
+    int c, i, rc = 0;
+
+    while ((c = getopt(argc, argv, "hs:m:n:t:p:d:D:o:kvHR:")) != -1) {
+        switch (c) {
+        case 's':
+            opt.bdf = optarg;
+            break;
+        case 'm':
+            opt.method = optarg;
+            break;
+        case 'n':
+            opt.iterations = strtol(optarg, NULL, 0);
+            break;
+        case 't':
+            opt.timeout_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            opt.poll_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            opt.gap_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            if (opt.nonline < PROBE_MAX_ONLINE) {
+                opt.online[opt.nonline++] = optarg;
+            }
+            break;
+        case 'o':
+            opt.csv = optarg;
+            break;
+        case 'k':
+            opt.keep_going = 1;
+            break;
+        case 'v':
+            opt.verbose = 1;
+            break;
+        case 'H':
+            opt.all_hist = 1;
+            break;
+        case 'R':
+            sysfs_root = optarg;
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+
+    if (opt.bdf) {
+        snprintf(dev.bdf, sizeof(dev.bdf), "%s%s",
+                 strchr(opt.bdf, ':') == strrchr(opt.bdf, ':') ? "0000:" : "", opt.bdf);
+    } else if (pcicfg_scan(PCI_VENDOR_ID_SFX, bdfs, 1)) {
+        snprintf(dev.bdf, sizeof(dev.bdf), "%s", bdfs[0]);
+    } else {
+        fprintf(stderr, "no device, give -s <bdf>\n");
+        return 1;
+    }
+    if (opt.iterations < 1 || baseline() || set_reset_method()) {
+        return 1;
+    }
+    for (i = 0; i < NR_STAGES; i++) {
+        t[i] = calloc(opt.iterations, sizeof(**t));
+        if (!t[i]) {
+            return 1;
+        }
+    }
+    if (opt.csv) {
+        csv = fopen(opt.csv, "w");
+        if (!csv) {
+            perror(opt.csv);
+            return 1;
+        }
+        fprintf(csv, "iteration");
+        for (i = 0; i < NR_STAGES; i++) {
+            if (dev.enabled[i]) {
+                fprintf(csv, ",%s_ms", stage_names[i]);
+            }
+        }
+        fprintf(csv, "\n");
+    }
+
+    if (opt.verbose) {
+        printf("iteration");
+        for (i = 0; i < NR_STAGES; i++) {
+            if (dev.enabled[i]) {
+                printf(" %s", stage_names[i]);
+            }
+        }
+        printf(" (ms)\n");
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    for (iter = 0; iter < opt.iterations && !stop; iter++) {
+        if (iterate(cur)) {
+            if (stop) {
+                break;
+            }
+            failed++;
+            fprintf(stderr, "iteration %ld: not ready after %u ms, missing:", iter,
+                    opt.timeout_ms);
+            for (i = STAGE_DRIVER; i < STAGE_READY; i++) {
+                if (dev.enabled[i] && cur[i] == UINT64_MAX) {
+                    fprintf(stderr, " %s", stage_names[i]);
+                }
+            }
+            fprintf(stderr, "\n");
+            if (csv) {
+                print_iteration(csv, iter, cur, ",");
+            }
+            if (!opt.keep_going) {
+                rc = 1;
+                break;
+            }
+            continue;
+        }
+        for (i = 0; i < NR_STAGES; i++) {
+            t[i][n] = cur[i];
+        }
+        n++;
+        if (opt.verbose) {
+            print_iteration(stdout, iter, cur, " ");
+        }
+        if (csv) {
+            print_iteration(csv, iter, cur, ",");
+        }
+        if (opt.gap_ms) {
+            usleep(opt.gap_ms * 1000);
+        }
+    }
+
+    restore_reset_method();
+    report(t, n, failed);
+    if (csv) {
+        fclose(csv);
+    }
+    return rc || failed;
+}
@@ -0,0 +1,366 @@
+/*************************************************************************
+@File Name: cxlras.c
+@Desc: CXL RAS capability poller with a timestamped event log.
+
+    Maps the BAR2 of each device (or a cxl_regemu file), finds the RAS
+    capability in the CXL.cache/mem capability array and polls its
+    uncorrectable and correctable error status. A poll is two loads.
+    Each newly set status bit becomes one log line with the wall clock
+    and CLOCK_MONOTONIC time. Uncorrectable events also carry the First
+    Error Pointer and the 16-dword header log, read before anything is
+    cleared. Status is left alone unless -c is given, since cxl_pci
+    normally owns it; -c clears it the way the kernel does (write back the
+    status masked to the defined bits), so repeated errors show up again.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cxl_regs.h"
+#include "pcicfg.h"
+#include "sysfs.h"
+
+#define RAS_MAX_DEVS            16
+
+typedef struct ras_dev ras_dev;
+
+struct ras_dev {
+    char bdf[16];
+    const char *resource;       /* -r override, else resource2 */
+    volatile uint8_t *bar;
+    volatile uint8_t *ras;
+    uint32_t uncor;             /* status at the last poll */
+    uint32_t cor;
+    uint64_t uncor_count[32];
+    uint64_t cor_count[32];
+};
+
+static struct {
+    uint32_t interval_ms;
+    int clear;
+    const char *log;
+} opt = {
+    .interval_ms = 100,
+};
+
+static ras_dev devs[RAS_MAX_DEVS];
+static int ndevs;
+static FILE *logf;
+static volatile sig_atomic_t stop;
+
+/* CXL 3.x 8.2.4.17.1 and 8.2.4.17.4 */
+static const char *const uncor_names[32] = {
+    [0] = "Cache Data Parity",
+    [1] = "Cache Address Parity",
+    [2] = "Cache Byte Enable Parity",
+    [3] = "Cache Data ECC",
+    [4] = "Memory Data Parity",
+    [5] = "Memory Address Parity",
+    [6] = "Memory Byte Enable Parity",
+    [7] = "Memory Data ECC",
+    [8] = "REINIT Threshold",
+    [9] = "Received Reserved Encoding",
+    [10] = "Received Poison",
+    [11] = "Receiver Overflow",
+    [14] = "Internal Error",
+    [15] = "CXL IDE Tx Error",
+    [16] = "CXL IDE Rx Error",
+};
+
+static const char *const cor_names[32] = {
+    [0] = "Cache Data ECC",
+    [1] = "Memory Data ECC",
+    [2] = "CRC Threshold",
+    [3] = "Retry Threshold",
+    [4] = "Cache Poison Received",
+    [5] = "Memory Poison Received",
+    [6] = "Physical Layer Error",
+};
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int dev_add(const char *bdf)
+{
+    ras_dev *dev;
+
+    if (ndevs == RAS_MAX_DEVS) {
+        fprintf(stderr, "at most %d devices\n", RAS_MAX_DEVS);
+        return -1;
+    }
+    dev = &devs[ndevs++];
+    snprintf(dev->bdf, sizeof(dev->bdf), "%s%s", strchr(bdf, ':') == strrchr(bdf, ':')
+             ? "0000:" : "", bdf);
+    return 0;
+}
+
+static int dev_map(ras_dev *dev)
+{
+    char path[512];
+    const char *res = dev->resource;
+    uint32_t off;
+
+    if (!res) {
+        res = sysfs_path(path, sizeof(path), "/sys/bus/pci/devices/%s/resource2",
+                         dev->bdf);
+    }
+    dev->bar = regs_map(res, opt.clear);
+    if (!dev->bar) {
+        return -1;
+    }
+    off = cm_find_cap(dev->bar, CM_CAP_ID_RAS);
+    if (!off) {
+        fprintf(stderr, "%s: no RAS capability in %s\n", dev->bdf, res);
+        munmap((void *)dev->bar, REGS_BAR_SIZE);
+        dev->bar = NULL;
+        return -1;
+    }
+    dev->ras = dev->bar + REGS_CM_BASE + off;
+    return 0;
+}
+
+/* "2026-10-19 06:00:00.123456 mono 1234.567890" */
+static void log_time(char *buf, size_t len)
+{
+    struct timespec rt, mono;
+    struct tm tm;
+    size_t n;
+
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    localtime_r(&rt.tv_sec, &tm);
+    n = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + n, len - n, ".%06ld mono %ld.%06ld", rt.tv_nsec / 1000,
+             (long)mono.tv_sec, mono.tv_nsec / 1000);
+}
+
+static __attribute__((format(printf, 1, 2))) void log_line(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    fflush(stdout);
+    if (logf) {
+        va_start(ap, fmt);
+        vfprintf(logf, fmt, ap);
+        va_end(ap);
+        fflush(logf);
+    }
+}
+
+static void log_bits(const char *ts, const ras_dev *dev, const char *kind,
+                     uint32_t status, uint32_t fresh, const char *const *names,
+                     const char *extra)
+{
+    int bit;
+
+    for (bit = 0; bit < 32; bit++) {
+        if (fresh & (1u << bit)) {
+            log_line("%s %s %s bit %d [%s] status 0x%08x%s\n", ts, dev->bdf, kind, bit,
+                     names[bit] ? names[bit] : "reserved", status, extra);
+        }
+    }
+}
+
+static void dev_poll(ras_dev *dev)
+{
+    char ts[64], extra[256];
+    uint32_t uncor, cor, fresh, ctrl;
+    int i, n;
+
+    uncor = regs_read32(dev->ras, RAS_UNCOR_STATUS);
+    cor = regs_read32(dev->ras, RAS_COR_STATUS);
+    if (uncor == ~0u && cor == ~0u) {
+        if (dev->uncor != ~0u) {
+            log_time(ts, sizeof(ts));
+            log_line("%s %s unreadable, link down or device reset\n", ts, dev->bdf);
+        }
+        dev->uncor = dev->cor = ~0u;
+        return;
+    }
+    if (dev->uncor == ~0u) {
+        dev->uncor = dev->cor = 0;
+    }
+    uncor &= RAS_UNCOR_STATUS_BITS;
+    cor &= RAS_COR_STATUS_BITS;
+    if (uncor == dev->uncor && cor == dev->cor) {
+        return;
+    }
+
+    log_time(ts, sizeof(ts));
+    fresh = uncor & ~dev->uncor;
+    if (fresh) {
+        /* the header log belongs to the error the First Error Pointer names */
+        ctrl = regs_read32(dev->ras, RAS_CAP_CTRL);
+        n = snprintf(extra, sizeof(extra), " fep %u hdr", RAS_FIRST_ERR_PTR(ctrl));
+        for (i = 0; i < RAS_HEADER_LOG_DW; i++) {
+            n += snprintf(extra + n, sizeof(extra) - n, " %08x",
+                          regs_read32(dev->ras, RAS_HEADER_LOG + 4 * i));
+        }
+        log_bits(ts, dev, "uncor", uncor, fresh, uncor_names, extra);
+    }
+    fresh = cor & ~dev->cor;
+    if (fresh) {
+        log_bits(ts, dev, "cor", cor, fresh, cor_names, "");
+    }
+    for (i = 0; i < 32; i++) {
+        dev->uncor_count[i] += (uncor & ~dev->uncor) >> i & 1;
+        dev->cor_count[i] += (cor & ~dev->cor) >> i & 1;
+    }
+
+    if (opt.clear) {
+        if (uncor) {
+            regs_write32(dev->ras, RAS_UNCOR_STATUS, uncor);
+        }
+        if (cor) {
+            regs_write32(dev->ras, RAS_COR_STATUS, cor);
+        }
+        uncor = cor = 0;
+    }
+    dev->uncor = uncor;
+    dev->cor = cor;
+}
+
+static void summary(void)
+{
+    uint64_t total;
+    int d, i;
+
+    for (d = 0; d < ndevs; d++) {
+        total = 0;
+        for (i = 0; i < 32; i++) {
+            total += devs[d].uncor_count[i] + devs[d].cor_count[i];
+        }
+        fprintf(stderr, "%s: %llu events\n", devs[d].bdf, (unsigned long long)total);
+        for (i = 0; i < 32; i++) {
+            if (devs[d].uncor_count[i]) {
+                fprintf(stderr, "    uncor %-28s %llu\n",
+                        uncor_names[i] ? uncor_names[i] : "reserved",
+                        (unsigned long long)devs[d].uncor_count[i]);
+            }
+        }
+        for (i = 0; i < 32; i++) {
+            if (devs[d].cor_count[i]) {
+                fprintf(stderr, "    cor   %-28s %llu\n",
+                        cor_names[i] ? cor_names[i] : "reserved",
+                        (unsigned long long)devs[d].cor_count[i]);
+            }
+        }
+    }
+}
+
+static void usage(void)
+{
+    printf("Usage: cxlras [-s <bdf> [-r <resource>]]... [-i <ms>] [-c] [-l <log>]\n"
+           "              [-R <root>]\n");
+    printf("  -s  device to watch, repeat for more; default every cc53 function\n"
+           "  -r  map <resource> for the -s before it, e.g. a cxl_regemu file;\n"
+           "      default the device's resource2\n"
+           "  -i  poll period, default 100 ms\n"
+           "  -c  clear the status after logging it\n"
+           "  -l  append events to <log> as well as stdout\n"
+           "  -R  read sys under <root>\n");
+}
+
+int main(int argc, char **argv)
+{
+    char bdfs[RAS_MAX_DEVS][16], ts[64];
+    struct timespec next;
+    int c, i, n;
+
+    while ((c = getopt(argc, argv, "hs:r:i:cl:R:")) != -1) {
+        switch (c) {
+        case 's':
+            if (dev_add(optarg)) {
+                return 1;
+            }
+            break;
+        case 'r':
+            if (!ndevs) {
+                fprintf(stderr, "-r goes after the -s it belongs to\n");
+                return 1;
+            }
+            devs[ndevs - 1].resource = optarg;
+            break;
+        case 'i':
+            opt.interval_ms = strtoul(optarg, NULL, 0);
+            if (!opt.interval_ms) {
+                opt.interval_ms = 1;
+            }
+            break;
+        case 'c':
+            opt.clear = 1;
+            break;
+        case 'l':
+            opt.log = optarg;
+            break;
+        case 'R':
+            sysfs_root = optarg;
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+
+    if (!ndevs) {
+        n = pcicfg_scan(PCI_VENDOR_ID_SFX, bdfs, RAS_MAX_DEVS);
+        for (i = 0; i < n; i++) {
+            dev_add(bdfs[i]);
+        }
+    }
+    if (!ndevs) {
+        fprintf(stderr, "no devices, give -s <bdf>\n");
+        return 1;
+    }
+    for (i = 0; i < ndevs; i++) {
+        if (dev_map(&devs[i])) {
+            return 1;
+        }
+    }
+    if (opt.log) {
+        logf = fopen(opt.log, "a");
+        if (!logf) {
+            perror(opt.log);
+            return 1;
+        }
+    }
+
+    log_time(ts, sizeof(ts));
+    for (i = 0; i < ndevs; i++) {
+        log_line("%s %s watching RAS at 0x%lx every %u ms%s\n", ts, devs[i].bdf,
+                 (long)(devs[i].ras - devs[i].bar), opt.interval_ms,
+                 opt.clear ? ", clearing" : "");
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stop) {
+        for (i = 0; i < ndevs; i++) {
+            dev_poll(&devs[i]);
+        }
+        next.tv_nsec += opt.interval_ms * 1000000L;
+        next.tv_sec += next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    summary();
+    if (logf) {
+        fclose(logf);
+    }
+    return 0;
+}
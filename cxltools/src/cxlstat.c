@@ -0,0 +1,979 @@
+/*************************************************************************
+@File Name: cxlstat.c
+@Desc: Native replacement for the cxlstat script.
+
+    Reads /sys/bus/cxl, /sys/bus/dax, /proc/iomem and PCI sysfs once. It
+    builds the memdev / decoder / region / dax / NUMA node topology in
+    memory and prints the script's report (plus the topology with -t) or
+    all of it as JSON with -j. No lspci, daxctl list or package manager
+    calls, so it runs in milliseconds.
+************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "sysfs.h"
+
+#define CXLSTAT_MAX_MEMDEVS     64
+#define CXLSTAT_MAX_DECODERS    512
+#define CXLSTAT_MAX_REGIONS     64
+#define CXLSTAT_MAX_TARGETS     16
+#define CXLSTAT_MAX_DAX         128
+#define CXLSTAT_MAX_NODES       64
+#define CXLSTAT_MAX_IOMEM       4096
+#define CXLSTAT_MAX_CONFIG      32
+#define CXLSTAT_NAME_LEN        32
+
+#define KERNEL_MAJOR_MIN        5
+#define KERNEL_MINOR_MIN        15
+#define DAXCTL_MAJOR_MIN        72
+#define DAXCTL_MINOR_MIN        1
+
+#define GB                      (1ULL << 30)
+
+typedef struct memdev memdev;
+typedef struct decoder decoder;
+typedef struct region region;
+typedef struct daxdev daxdev;
+typedef struct numa_node numa_node;
+typedef struct iomem_res iomem_res;
+typedef struct kconfig_opt kconfig_opt;
+
+struct memdev {
+    char name[CXLSTAT_NAME_LEN];
+    char bdf[16];
+    char endpoint[CXLSTAT_NAME_LEN];
+    char vendor_name[128];
+    char device_name[128];
+    char serial[32];
+    char firmware[32];
+    uint64_t vendor;
+    uint64_t device;
+    uint64_t class;
+    uint64_t ram_size;
+    uint64_t pmem_size;
+    int numa_node;
+    int mailbox;
+};
+
+struct decoder {
+    char name[CXLSTAT_NAME_LEN];
+    char port[CXLSTAT_NAME_LEN];
+    char mode[16];
+    char region[CXLSTAT_NAME_LEN];
+    int memdev;                 /* index for endpoint decoders, else -1 */
+    uint64_t start;             /* HPA, root and switch decoders */
+    uint64_t size;
+    uint64_t dpa_start;         /* endpoint decoders */
+    uint64_t dpa_size;
+    uint64_t ways;
+    uint64_t gran;
+};
+
+struct region {
+    char name[CXLSTAT_NAME_LEN];
+    char mode[16];
+    char targets[CXLSTAT_MAX_TARGETS][CXLSTAT_NAME_LEN];
+    int ntargets;
+    uint64_t start;
+    uint64_t size;
+    uint64_t ways;
+    uint64_t gran;
+    int start_known;
+};
+
+struct daxdev {
+    char name[CXLSTAT_NAME_LEN];
+    char region[CXLSTAT_NAME_LEN];
+    char mode[16];
+    uint64_t size;
+    uint64_t start;
+    uint64_t end;
+    int target_node;
+    int range_known;
+};
+
+struct numa_node {
+    int id;
+    uint64_t mem_total_kb;
+    char cpus[64];
+};
+
+struct iomem_res {
+    uint64_t start;
+    uint64_t end;
+    char name[CXLSTAT_NAME_LEN];
+};
+
+struct kconfig_opt {
+    char name[48];
+    char value[16];
+};
+
+static struct {
+    int uefi;
+    char distro_str[128];
+    char distro[32];
+    char kernel[128];
+    int kernel_ok;
+    char kconfig_path[256];
+    int kconfig_known;
+    kconfig_opt kconfig[CXLSTAT_MAX_CONFIG];
+    int nkconfig;
+    char daxctl[256];
+    int daxctl_major;
+    int daxctl_minor;
+
+    memdev memdevs[CXLSTAT_MAX_MEMDEVS];
+    decoder decoders[CXLSTAT_MAX_DECODERS];
+    region regions[CXLSTAT_MAX_REGIONS];
+    daxdev dax[CXLSTAT_MAX_DAX];
+    numa_node nodes[CXLSTAT_MAX_NODES];
+    iomem_res iomem[CXLSTAT_MAX_IOMEM];
+    int nmemdevs;
+    int ndecoders;
+    int nregions;
+    int ndax;
+    int nnodes;
+    int niomem;
+} topo;
+
+/* Options the script always reports, in its order */
+static const char *const kconfig_known[] = {
+    "CONFIG_CXL_BUS", "CONFIG_CXL_PCI", "CONFIG_CXL_MEM_RAW_COMMANDS", "CONFIG_CXL_ACPI",
+    "CONFIG_CXL_PMEM", "CONFIG_CXL_MEM", "CONFIG_CXL_PORT", "CONFIG_CXL_REGION",
+};
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strverscmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Entries of directory @dir starting with @prefix, in version order
+ * (mem2 before mem10). Returns the count, names in @out.
+ */
+static int list_dir(const char *dir, const char *prefix, char out[][CXLSTAT_NAME_LEN],
+                    int max)
+{
+    char path[512], *names[CXLSTAT_MAX_DECODERS];
+    char tmp[CXLSTAT_MAX_DECODERS][CXLSTAT_NAME_LEN];
+    struct dirent *de;
+    DIR *d;
+    int i, n = 0;
+
+    d = opendir(sysfs_path(path, sizeof(path), "%s", dir));
+    if (!d) {
+        return 0;
+    }
+    while ((de = readdir(d)) && n < max && n < CXLSTAT_MAX_DECODERS) {
+        if (strncmp(de->d_name, prefix, strlen(prefix)) ||
+            strlen(de->d_name) >= CXLSTAT_NAME_LEN) {
+            continue;
+        }
+        snprintf(tmp[n], CXLSTAT_NAME_LEN, "%s", de->d_name);
+        names[n] = tmp[n];
+        n++;
+    }
+    closedir(d);
+
+    qsort(names, n, sizeof(names[0]), cmp_name);
+    for (i = 0; i < n; i++) {
+        snprintf(out[i], CXLSTAT_NAME_LEN, "%s", names[i]);
+    }
+    return n;
+}
+
+/* Name of the directory a /sys/bus/... link points into, e.g. the port of a decoder */
+static int link_parent(char *buf, size_t len, const char *fmt, const char *name)
+{
+    char path[512], target[512], *end, *base;
+    ssize_t n;
+
+    buf[0] = 0;
+    sysfs_path(path, sizeof(path), fmt, name);
+    n = readlink(path, target, sizeof(target) - 1);
+    if (n < 0) {
+        return -errno;
+    }
+    target[n] = 0;
+    end = strrchr(target, '/');
+    if (!end) {
+        return -ENOENT;
+    }
+    *end = 0;
+    base = strrchr(target, '/');
+    snprintf(buf, len, "%s", base ? base + 1 : target);
+    return 0;
+}
+
+static int find_memdev(const char *name)
+{
+    int i;
+
+    for (i = 0; i < topo.nmemdevs; i++) {
+        if (!strcmp(topo.memdevs[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const iomem_res *find_iomem(const char *name)
+{
+    int i;
+
+    for (i = 0; i < topo.niomem; i++) {
+        if (!strcmp(topo.iomem[i].name, name)) {
+            return &topo.iomem[i];
+        }
+    }
+    return NULL;
+}
+
+/* System */
+
+static void scan_system(void)
+{
+    char buf[256], path[512], line[256], *p;
+    struct utsname uts;
+    unsigned major = 0, minor = 0;
+    FILE *f;
+    int i;
+
+    topo.uefi = sysfs_exists("/sys/firmware/efi");
+
+    snprintf(topo.distro_str, sizeof(topo.distro_str), "unknown");
+    f = fopen(sysfs_path(path, sizeof(path), "/etc/os-release"), "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "NAME=", 5)) {
+            continue;
+        }
+        p = line + 5;
+        p[strcspn(p, "\n")] = 0;
+        if (*p == '"') {
+            p++;
+            p[strcspn(p, "\"")] = 0;
+        }
+        snprintf(topo.distro_str, sizeof(topo.distro_str), "%s", p);
+        break;
+    }
+    if (f) {
+        fclose(f);
+    }
+    for (i = 0; topo.distro_str[i] && topo.distro_str[i] != ' ' &&
+                i < (int)sizeof(topo.distro) - 1; i++) {
+        topo.distro[i] = tolower((unsigned char)topo.distro_str[i]);
+    }
+
+    uname(&uts);
+    snprintf(topo.kernel, sizeof(topo.kernel), "%s", uts.release);
+    sscanf(uts.release, "%u.%u", &major, &minor);
+    topo.kernel_ok = major > KERNEL_MAJOR_MIN ||
+                     (major == KERNEL_MAJOR_MIN && minor >= KERNEL_MINOR_MIN);
+
+    sysfs_path(topo.kconfig_path, sizeof(topo.kconfig_path), "/boot/config-%s",
+               uts.release);
+    for (i = 0; i < (int)(sizeof(kconfig_known) / sizeof(kconfig_known[0])); i++) {
+        snprintf(topo.kconfig[i].name, sizeof(topo.kconfig[i].name), "%s",
+                 kconfig_known[i]);
+    }
+    topo.nkconfig = i;
+    f = fopen(topo.kconfig_path, "r");
+    topo.kconfig_known = !!f;
+    while (f && fgets(line, sizeof(line), f)) {
+        char name[48], value[16];
+
+        if (strncmp(line, "CONFIG_CXL_", 11) ||
+            sscanf(line, "%47[A-Z0-9_]=%15[A-Za-z0-9]", name, value) != 2) {
+            continue;
+        }
+        for (i = 0; i < topo.nkconfig && strcmp(topo.kconfig[i].name, name); i++) {
+            ;
+        }
+        if (i == topo.nkconfig) {
+            if (topo.nkconfig == CXLSTAT_MAX_CONFIG) {
+                continue;
+            }
+            snprintf(topo.kconfig[i].name, sizeof(topo.kconfig[i].name), "%s", name);
+            topo.nkconfig++;
+        }
+        snprintf(topo.kconfig[i].value, sizeof(topo.kconfig[i].value), "%s", value);
+    }
+    if (f) {
+        fclose(f);
+    }
+
+    /* daxctl: found on PATH and its --version, no package manager */
+    p = getenv("PATH");
+    snprintf(line, sizeof(line), "%s", p ? p : "/usr/bin:/bin");
+    for (p = strtok(line, ":"); p; p = strtok(NULL, ":")) {
+        snprintf(buf, sizeof(buf), "%s/daxctl", p);
+        if (!access(buf, X_OK)) {
+            snprintf(topo.daxctl, sizeof(topo.daxctl), "%s", buf);
+            break;
+        }
+    }
+    if (topo.daxctl[0] && !*sysfs_root) {
+        snprintf(path, sizeof(path), "%s --version 2>/dev/null", topo.daxctl);
+        f = popen(path, "r");
+        if (f) {
+            if (fgets(buf, sizeof(buf), f)) {
+                p = buf + strcspn(buf, "0123456789");
+                sscanf(p, "%d.%d", &topo.daxctl_major, &topo.daxctl_minor);
+            }
+            pclose(f);
+        }
+    }
+}
+
+/* /proc/iomem, every level; non-root sees zero addresses, those are dropped */
+static void scan_iomem(void)
+{
+    char path[512], line[256], name[CXLSTAT_NAME_LEN];
+    unsigned long long start, end;
+    iomem_res *r;
+    FILE *f;
+
+    f = fopen(sysfs_path(path, sizeof(path), "/proc/iomem"), "r");
+    if (!f) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f) && topo.niomem < CXLSTAT_MAX_IOMEM) {
+        if (sscanf(line, " %llx-%llx : %31[^\n]", &start, &end, name) != 3 || !end) {
+            continue;
+        }
+        r = &topo.iomem[topo.niomem++];
+        r->start = start;
+        r->end = end;
+        snprintf(r->name, sizeof(r->name), "%s", name);
+    }
+    fclose(f);
+}
+
+/* pci.ids lookup for the vendor and device strings lspci would print */
+static void pci_names(memdev *m)
+{
+    static const char *const ids[] = { "/usr/share/misc/pci.ids",
+                                       "/usr/share/hwdata/pci.ids",
+                                       "/usr/share/pci.ids" };
+    char path[512], line[256], *name;
+    unsigned long id;
+    int i, in_vendor = 0;
+    FILE *f = NULL;
+
+    snprintf(m->vendor_name, sizeof(m->vendor_name), "Vendor %04llx",
+             (unsigned long long)m->vendor);
+    snprintf(m->device_name, sizeof(m->device_name), "Device %04llx",
+             (unsigned long long)m->device);
+
+    for (i = 0; i < 3 && !f; i++) {
+        f = fopen(sysfs_path(path, sizeof(path), "%s", ids[i]), "r");
+    }
+    while (f && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (line[0] != '\t') {
+            if (in_vendor) {
+                break;
+            }
+            id = strtoul(line, &name, 16);
+            if (id == m->vendor && name != line) {
+                in_vendor = 1;
+                name += strspn(name, " ");
+                name[strcspn(name, "\n")] = 0;
+                snprintf(m->vendor_name, sizeof(m->vendor_name), "%s", name);
+            }
+        } else if (in_vendor && line[1] != '\t') {
+            id = strtoul(line + 1, &name, 16);
+            if (id == m->device) {
+                name += strspn(name, " ");
+                name[strcspn(name, "\n")] = 0;
+                snprintf(m->device_name, sizeof(m->device_name), "%s", name);
+                break;
+            }
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+}
+
+/* CXL bus: memdevs, endpoint ports, decoders, regions */
+
+static void scan_cxl(void)
+{
+    static char names[CXLSTAT_MAX_DECODERS][CXLSTAT_NAME_LEN];
+    char path[512], uport[CXLSTAT_NAME_LEN];
+    const char *dev = "/sys/bus/cxl/devices";
+    const iomem_res *res;
+    uint64_t v;
+    memdev *m;
+    decoder *d;
+    region *r;
+    int i, j, n, idx;
+
+    n = list_dir(dev, "mem", names, CXLSTAT_MAX_MEMDEVS);
+    for (i = 0; i < n; i++) {
+        m = &topo.memdevs[topo.nmemdevs++];
+        snprintf(m->name, sizeof(m->name), "%s", names[i]);
+        link_parent(m->bdf, sizeof(m->bdf), "/sys/bus/cxl/devices/%s", m->name);
+        sysfs_read_u64(&m->vendor, "/sys/bus/pci/devices/%s/vendor", m->bdf);
+        sysfs_read_u64(&m->device, "/sys/bus/pci/devices/%s/device", m->bdf);
+        sysfs_read_u64(&m->class, "/sys/bus/pci/devices/%s/class", m->bdf);
+        sysfs_read_u64(&m->ram_size, "%s/%s/ram/size", dev, m->name);
+        sysfs_read_u64(&m->pmem_size, "%s/%s/pmem/size", dev, m->name);
+        sysfs_read(m->serial, sizeof(m->serial), "%s/%s/serial", dev, m->name);
+        sysfs_read(m->firmware, sizeof(m->firmware), "%s/%s/firmware_version", dev,
+                   m->name);
+        m->numa_node = -1;
+        if (sysfs_read(path, sizeof(path), "%s/%s/numa_node", dev, m->name) > 0) {
+            m->numa_node = atoi(path);
+        }
+        m->mailbox = sysfs_exists("/dev/cxl/%s", m->name);
+        pci_names(m);
+    }
+
+    n = list_dir(dev, "endpoint", names, CXLSTAT_MAX_DECODERS);
+    for (i = 0; i < n; i++) {
+        if (sysfs_link_name(uport, sizeof(uport), "%s/%s/uport", dev, names[i])) {
+            continue;
+        }
+        idx = find_memdev(uport);
+        if (idx >= 0) {
+            snprintf(topo.memdevs[idx].endpoint, CXLSTAT_NAME_LEN, "%s", names[i]);
+        }
+    }
+
+    n = list_dir(dev, "decoder", names, CXLSTAT_MAX_DECODERS);
+    for (i = 0; i < n; i++) {
+        d = &topo.decoders[topo.ndecoders++];
+        snprintf(d->name, sizeof(d->name), "%s", names[i]);
+        link_parent(d->port, sizeof(d->port), "/sys/bus/cxl/devices/%s", d->name);
+        sysfs_read_u64(&d->start, "%s/%s/start", dev, d->name);
+        sysfs_read_u64(&d->size, "%s/%s/size", dev, d->name);
+        sysfs_read_u64(&d->ways, "%s/%s/interleave_ways", dev, d->name);
+        sysfs_read_u64(&d->gran, "%s/%s/interleave_granularity", dev, d->name);
+        sysfs_read_u64(&d->dpa_start, "%s/%s/dpa_resource", dev, d->name);
+        sysfs_read_u64(&d->dpa_size, "%s/%s/dpa_size", dev, d->name);
+        sysfs_read(d->mode, sizeof(d->mode), "%s/%s/mode", dev, d->name);
+        sysfs_read(d->region, sizeof(d->region), "%s/%s/region", dev, d->name);
+        d->memdev = -1;
+        for (j = 0; j < topo.nmemdevs; j++) {
+            if (!strcmp(topo.memdevs[j].endpoint, d->port)) {
+                d->memdev = j;
+            }
+        }
+    }
+
+    n = list_dir(dev, "region", names, CXLSTAT_MAX_REGIONS);
+    for (i = 0; i < n; i++) {
+        r = &topo.regions[topo.nregions++];
+        snprintf(r->name, sizeof(r->name), "%s", names[i]);
+        sysfs_read_u64(&r->size, "%s/%s/size", dev, r->name);
+        sysfs_read_u64(&r->ways, "%s/%s/interleave_ways", dev, r->name);
+        sysfs_read_u64(&r->gran, "%s/%s/interleave_granularity", dev, r->name);
+        sysfs_read(r->mode, sizeof(r->mode), "%s/%s/mode", dev, r->name);
+        /* resource is root only; /proc/iomem has it too when root */
+        if (!sysfs_read_u64(&v, "%s/%s/resource", dev, r->name) && v) {
+            r->start = v;
+            r->start_known = 1;
+        } else if ((res = find_iomem(r->name))) {
+            r->start = res->start;
+            r->start_known = 1;
+        }
+        for (j = 0; j < (int)r->ways && j < CXLSTAT_MAX_TARGETS; j++) {
+            if (sysfs_read(r->targets[j], CXLSTAT_NAME_LEN, "%s/%s/target%d", dev,
+                           r->name, j) > 0) {
+                r->ntargets = j + 1;
+            }
+        }
+    }
+}
+
+/* DAX bus and the NUMA nodes system-ram dax devices land on */
+
+static void add_node(int id)
+{
+    numa_node *nd;
+    char line[256], path[512];
+    FILE *f;
+    int i;
+
+    if (id < 0) {
+        return;
+    }
+    for (i = 0; i < topo.nnodes; i++) {
+        if (topo.nodes[i].id == id) {
+            return;
+        }
+    }
+    if (topo.nnodes == CXLSTAT_MAX_NODES) {
+        return;
+    }
+    nd = &topo.nodes[topo.nnodes++];
+    nd->id = id;
+    sysfs_read(nd->cpus, sizeof(nd->cpus), "/sys/devices/system/node/node%d/cpulist", id);
+    f = fopen(sysfs_path(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo",
+                         id), "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        unsigned long long kb;
+
+        if (sscanf(line, "Node %*d MemTotal: %llu kB", &kb) == 1) {
+            nd->mem_total_kb = kb;
+            break;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+}
+
+static void scan_dax(void)
+{
+    static char names[CXLSTAT_MAX_DAX][CXLSTAT_NAME_LEN];
+    char path[512], target[512], drv[CXLSTAT_NAME_LEN], *p;
+    const char *dev = "/sys/bus/dax/devices";
+    const iomem_res *res;
+    uint64_t v;
+    daxdev *x;
+    ssize_t len;
+    int i, n;
+
+    n = list_dir(dev, "dax", names, CXLSTAT_MAX_DAX);
+    for (i = 0; i < n; i++) {
+        x = &topo.dax[topo.ndax++];
+        snprintf(x->name, sizeof(x->name), "%s", names[i]);
+        sysfs_read_u64(&x->size, "%s/%s/size", dev, x->name);
+        x->target_node = -1;
+        if (sysfs_read(path, sizeof(path), "%s/%s/target_node", dev, x->name) > 0) {
+            x->target_node = atoi(path);
+        }
+
+        if (sysfs_link_name(drv, sizeof(drv), "%s/%s/driver", dev, x->name)) {
+            snprintf(x->mode, sizeof(x->mode), "none");
+        } else if (!strcmp(drv, "kmem")) {
+            snprintf(x->mode, sizeof(x->mode), "system-ram");
+        } else if (!strcmp(drv, "device_dax")) {
+            snprintf(x->mode, sizeof(x->mode), "devdax");
+        } else {
+            snprintf(x->mode, sizeof(x->mode), "%s", drv);
+        }
+
+        /* .../regionN/dax_regionN/daxN.M for CXL backed dax */
+        len = readlink(sysfs_path(path, sizeof(path), "%s/%s", dev, x->name), target,
+                       sizeof(target) - 1);
+        if (len > 0) {
+            target[len] = 0;
+            p = strstr(target, "/region");
+            if (p && sscanf(p + 1, "%31[^/]", x->region) != 1) {
+                x->region[0] = 0;
+            }
+        }
+
+        if ((res = find_iomem(x->name))) {
+            x->start = res->start;
+            x->end = res->end;
+            x->range_known = 1;
+        } else if (!sysfs_read_u64(&v, "%s/%s/resource", dev, x->name) && v) {
+            x->start = v;
+            x->end = v + x->size - 1;
+            x->range_known = 1;
+        }
+        if (!strcmp(x->mode, "system-ram")) {
+            add_node(x->target_node);
+        }
+    }
+}
+
+/* Report, in the script's words */
+
+static void print_report(void)
+{
+    const memdev *m;
+    const daxdev *x;
+    const char *mem = "", *raw = "";
+    int i;
+
+    printf("System booted using %s\n", topo.uefi ? "UEFI" : "BIOS");
+    printf("Detected %s\n", topo.distro_str);
+    if (strcmp(topo.distro, "ubuntu") && strcmp(topo.distro, "fedora")) {
+        printf("Warning - Running one of Fedora Core (version 36 or later) or Ubuntu\n"
+               "          (version 22.04 LTS or later) is suggested\n");
+    }
+    if (!topo.kernel_ok) {
+        printf("Warning - Minimum kernel version requirement not met. Currently running\n"
+               "          kernel version %s while a kernel of at least version\n"
+               "          %d.%d is recommended\n", topo.kernel, KERNEL_MAJOR_MIN,
+               KERNEL_MINOR_MIN);
+    } else {
+        printf("Minimum kernel version requirement met - %s vs. %d.%d\n", topo.kernel,
+               KERNEL_MAJOR_MIN, KERNEL_MINOR_MIN);
+    }
+    if (!topo.kconfig_known) {
+        printf("Kernel compile configuration not in known location, expected %s\n"
+               "    The kernel compile options are unknown.\n", topo.kconfig_path);
+    } else {
+        printf("Kernel boot configuration located (%s)\n", topo.kconfig_path);
+    }
+
+    printf("\n");
+    if (!topo.daxctl[0]) {
+        printf("Package daxctl does not appear to be installed. Please install the latest\n"
+               "version or at least version %d.%d. If not available then compile from\n"
+               "source.\n", DAXCTL_MAJOR_MIN, DAXCTL_MINOR_MIN);
+    } else if (topo.daxctl_major > DAXCTL_MAJOR_MIN ||
+               (topo.daxctl_major == DAXCTL_MAJOR_MIN &&
+                topo.daxctl_minor >= DAXCTL_MINOR_MIN)) {
+        printf("The package daxctl is installed and at a sufficient version "
+               "(found %d.%d).\n", topo.daxctl_major, topo.daxctl_minor);
+    } else {
+        printf("The package daxctl is installed but at a version that is too old "
+               "(found %d.%d).\n", topo.daxctl_major, topo.daxctl_minor);
+    }
+
+    printf("\nDetecting CXL devices ...\n");
+    if (!topo.nmemdevs) {
+        printf("          No devices found\n");
+    }
+    for (i = 0; i < topo.nmemdevs; i++) {
+        m = &topo.memdevs[i];
+        if (m->class >> 8 != 0x0502) {
+            printf("Warning - Apparent device class mismatch for %s, expected CXL. Got\n"
+                   "          %06llx\n", m->name, (unsigned long long)m->class);
+        }
+        printf("            CXL Device : %s\n", m->name);
+        printf("                Vendor : %s\n", m->vendor_name);
+        printf("             Device ID : %s\n", m->device_name);
+        printf("          PCIe Address : %s\n", m->bdf);
+        printf("                  Size : %llu GB\n", (unsigned long long)(m->ram_size / GB));
+        printf("       Mailbox Present : %s\n", m->mailbox ? "yes" : "no");
+    }
+
+    printf("\nDetecting DAX devices ...\n");
+    if (!topo.ndax) {
+        printf("          No devices found\n");
+    }
+    for (i = 0; i < topo.ndax; i++) {
+        x = &topo.dax[i];
+        printf("                  Name : %s\n", x->name);
+        printf("                  Path : /dev/%s\n", x->name);
+        printf("                  Size : %llu GB\n", (unsigned long long)(x->size / GB));
+        if (x->range_known) {
+            printf("      Memory HPA Range : 0x%llX-0x%llX (%llu GB)\n",
+                   (unsigned long long)x->start, (unsigned long long)x->end,
+                   (unsigned long long)((x->end - x->start + 1) / GB));
+        } else {
+            printf("      Memory HPA Range : UNKNOWN (run as root to see HPA range)\n");
+        }
+        if (!strcmp(x->mode, "devdax")) {
+            printf("                  Mode : %s (memory directly usable only via DAX access)\n",
+                   x->mode);
+        } else {
+            printf("                  Mode : %s (memory directly usable, e.g. via numactl)\n",
+                   x->mode);
+        }
+    }
+
+    if (topo.daxctl[0]) {
+        printf("\n");
+        if (topo.daxctl_major > DAXCTL_MAJOR_MIN ||
+            (topo.daxctl_major == DAXCTL_MAJOR_MIN && topo.daxctl_minor >= DAXCTL_MINOR_MIN)) {
+            printf("The daxctl command appears usable for all normal functions.\n");
+        } else {
+            printf("The daxctl command may not be usable.\n");
+        }
+    }
+
+    for (i = 0; i < topo.nkconfig; i++) {
+        if (!strcmp(topo.kconfig[i].name, "CONFIG_CXL_MEM")) {
+            mem = topo.kconfig[i].value;
+        } else if (!strcmp(topo.kconfig[i].name, "CONFIG_CXL_MEM_RAW_COMMANDS")) {
+            raw = topo.kconfig[i].value;
+        }
+    }
+    printf("\n");
+    if (!strcmp(mem, "y") || !strcmp(mem, "m")) {
+        if (!strcmp(raw, "y") || !strcmp(raw, "m")) {
+            printf("Standard and vendor-specific CXL mailbox commands may be used.\n");
+        } else {
+            printf("Standard CXL mailbox commands may be used (no vendor-specific commands allowed).\n");
+        }
+    } else if (topo.kconfig_known) {
+        printf("CXL driver stack disabled in your kernel.\n"
+               "Note: CXL memory will still work if BIOS and CPU support CXL\n");
+    } else {
+        printf("CXL driver stack not detected in your kernel.\n"
+               "Note: CXL memory will still work if BIOS and CPU support CXL\n");
+    }
+    printf("\n");
+}
+
+/* -t: region -> endpoint decoder -> memdev, then dax and node */
+static void print_topology(void)
+{
+    const decoder *d;
+    const region *r;
+    const daxdev *x;
+    int i, j, k;
+
+    printf("CXL topology ...\n");
+    for (i = 0; i < topo.ndecoders; i++) {
+        d = &topo.decoders[i];
+        if (!strncmp(d->port, "root", 4) && d->size) {
+            printf("  window %s: 0x%llx-0x%llx (%llu GB), %llu way x %llu B\n", d->name,
+                   (unsigned long long)d->start,
+                   (unsigned long long)(d->start + d->size - 1),
+                   (unsigned long long)(d->size / GB), (unsigned long long)d->ways,
+                   (unsigned long long)d->gran);
+        }
+    }
+    for (i = 0; i < topo.nregions; i++) {
+        r = &topo.regions[i];
+        printf("  %s: %s, %llu GB, %llu way x %llu B", r->name, r->mode,
+               (unsigned long long)(r->size / GB), (unsigned long long)r->ways,
+               (unsigned long long)r->gran);
+        if (r->start_known) {
+            printf(", 0x%llx-0x%llx", (unsigned long long)r->start,
+                   (unsigned long long)(r->start + r->size - 1));
+        }
+        printf("\n");
+        for (j = 0; j < r->ntargets; j++) {
+            for (k = 0; k < topo.ndecoders && strcmp(topo.decoders[k].name, r->targets[j]);
+                 k++) {
+                ;
+            }
+            d = k < topo.ndecoders ? &topo.decoders[k] : NULL;
+            printf("    target%d %s", j, r->targets[j]);
+            if (d && d->memdev >= 0) {
+                printf(" -> %s (%s) dpa 0x%llx+0x%llx",
+                       topo.memdevs[d->memdev].name, topo.memdevs[d->memdev].bdf,
+                       (unsigned long long)d->dpa_start, (unsigned long long)d->dpa_size);
+            }
+            printf("\n");
+        }
+        for (j = 0; j < topo.ndax; j++) {
+            x = &topo.dax[j];
+            if (strcmp(x->region, r->name)) {
+                continue;
+            }
+            printf("    %s: %s, %llu GB", x->name, x->mode,
+                   (unsigned long long)(x->size / GB));
+            if (x->target_node >= 0) {
+                printf(", node %d", x->target_node);
+            }
+            printf("\n");
+        }
+    }
+    for (i = 0; i < topo.nmemdevs; i++) {
+        for (j = 0; j < topo.ndecoders; j++) {
+            if (topo.decoders[j].memdev == i && topo.decoders[j].region[0]) {
+                break;
+            }
+        }
+        if (j == topo.ndecoders) {
+            printf("  %s (%s): not in a region\n", topo.memdevs[i].name,
+                   topo.memdevs[i].bdf);
+        }
+    }
+    for (i = 0; i < topo.nnodes; i++) {
+        printf("  node%d: %llu MB, cpus %s\n", topo.nodes[i].id,
+               (unsigned long long)(topo.nodes[i].mem_total_kb >> 10),
+               topo.nodes[i].cpus[0] ? topo.nodes[i].cpus : "none");
+    }
+    printf("\n");
+}
+
+/* JSON */
+
+static void json_str(const char *key, const char *val, int last)
+{
+    printf("\"%s\":\"", key);
+    for (; *val; val++) {
+        if (*val == '"' || *val == '\\') {
+            putchar('\\');
+        }
+        if ((unsigned char)*val >= 0x20) {
+            putchar(*val);
+        }
+    }
+    printf("\"%s", last ? "" : ",");
+}
+
+static void json_u64(const char *key, uint64_t val, int last)
+{
+    printf("\"%s\":%llu%s", key, (unsigned long long)val, last ? "" : ",");
+}
+
+static void json_int(const char *key, int val, int last)
+{
+    printf("\"%s\":%d%s", key, val, last ? "" : ",");
+}
+
+static void print_json(void)
+{
+    const memdev *m;
+    const decoder *d;
+    const region *r;
+    const daxdev *x;
+    int i, j;
+
+    printf("{");
+    json_str("boot", topo.uefi ? "uefi" : "bios", 0);
+    json_str("distro", topo.distro_str, 0);
+    json_str("kernel", topo.kernel, 0);
+    printf("\"kernel_ok\":%s,", topo.kernel_ok ? "true" : "false");
+    printf("\"kernel_config\":{");
+    for (i = 0; i < topo.nkconfig; i++) {
+        json_str(topo.kconfig[i].name, topo.kconfig[i].value, i == topo.nkconfig - 1);
+    }
+    printf("},\"daxctl\":");
+    if (topo.daxctl[0]) {
+        char ver[32];
+
+        snprintf(ver, sizeof(ver), "%d.%d", topo.daxctl_major, topo.daxctl_minor);
+        printf("{");
+        json_str("path", topo.daxctl, 0);
+        json_str("version", ver, 1);
+        printf("},");
+    } else {
+        printf("null,");
+    }
+
+    printf("\"memdevs\":[");
+    for (i = 0; i < topo.nmemdevs; i++) {
+        m = &topo.memdevs[i];
+        printf("%s{", i ? "," : "");
+        json_str("name", m->name, 0);
+        json_str("pci", m->bdf, 0);
+        json_str("vendor", m->vendor_name, 0);
+        json_str("device", m->device_name, 0);
+        json_u64("vendor_id", m->vendor, 0);
+        json_u64("device_id", m->device, 0);
+        json_str("serial", m->serial, 0);
+        json_str("firmware", m->firmware, 0);
+        json_u64("ram_size", m->ram_size, 0);
+        json_u64("pmem_size", m->pmem_size, 0);
+        json_int("numa_node", m->numa_node, 0);
+        json_str("endpoint", m->endpoint, 0);
+        printf("\"mailbox\":%s}", m->mailbox ? "true" : "false");
+    }
+
+    printf("],\"decoders\":[");
+    for (i = 0; i < topo.ndecoders; i++) {
+        d = &topo.decoders[i];
+        printf("%s{", i ? "," : "");
+        json_str("name", d->name, 0);
+        json_str("port", d->port, 0);
+        json_str("memdev", d->memdev >= 0 ? topo.memdevs[d->memdev].name : "", 0);
+        json_u64("start", d->start, 0);
+        json_u64("size", d->size, 0);
+        json_u64("dpa_start", d->dpa_start, 0);
+        json_u64("dpa_size", d->dpa_size, 0);
+        json_u64("interleave_ways", d->ways, 0);
+        json_u64("interleave_granularity", d->gran, 0);
+        json_str("mode", d->mode, 0);
+        json_str("region", d->region, 1);
+        printf("}");
+    }
+
+    printf("],\"regions\":[");
+    for (i = 0; i < topo.nregions; i++) {
+        r = &topo.regions[i];
+        printf("%s{", i ? "," : "");
+        json_str("name", r->name, 0);
+        json_str("mode", r->mode, 0);
+        if (r->start_known) {
+            json_u64("start", r->start, 0);
+        }
+        json_u64("size", r->size, 0);
+        json_u64("interleave_ways", r->ways, 0);
+        json_u64("interleave_granularity", r->gran, 0);
+        printf("\"targets\":[");
+        for (j = 0; j < r->ntargets; j++) {
+            printf("%s\"%s\"", j ? "," : "", r->targets[j]);
+        }
+        printf("]}");
+    }
+
+    printf("],\"dax\":[");
+    for (i = 0; i < topo.ndax; i++) {
+        x = &topo.dax[i];
+        printf("%s{", i ? "," : "");
+        json_str("name", x->name, 0);
+        json_str("mode", x->mode, 0);
+        json_str("region", x->region, 0);
+        json_u64("size", x->size, 0);
+        if (x->range_known) {
+            json_u64("start", x->start, 0);
+            json_u64("end", x->end, 0);
+        }
+        json_int("target_node", x->target_node, 1);
+        printf("}");
+    }
+
+    printf("],\"nodes\":[");
+    for (i = 0; i < topo.nnodes; i++) {
+        printf("%s{", i ? "," : "");
+        json_int("node", topo.nodes[i].id, 0);
+        json_u64("mem_total", topo.nodes[i].mem_total_kb << 10, 0);
+        json_str("cpus", topo.nodes[i].cpus, 1);
+        printf("}");
+    }
+    printf("]}\n");
+}
+
+static void usage(void)
+{
+    printf("Usage: cxlstat [-j] [-t] [-R <root>]\n"
+           "  -j  print the whole topology as JSON instead of the report\n"
+           "  -t  add the region / decoder / memdev / dax / node tree to the report\n"
+           "  -R  read sys, proc, dev, boot and etc under <root>, e.g. a copied tree\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, json = 0, tree = 0;
+
+    while ((c = getopt(argc, argv, "hjtR:")) != -1) {
+        switch (c) {
+        case 'j':
+            json = 1;
+            break;
+        case 't':
+            tree = 1;
+            break;
+        case 'R':
+            sysfs_root = optarg;
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+
+    scan_system();
+    scan_iomem();
+    scan_cxl();
+    scan_dax();
+
+    if (json) {
+        print_json();
+        return 0;
+    }
+    print_report();
+    if (tree) {
+        print_topology();
+    }
+    return 0;
+}
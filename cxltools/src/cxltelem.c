@@ -0,0 +1,487 @@
+/*************************************************************************
+@File Name: cxltelem.c
+@Desc: Device telemetry sampler feeding a shared-memory ring.
+
+    "run" samples Link Status, the CXL DVSEC Control/Status and Range 1
+    Size Low (Mem_Enable, Mem_Active), the AER status registers and the
+    CXL RAS status registers of each device at a fixed rate. Config space
+    is read through a held config fd at capability offsets found once,
+    and RAS through a read-only mapping of resource2. One sample costs a
+    few preads and two loads instead of an lspci -vvvv parse. Samples go
+    into the ring described in cxl_telem.h.
+
+    "dump" reads the ring as CSV, optionally following it and printing
+    only samples where something changed.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cxl_regs.h"
+#include "cxl_telem.h"
+#include "pcicfg.h"
+#include "sysfs.h"
+
+typedef struct telem_src telem_src;
+
+/* Where one device's registers are, looked up once (and after a rescan) */
+struct telem_src {
+    char bdf[16];
+    const char *resource;       /* -r override, else resource2 */
+    int fd;
+    uint32_t exp;
+    uint32_t dvsec;
+    uint32_t aer;
+    volatile uint8_t *bar;
+    volatile uint8_t *ras;
+};
+
+static struct {
+    const char *file;
+    uint32_t interval_us;
+    uint32_t nslots;
+    int follow;
+    int changes;
+} opt = {
+    .file = TELEM_DEFAULT_FILE,
+    .interval_us = 1000,
+    .nslots = 65536,
+};
+
+static telem_src srcs[TELEM_MAX_DEVS];
+static int nsrcs;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* run */
+
+static int src_add(const char *bdf)
+{
+    telem_src *src;
+
+    if (nsrcs == TELEM_MAX_DEVS) {
+        fprintf(stderr, "at most %d devices\n", TELEM_MAX_DEVS);
+        return -1;
+    }
+    src = &srcs[nsrcs++];
+    snprintf(src->bdf, sizeof(src->bdf), "%s%s", strchr(bdf, ':') == strrchr(bdf, ':')
+             ? "0000:" : "", bdf);
+    src->fd = -1;
+    return 0;
+}
+
+/* No -s: every function with our vendor ID, like lspci -d cc53: */
+static void src_scan(void)
+{
+    char bdfs[TELEM_MAX_DEVS][16];
+    int i, n;
+
+    n = pcicfg_scan(PCI_VENDOR_ID_SFX, bdfs, TELEM_MAX_DEVS);
+    for (i = 0; i < n; i++) {
+        src_add(bdfs[i]);
+    }
+}
+
+static void src_close(telem_src *src)
+{
+    if (src->fd >= 0) {
+        close(src->fd);
+        src->fd = -1;
+    }
+    if (src->bar) {
+        munmap((void *)src->bar, REGS_BAR_SIZE);
+        src->bar = NULL;
+        src->ras = NULL;
+    }
+}
+
+static int src_open(telem_src *src, telem_dev *dev)
+{
+    char path[512];
+    const char *res = src->resource;
+    uint32_t cap, ras;
+    int fd;
+
+    fd = pcicfg_open(src->bdf);
+    if (fd < 0) {
+        return fd;
+    }
+    src->fd = fd;
+    src->exp = pcicfg_find_cap(fd, PCI_CAP_ID_EXP);
+    src->dvsec = pcicfg_find_dvsec(fd, PCI_VENDOR_ID_CXL, CXL_DVSEC_PCIE_DEVICE);
+    src->aer = pcicfg_find_ext_cap(fd, PCI_EXT_CAP_ID_AER);
+    if (src->exp) {
+        cap = pcicfg_read32(fd, src->exp + PCI_EXP_LNKCAP);
+        dev->lnkcap_speed = cap & 0xf;
+        dev->lnkcap_width = (cap >> 4) & 0x3f;
+    }
+
+    if (!res) {
+        res = sysfs_path(path, sizeof(path), "/sys/bus/pci/devices/%s/resource2",
+                         src->bdf);
+    }
+    if (!access(res, R_OK)) {
+        src->bar = regs_map(res, 0);
+    }
+    if (src->bar) {
+        ras = cm_find_cap(src->bar, CM_CAP_ID_RAS);
+        src->ras = ras ? src->bar + REGS_CM_BASE + ras : NULL;
+    }
+    return 0;
+}
+
+static void src_sample(telem_src *src, telem_sample *s)
+{
+    uint32_t v;
+
+    if (src->fd < 0) {
+        s->valid = TELEM_DEV_GONE;
+        return;
+    }
+    if (src->exp) {
+        s->lnksta = pcicfg_read16(src->fd, src->exp + PCI_EXP_LNKSTA);
+        s->valid |= TELEM_HAS_LINK;
+    }
+    if (src->dvsec) {
+        v = pcicfg_read32(src->fd, src->dvsec + CXL_DVSEC_CTRL);
+        s->dvsec_ctrl = v;
+        s->dvsec_status = v >> 16;
+        s->dvsec_range1_lo = pcicfg_read32(src->fd, src->dvsec + CXL_DVSEC_RANGE1_SIZE_LO);
+        s->valid |= TELEM_HAS_DVSEC;
+    }
+    if (src->aer) {
+        s->aer_uncor = pcicfg_read32(src->fd, src->aer + PCI_ERR_UNCOR_STATUS);
+        s->aer_cor = pcicfg_read32(src->fd, src->aer + PCI_ERR_COR_STATUS);
+        s->valid |= TELEM_HAS_AER;
+    }
+    if (src->ras) {
+        s->ras_uncor = regs_read32(src->ras, RAS_UNCOR_STATUS) & RAS_UNCOR_STATUS_BITS;
+        s->ras_cor = regs_read32(src->ras, RAS_COR_STATUS) & RAS_COR_STATUS_BITS;
+        s->valid |= TELEM_HAS_RAS;
+    }
+    /* surprise removal or reset in progress */
+    if ((s->valid & TELEM_HAS_LINK && s->lnksta == 0xffff) ||
+        (s->valid & TELEM_HAS_AER && s->aer_uncor == ~0u)) {
+        s->valid |= TELEM_DEV_GONE;
+    }
+}
+
+static telem_ring *ring_create(void)
+{
+    uint64_t size = telem_ring_size(opt.nslots);
+    telem_ring *r;
+    int fd;
+
+    fd = open(opt.file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size)) {
+        fprintf(stderr, "create %s: %s\n", opt.file, strerror(errno));
+        return NULL;
+    }
+    r = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED) {
+        fprintf(stderr, "mmap %s: %s\n", opt.file, strerror(errno));
+        return NULL;
+    }
+    r->version = TELEM_VERSION;
+    r->nslots = opt.nslots;
+    r->interval_ns = opt.interval_us * 1000ULL;
+    return r;
+}
+
+static int cmd_run(void)
+{
+    struct timespec next;
+    telem_sample s;
+    telem_ring *r;
+    uint64_t now, missed = 0;
+    int i;
+
+    if (!nsrcs) {
+        src_scan();
+    }
+    if (!nsrcs) {
+        fprintf(stderr, "no devices, give -s <bdf>\n");
+        return 1;
+    }
+    /* 0 passes the power-of-two test but leaves the ring no slot */
+    if (opt.nslots < 2 || (opt.nslots & (opt.nslots - 1))) {
+        fprintf(stderr, "-n must be a power of two, at least 2\n");
+        return 1;
+    }
+    r = ring_create();
+    if (!r) {
+        return 1;
+    }
+    r->ndevs = nsrcs;
+    for (i = 0; i < nsrcs; i++) {
+        snprintf(r->devs[i].bdf, sizeof(r->devs[i].bdf), "%s", srcs[i].bdf);
+        if (src_open(&srcs[i], &r->devs[i])) {
+            fprintf(stderr, "%s: no config space, sampling as gone\n", srcs[i].bdf);
+        }
+        printf("%s: exp 0x%x dvsec 0x%x aer 0x%x ras %s\n", srcs[i].bdf, srcs[i].exp,
+               srcs[i].dvsec, srcs[i].aer, srcs[i].ras ? "mapped" : "-");
+    }
+    /* readers check magic last, once the header is complete */
+    __atomic_store_n(&r->magic, TELEM_MAGIC, __ATOMIC_RELEASE);
+    printf("%s: %u slots, every %u us\n", opt.file, opt.nslots, opt.interval_us);
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stop) {
+        now = now_ns();
+        for (i = 0; i < nsrcs; i++) {
+            memset(&s, 0, sizeof(s));
+            s.ts_ns = now;
+            s.dev = i;
+            src_sample(&srcs[i], &s);
+            /* the device went away (remove/rescan, reset): find it again */
+            if (s.valid & TELEM_DEV_GONE) {
+                src_close(&srcs[i]);
+                src_open(&srcs[i], &r->devs[i]);
+            }
+            telem_publish(r, &s);
+        }
+
+        next.tv_nsec += opt.interval_us * 1000L;
+        next.tv_sec += next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        if (now_ns() > next.tv_sec * 1000000000ULL + next.tv_nsec) {
+            /* overran a period: drop it rather than burst to catch up */
+            missed++;
+            clock_gettime(CLOCK_MONOTONIC, &next);
+            continue;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    printf("%llu samples, %llu periods overrun\n", (unsigned long long)r->head,
+           (unsigned long long)missed);
+    for (i = 0; i < nsrcs; i++) {
+        src_close(&srcs[i]);
+    }
+    munmap(r, telem_ring_size(r->nslots));
+    return 0;
+}
+
+/* dump */
+
+static const char *link_speed(uint32_t v)
+{
+    static const char *const gts[] = { "?", "2.5", "5", "8", "16", "32", "64" };
+
+    return v < sizeof(gts) / sizeof(gts[0]) ? gts[v] : "?";
+}
+
+static void print_sample(const telem_ring *r, const telem_sample *s, uint64_t t0)
+{
+    const telem_dev *dev = &r->devs[s->dev < TELEM_MAX_DEVS ? s->dev : 0];
+
+    printf("%.6f,%s,", (s->ts_ns - t0) / 1e9, dev->bdf);
+    if (s->valid & TELEM_DEV_GONE) {
+        printf("gone,,,,,,,,,\n");
+        return;
+    }
+    if (s->valid & TELEM_HAS_LINK) {
+        printf("%s,x%u,x%u,%u,", link_speed(PCI_EXP_LNKSTA_SPEED(s->lnksta)),
+               PCI_EXP_LNKSTA_WIDTH(s->lnksta), dev->lnkcap_width,
+               !!(s->lnksta & PCI_EXP_LNKSTA_TRAINING));
+    } else {
+        printf(",,,,");
+    }
+    if (s->valid & TELEM_HAS_DVSEC) {
+        printf("%u,%u,", !!(s->dvsec_ctrl & CXL_DVSEC_CTRL_MEM_ENABLE),
+               !!(s->dvsec_range1_lo & CXL_DVSEC_MEM_ACTIVE));
+    } else {
+        printf(",,");
+    }
+    if (s->valid & TELEM_HAS_AER) {
+        printf("0x%x,0x%x,", s->aer_uncor, s->aer_cor);
+    } else {
+        printf(",,");
+    }
+    if (s->valid & TELEM_HAS_RAS) {
+        printf("0x%x,0x%x\n", s->ras_uncor, s->ras_cor);
+    } else {
+        printf(",\n");
+    }
+}
+
+/* Same device state as the last sample of that device? */
+static int sample_same(const telem_sample *a, const telem_sample *b)
+{
+    return a->valid == b->valid && a->lnksta == b->lnksta &&
+           a->dvsec_ctrl == b->dvsec_ctrl && a->dvsec_range1_lo == b->dvsec_range1_lo &&
+           a->aer_uncor == b->aer_uncor && a->aer_cor == b->aer_cor &&
+           a->ras_uncor == b->ras_uncor && a->ras_cor == b->ras_cor;
+}
+
+static int cmd_dump(void)
+{
+    static telem_sample last[TELEM_MAX_DEVS];
+    static char seen[TELEM_MAX_DEVS];
+    struct stat st;
+    telem_sample s;
+    telem_ring *r;
+    uint64_t pos, head, t0 = 0, lost = 0;
+    int fd, rc;
+
+    fd = open(opt.file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) || (size_t)st.st_size < sizeof(telem_ring)) {
+        fprintf(stderr, "%s: no ring, is cxltelem run going?\n", opt.file);
+        return 1;
+    }
+    r = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED || __atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != TELEM_MAGIC ||
+        r->version != TELEM_VERSION || r->nslots < 2 || (r->nslots & (r->nslots - 1)) ||
+        telem_ring_size(r->nslots) > (uint64_t)st.st_size) {
+        fprintf(stderr, "%s: not a telemetry ring\n", opt.file);
+        return 1;
+    }
+
+    head = telem_head(r);
+    pos = head > r->nslots ? head - r->nslots : 0;
+    printf("time_s,bdf,speed_gts,width,max_width,training,mem_enable,mem_active,"
+           "aer_uncor,aer_cor,ras_uncor,ras_cor\n");
+    signal(SIGINT, on_signal);
+    while (!stop) {
+        rc = telem_read(r, pos, &s);
+        if (rc == -EAGAIN) {
+            if (!opt.follow) {
+                break;
+            }
+            fflush(stdout);
+            usleep(r->interval_ns / 2000 + 1);
+            continue;
+        }
+        if (rc == -ESTALE) {
+            head = telem_head(r);
+            lost += head - r->nslots - pos;
+            pos = head - r->nslots;
+            continue;
+        }
+        if (!t0) {
+            t0 = s.ts_ns;
+        }
+        pos++;
+        if (s.dev >= TELEM_MAX_DEVS) {
+            continue;
+        }
+        if (opt.changes && seen[s.dev] && sample_same(&s, &last[s.dev])) {
+            continue;
+        }
+        seen[s.dev] = 1;
+        last[s.dev] = s;
+        print_sample(r, &s, t0);
+    }
+    if (lost) {
+        fprintf(stderr, "%llu samples overwritten before they were read\n",
+                (unsigned long long)lost);
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    printf("Usage: cxltelem run [-s <bdf> [-r <resource>]]... [-i <us>] [-n <slots>]\n"
+           "                    [-f <file>] [-R <root>]\n"
+           "       cxltelem dump [-f <file>] [-F] [-c]\n");
+    printf("  -s  device to sample, repeat for more; default every cc53 function\n"
+           "  -r  map <resource> for the RAS registers of the -s before it, e.g. a\n"
+           "      cxl_regemu file; default the device's resource2\n"
+           "  -i  sample period, default 1000 us\n"
+           "  -n  ring slots, a power of two of at least 2, default 65536\n"
+           "  -f  ring file, default " TELEM_DEFAULT_FILE "\n"
+           "  -R  read sys under <root>\n"
+           "  -F  keep following the ring\n"
+           "  -c  print a sample only when it differs from the device's last one\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    int c;
+
+    if (argc < 2 || !strcmp(argv[1], "-h")) {
+        usage();
+        return argc < 2;
+    }
+    cmd = argv[1];
+    argc--;
+    argv++;
+
+    while ((c = getopt(argc, argv, "hs:r:i:n:f:R:Fc")) != -1) {
+        switch (c) {
+        case 's':
+            if (src_add(optarg)) {
+                return 1;
+            }
+            break;
+        case 'r':
+            if (!nsrcs) {
+                fprintf(stderr, "-r goes after the -s it belongs to\n");
+                return 1;
+            }
+            srcs[nsrcs - 1].resource = optarg;
+            break;
+        case 'i':
+            opt.interval_us = strtoul(optarg, NULL, 0);
+            if (!opt.interval_us) {
+                opt.interval_us = 1;
+            }
+            break;
+        case 'n':
+            opt.nslots = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            opt.file = optarg;
+            break;
+        case 'R':
+            sysfs_root = optarg;
+            break;
+        case 'F':
+            opt.follow = 1;
+            break;
+        case 'c':
+            opt.changes = 1;
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+
+    if (!strcmp(cmd, "run")) {
+        return cmd_run();
+    }
+    if (!strcmp(cmd, "dump")) {
+        return cmd_dump();
+    }
+    usage();
+    return 1;
+}
@@ -0,0 +1,465 @@
+/*************************************************************************
+@File Name: cxltop.c
+@Desc: top-style monitor of per-node memory use and tiering activity.
+
+    Samples each node's numastat, meminfo and vmstat, plus /proc/vmstat.
+    It shows allocation, local/remote, promotion/demotion and NUMA hint
+    fault rates for CXL nodes next to DRAM ones. A node counts as CXL
+    when a system-ram dax device (dax_to_numa.sh) targets it or when -c
+    names it.
+
+    Files are opened once and re-read with pread() into static buffers.
+    The parser remembers on which line each wanted key was found, so a
+    sample is one pass of memcmp()s with no lookups, no stdio and no
+    allocation. That keeps 10 Hz (-i 100) cheap on a busy host.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sysfs.h"
+
+#define CXLTOP_MAX_NODES        64
+#define CXLTOP_MAX_LINES        512
+#define CXLTOP_BUF_SIZE         16384
+
+enum node_type {
+    NODE_DRAM,
+    NODE_MEM,                   /* no CPUs, not known to be CXL */
+    NODE_CXL,
+};
+
+static const char *const node_type_name[] = { "dram", "mem", "cxl" };
+
+/* Keys wanted from each file, values land at the same index */
+enum { NS_HIT, NS_MISS, NS_FOREIGN, NS_LOCAL, NS_OTHER, NS_MAX };
+static const char *const numastat_keys[NS_MAX] = {
+    "numa_hit", "numa_miss", "numa_foreign", "local_node", "other_node",
+};
+
+enum { MI_TOTAL, MI_FREE, MI_USED, MI_ANON, MI_FILE, MI_MAX };
+static const char *const meminfo_keys[MI_MAX] = {
+    "MemTotal", "MemFree", "MemUsed", "AnonPages", "FilePages",
+};
+
+enum { NV_PROMOTE, NV_DEMOTE_KSWAPD, NV_DEMOTE_DIRECT, NV_DEMOTE_KHUGEPAGED, NV_MAX };
+static const char *const node_vmstat_keys[NV_MAX] = {
+    "pgpromote_success", "pgdemote_kswapd", "pgdemote_direct", "pgdemote_khugepaged",
+};
+
+enum { VM_HINT, VM_HINT_LOCAL, VM_MIGRATED, VM_PTE_UPDATES, VM_PROMOTE,
+       VM_DEMOTE_KSWAPD, VM_DEMOTE_DIRECT, VM_MAX };
+static const char *const vmstat_keys[VM_MAX] = {
+    "numa_hint_faults", "numa_hint_faults_local", "numa_pages_migrated",
+    "numa_pte_updates", "pgpromote_success", "pgdemote_kswapd", "pgdemote_direct",
+};
+
+typedef struct stat_file stat_file;
+typedef struct node node;
+
+/*
+ * One "key value" or "Node N key: value kB" file. line_key[i] is the key
+ * index seen on line i last time, so the next parse checks that key
+ * first; -1 means the line holds nothing wanted.
+ */
+struct stat_file {
+    int fd;
+    int skip;                   /* words before the key, 2 for "Node N" */
+    int nkeys;
+    int present;                /* keys the file had on the last full pass */
+    const char *const *keys;
+    uint8_t key_len[16];
+    int16_t line_key[CXLTOP_MAX_LINES];
+    uint64_t *vals;
+};
+
+struct node {
+    int id;
+    int type;
+    stat_file numastat;
+    stat_file meminfo;
+    stat_file vmstat;
+    uint64_t ns[2][NS_MAX];
+    uint64_t mi[2][MI_MAX];
+    uint64_t nv[2][NV_MAX];
+};
+
+static struct {
+    uint32_t interval_ms;
+    long count;
+    int batch;
+    char cxl_nodes[CXLTOP_MAX_NODES];
+} opt = {
+    .interval_ms = 500,
+};
+
+static node nodes[CXLTOP_MAX_NODES];
+static int nnodes;
+static stat_file vmstat;
+static uint64_t vm[2][VM_MAX];
+static char buf[CXLTOP_BUF_SIZE];
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int stat_open(stat_file *sf, const char *path, int skip,
+                     const char *const *keys, int nkeys, uint64_t *vals)
+{
+    int i;
+
+    sf->fd = open(path, O_RDONLY);
+    sf->skip = skip;
+    sf->keys = keys;
+    sf->nkeys = nkeys;
+    sf->present = nkeys;
+    sf->vals = vals;
+    for (i = 0; i < nkeys; i++) {
+        sf->key_len[i] = strlen(keys[i]);
+    }
+    for (i = 0; i < CXLTOP_MAX_LINES; i++) {
+        sf->line_key[i] = -2;   /* not seen yet */
+    }
+    return sf->fd;
+}
+
+static int key_match(const stat_file *sf, int k, const char *key, int len)
+{
+    return sf->key_len[k] == len && !memcmp(sf->keys[k], key, len);
+}
+
+/* Re-read @sf and update the values of the keys present; 0 or -errno */
+static int stat_read(stat_file *sf)
+{
+    const char *p, *end, *key;
+    uint64_t v;
+    ssize_t n;
+    int line, k, w, len, found = 0, skipped = 0;
+
+    if (sf->fd < 0) {
+        return -ENOENT;
+    }
+    n = pread(sf->fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+        return -errno;
+    }
+    p = buf;
+    end = buf + n;
+
+    for (line = 0; p < end && line < CXLTOP_MAX_LINES && found < sf->present; line++) {
+        if (sf->line_key[line] == -1) {
+            p = memchr(p, '\n', end - p);
+            p = p ? p + 1 : end;
+            skipped++;
+            continue;
+        }
+
+        for (w = 0; w < sf->skip; w++) {
+            while (p < end && *p == ' ') {
+                p++;
+            }
+            while (p < end && *p != ' ' && *p != '\n') {
+                p++;
+            }
+        }
+        while (p < end && *p == ' ') {
+            p++;
+        }
+        key = p;
+        while (p < end && *p != ' ' && *p != ':' && *p != '\n') {
+            p++;
+        }
+        len = p - key;
+
+        k = sf->line_key[line];
+        if (k < 0 || !key_match(sf, k, key, len)) {
+            for (k = 0; k < sf->nkeys && !key_match(sf, k, key, len); k++) {
+                ;
+            }
+            sf->line_key[line] = k < sf->nkeys ? k : -1;
+        }
+
+        while (p < end && (*p == ':' || *p == ' ')) {
+            p++;
+        }
+        for (v = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+            v = v * 10 + (*p - '0');
+        }
+        if (sf->line_key[line] >= 0) {
+            sf->vals[sf->line_key[line]] = v;
+            found++;
+        }
+        p = memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+    }
+
+    if (!skipped) {
+        sf->present = found;
+    } else if (found < sf->present) {
+        /* a key moved onto a line skipped as uninteresting: forget the layout */
+        for (line = 0; line < CXLTOP_MAX_LINES; line++) {
+            if (sf->line_key[line] == -1) {
+                sf->line_key[line] = -2;
+            }
+        }
+        return stat_read(sf);
+    }
+    return 0;
+}
+
+/* Setup, the only place that allocates (opendir) */
+
+static int node_is_dax_target(int id)
+{
+    char path[512], val[16];
+    struct dirent *de;
+    DIR *d;
+    int hit = 0;
+
+    d = opendir(sysfs_path(path, sizeof(path), "/sys/bus/dax/devices"));
+    while (d && (de = readdir(d)) && !hit) {
+        if (strncmp(de->d_name, "dax", 3) ||
+            sysfs_link_name(val, sizeof(val), "/sys/bus/dax/devices/%s/driver",
+                            de->d_name) || strcmp(val, "kmem")) {
+            continue;
+        }
+        hit = sysfs_read(val, sizeof(val), "/sys/bus/dax/devices/%s/target_node",
+                         de->d_name) > 0 && atoi(val) == id;
+    }
+    if (d) {
+        closedir(d);
+    }
+    return hit;
+}
+
+static int cmp_node(const void *a, const void *b)
+{
+    return ((const node *)a)->id - ((const node *)b)->id;
+}
+
+static int nodes_open(void)
+{
+    char path[512], cpus[256];
+    const char *base = "/sys/devices/system/node";
+    struct dirent *de;
+    node *nd;
+    DIR *d;
+    char *e;
+    long id;
+
+    d = opendir(sysfs_path(path, sizeof(path), "%s", base));
+    if (!d) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while ((de = readdir(d)) && nnodes < CXLTOP_MAX_NODES) {
+        if (strncmp(de->d_name, "node", 4)) {
+            continue;
+        }
+        id = strtol(de->d_name + 4, &e, 10);
+        if (*e || e == de->d_name + 4) {
+            continue;
+        }
+        nd = &nodes[nnodes++];
+        nd->id = id;
+    }
+    closedir(d);
+    qsort(nodes, nnodes, sizeof(nodes[0]), cmp_node);
+
+    for (nd = nodes; nd < nodes + nnodes; nd++) {
+        stat_open(&nd->numastat, sysfs_path(path, sizeof(path), "%s/node%d/numastat",
+                                            base, nd->id),
+                  0, numastat_keys, NS_MAX, nd->ns[0]);
+        stat_open(&nd->meminfo, sysfs_path(path, sizeof(path), "%s/node%d/meminfo",
+                                           base, nd->id),
+                  2, meminfo_keys, MI_MAX, nd->mi[0]);
+        stat_open(&nd->vmstat, sysfs_path(path, sizeof(path), "%s/node%d/vmstat",
+                                          base, nd->id),
+                  0, node_vmstat_keys, NV_MAX, nd->nv[0]);
+
+        if ((nd->id < CXLTOP_MAX_NODES && opt.cxl_nodes[nd->id]) ||
+            node_is_dax_target(nd->id)) {
+            nd->type = NODE_CXL;
+        } else if (sysfs_read(cpus, sizeof(cpus), "%s/node%d/cpulist", base, nd->id) <= 0) {
+            nd->type = NODE_MEM;
+        } else {
+            nd->type = NODE_DRAM;
+        }
+    }
+    stat_open(&vmstat, sysfs_path(path, sizeof(path), "/proc/vmstat"), 0, vmstat_keys,
+              VM_MAX, vm[0]);
+    return nnodes ? 0 : -1;
+}
+
+/* Sampling: values are read into slot 0, the previous sample is in slot 1 */
+
+static void sample(void)
+{
+    node *nd;
+
+    for (nd = nodes; nd < nodes + nnodes; nd++) {
+        memcpy(nd->ns[1], nd->ns[0], sizeof(nd->ns[0]));
+        memcpy(nd->nv[1], nd->nv[0], sizeof(nd->nv[0]));
+        stat_read(&nd->numastat);
+        stat_read(&nd->meminfo);
+        stat_read(&nd->vmstat);
+    }
+    memcpy(vm[1], vm[0], sizeof(vm[0]));
+    stat_read(&vmstat);
+}
+
+static double rate(uint64_t cur, uint64_t prev, double secs)
+{
+    return cur >= prev ? (cur - prev) / secs : 0.0;
+}
+
+static void show(double secs)
+{
+    char tbuf[16];
+    time_t t = time(NULL);
+    const node *nd;
+    double demote;
+    uint64_t used;
+
+    strftime(tbuf, sizeof(tbuf), "%H:%M:%S", localtime(&t));
+    if (!opt.batch) {
+        fputs("\033[H\033[2J", stdout);
+    }
+    printf("cxltop - %s  interval %u ms  (rates per second, pages)\n\n", tbuf,
+           opt.interval_ms);
+    printf("NODE TYPE  TOTAL_MB   USED_MB  USED%%  ANON_MB  FILE_MB     ALLOC     LOCAL"
+           "    REMOTE      MISS   PROMOTE    DEMOTE\n");
+
+    for (nd = nodes; nd < nodes + nnodes; nd++) {
+        used = nd->mi[0][MI_USED] ? nd->mi[0][MI_USED]
+                                  : nd->mi[0][MI_TOTAL] - nd->mi[0][MI_FREE];
+        demote = rate(nd->nv[0][NV_DEMOTE_KSWAPD], nd->nv[1][NV_DEMOTE_KSWAPD], secs) +
+                 rate(nd->nv[0][NV_DEMOTE_DIRECT], nd->nv[1][NV_DEMOTE_DIRECT], secs) +
+                 rate(nd->nv[0][NV_DEMOTE_KHUGEPAGED], nd->nv[1][NV_DEMOTE_KHUGEPAGED],
+                      secs);
+        printf("%4d %-4s %9llu %9llu %5.1f %8llu %8llu %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f\n",
+               nd->id, node_type_name[nd->type],
+               (unsigned long long)(nd->mi[0][MI_TOTAL] >> 10),
+               (unsigned long long)(used >> 10),
+               nd->mi[0][MI_TOTAL] ? 100.0 * used / nd->mi[0][MI_TOTAL] : 0.0,
+               (unsigned long long)(nd->mi[0][MI_ANON] >> 10),
+               (unsigned long long)(nd->mi[0][MI_FILE] >> 10),
+               rate(nd->ns[0][NS_HIT], nd->ns[1][NS_HIT], secs) +
+               rate(nd->ns[0][NS_MISS], nd->ns[1][NS_MISS], secs),
+               rate(nd->ns[0][NS_LOCAL], nd->ns[1][NS_LOCAL], secs),
+               rate(nd->ns[0][NS_OTHER], nd->ns[1][NS_OTHER], secs),
+               rate(nd->ns[0][NS_MISS], nd->ns[1][NS_MISS], secs),
+               rate(nd->nv[0][NV_PROMOTE], nd->nv[1][NV_PROMOTE], secs), demote);
+    }
+
+    printf("\nhint faults %.0f (local %.0f)  pte updates %.0f  migrated %.0f  "
+           "promoted %.0f  demoted %.0f\n",
+           rate(vm[0][VM_HINT], vm[1][VM_HINT], secs),
+           rate(vm[0][VM_HINT_LOCAL], vm[1][VM_HINT_LOCAL], secs),
+           rate(vm[0][VM_PTE_UPDATES], vm[1][VM_PTE_UPDATES], secs),
+           rate(vm[0][VM_MIGRATED], vm[1][VM_MIGRATED], secs),
+           rate(vm[0][VM_PROMOTE], vm[1][VM_PROMOTE], secs),
+           rate(vm[0][VM_DEMOTE_KSWAPD], vm[1][VM_DEMOTE_KSWAPD], secs) +
+           rate(vm[0][VM_DEMOTE_DIRECT], vm[1][VM_DEMOTE_DIRECT], secs));
+    if (opt.batch) {
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+static void usage(void)
+{
+    printf("Usage: cxltop [-i <ms>] [-n <count>] [-b] [-c <node>[,<node>...]] [-R <root>]\n"
+           "  -i  refresh interval, default 500 ms; 100 for 10 Hz\n"
+           "  -n  stop after <count> refreshes\n"
+           "  -b  batch mode: append every refresh instead of redrawing\n"
+           "  -c  treat these nodes as CXL, on top of kmem dax targets\n"
+           "  -R  read sys and proc under <root>\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec next;
+    uint64_t prev, now;
+    long i;
+    char *s;
+    int c, id;
+
+    while ((c = getopt(argc, argv, "hi:n:bc:R:")) != -1) {
+        switch (c) {
+        case 'i':
+            opt.interval_ms = strtoul(optarg, NULL, 0);
+            if (!opt.interval_ms) {
+                opt.interval_ms = 1;
+            }
+            break;
+        case 'n':
+            opt.count = strtol(optarg, NULL, 0);
+            break;
+        case 'b':
+            opt.batch = 1;
+            break;
+        case 'c':
+            for (s = strtok(optarg, ","); s; s = strtok(NULL, ",")) {
+                id = atoi(s);
+                if (id >= 0 && id < CXLTOP_MAX_NODES) {
+                    opt.cxl_nodes[id] = 1;
+                }
+            }
+            break;
+        case 'R':
+            sysfs_root = optarg;
+            break;
+        default:
+            usage();
+            return c != 'h';
+        }
+    }
+    if (!isatty(STDOUT_FILENO)) {
+        opt.batch = 1;
+    }
+
+    if (nodes_open()) {
+        fprintf(stderr, "no NUMA nodes found\n");
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    sample();
+    prev = now_ns();
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (i = 0; !stop && (!opt.count || i < opt.count); i++) {
+        /* absolute deadlines, so the period does not drift with the work */
+        next.tv_nsec += (opt.interval_ms % 1000) * 1000000L;
+        next.tv_sec += opt.interval_ms / 1000 + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+            break;
+        }
+        sample();
+        now = now_ns();
+        show((now - prev) / 1e9);
+        prev = now;
+    }
+    return 0;
+}
@@ -8,5 +8,140 @@
 #ifndef DOE_API_H
 #define DOE_API_H
 
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
 #define DOE_MBOX_CMD 0
+
+#define DOE_IOC_MAGIC 'D'
+
+/*
+ * Every request naming a @cap_offset fails with ENODEV when the function
+ * has no DOE mailbox there. ENOTTY only ever means the driver does not
+ * know the request (or DOE_MBOX_VEC mode), so callers can fall back.
+ */
+
+/*
+ * Asynchronous exchanges.
+ *
+ * DOE_MBOX_SUBMIT queues one request on the mailbox at @cap_offset and
+ * returns at once. Requests are run in order per mailbox; mailboxes run
+ * independently of each other. At most DOE_MAX_INFLIGHT requests per open
+ * file may be submitted and not yet read, beyond that submit fails with
+ * EAGAIN.
+ *
+ * Completions are read() from the same file descriptor. Each record is a
+ * struct doe_cpl followed by @rsp_dw response dwords; one read returns as
+ * many whole records as fit. poll()/epoll report POLLIN while completions
+ * are pending and POLLOUT while there is room to submit.
+ */
+#define DOE_MAX_INFLIGHT 64
+
+struct doe_submit {
+	__u64 tag;		/* Returned unchanged in the completion */
+	__u64 req_ptr;		/* Request object, header included */
+	__u32 cap_offset;	/* DOE extended capability offset */
+	__u32 rsp_max_dw;	/* Largest response accepted, in dwords */
+};
+
+struct doe_cpl {
+	__u64 tag;
+	__s32 status;		/* 0 or a negative errno */
+	__u32 rsp_dw;		/* Response dwords following this record */
+};
+
+#define DOE_MBOX_SUBMIT _IOW(DOE_IOC_MAGIC, 1, struct doe_submit)
+
+/*
+ * Chained exchanges.
+ *
+ * DOE_MBOX_VEC runs a whole chain of exchanges on the mailbox at
+ * @cap_offset in one call, holding the mailbox throughout so no other user
+ * interleaves. At most DOE_VEC_MAX exchanges are run per call.
+ *
+ * DOE_VEC_LIST: the @count entries at @ents_ptr are run in order. Each
+ * gets its @status and @rsp_used filled in; entries that were not run,
+ * also when the call fails before running any, read -ECANCELED. The whole
+ * array is written back. The chain stops at the first failure unless
+ * DOE_VEC_F_CONTINUE is set.
+ *
+ * DOE_VEC_FOLLOW_DISCOVERY: the kernel walks the discovery index from 0
+ * until the next index is 0 and stores the third dword of every response
+ * (vendor id, protocol, next index) at @rsp_ptr.
+ *
+ * DOE_VEC_FOLLOW_CDAT: the kernel reads CDAT entries from handle 0 until
+ * the next handle is 0xFFFF and stores the entry payloads back to back at
+ * @rsp_ptr, which yields the complete CDAT table.
+ *
+ * For both follow modes @rsp_len is the buffer size in bytes and on return
+ * @rsp_used is the number of bytes stored. In every mode @count returns the
+ * number of exchanges run, also when the call fails part way.
+ */
+#define DOE_VEC_MAX 1024
+
+enum {
+	DOE_VEC_LIST,
+	DOE_VEC_FOLLOW_DISCOVERY,
+	DOE_VEC_FOLLOW_CDAT,
+};
+
+#define DOE_VEC_F_CONTINUE	(1 << 0)
+
+struct doe_vec_ent {
+	__u64 req_ptr;		/* Request object, header included */
+	__u64 rsp_ptr;		/* Response object buffer */
+	__u32 rsp_len;		/* Size of the response buffer in bytes */
+	__u32 rsp_used;		/* Bytes of response stored */
+	__s32 status;		/* 0 or a negative errno */
+	__u32 reserved;
+};
+
+struct doe_vec {
+	__u32 cap_offset;
+	__u32 mode;		/* DOE_VEC_* */
+	__u32 flags;		/* DOE_VEC_F_* */
+	__u32 count;
+	__u64 ents_ptr;		/* DOE_VEC_LIST: struct doe_vec_ent array */
+	__u64 rsp_ptr;		/* Follow modes: output buffer */
+	__u32 rsp_len;
+	__u32 rsp_used;
+};
+
+#define DOE_MBOX_VEC _IOWR(DOE_IOC_MAGIC, 2, struct doe_vec)
+
+/*
+ * Mailbox control.
+ *
+ * DOE_MBOX_ABORT takes the mailbox at the given cap offset like an
+ * exchange would, so it never cuts into one, and sets DOE Abort. Fails
+ * with EIO if the mailbox stays busy or in error.
+ *
+ * DOE_MBOX_STATS returns the counters behind debugfs
+ * doe/<BDF>/mbox_<cap>/stats, clearing them afterwards with
+ * DOE_STATS_F_RESET. Lock wait is the time from asking for the mailbox to
+ * getting it; lock hold is the time it was held. Both are ns.
+ */
+#define DOE_MBOX_ABORT _IOW(DOE_IOC_MAGIC, 3, __u32)
+
+#define DOE_STATS_F_RESET	(1 << 0)
+
+struct doe_mbox_stats {
+	__u32 cap_offset;
+	__u32 flags;		/* DOE_STATS_F_* */
+	__u64 exchanges;
+	__u64 errors;
+	__u64 timeouts;
+	__u64 aborts;
+	__u64 lat_min_ns;
+	__u64 lat_max_ns;
+	__u64 lat_total_ns;
+	__u64 lock_acquires;
+	__u64 lock_wait_total_ns;
+	__u64 lock_wait_max_ns;
+	__u64 lock_hold_total_ns;
+	__u64 lock_hold_max_ns;
+};
+
+#define DOE_MBOX_STATS _IOWR(DOE_IOC_MAGIC, 4, struct doe_mbox_stats)
+
 #endif /* DOE_API_H */
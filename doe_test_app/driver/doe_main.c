@@ -5,12 +5,25 @@
  * See the LICENSE file in the top-level directory.
  */
 
-#define DEBUG
 #include <linux/sched/clock.h>
+#include <linux/bitfield.h>
+#include <linux/sizes.h>
+#include <linux/debugfs.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/mm.h>
+#include <linux/overflow.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/cdev.h>
+#include <linux/sysfs.h>
 #include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <linux/pci.h>
 #include <linux/io.h>
 #include <uapi/linux/pci_regs.h>
@@ -23,189 +36,1215 @@
 #define PCI_CLASS_MEMORY_CXL	0x0502
 #define CXL_MEMORY_PROGIF 0x10
 #define PCIE_EXT_CAP_OFFSET 0x100
+/* CXL Table Access protocol, used to follow CDAT entry handles */
+#define CXL_VENDOR_ID 0x1e98
+#define CXL_DOE_TABLE_ACCESS 2
+#define CXL_DOE_TAB_REQ_3_HANDLE GENMASK(31, 16)
+#define CXL_DOE_TAB_RSP_3_HANDLE GENMASK(31, 16)
+#define CXL_DOE_TAB_ENT_MAX 0xFFFF
+/* Read Entry Response header plus the largest CDAT structure */
+#define CXL_DOE_TAB_RSP_MAX (3 * sizeof(u32) + SZ_64K)
+/* CDAT header: length, revision, checksum, reserved, sequence */
+#define CDAT_HDR_DW 4
+#define CDAT_HDR_SEQ_DW 3
+#define CDAT_TBL_MAX SZ_1M
+/* Number of /dev/doe<N> minors, one per probed function */
+#define DOE_MAX_DEVS 256
 
+/*
+ * @queue holds the mailbox's pending asynchronous requests, run in
+ * submission order by @work. Work items on doe_wq never run concurrently
+ * with themselves, so each mailbox has one exchange in flight while
+ * different mailboxes progress in parallel.
+ */
 struct doe_node {
 	struct pcie_doe doe;
 	struct doe_node *next;
+	struct doe_dev *ddev;
+	/* Discovery results, vendor id | protocol << 16, filled at probe */
+	u32 prots[PCI_DOE_PROTOCOL_MAX];
+	int nr_prots;
+	spinlock_t qlock;
+	struct list_head queue;
+	struct work_struct work;
 };
 
+/*
+ * Per open file completion state. Every queued request holds a reference,
+ * so requests still running when the file is closed complete into a
+ * context that is then dropped. @inflight counts requests submitted and
+ * not yet read back.
+ */
+struct doe_file {
+	struct doe_dev *ddev;
+	struct kref kref;
+	spinlock_t lock;
+	struct list_head done;
+	wait_queue_head_t wq;
+	unsigned int inflight;
+	bool closed;
+};
+
+struct doe_async_req {
+	struct list_head list;
+	struct doe_file *dfile;
+	u64 tag;
+	int status;
+	u32 req_dw;
+	u32 rsp_max_dw;
+	u32 rsp_dw;
+	u32 *req;
+	u32 *rsp;
+};
+
+/*
+ * One per probed PCI function. The structure lives as long as its class
+ * device: open files hold a reference through the cdev, so it outlives
+ * doe_remove() until the last close. @rwsem is taken shared by every
+ * mailbox user and exclusively by remove, which sets @removed.
+ *
+ * @cdat caches the table read through @cdat_mbox, under @cdat_lock. It is
+ * read again on first use after @cdat_valid has been cleared: by a refresh
+ * from sysfs, by a function reset, or by any exchange returning a CDAT
+ * header whose sequence number differs from @cdat_seq. Every sysfs read
+ * that starts at offset 0 re-reads that header to catch changes the
+ * driver did not see.
+ */
 struct doe_dev {
 	struct pci_dev *pdev;
+	struct device dev;
 	struct cdev cdev;
+	int minor;
+	struct rw_semaphore rwsem;
+	bool removed;
 	struct doe_node *doe_head;
+	struct dentry *debugfs;
+	struct mutex cdat_lock;
+	struct doe_node *cdat_mbox;
+	void *cdat;
+	size_t cdat_len;
+	u32 cdat_seq;
+	bool cdat_valid;
 };
 
 static int doe_major;
 static struct class *doe_class = NULL;
+static struct dentry *doe_debugfs;
+static struct workqueue_struct *doe_wq;
+static DEFINE_IDA(doe_minor_ida);
+
+static bool use_irq = true;
+module_param(use_irq, bool, 0444);
+MODULE_PARM_DESC(use_irq, "Complete DOE exchanges from the mailbox interrupt (default: true)");
+
+/*
+ * Drop the cached CDAT if @rsp answers a Read Entry request for the table
+ * header (handle 0) with a sequence number other than the cached one.
+ * Called for every exchange the driver runs, possibly with the mailbox
+ * held, so it only flips @cdat_valid and never takes @cdat_lock.
+ */
+static void doe_cdat_snoop(struct doe_node *dn, const u32 *req, size_t req_dw,
+			   const u32 *rsp, size_t rsp_dw)
+{
+	struct doe_dev *ddev = dn->ddev;
+
+	if (req_dw < 3 || rsp_dw < 3 + CDAT_HDR_DW ||
+	    FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_VID, req[0]) != CXL_VENDOR_ID ||
+	    FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_TYPE, req[0]) != CXL_DOE_TABLE_ACCESS ||
+	    FIELD_GET(CXL_DOE_TAB_REQ_3_HANDLE, req[2]) != 0)
+		return;
+
+	if (smp_load_acquire(&ddev->cdat_valid) &&
+	    rsp[3 + CDAT_HDR_SEQ_DW] != READ_ONCE(ddev->cdat_seq)) {
+		dev_dbg(&ddev->dev, "CDAT sequence %u -> %u, dropping cache\n",
+			READ_ONCE(ddev->cdat_seq), rsp[3 + CDAT_HDR_SEQ_DW]);
+		WRITE_ONCE(ddev->cdat_valid, false);
+	}
+}
+
+typedef int (*doe_walk_fn)(void *ctx, const void *data, size_t len);
+
+/*
+ * Generate the discovery (@cdat false) or CDAT Read Entry requests in the
+ * kernel, chasing the next index / entry handle from each response, and
+ * pass each payload to @emit: the third dword of a discovery response, or
+ * the CDAT structure of a Read Entry response. A positive return from
+ * @emit ends the walk and is returned. The caller holds the mailbox.
+ * @count gets the number of exchanges run, also on failure.
+ */
+static int doe_walk(struct doe_node *dn, bool cdat, doe_walk_fn emit, void *ctx,
+		    u32 *count)
+{
+	size_t rsp_sz = cdat ? CXL_DOE_TAB_RSP_MAX : 3 * sizeof(u32);
+	size_t payload, rsp_dw;
+	u32 req[3], *rsp, next = 0, n = 0;
+	int rc = 0;
+
+	rsp = kvmalloc(rsp_sz, GFP_KERNEL);
+	if (!rsp)
+		return -ENOMEM;
+
+	req[1] = FIELD_PREP(PCI_DOE_DATA_OBJECT_HEADER_2_LENGTH, 3);
+
+	do {
+		if (n == DOE_VEC_MAX) {
+			rc = -ELOOP;
+			break;
+		}
+
+		if (cdat) {
+			req[0] = FIELD_PREP(PCI_DOE_DATA_OBJECT_HEADER_1_VID, CXL_VENDOR_ID) |
+				 FIELD_PREP(PCI_DOE_DATA_OBJECT_HEADER_1_TYPE, CXL_DOE_TABLE_ACCESS);
+			/* Read Entry request code and CDAT table type are both 0 */
+			req[2] = FIELD_PREP(CXL_DOE_TAB_REQ_3_HANDLE, next);
+		} else {
+			req[0] = FIELD_PREP(PCI_DOE_DATA_OBJECT_HEADER_1_VID, PCI_DOE_PCI_SIG_VID) |
+				 FIELD_PREP(PCI_DOE_DATA_OBJECT_HEADER_1_TYPE, PCI_SIG_DOE_DISCOVERY);
+			req[2] = FIELD_PREP(PCI_DOE_DATA_OBJECT_DISC_REQ_3_INDEX, next);
+		}
+
+		rc = __pcie_doe_exchange(&dn->doe, req, sizeof(req), rsp, rsp_sz);
+		if (rc)
+			break;
+		n++;
+
+		rsp_dw = min_t(size_t, FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_2_LENGTH, rsp[1]),
+			       rsp_sz / sizeof(u32));
+		if (rsp_dw < 3) {
+			rc = -EIO;
+			break;
+		}
+
+		if (cdat) {
+			doe_cdat_snoop(dn, req, ARRAY_SIZE(req), rsp, rsp_dw);
+			payload = (rsp_dw - 3) * sizeof(u32);
+			next = FIELD_GET(CXL_DOE_TAB_RSP_3_HANDLE, rsp[2]);
+		} else {
+			payload = sizeof(u32);
+			next = FIELD_GET(PCI_DOE_DATA_OBJECT_DISC_RSP_3_NEXT_INDEX, rsp[2]);
+		}
+
+		rc = emit(ctx, cdat ? &rsp[3] : &rsp[2], payload);
+		if (rc)
+			break;
+	} while (cdat ? next != CXL_DOE_TAB_ENT_MAX : next != 0);
+
+	kvfree(rsp);
+	*count = n;
+	return rc;
+}
+
+static int doe_prot_emit(void *ctx, const void *data, size_t len)
+{
+	struct doe_node *dn = ctx;
+	u32 dw = *(const u32 *)data;
+
+	if (dn->nr_prots == PCI_DOE_PROTOCOL_MAX)
+		return -E2BIG;
+
+	dn->prots[dn->nr_prots++] =
+		FIELD_GET(PCI_DOE_DATA_OBJECT_DISC_RSP_3_VID, dw) |
+		FIELD_GET(PCI_DOE_DATA_OBJECT_DISC_RSP_3_PROTOCOL, dw) << 16;
+	return 0;
+}
+
+/* Discovery in kernel space, the results are kept for sysfs */
+static void do_doe_discovery(struct doe_dev *ddev, struct doe_node *dn)
+{
+	u32 count;
+	int i, ret;
+
+	pcie_doe_lock(&dn->doe);
+	ret = doe_walk(dn, false, doe_prot_emit, dn, &count);
+	pcie_doe_unlock(&dn->doe);
+	if (ret)
+		dev_info(&ddev->pdev->dev, "cap %x: discovery failed %d\n",
+			 dn->doe.cap_offset, ret);
+
+	for (i = 0; i < dn->nr_prots; i++) {
+		dev_info(&ddev->pdev->dev, "cap %x: vid %x, type %x\n",
+			 dn->doe.cap_offset, dn->prots[i] & 0xffff, dn->prots[i] >> 16);
+		if (dn->prots[i] == (CXL_VENDOR_ID | CXL_DOE_TABLE_ACCESS << 16) &&
+		    !ddev->cdat_mbox)
+			ddev->cdat_mbox = dn;
+	}
+}
+
+static struct doe_node *doe_find_mbox(struct doe_dev *ddev, u32 cap_offset)
+{
+	struct doe_node *doe_node;
+
+	for (doe_node = ddev->doe_head; doe_node; doe_node = doe_node->next) {
+		if (doe_node->doe.cap_offset == cap_offset)
+			return doe_node;
+	}
+
+	dev_dbg(&ddev->pdev->dev, "can't find the required capability 0x%x\n",
+		cap_offset);
+	return NULL;
+}
+
+/*
+ * DOE_MBOX_CMD: the user buffer holds the DOE cap offset followed by the
+ * request object, and receives the response object in place. Users should
+ * maintain the mappings for the DOE cap offsets and their protocols. Only
+ * the request and response lengths are copied, not the maximum object size.
+ */
+static long doe_mbox_cmd(struct doe_dev *ddev, void __user *arg)
+{
+	u32 hdr[3], *req_buf, *rsp_buf = NULL;
+	size_t req_dw, rsp_dw;
+	struct doe_node *dn;
+	long rc;
+
+	if (copy_from_user(hdr, arg, sizeof(hdr)))
+		return -EFAULT;
+
+	dn = doe_find_mbox(ddev, hdr[0]);
+	if (!dn)
+		return -ENODEV;
+
+	req_dw = ((DOEHeader *)&hdr[1])->length;
+	if (req_dw < 2 || req_dw > PCI_DOE_MAX_DW_SIZE)
+		return -EINVAL;
+
+	req_buf = kvmalloc_array(req_dw, sizeof(u32), GFP_KERNEL);
+	rsp_buf = kvmalloc_array(PCI_DOE_MAX_DW_SIZE, sizeof(u32), GFP_KERNEL);
+	if (!req_buf || !rsp_buf) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(req_buf, arg + sizeof(u32), req_dw * sizeof(u32))) {
+		rc = -EFAULT;
+		goto out;
+	}
+
+	rc = pcie_doe_exchange(&dn->doe, req_buf, req_dw * sizeof(u32), rsp_buf,
+			       PCI_DOE_MAX_DW_SIZE * sizeof(u32));
+	if (rc)
+		goto out;
+
+	rsp_dw = min_t(size_t, ((DOEHeader *)rsp_buf)->length, PCI_DOE_MAX_DW_SIZE);
+	doe_cdat_snoop(dn, req_buf, req_dw, rsp_buf, rsp_dw);
+	if (copy_to_user(arg, rsp_buf, rsp_dw * sizeof(u32)))
+		rc = -EFAULT;
+out:
+	kvfree(req_buf);
+	kvfree(rsp_buf);
+	return rc;
+}
+
+/*
+ * DOE_VEC_LIST: request headers are checked and the scratch buffers sized
+ * before the mailbox is taken; requests are then copied in and responses
+ * out one at a time while it is held.
+ */
+static long doe_vec_list(struct doe_node *dn, struct doe_vec *vec)
+{
+	struct doe_vec_ent *ents;
+	size_t req_max = 0, rsp_max = 0, rsp_dw;
+	u32 *req = NULL, *rsp = NULL;
+	DOEHeader hdr;
+	long rc = 0;
+	u32 i, n = 0, count;
+
+	if (!vec->count || vec->count > DOE_VEC_MAX)
+		return -EINVAL;
+	count = vec->count;
+
+	ents = vmemdup_user(u64_to_user_ptr(vec->ents_ptr),
+			    array_size(count, sizeof(*ents)));
+	if (IS_ERR(ents))
+		return PTR_ERR(ents);
+
+	/* Whatever happens below, every entry not run reads -ECANCELED */
+	for (i = 0; i < count; i++) {
+		ents[i].status = -ECANCELED;
+		ents[i].rsp_used = 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (copy_from_user(&hdr, u64_to_user_ptr(ents[i].req_ptr), sizeof(hdr))) {
+			rc = -EFAULT;
+			goto out_copy;
+		}
+		if (hdr.length < 2 || hdr.length > PCI_DOE_MAX_DW_SIZE ||
+		    ents[i].rsp_len < 2 * sizeof(u32)) {
+			rc = -EINVAL;
+			goto out_copy;
+		}
+		req_max = max_t(size_t, req_max, hdr.length);
+		rsp_max = max_t(size_t, rsp_max,
+				min_t(size_t, ents[i].rsp_len / sizeof(u32),
+				      PCI_DOE_MAX_DW_SIZE));
+	}
+
+	req = kvmalloc_array(req_max, sizeof(u32), GFP_KERNEL);
+	rsp = kvmalloc_array(rsp_max, sizeof(u32), GFP_KERNEL);
+	if (!req || !rsp) {
+		rc = -ENOMEM;
+		goto out_copy;
+	}
+
+	pcie_doe_lock(&dn->doe);
+	for (i = 0; i < count; i++) {
+		struct doe_vec_ent *ent = &ents[i];
+		size_t rsp_cap = min_t(size_t, ent->rsp_len / sizeof(u32), rsp_max);
+
+		/* The request may have changed since it was sized */
+		if (copy_from_user(&hdr, u64_to_user_ptr(ent->req_ptr), sizeof(hdr)))
+			ent->status = -EFAULT;
+		else if (hdr.length < 2 || hdr.length > req_max)
+			ent->status = -EINVAL;
+		else if (copy_from_user(req, u64_to_user_ptr(ent->req_ptr),
+					hdr.length * sizeof(u32)))
+			ent->status = -EFAULT;
+		else
+			ent->status = __pcie_doe_exchange(&dn->doe, req,
+							  hdr.length * sizeof(u32),
+							  rsp, rsp_cap * sizeof(u32));
+		n++;
+
+		if (!ent->status) {
+			rsp_dw = min_t(size_t, ((DOEHeader *)rsp)->length, rsp_cap);
+			doe_cdat_snoop(dn, req, hdr.length, rsp, rsp_dw);
+			if (copy_to_user(u64_to_user_ptr(ent->rsp_ptr), rsp,
+					 rsp_dw * sizeof(u32)))
+				ent->status = -EFAULT;
+			else
+				ent->rsp_used = rsp_dw * sizeof(u32);
+		}
+
+		if (ent->status && !rc)
+			rc = ent->status;
+		if (ent->status && !(vec->flags & DOE_VEC_F_CONTINUE))
+			break;
+	}
+	pcie_doe_unlock(&dn->doe);
 
-/* Discovery in kernel space */
-static void do_doe_discovery(struct doe_dev *ddev) {
-	int ret = -2;
-    int idx = 0;
-    doe_discovery_rsp response = { 0 };
-    do {
-        idx = response.next_index;
-        doe_discovery request = {
-            .header = {
-                .vendor_id = PCI_DOE_PCI_SIG_VID,
-                .doe_type = PCI_SIG_DOE_DISCOVERY,
-                .length = DIV_ROUND_UP(sizeof(request), sizeof(uint32_t)),
-            },
-            .index = idx,
-        };
-
-        ret = pcie_doe_exchange(&ddev->doe_head->doe, (u32 *)&request, sizeof(request),
-            (u32 *)&response, sizeof(response));
-        dev_info(&ddev->pdev->dev, "ret = %x, len %x, vid %x, type %x, next idx %x\n",
-            ret, response.header.length, response.vendor_id, response.doe_type,
-            response.next_index);
-    } while (response.next_index != 0);
+out_copy:
+	vec->count = n;
+	if (copy_to_user(u64_to_user_ptr(vec->ents_ptr), ents,
+			 array_size(count, sizeof(*ents))))
+		rc = -EFAULT;
+	kvfree(req);
+	kvfree(rsp);
+	kvfree(ents);
+	return rc;
+}
+
+struct doe_user_buf {
+	void __user *buf;
+	size_t len;
+	size_t used;
+};
+
+static int doe_user_emit(void *ctx, const void *data, size_t len)
+{
+	struct doe_user_buf *ub = ctx;
+
+	if (len > ub->len - ub->used)
+		return -ENOSPC;
+	if (copy_to_user(ub->buf + ub->used, data, len))
+		return -EFAULT;
+	ub->used += len;
+	return 0;
+}
+
+/* Follow modes: the requests are generated in the kernel by doe_walk() */
+static long doe_vec_follow(struct doe_node *dn, struct doe_vec *vec)
+{
+	struct doe_user_buf ub = {
+		.buf = u64_to_user_ptr(vec->rsp_ptr),
+		.len = vec->rsp_len,
+	};
+	long rc;
+
+	pcie_doe_lock(&dn->doe);
+	rc = doe_walk(dn, vec->mode == DOE_VEC_FOLLOW_CDAT, doe_user_emit, &ub,
+		      &vec->count);
+	pcie_doe_unlock(&dn->doe);
+
+	vec->rsp_used = ub.used;
+	return rc;
+}
+
+/* DOE_MBOX_VEC: run a chain of exchanges under one mailbox acquisition */
+static long doe_mbox_vec(struct doe_dev *ddev, void __user *arg)
+{
+	struct doe_node *dn;
+	struct doe_vec vec;
+	long rc;
+
+	if (copy_from_user(&vec, arg, sizeof(vec)))
+		return -EFAULT;
+
+	dn = doe_find_mbox(ddev, vec.cap_offset);
+	if (!dn)
+		return -ENODEV;
+
+	switch (vec.mode) {
+	case DOE_VEC_LIST:
+		rc = doe_vec_list(dn, &vec);
+		break;
+	case DOE_VEC_FOLLOW_DISCOVERY:
+	case DOE_VEC_FOLLOW_CDAT:
+		rc = doe_vec_follow(dn, &vec);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (copy_to_user(arg, &vec, sizeof(vec)))
+		return -EFAULT;
+	return rc;
+}
+
+static void doe_file_release(struct kref *kref)
+{
+	kfree(container_of(kref, struct doe_file, kref));
+}
+
+static void doe_async_free(struct doe_async_req *areq)
+{
+	kvfree(areq->req);
+	kvfree(areq->rsp);
+	kfree(areq);
+}
+
+/* Hand a finished request back to its file, or drop it if nobody listens */
+static void doe_async_complete(struct doe_async_req *areq)
+{
+	struct doe_file *dfile = areq->dfile;
+	bool closed;
+
+	spin_lock(&dfile->lock);
+	closed = dfile->closed;
+	if (!closed)
+		list_add_tail(&areq->list, &dfile->done);
+	spin_unlock(&dfile->lock);
+
+	if (closed)
+		doe_async_free(areq);
+	else
+		wake_up_interruptible_poll(&dfile->wq, EPOLLIN | EPOLLRDNORM);
+	kref_put(&dfile->kref, doe_file_release);
+}
+
+static void doe_mbox_work(struct work_struct *work)
+{
+	struct doe_node *dn = container_of(work, struct doe_node, work);
+	struct doe_async_req *areq;
+
+	for (;;) {
+		spin_lock(&dn->qlock);
+		areq = list_first_entry_or_null(&dn->queue, struct doe_async_req, list);
+		if (areq)
+			list_del(&areq->list);
+		spin_unlock(&dn->qlock);
+		if (!areq)
+			break;
+
+		areq->status = pcie_doe_exchange(&dn->doe, areq->req,
+						 areq->req_dw * sizeof(u32), areq->rsp,
+						 areq->rsp_max_dw * sizeof(u32));
+		if (!areq->status) {
+			areq->rsp_dw = min_t(u32, ((DOEHeader *)areq->rsp)->length,
+					     areq->rsp_max_dw);
+			doe_cdat_snoop(dn, areq->req, areq->req_dw, areq->rsp,
+				       areq->rsp_dw);
+		}
+		doe_async_complete(areq);
+	}
+}
+
+/* Fail every request still waiting for the mailbox */
+static void doe_mbox_flush(struct doe_node *dn)
+{
+	struct doe_async_req *areq, *tmp;
+	LIST_HEAD(pending);
+
+	spin_lock(&dn->qlock);
+	list_splice_init(&dn->queue, &pending);
+	spin_unlock(&dn->qlock);
+
+	list_for_each_entry_safe(areq, tmp, &pending, list) {
+		list_del(&areq->list);
+		areq->status = -ENODEV;
+		doe_async_complete(areq);
+	}
+}
+
+/* DOE_MBOX_SUBMIT: copy the request and queue it on its mailbox */
+static long doe_mbox_submit(struct doe_file *dfile, void __user *arg)
+{
+	struct doe_dev *ddev = dfile->ddev;
+	struct doe_async_req *areq;
+	struct doe_submit sub;
+	struct doe_node *dn;
+	DOEHeader hdr;
+	long rc;
+
+	if (copy_from_user(&sub, arg, sizeof(sub)))
+		return -EFAULT;
+	if (sub.rsp_max_dw < 2 || sub.rsp_max_dw > PCI_DOE_MAX_DW_SIZE)
+		return -EINVAL;
+	if (copy_from_user(&hdr, u64_to_user_ptr(sub.req_ptr), sizeof(hdr)))
+		return -EFAULT;
+	if (hdr.length < 2 || hdr.length > PCI_DOE_MAX_DW_SIZE)
+		return -EINVAL;
+
+	dn = doe_find_mbox(ddev, sub.cap_offset);
+	if (!dn)
+		return -ENODEV;
+
+	spin_lock(&dfile->lock);
+	if (dfile->inflight >= DOE_MAX_INFLIGHT) {
+		spin_unlock(&dfile->lock);
+		return -EAGAIN;
+	}
+	dfile->inflight++;
+	spin_unlock(&dfile->lock);
+
+	areq = kzalloc(sizeof(*areq), GFP_KERNEL);
+	if (!areq) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	areq->tag = sub.tag;
+	areq->req_dw = hdr.length;
+	areq->rsp_max_dw = sub.rsp_max_dw;
+	areq->req = kvmalloc_array(areq->req_dw, sizeof(u32), GFP_KERNEL);
+	areq->rsp = kvmalloc_array(areq->rsp_max_dw, sizeof(u32), GFP_KERNEL);
+	if (!areq->req || !areq->rsp) {
+		rc = -ENOMEM;
+		goto err_free;
+	}
+	if (copy_from_user(areq->req, u64_to_user_ptr(sub.req_ptr),
+			   areq->req_dw * sizeof(u32))) {
+		rc = -EFAULT;
+		goto err_free;
+	}
+
+	areq->dfile = dfile;
+	kref_get(&dfile->kref);
+
+	spin_lock(&dn->qlock);
+	list_add_tail(&areq->list, &dn->queue);
+	spin_unlock(&dn->qlock);
+	queue_work(doe_wq, &dn->work);
+	return 0;
+
+err_free:
+	doe_async_free(areq);
+err:
+	spin_lock(&dfile->lock);
+	dfile->inflight--;
+	spin_unlock(&dfile->lock);
+	return rc;
+}
+
+static long doe_mbox_abort(struct doe_dev *ddev, void __user *arg)
+{
+	struct doe_node *dn;
+	u32 cap_offset;
+
+	if (get_user(cap_offset, (u32 __user *)arg))
+		return -EFAULT;
+
+	dn = doe_find_mbox(ddev, cap_offset);
+	if (!dn)
+		return -ENODEV;
+
+	return pcie_doe_reset(&dn->doe);
+}
+
+static long doe_mbox_stats(struct doe_dev *ddev, void __user *arg)
+{
+	struct doe_mbox_stats ust;
+	struct pcie_doe_stats st;
+	struct doe_node *dn;
+
+	if (copy_from_user(&ust, arg, sizeof(ust)))
+		return -EFAULT;
+	if (ust.flags & ~DOE_STATS_F_RESET)
+		return -EINVAL;
+
+	dn = doe_find_mbox(ddev, ust.cap_offset);
+	if (!dn)
+		return -ENODEV;
+
+	pcie_doe_stats_get(&dn->doe, &st, ust.flags & DOE_STATS_F_RESET);
+
+	ust.exchanges = st.exchanges;
+	ust.errors = st.errors;
+	ust.timeouts = st.timeouts;
+	ust.aborts = st.aborts;
+	ust.lat_min_ns = st.lat_min_ns;
+	ust.lat_max_ns = st.lat_max_ns;
+	ust.lat_total_ns = st.lat_total_ns;
+	ust.lock_acquires = st.lock_acquires;
+	ust.lock_wait_total_ns = st.lock_wait_total_ns;
+	ust.lock_wait_max_ns = st.lock_wait_max_ns;
+	ust.lock_hold_total_ns = st.lock_hold_total_ns;
+	ust.lock_hold_max_ns = st.lock_hold_max_ns;
+
+	if (copy_to_user(arg, &ust, sizeof(ust)))
+		return -EFAULT;
+	return 0;
 }
 
 static long doe_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	u32 *req_buf, *rsp_buf;
-	int req_size = (PCI_DOE_MAX_DW_SIZE + 1) * sizeof(u32),
-		rsp_size = PCI_DOE_MAX_DW_SIZE * sizeof(u32);
-	struct inode *inode;
-	struct doe_dev *doe_dev;
-	struct doe_node *doe_node = NULL;
-	DOEHeader *doe_hdr;
+	struct doe_file *dfile = file->private_data;
+	struct doe_dev *ddev = dfile->ddev;
+	long rc;
+
+	down_read(&ddev->rwsem);
+	if (ddev->removed) {
+		rc = -ENODEV;
+		goto out;
+	}
 
 	switch (cmd) {
 	case DOE_MBOX_CMD:
-		/* Add one DW for cap_offset. Users should maintain the mappings for the
-		 * DOE cap offsets and their protocols */
-		req_buf = kmalloc(req_size, GFP_KERNEL);
-		rsp_buf = kmalloc(rsp_size, GFP_KERNEL);
-		inode = file_inode(file);
-		doe_dev = container_of(inode->i_cdev, typeof(*doe_dev), cdev);
-
-		copy_from_user(req_buf, (void __user *)arg, req_size);
-		dev_info(&doe_dev->pdev->dev, "buf: %08x %08x %08x %08x %08x %08x, req_size=%x\n", 
-				req_buf[0], req_buf[1], req_buf[2], req_buf[3], req_buf[4], req_buf[5], req_size);
-		/* Find the struct doe_node corresponding to the offset info from user */
-		for (doe_node = doe_dev->doe_head; doe_node;
-			doe_node = doe_node->next) {
-			dev_info(&doe_dev->pdev->dev, "cap_offset=%x\n", doe_node->doe.cap_offset);
-			if (doe_node->doe.cap_offset == req_buf[0])
-				break;
+		rc = doe_mbox_cmd(ddev, (void __user *)arg);
+		break;
+	case DOE_MBOX_SUBMIT:
+		rc = doe_mbox_submit(dfile, (void __user *)arg);
+		break;
+	case DOE_MBOX_VEC:
+		rc = doe_mbox_vec(ddev, (void __user *)arg);
+		break;
+	case DOE_MBOX_ABORT:
+		rc = doe_mbox_abort(ddev, (void __user *)arg);
+		break;
+	case DOE_MBOX_STATS:
+		rc = doe_mbox_stats(ddev, (void __user *)arg);
+		break;
+	default:
+		rc = -ENOTTY;
+		break;
+	}
+out:
+	up_read(&ddev->rwsem);
+	return rc;
+}
+
+/*
+ * Return as many whole completion records as fit in @count. A record is
+ * only dequeued once it has been copied out, so a short or faulting
+ * buffer loses nothing.
+ */
+static ssize_t doe_read(struct file *file, char __user *buf, size_t count,
+			loff_t *ppos)
+{
+	struct doe_file *dfile = file->private_data;
+	struct doe_async_req *areq;
+	struct doe_cpl cpl;
+	size_t rec_sz, copied = 0;
+	int rc = 0;
+
+	spin_lock(&dfile->lock);
+	while (list_empty(&dfile->done)) {
+		spin_unlock(&dfile->lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		rc = wait_event_interruptible(dfile->wq, !list_empty(&dfile->done));
+		if (rc)
+			return rc;
+		spin_lock(&dfile->lock);
+	}
+
+	while ((areq = list_first_entry_or_null(&dfile->done,
+						 struct doe_async_req, list))) {
+		rec_sz = sizeof(cpl) + areq->rsp_dw * sizeof(u32);
+		if (rec_sz > count - copied) {
+			rc = -EINVAL;
+			break;
 		}
-		if (doe_node == NULL) {
-			printk (KERN_NOTICE "can't find the required capability 0x%x", req_buf[0]);
-			return -ENOTTY;
+		list_del(&areq->list);
+		spin_unlock(&dfile->lock);
+
+		cpl.tag = areq->tag;
+		cpl.status = areq->status;
+		cpl.rsp_dw = areq->rsp_dw;
+		if (copy_to_user(buf + copied, &cpl, sizeof(cpl)) ||
+		    copy_to_user(buf + copied + sizeof(cpl), areq->rsp,
+				 areq->rsp_dw * sizeof(u32))) {
+			spin_lock(&dfile->lock);
+			list_add(&areq->list, &dfile->done);
+			rc = -EFAULT;
+			break;
 		}
+		doe_async_free(areq);
+		copied += rec_sz;
 
-		doe_hdr = (DOEHeader *)(req_buf + 1);
-		pcie_doe_exchange(&doe_node->doe, req_buf + 1,
-			doe_hdr->length * sizeof(u32), rsp_buf, rsp_size);
+		spin_lock(&dfile->lock);
+		dfile->inflight--;
+	}
+	spin_unlock(&dfile->lock);
 
-		doe_hdr = (DOEHeader *)rsp_buf;
-		dev_info(&doe_dev->pdev->dev, "vendor %x, type %x, len %x\n",
-			 doe_hdr->vendor_id, doe_hdr->doe_type,
-			 doe_hdr->length * sizeof(u32));
-		copy_to_user((void __user *)arg, rsp_buf, doe_hdr->length * sizeof(u32));
+	if (!copied)
+		return rc;
+	wake_up_interruptible_poll(&dfile->wq, EPOLLOUT | EPOLLWRNORM);
+	return copied;
+}
 
-		kfree(req_buf);
-		kfree(rsp_buf);
-		return 0;
-	default:
-		return -ENOTTY;
-	}
+static __poll_t doe_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct doe_file *dfile = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &dfile->wq, wait);
+
+	spin_lock(&dfile->lock);
+	if (!list_empty(&dfile->done))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (dfile->inflight < DOE_MAX_INFLIGHT)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	spin_unlock(&dfile->lock);
+
+	if (READ_ONCE(dfile->ddev->removed))
+		mask |= EPOLLHUP;
+	return mask;
+}
+
+static int doe_open(struct inode *inode, struct file *file)
+{
+	struct doe_file *dfile;
+
+	dfile = kzalloc(sizeof(*dfile), GFP_KERNEL);
+	if (!dfile)
+		return -ENOMEM;
+
+	dfile->ddev = container_of(inode->i_cdev, struct doe_dev, cdev);
+	kref_init(&dfile->kref);
+	spin_lock_init(&dfile->lock);
+	INIT_LIST_HEAD(&dfile->done);
+	init_waitqueue_head(&dfile->wq);
+	file->private_data = dfile;
+	return 0;
+}
+
+static int doe_release(struct inode *inode, struct file *file)
+{
+	struct doe_file *dfile = file->private_data;
+	struct doe_async_req *areq, *tmp;
+	LIST_HEAD(done);
+
+	/* Requests still queued are freed as they complete */
+	spin_lock(&dfile->lock);
+	dfile->closed = true;
+	list_splice_init(&dfile->done, &done);
+	spin_unlock(&dfile->lock);
+
+	list_for_each_entry_safe(areq, tmp, &done, list)
+		doe_async_free(areq);
+
+	kref_put(&dfile->kref, doe_file_release);
+	return 0;
 }
 
 static const struct file_operations doe_fops = {
 	.owner = THIS_MODULE,
+	.open = doe_open,
+	.release = doe_release,
+	.read = doe_read,
+	.poll = doe_poll,
 	.unlocked_ioctl = doe_ioctl,
 	.compat_ioctl = compat_ptr_ioctl,
 	.llseek = noop_llseek,
 };
 
-static int doe_create_cdev(struct doe_dev *doe_dev)
+struct doe_cdat_buf {
+	u8 *buf;
+	size_t len;
+	size_t used;
+};
+
+/* The table header comes first and sizes the buffer for the rest */
+static int doe_cdat_emit(void *ctx, const void *data, size_t len)
 {
-	struct cdev *cdev = &doe_dev->cdev;
-	int devno, rc = 0;
+	struct doe_cdat_buf *cb = ctx;
+	u32 tbl_len;
 
-	cdev_init(cdev, &doe_fops);
-	devno = MKDEV(doe_major, /*minor*/0);
-	rc = cdev_add(cdev, devno, 1);
-	if (rc)
-		goto err_cdev;
+	if (!cb->buf) {
+		if (len < CDAT_HDR_DW * sizeof(u32))
+			return -EIO;
+		tbl_len = *(const u32 *)data;
+		if (tbl_len < len || tbl_len > CDAT_TBL_MAX)
+			return -EIO;
+		cb->buf = kvzalloc(tbl_len, GFP_KERNEL);
+		if (!cb->buf)
+			return -ENOMEM;
+		cb->len = tbl_len;
+	}
 
-	doe_class = class_create("doe");
-	device_create(doe_class, NULL, devno, NULL, "doe%d", /*minor*/0);
+	if (len > cb->len - cb->used)
+		return -EIO;
+	memcpy(cb->buf + cb->used, data, len);
+	cb->used += len;
+	return 0;
+}
+
+static int doe_cdat_stop_emit(void *ctx, const void *data, size_t len)
+{
+	return 1;
+}
+
+/*
+ * Check a valid cache against the device: the header entry exchange goes
+ * through doe_cdat_snoop(), which drops the cache if the sequence number
+ * moved. A failed exchange drops it too, as nothing was confirmed.
+ */
+static void doe_cdat_revalidate(struct doe_dev *ddev)
+{
+	u32 count;
+	int rc;
+
+	lockdep_assert_held(&ddev->cdat_lock);
+
+	if (!ddev->cdat_mbox || !READ_ONCE(ddev->cdat_valid))
+		return;
+
+	pcie_doe_lock(&ddev->cdat_mbox->doe);
+	rc = doe_walk(ddev->cdat_mbox, true, doe_cdat_stop_emit, NULL, &count);
+	pcie_doe_unlock(&ddev->cdat_mbox->doe);
+	if (rc < 0)
+		WRITE_ONCE(ddev->cdat_valid, false);
+}
+
+/* Read the CDAT again unless the cached copy is still valid */
+static int doe_cdat_update(struct doe_dev *ddev)
+{
+	struct doe_cdat_buf cb = { 0 };
+	u32 count;
+	int rc;
+
+	lockdep_assert_held(&ddev->cdat_lock);
+
+	if (!ddev->cdat_mbox)
+		return -ENODEV;
+	if (READ_ONCE(ddev->cdat_valid))
+		return 0;
 
+	pcie_doe_lock(&ddev->cdat_mbox->doe);
+	rc = doe_walk(ddev->cdat_mbox, true, doe_cdat_emit, &cb, &count);
+	pcie_doe_unlock(&ddev->cdat_mbox->doe);
+	if (!rc && cb.used != cb.len)
+		rc = -EIO;
+	if (rc) {
+		dev_dbg(&ddev->dev, "CDAT read failed %d after %u entries\n", rc, count);
+		kvfree(cb.buf);
+		return rc;
+	}
+
+	kvfree(ddev->cdat);
+	ddev->cdat = cb.buf;
+	ddev->cdat_len = cb.len;
+	WRITE_ONCE(ddev->cdat_seq, ((u32 *)cb.buf)[CDAT_HDR_SEQ_DW]);
+	smp_store_release(&ddev->cdat_valid, true);
 	return 0;
+}
 
-err_cdev:
-	cdev_del(cdev);
-	unregister_chrdev_region(MKDEV(doe_major, 0), 1);
+static struct doe_dev *to_doe_dev(struct device *dev)
+{
+	return container_of(dev, struct doe_dev, dev);
+}
+
+/* One line per mailbox: cap offset followed by its vid:protocol pairs */
+static ssize_t mailboxes_show(struct device *dev, struct device_attribute *attr,
+			      char *buf)
+{
+	struct doe_dev *ddev = to_doe_dev(dev);
+	struct doe_node *dn;
+	int i, len = 0;
+
+	for (dn = ddev->doe_head; dn; dn = dn->next) {
+		len += sysfs_emit_at(buf, len, "%#x", dn->doe.cap_offset);
+		for (i = 0; i < dn->nr_prots; i++)
+			len += sysfs_emit_at(buf, len, " %04x:%02x",
+					     dn->prots[i] & 0xffff, dn->prots[i] >> 16);
+		len += sysfs_emit_at(buf, len, "\n");
+	}
+	return len;
+}
+static DEVICE_ATTR_RO(mailboxes);
+
+static ssize_t cdat_sequence_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct doe_dev *ddev = to_doe_dev(dev);
+	ssize_t rc;
 
+	mutex_lock(&ddev->cdat_lock);
+	doe_cdat_revalidate(ddev);
+	rc = doe_cdat_update(ddev);
+	if (!rc)
+		rc = sysfs_emit(buf, "%u\n", ddev->cdat_seq);
+	mutex_unlock(&ddev->cdat_lock);
 	return rc;
 }
+static DEVICE_ATTR_RO(cdat_sequence);
+
+/* Writing 1 drops the cache and reads the table again right away */
+static ssize_t cdat_refresh_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct doe_dev *ddev = to_doe_dev(dev);
+	bool refresh;
+	int rc;
+
+	rc = kstrtobool(buf, &refresh);
+	if (rc)
+		return rc;
+	if (!refresh)
+		return count;
+
+	mutex_lock(&ddev->cdat_lock);
+	WRITE_ONCE(ddev->cdat_valid, false);
+	rc = doe_cdat_update(ddev);
+	mutex_unlock(&ddev->cdat_lock);
+	return rc ? rc : count;
+}
+static DEVICE_ATTR_WO(cdat_refresh);
+
+/*
+ * A read of the table comes in chunks. The first (offset 0) checks the
+ * cache with the device and fills it; later chunks are served from that
+ * copy as it is, so a reader never gets parts of two table versions. Only
+ * another read from offset 0 or a refresh can replace it meanwhile.
+ */
+static ssize_t cdat_read(struct file *filp, struct kobject *kobj,
+			 struct bin_attribute *attr, char *buf, loff_t off,
+			 size_t count)
+{
+	struct doe_dev *ddev = to_doe_dev(kobj_to_dev(kobj));
+	ssize_t rc = 0;
+
+	mutex_lock(&ddev->cdat_lock);
+	if (!off) {
+		doe_cdat_revalidate(ddev);
+		rc = doe_cdat_update(ddev);
+	} else if (!ddev->cdat) {
+		rc = doe_cdat_update(ddev);
+	}
+	if (!rc)
+		rc = memory_read_from_buffer(buf, count, &off, ddev->cdat,
+					     ddev->cdat_len);
+	mutex_unlock(&ddev->cdat_lock);
+	return rc;
+}
+static BIN_ATTR_RO(cdat, 0);
+
+static struct attribute *doe_dev_attrs[] = {
+	&dev_attr_mailboxes.attr,
+	&dev_attr_cdat_sequence.attr,
+	&dev_attr_cdat_refresh.attr,
+	NULL
+};
+
+static struct bin_attribute *doe_dev_bin_attrs[] = {
+	&bin_attr_cdat,
+	NULL
+};
+
+/* The CDAT files only show up on functions with a Table Access mailbox */
+static umode_t doe_dev_attr_visible(struct kobject *kobj, struct attribute *a,
+				    int n)
+{
+	struct doe_dev *ddev = to_doe_dev(kobj_to_dev(kobj));
+
+	if (a != &dev_attr_mailboxes.attr && !ddev->cdat_mbox)
+		return 0;
+	return a->mode;
+}
+
+static umode_t doe_dev_bin_attr_visible(struct kobject *kobj,
+					struct bin_attribute *a, int n)
+{
+	struct doe_dev *ddev = to_doe_dev(kobj_to_dev(kobj));
+
+	return ddev->cdat_mbox ? a->attr.mode : 0;
+}
+
+static const struct attribute_group doe_dev_group = {
+	.attrs = doe_dev_attrs,
+	.bin_attrs = doe_dev_bin_attrs,
+	.is_visible = doe_dev_attr_visible,
+	.is_bin_visible = doe_dev_bin_attr_visible,
+};
+
+static const struct attribute_group *doe_dev_groups[] = {
+	&doe_dev_group,
+	NULL
+};
+
+static void doe_free_mboxes(struct doe_dev *ddev)
+{
+	struct doe_node *dn;
+
+	while ((dn = ddev->doe_head)) {
+		ddev->doe_head = dn->next;
+		vfree(dn);
+	}
+}
+
+static void doe_dev_release(struct device *dev)
+{
+	struct doe_dev *ddev = container_of(dev, struct doe_dev, dev);
+
+	doe_free_mboxes(ddev);
+	kvfree(ddev->cdat);
+	if (ddev->minor >= 0)
+		ida_free(&doe_minor_ida, ddev->minor);
+	pci_dev_put(ddev->pdev);
+	kfree(ddev);
+}
+
+static int doe_create_cdev(struct doe_dev *ddev)
+{
+	struct device *dev = &ddev->dev;
+	int rc;
+
+	cdev_init(&ddev->cdev, &doe_fops);
+	ddev->cdev.owner = THIS_MODULE;
+
+	dev->class = doe_class;
+	dev->parent = &ddev->pdev->dev;
+	dev->groups = doe_dev_groups;
+	dev->devt = MKDEV(doe_major, ddev->minor);
+	rc = dev_set_name(dev, "doe%d", ddev->minor);
+	if (rc)
+		return rc;
+
+	return cdev_device_add(&ddev->cdev, dev);
+}
 
 static int doe_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 {
 	int rc;
 	struct doe_dev *ddev = NULL;
 	u32 cap_offset, reg_val;
-	struct doe_node **dnp;
+	struct doe_node **dnp, *dn;
 	bool use_int = false;
 
-	printk("doe_probe\n");
 	rc = pcim_enable_device(pdev);
-	pci_set_master(pdev);
 	if (rc) {
 		dev_info(&pdev->dev, "pcim_enable_device failed\n");
 		return rc;
 	}
+	pci_set_master(pdev);
 
 	ddev = kzalloc(sizeof(struct doe_dev), GFP_KERNEL);
-	ddev->pdev = pdev;
-	dnp = &ddev->doe_head;
+	if (!ddev)
+		return -ENOMEM;
+	ddev->pdev = pci_dev_get(pdev);
+	init_rwsem(&ddev->rwsem);
+	mutex_init(&ddev->cdat_lock);
+	device_initialize(&ddev->dev);
+	ddev->dev.release = doe_dev_release;
 
-	rc = pci_alloc_irq_vectors(pdev, 1, 4, PCI_IRQ_MSI);
+	ddev->minor = ida_alloc_max(&doe_minor_ida, DOE_MAX_DEVS - 1, GFP_KERNEL);
+	if (ddev->minor < 0) {
+		rc = ddev->minor;
+		goto err_put;
+	}
+
+	/*
+	 * The DOE interrupt message number may be anywhere in the function's
+	 * vector table. Without vectors every mailbox falls back to polling.
+	 */
+	rc = use_irq ? pci_alloc_irq_vectors(pdev, 1, 32, PCI_IRQ_MSIX | PCI_IRQ_MSI) : 0;
 	if (rc > 0) {
 		dev_info(&pdev->dev, "allocated %d irqs\n", rc);
 		use_int = true;
 	} else {
-		dev_info(&pdev->dev, "alloc %d irqs failed\n", rc);
-		kfree(ddev);
-		pci_set_drvdata(pdev, NULL);
-		return -1;
+		dev_info(&pdev->dev, "alloc irqs failed %d, polling\n", rc);
 	}
 
+	/* Each mailbox gets its own lock, completion and interrupt */
+	dnp = &ddev->doe_head;
 	for (cap_offset = PCIE_EXT_CAP_OFFSET; cap_offset; cap_offset = PCI_EXT_CAP_NEXT(reg_val)) {
 		pci_read_config_dword(pdev, cap_offset, &reg_val);
 
 		if (PCI_EXT_CAP_ID(reg_val) == PCI_EXT_CAP_ID_DOE) {
 			dev_info(&pdev->dev, "cap = %x\n", cap_offset);
-			*dnp = vmalloc(sizeof(struct doe_node));
-			pcie_doe_init(&(*dnp)->doe, pdev, cap_offset, use_int);
+			*dnp = vzalloc(sizeof(struct doe_node));
+			if (!*dnp) {
+				rc = -ENOMEM;
+				goto err_mbox;
+			}
+			(*dnp)->ddev = ddev;
+			spin_lock_init(&(*dnp)->qlock);
+			INIT_LIST_HEAD(&(*dnp)->queue);
+			INIT_WORK(&(*dnp)->work, doe_mbox_work);
+			rc = pcie_doe_init(&(*dnp)->doe, pdev, cap_offset, use_int);
+			if (rc) {
+				vfree(*dnp);
+				*dnp = NULL;
+				goto err_mbox;
+			}
 			dnp = &(*dnp)->next;
 		}
 	}
 
-	dev_set_drvdata(&pdev->dev, ddev);
-	doe_create_cdev(ddev);
+	ddev->debugfs = debugfs_create_dir(pci_name(pdev), doe_debugfs);
+	for (dn = ddev->doe_head; dn; dn = dn->next)
+		pcie_doe_debugfs_init(&dn->doe, ddev->debugfs);
+
+	for (dn = ddev->doe_head; dn; dn = dn->next)
+		do_doe_discovery(ddev, dn);
 
-	do_doe_discovery(ddev);
+	dev_set_drvdata(&pdev->dev, ddev);
+	rc = doe_create_cdev(ddev);
+	if (rc)
+		goto err_cdev;
 
+	dev_info(&pdev->dev, "registered %s\n", dev_name(&ddev->dev));
 	return 0;
+
+err_cdev:
+	dev_set_drvdata(&pdev->dev, NULL);
+	debugfs_remove_recursive(ddev->debugfs);
+err_mbox:
+	for (dn = ddev->doe_head; dn; dn = dn->next)
+		pcie_doe_fini(&dn->doe);
+	pci_free_irq_vectors(pdev);
+err_put:
+	put_device(&ddev->dev);
+	return rc;
 }
 
 static void doe_remove(struct pci_dev *pdev)
 {
 	struct doe_dev *ddev;
+	struct doe_node *dn;
 
 	ddev = dev_get_drvdata(&pdev->dev);
-	pcie_doe_fini(pdev);
+	cdev_device_del(&ddev->cdev, &ddev->dev);
 
-	/* Reset DOE control register*/
-	pci_write_config_dword(pdev, ddev->doe_head->doe.cap_offset + PCI_DOE_CTRL, 0);
+	/* Wait for in-flight exchanges, later ones fail with -ENODEV */
+	down_write(&ddev->rwsem);
+	ddev->removed = true;
+	up_write(&ddev->rwsem);
+
+	/* No more submissions: fail the queued ones, wait for the running one */
+	for (dn = ddev->doe_head; dn; dn = dn->next) {
+		doe_mbox_flush(dn);
+		cancel_work_sync(&dn->work);
+	}
+
+	debugfs_remove_recursive(ddev->debugfs);
+	for (dn = ddev->doe_head; dn; dn = dn->next)
+		pcie_doe_fini(&dn->doe);
+	pci_free_irq_vectors(pdev);
 
-	kfree(ddev);
 	pci_set_drvdata(pdev, NULL);
+	put_device(&ddev->dev);
 }
 
 static const struct pci_device_id doe_pci_tbl[] = {
@@ -217,11 +1256,25 @@ static const struct pci_device_id doe_pci_tbl[] = {
 };
 MODULE_DEVICE_TABLE(pci, doe_pci_tbl);
 
+/* A reset (FLR, bus reset) may come with new firmware and a new CDAT */
+static void doe_reset_done(struct pci_dev *pdev)
+{
+	struct doe_dev *ddev = dev_get_drvdata(&pdev->dev);
+
+	if (ddev)
+		WRITE_ONCE(ddev->cdat_valid, false);
+}
+
+static const struct pci_error_handlers doe_err_handler = {
+	.reset_done		= doe_reset_done,
+};
+
 static struct pci_driver doe_driver = {
 	.name			= KBUILD_MODNAME,
 	.id_table		= doe_pci_tbl,
 	.probe			= doe_probe,
 	.remove			= doe_remove,
+	.err_handler		= &doe_err_handler,
 };
 
 static __init int doe_init(void)
@@ -229,37 +1282,52 @@ static __init int doe_init(void)
 	int rc;
 	dev_t devt;
 
-	printk("doe_init\n");
-	rc = alloc_chrdev_region(&devt, 0, 1, "doe");
+	rc = alloc_chrdev_region(&devt, 0, DOE_MAX_DEVS, "doe");
 	if (rc) {
 		printk("alloc_chrdev_region failed, rc=%x\n", rc);
 		return rc;
 	}
-
 	doe_major = MAJOR(devt);
 
+	doe_class = class_create("doe");
+	if (IS_ERR(doe_class)) {
+		rc = PTR_ERR(doe_class);
+		printk("class_create failed, rc=%x\n", rc);
+		goto err_class;
+	}
+
+	doe_wq = alloc_workqueue("doe", WQ_UNBOUND, 0);
+	if (!doe_wq) {
+		rc = -ENOMEM;
+		goto err_wq;
+	}
+
+	doe_debugfs = debugfs_create_dir("doe", NULL);
+
 	rc = pci_register_driver(&doe_driver);
 	if (rc) {
-		printk("alloc_chrdev_region failed, rc=%x\n", rc);
+		printk("pci_register_driver failed, rc=%x\n", rc);
 		goto err_driver;
 	}
 
 	return 0;
 err_driver:
-	unregister_chrdev_region(MKDEV(doe_major, 0), 1);
+	debugfs_remove_recursive(doe_debugfs);
+	destroy_workqueue(doe_wq);
+err_wq:
+	class_destroy(doe_class);
+err_class:
+	unregister_chrdev_region(MKDEV(doe_major, 0), DOE_MAX_DEVS);
 	return rc;
 }
 
 static __exit void doe_exit(void)
 {
-
-	if (doe_class)
-		device_destroy(doe_class, MKDEV(doe_major, 0));
-	if (doe_class)
-		class_destroy(doe_class);
-	unregister_chrdev_region(MKDEV(doe_major, 0), 1);
-
 	pci_unregister_driver(&doe_driver);
+	debugfs_remove_recursive(doe_debugfs);
+	destroy_workqueue(doe_wq);
+	class_destroy(doe_class);
+	unregister_chrdev_region(MKDEV(doe_major, 0), DOE_MAX_DEVS);
 }
 
 MODULE_LICENSE("GPL v2");
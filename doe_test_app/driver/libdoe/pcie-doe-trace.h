@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints for DOE mailbox exchanges.
+ *
+ * doe_submit fires once the request has been written and GO set,
+ * doe_ready once Data Object Ready (or Error) is seen, and doe_complete
+ * after the response has been drained. They compile to a static branch
+ * when tracing is disabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM doe
+
+#if !defined(_PCIE_DOE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PCIE_DOE_TRACE_H
+
+#include <linux/bitfield.h>
+#include <linux/pci.h>
+#include <linux/tracepoint.h>
+#include "pci_regs.h"
+#include "pcie-doe.h"
+
+#define DOE_TP_PCI_FIELDS			\
+	__field(u16, domain)			\
+	__field(u16, bdf)			\
+	__field(u16, cap)
+
+#define DOE_TP_PCI_ASSIGN(doe)						\
+	do {								\
+		__entry->domain = pci_domain_nr((doe)->pdev->bus);	\
+		__entry->bdf = pci_dev_id((doe)->pdev);			\
+		__entry->cap = (doe)->cap_offset;			\
+	} while (0)
+
+#define DOE_TP_PCI_FMT		"%04x:%02x:%02x.%d cap %#x"
+#define DOE_TP_PCI_ARGS						\
+	__entry->domain, __entry->bdf >> 8,			\
+	PCI_SLOT(__entry->bdf & 0xff), PCI_FUNC(__entry->bdf & 0xff),	\
+	__entry->cap
+
+TRACE_EVENT(doe_submit,
+	TP_PROTO(struct pcie_doe *doe, const u32 *request, size_t request_sz),
+	TP_ARGS(doe, request, request_sz),
+	TP_STRUCT__entry(
+		DOE_TP_PCI_FIELDS
+		__field(u16, vid)
+		__field(u8, type)
+		__field(u32, dw)
+	),
+	TP_fast_assign(
+		DOE_TP_PCI_ASSIGN(doe);
+		__entry->vid = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_VID, request[0]);
+		__entry->type = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_TYPE, request[0]);
+		__entry->dw = request_sz / sizeof(u32);
+	),
+	TP_printk(DOE_TP_PCI_FMT " vid %#06x type %u dw %u",
+		  DOE_TP_PCI_ARGS, __entry->vid, __entry->type, __entry->dw)
+);
+
+TRACE_EVENT(doe_ready,
+	TP_PROTO(struct pcie_doe *doe, u32 status, u64 wait_ns),
+	TP_ARGS(doe, status, wait_ns),
+	TP_STRUCT__entry(
+		DOE_TP_PCI_FIELDS
+		__field(u32, status)
+		__field(u64, wait_ns)
+		__field(bool, use_int)
+	),
+	TP_fast_assign(
+		DOE_TP_PCI_ASSIGN(doe);
+		__entry->status = status;
+		__entry->wait_ns = wait_ns;
+		__entry->use_int = doe->use_int;
+	),
+	TP_printk(DOE_TP_PCI_FMT " status %#010x wait %llu ns (%s)",
+		  DOE_TP_PCI_ARGS, __entry->status, __entry->wait_ns,
+		  __entry->use_int ? "irq" : "poll")
+);
+
+TRACE_EVENT(doe_complete,
+	TP_PROTO(struct pcie_doe *doe, const u32 *response, int ret, u64 lat_ns),
+	TP_ARGS(doe, response, ret, lat_ns),
+	TP_STRUCT__entry(
+		DOE_TP_PCI_FIELDS
+		__field(u16, vid)
+		__field(u8, type)
+		__field(u32, dw)
+		__field(int, ret)
+		__field(u64, lat_ns)
+	),
+	TP_fast_assign(
+		DOE_TP_PCI_ASSIGN(doe);
+		__entry->vid = ret ? 0 : FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_VID, response[0]);
+		__entry->type = ret ? 0 : FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_1_TYPE, response[0]);
+		__entry->dw = ret ? 0 : FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_2_LENGTH, response[1]);
+		__entry->ret = ret;
+		__entry->lat_ns = lat_ns;
+	),
+	TP_printk(DOE_TP_PCI_FMT " vid %#06x type %u dw %u ret %d lat %llu ns",
+		  DOE_TP_PCI_ARGS, __entry->vid, __entry->type, __entry->dw,
+		  __entry->ret, __entry->lat_ns)
+);
+
+#endif /* _PCIE_DOE_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pcie-doe-trace
+#include <trace/define_trace.h>
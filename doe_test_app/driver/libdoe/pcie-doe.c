@@ -7,35 +7,114 @@
  */
 
 #include <linux/bitfield.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/interrupt.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
 #include <linux/mutex.h>
 #include <linux/pci.h>
+#include <linux/seq_file.h>
 #include "pci_regs.h"
 #include "pcie-doe.h"
 //#include <pcie-doe.h>
 
+#define CREATE_TRACE_POINTS
+#include "pcie-doe-trace.h"
+
+/*
+ * The spec allows a DOE response to take up to 1 second. Keep the generous
+ * timeout the driver has always used for slow device firmware.
+ */
+#define PCIE_DOE_TIMEOUT_MS		10000
+/* Re-check the status register this often when waiting for the interrupt */
+#define PCIE_DOE_IRQ_RECHECK_MS		10
+/* Busy-poll this long before starting to sleep between status reads */
+#define PCIE_DOE_POLL_SPIN_NS		(50 * NSEC_PER_USEC)
+/* Sleep interval bounds for the polling fallback, doubled on each miss */
+#define PCIE_DOE_POLL_MIN_US		10
+#define PCIE_DOE_POLL_MAX_US		1000
+
 static irqreturn_t doe_irq(int irq, void *data)
 {
 	struct pcie_doe *doe = data;
 	struct pci_dev *pdev = doe->pdev;
 	u32 val;
 
-	dev_info(&pdev->dev, "doe_irq recv msi irq\n");
 	pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS, &val);
-	/* Leave the error case to be handled outside irq */
-	if (FIELD_GET(PCI_DOE_STATUS_ERROR, val)) {
-		dev_info(&pdev->dev, "doe_irq doe err\n");
-		//complete(&doe->c);
-		return IRQ_HANDLED;
+	if (!FIELD_GET(PCI_DOE_STATUS_INT_STATUS, val))
+		return IRQ_NONE;
+
+	/*
+	 * Interrupt Status is RW1C. Error and Data Object Ready are both
+	 * reported through the same interrupt; the waiter sorts them out.
+	 */
+	pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS,
+			       PCI_DOE_STATUS_INT_STATUS);
+	complete(&doe->c);
+	return IRQ_HANDLED;
+}
+
+static u32 pcie_doe_ctrl_int(struct pcie_doe *doe)
+{
+	return doe->use_int ? PCI_DOE_CTRL_INT_EN : 0;
+}
+
+static bool pcie_doe_status_done(u32 val)
+{
+	return FIELD_GET(PCI_DOE_STATUS_ERROR, val) ||
+	       FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, val);
+}
+
+/*
+ * Wait for the DOE interrupt. The status register is re-read every
+ * PCIE_DOE_IRQ_RECHECK_MS so a lost or unsignalled interrupt only costs
+ * latency instead of failing the exchange.
+ */
+static int pcie_doe_wait_irq(struct pcie_doe *doe, u32 *val, ktime_t deadline)
+{
+	struct pci_dev *pdev = doe->pdev;
+
+	for (;;) {
+		wait_for_completion_timeout(&doe->c,
+				msecs_to_jiffies(PCIE_DOE_IRQ_RECHECK_MS));
+		pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS, val);
+		if (pcie_doe_status_done(*val))
+			return 0;
+		if (ktime_after(ktime_get(), deadline))
+			return -ETIMEDOUT;
 	}
-	if (FIELD_GET(PCI_DOE_STATUS_INT_STATUS, val)) {
-		pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS,
-				       val & (~PCI_DOE_STATUS_INT_STATUS));
-		dev_info(&pdev->dev, "doe_irq clear int status bit\n");
+}
+
+/*
+ * Adaptive polling for mailboxes without a usable interrupt: spin on the
+ * status register for PCIE_DOE_POLL_SPIN_NS, which covers the common case
+ * of firmware answering within microseconds, then back off exponentially
+ * from PCIE_DOE_POLL_MIN_US to PCIE_DOE_POLL_MAX_US between reads.
+ */
+static int pcie_doe_poll(struct pcie_doe *doe, u32 *val, ktime_t deadline)
+{
+	struct pci_dev *pdev = doe->pdev;
+	ktime_t spin_end = ktime_add_ns(ktime_get(), PCIE_DOE_POLL_SPIN_NS);
+	unsigned long delay = PCIE_DOE_POLL_MIN_US;
+	ktime_t now;
+
+	for (;;) {
+		pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS, val);
+		if (pcie_doe_status_done(*val))
+			return 0;
+
+		now = ktime_get();
+		if (ktime_after(now, deadline))
+			return -ETIMEDOUT;
+		if (ktime_before(now, spin_end)) {
+			cpu_relax();
+			continue;
+		}
+
+		usleep_range(delay, delay * 2);
+		delay = min(delay * 2, (unsigned long)PCIE_DOE_POLL_MAX_US);
 	}
-	//complete(&doe->c);
-	return IRQ_HANDLED;
 }
 
 static int pcie_doe_abort(struct pcie_doe *doe)
@@ -45,7 +124,7 @@ static int pcie_doe_abort(struct pcie_doe *doe)
 	u32 val;
 
 	pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_CTRL,
-			       PCI_DOE_CTRL_ABORT | PCI_DOE_CTRL_INT_EN);
+			       PCI_DOE_CTRL_ABORT | pcie_doe_ctrl_int(doe));
 	/* Abort is allowed to take up to 1 second */
 	do {
 		retry++;
@@ -71,18 +150,18 @@ static int pcie_doe_abort(struct pcie_doe *doe)
  * Caller responsible for calling pci_alloc_irq_vectors() including DOE
  * interrupt.
  */
-struct pcie_doe *g_doe = NULL;
-u32 g_irq_vector = 0;
 int pcie_doe_init(struct pcie_doe *doe, struct pci_dev *pdev, int doe_offset,
 		  bool use_int)
 {
-	u32 val;
-	int rc;
+	u32 val, msg_num;
+	int irq, rc;
 
 	mutex_init(&doe->lock);
 	init_completion(&doe->c);
 	doe->cap_offset = doe_offset;
 	doe->pdev = pdev;
+	doe->use_int = false;
+	doe->irq = 0;
 #if 0
 	/* Reset the mailbox by issuing an abort */
 	rc = pcie_doe_abort(doe);
@@ -95,19 +174,27 @@ int pcie_doe_init(struct pcie_doe *doe, struct pci_dev *pdev, int doe_offset,
 	pci_read_config_dword(pdev, doe_offset + PCI_DOE_CAP, &val);
 	dev_info(&pdev->dev, "doe cap reg[0x4]= 0x%x\n", val);
 
-	g_doe = doe;
-
 	if (use_int && FIELD_GET(PCI_DOE_CAP_INT, val)) {
-		g_irq_vector = pci_irq_vector(pdev, FIELD_GET(PCI_DOE_CAP_IRQ, val));
-		dev_info(&pdev->dev, "g_irq_vector = %d, rc = %x\n",
-		       FIELD_GET(PCI_DOE_CAP_IRQ, val), g_irq_vector);
-		rc = devm_request_irq(&pdev->dev, g_irq_vector, doe_irq, 0, "DOE", doe);
-		//rc = pci_request_irq(pdev, g_irq_vector, doe_irq, NULL, g_doe, "DOE");
-		if (rc)
-			return rc;
-
-		dev_info(&pdev->dev, "devm_request_irq success 0x%x\n", g_irq_vector);
-		doe->use_int = use_int;
+		msg_num = FIELD_GET(PCI_DOE_CAP_IRQ, val);
+		irq = pci_irq_vector(pdev, msg_num);
+		if (irq < 0) {
+			dev_info(&pdev->dev, "doe msg num %u not allocated, polling\n",
+				 msg_num);
+			return 0;
+		}
+
+		/* Several mailboxes may report through the same message number */
+		rc = devm_request_irq(&pdev->dev, irq, doe_irq, IRQF_SHARED,
+				      "DOE", doe);
+		if (rc) {
+			dev_info(&pdev->dev, "request irq %d failed %d, polling\n",
+				 irq, rc);
+			return 0;
+		}
+
+		dev_info(&pdev->dev, "devm_request_irq success 0x%x\n", irq);
+		doe->irq = irq;
+		doe->use_int = true;
 		pci_write_config_dword(pdev, doe_offset + PCI_DOE_CTRL,
 				       FIELD_PREP(PCI_DOE_CTRL_INT_EN, 1));
 	}
@@ -115,24 +202,200 @@ int pcie_doe_init(struct pcie_doe *doe, struct pci_dev *pdev, int doe_offset,
 	return 0;
 }
 
-void pcie_doe_fini(struct pci_dev *pdev)
+/**
+ * pcie_doe_fini() - Release a DOE mailbox set up by pcie_doe_init()
+ * @doe: state structure for the DOE mailbox
+ *
+ * Disables the mailbox interrupt and frees its handler. The caller frees
+ * the function's IRQ vectors once every mailbox has been released.
+ */
+void pcie_doe_fini(struct pcie_doe *doe)
+{
+	struct pci_dev *pdev = doe->pdev;
+
+	/* Reset DOE control register */
+	pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_CTRL, 0);
+	if (doe->use_int) {
+		devm_free_irq(&pdev->dev, doe->irq, doe);
+		doe->use_int = false;
+	}
+}
+
+static void pcie_doe_account(struct pcie_doe *doe, int ret, u64 lat_ns)
 {
-	pci_free_irq_vectors(pdev);
-	if (g_doe) {
-		if (g_doe->use_int) {
-			devm_free_irq(&pdev->dev, g_irq_vector, g_doe);
-			//pci_free_irq(pdev, g_irq_vector, g_doe);
-			dev_info(&pdev->dev, "devm_free_irq 0x%x\n", g_irq_vector);
-		}
-		g_doe = NULL;
+	struct pcie_doe_stats *st = &doe->stats;
+
+	st->exchanges++;
+	if (ret == -ETIMEDOUT)
+		st->timeouts++;
+	else if (ret)
+		st->errors++;
+
+	if (!st->lat_min_ns || lat_ns < st->lat_min_ns)
+		st->lat_min_ns = lat_ns;
+	if (lat_ns > st->lat_max_ns)
+		st->lat_max_ns = lat_ns;
+	st->lat_total_ns += lat_ns;
+	st->lat_hist[min_t(int, ilog2(lat_ns | 1), PCIE_DOE_LAT_BUCKETS - 1)]++;
+}
+
+/**
+ * pcie_doe_stats_get() - Snapshot the mailbox counters
+ * @doe: DOE mailbox state structure
+ * @st: receives the counters
+ * @reset: clear the counters after reading them
+ *
+ * Does not count as a lock acquisition itself.
+ */
+void pcie_doe_stats_get(struct pcie_doe *doe, struct pcie_doe_stats *st,
+			bool reset)
+{
+	mutex_lock(&doe->lock);
+	*st = doe->stats;
+	if (reset)
+		memset(&doe->stats, 0, sizeof(doe->stats));
+	mutex_unlock(&doe->lock);
+}
+
+static int pcie_doe_stats_show(struct seq_file *m, void *unused)
+{
+	struct pcie_doe *doe = m->private;
+	struct pcie_doe_stats st;
+	int i;
+
+	pcie_doe_stats_get(doe, &st, false);
+
+	seq_printf(m, "mode:         %s\n", doe->use_int ? "irq" : "poll");
+	seq_printf(m, "exchanges:    %llu\n", st.exchanges);
+	seq_printf(m, "errors:       %llu\n", st.errors);
+	seq_printf(m, "timeouts:     %llu\n", st.timeouts);
+	seq_printf(m, "aborts:       %llu\n", st.aborts);
+	seq_printf(m, "lat_min_ns:   %llu\n", st.lat_min_ns);
+	seq_printf(m, "lat_max_ns:   %llu\n", st.lat_max_ns);
+	seq_printf(m, "lat_avg_ns:   %llu\n",
+		   st.exchanges ? div64_u64(st.lat_total_ns, st.exchanges) : 0);
+	seq_printf(m, "lock_acquires: %llu\n", st.lock_acquires);
+	seq_printf(m, "lock_wait_max_ns: %llu\n", st.lock_wait_max_ns);
+	seq_printf(m, "lock_wait_avg_ns: %llu\n",
+		   st.lock_acquires ? div64_u64(st.lock_wait_total_ns, st.lock_acquires) : 0);
+	seq_printf(m, "lock_hold_max_ns: %llu\n", st.lock_hold_max_ns);
+	seq_printf(m, "lock_hold_avg_ns: %llu\n",
+		   st.lock_acquires ? div64_u64(st.lock_hold_total_ns, st.lock_acquires) : 0);
+	seq_puts(m, "lat_hist_ns:\n");
+	for (i = 0; i < PCIE_DOE_LAT_BUCKETS; i++) {
+		if (!st.lat_hist[i])
+			continue;
+		seq_printf(m, "  [%12llu, %12llu%c %llu\n", 1ULL << i,
+			   1ULL << (i + 1),
+			   i == PCIE_DOE_LAT_BUCKETS - 1 ? '+' : ')',
+			   st.lat_hist[i]);
 	}
+
+	return 0;
+}
+
+static int pcie_doe_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pcie_doe_stats_show, inode->i_private);
 }
 
+/* Any write to the stats file clears the counters */
+static ssize_t pcie_doe_stats_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct pcie_doe *doe = ((struct seq_file *)file->private_data)->private;
+	struct pcie_doe_stats st;
+
+	pcie_doe_stats_get(doe, &st, true);
+
+	return count;
+}
 
+static const struct file_operations pcie_doe_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = pcie_doe_stats_open,
+	.read = seq_read,
+	.write = pcie_doe_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
 /**
- * pcie_doe_exchange() - Send a request and receive a response
+ * pcie_doe_debugfs_init() - Expose mailbox counters and latency histogram
+ * @doe: DOE mailbox state structure
+ * @parent: debugfs directory of the owning device
+ *
+ * Creates <parent>/mbox_<cap offset>/stats. Reading it returns the
+ * exchange, error, timeout and abort counts, min/max/avg latency and a
+ * log2 histogram in ns, and how long users waited for and held the
+ * mailbox. Writing anything to it resets the counters.
+ */
+void pcie_doe_debugfs_init(struct pcie_doe *doe, struct dentry *parent)
+{
+	char name[16];
+
+	snprintf(name, sizeof(name), "mbox_%03x", doe->cap_offset);
+	doe->debugfs = debugfs_create_dir(name, parent);
+	debugfs_create_file("stats", 0600, doe->debugfs, doe,
+			    &pcie_doe_stats_fops);
+}
+
+/**
+ * pcie_doe_lock() - Take the mailbox for a chain of exchanges
+ * @doe: DOE mailbox state structure
+ *
+ * Callers that run several dependent exchanges (a discovery walk, a CDAT
+ * table read) hold the mailbox across all of them with pcie_doe_lock() and
+ * __pcie_doe_exchange(), so no other user interleaves. Wait and hold
+ * times are accounted in the mailbox stats.
+ */
+void pcie_doe_lock(struct pcie_doe *doe)
+{
+	struct pcie_doe_stats *st = &doe->stats;
+	u64 start = ktime_get_ns(), wait;
+
+	mutex_lock(&doe->lock);
+	doe->lock_t0 = ktime_get_ns();
+	wait = doe->lock_t0 - start;
+
+	st->lock_acquires++;
+	st->lock_wait_total_ns += wait;
+	if (wait > st->lock_wait_max_ns)
+		st->lock_wait_max_ns = wait;
+}
+
+void pcie_doe_unlock(struct pcie_doe *doe)
+{
+	struct pcie_doe_stats *st = &doe->stats;
+	u64 hold = ktime_get_ns() - doe->lock_t0;
+
+	st->lock_hold_total_ns += hold;
+	if (hold > st->lock_hold_max_ns)
+		st->lock_hold_max_ns = hold;
+	mutex_unlock(&doe->lock);
+}
+
+/**
+ * pcie_doe_reset() - Abort whatever the mailbox is doing
  * @doe: DOE mailbox state structure
+ *
+ * Waits for the mailbox like an exchange does, so it never cuts into one.
+ * Return: 0 on success, -EIO if the mailbox stays busy or in error.
+ */
+int pcie_doe_reset(struct pcie_doe *doe)
+{
+	int ret;
+
+	pcie_doe_lock(doe);
+	ret = pcie_doe_abort(doe);
+	doe->stats.aborts++;
+	pcie_doe_unlock(doe);
+	return ret;
+}
+
+/**
+ * __pcie_doe_exchange() - Send a request and receive a response
+ * @doe: DOE mailbox state structure, locked with pcie_doe_lock()
  * @request: request data to be sent
  * @request_sz: size of request in bytes
  * @response: buffer into which to place the response
@@ -141,14 +404,15 @@ void pcie_doe_fini(struct pci_dev *pdev)
  * Return: 0 on success, < 0 on error
  * Excess data will be discarded.
  */
-int pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
-		      u32 *response, size_t response_sz)
+int __pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
+			u32 *response, size_t response_sz)
 {
 	struct pci_dev *pdev = doe->pdev;
 	int ret = 0;
 	int i;
 	u32 val;
-	int retry = -1;
+	ktime_t deadline;
+	u64 t_start, t_ready;
 	size_t length;
 
 	/* DOE requests must be a whole number of DW */
@@ -160,7 +424,8 @@ int pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
 	if (response_sz < 2 * sizeof(u32))
 		return -EINVAL;
 
-	mutex_lock(&doe->lock);
+	lockdep_assert_held(&doe->lock);
+	t_start = ktime_get_ns();
 	/*
 	 * Check the DOE busy bit is not set.
 	 * If it is set, this could indicate someone other than Linux is
@@ -168,98 +433,67 @@ int pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
 	 */
 	pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS, &val);
 	if (FIELD_GET(PCI_DOE_STATUS_BUSY, val)) {
-		dev_info(&pdev->dev, "!!!!!!!!!!!! busy !!!!!!!!!!\n");
+		dev_dbg(&pdev->dev, "mailbox busy before submit\n");
 		pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS, 0);
 		//ret = -EBUSY;
-		//goto unlock;
+		//goto out;
 	}
 
 	if (FIELD_GET(PCI_DOE_STATUS_ERROR, val)) {
-		dev_info(&pdev->dev, "!!!!!!!!!!!! err !!!!!!!!!!\n");
+		dev_dbg(&pdev->dev, "mailbox error before submit\n");
 		pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS, 0);
 		//ret = pcie_doe_abort(doe);
 		//if (ret)
-		//	goto unlock;
+		//	goto out;
 	}
 
-	dev_info(&pdev->dev, "================ start ==============\n");
-	for (i = 0; i < request_sz / 4; i++) {
+	for (i = 0; i < request_sz / 4; i++)
 		pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_WRITE,
 				       request[i]);
-		dev_info(&pdev->dev, "request[%d] = %x\n", i, request[i]);
-	}
 
 	reinit_completion(&doe->c);
 	pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_CTRL,
-			       PCI_DOE_CTRL_GO | PCI_DOE_CTRL_INT_EN);
-
-	//if (doe->use_int) {
-	if (0) {
-		dev_info(&pdev->dev, "wait for irq doe rdy\n");
-		/*
-		 * Timeout of 1 second from 6.xx.1 ECN - Data Object Exchange
-		 * Note a protocol is allowed to specify a different timeout, so
-		 * that may need supporting in future.
-		 */
-		if (!wait_for_completion_timeout(&doe->c,
-						 msecs_to_jiffies(10000))) {
-			dev_info(&pdev->dev, "msi irq timeout\n");
-			ret = -ETIMEDOUT;
-			dev_info(&pdev->dev, "irq: doe rdy timeout\n");
-			goto unlock;
-		}
+			       PCI_DOE_CTRL_GO | pcie_doe_ctrl_int(doe));
+	trace_doe_submit(doe, request, request_sz);
+	t_ready = ktime_get_ns();
+
+	deadline = ktime_add_ms(ktime_get(), PCIE_DOE_TIMEOUT_MS);
+	if (doe->use_int)
+		ret = pcie_doe_wait_irq(doe, &val, deadline);
+	else
+		ret = pcie_doe_poll(doe, &val, deadline);
+	if (ret) {
+		dev_info(&pdev->dev, "%s: doe rdy timeout\n",
+			 doe->use_int ? "irq" : "polling");
+		goto out;
+	}
+	trace_doe_ready(doe, val, ktime_get_ns() - t_ready);
 
-		pci_read_config_dword(pdev,
-				      doe->cap_offset + PCI_DOE_STATUS,
-				      &val);
-		if (FIELD_GET(PCI_DOE_STATUS_ERROR, val)) {
-			pcie_doe_abort(doe);
-			ret = -EIO;
-			goto unlock;
-		}
-	} else {
-		dev_info(&pdev->dev, "polling doe rdy\n");
-		do {
-			retry++;
-			pci_read_config_dword(pdev,
-					      doe->cap_offset + PCI_DOE_STATUS,
-					      &val);
-			if (FIELD_GET(PCI_DOE_STATUS_ERROR, val)) {
-				pcie_doe_abort(doe);
-				ret = -EIO;
-				goto unlock;
-			}
-
-			if (FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, val))
-				break;
-			usleep_range(1000, 2000);
-		} while (retry < 10000);
-		if (!FIELD_GET(PCI_DOE_STATUS_DATA_OBJECT_READY, val)) {
-			dev_info(&pdev->dev, "polling: doe rdy timeout\n");
-			ret = -ETIMEDOUT;
-			goto unlock;
-		}
+	if (FIELD_GET(PCI_DOE_STATUS_ERROR, val)) {
+		pcie_doe_abort(doe);
+		doe->stats.aborts++;
+		ret = -EIO;
+		goto out;
 	}
 
 	/* Read the first two dwords to get the length */
 	pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_READ,
 			      &response[0]);
-	dev_info(&pdev->dev, "rep[0] = %x\n", response[0]);
 
 	pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_READ, 0);
 	pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_READ,
 			      &response[1]);
-	dev_info(&pdev->dev, "rep[1] = %x\n", response[1]);
 	pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_READ, 0);
 	length = FIELD_GET(PCI_DOE_DATA_OBJECT_HEADER_2_LENGTH,
 			   response[1]);
-	if (length > SZ_1M)
-		return -EIO;
+	if (length > SZ_1M) {
+		ret = -EIO;
+		goto out;
+	}
 
 	for (i = 2; i < min(length, response_sz / 4); i++) {
 		pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_READ,
 				      &response[i]);
-		dev_info(&pdev->dev, "rep[%d] = %x\n", i, response[i]);
 		pci_write_config_dword(pdev, doe->cap_offset + PCI_DOE_READ, 0);
 	}
 	/* flush excess length */
@@ -272,12 +506,35 @@ int pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
 	pci_read_config_dword(pdev, doe->cap_offset + PCI_DOE_STATUS, &val);
 	if (FIELD_GET(PCI_DOE_STATUS_ERROR, val)) {
 		pcie_doe_abort(doe);
+		doe->stats.aborts++;
 		ret = -EIO;
 	}
 
-	dev_info(&pdev->dev, "================ end ==============\n");
-unlock:
-	mutex_unlock(&doe->lock);
+out:
+	pcie_doe_account(doe, ret, ktime_get_ns() - t_start);
+	trace_doe_complete(doe, response, ret, ktime_get_ns() - t_start);
+	return ret;
+}
+
+/**
+ * pcie_doe_exchange() - Send a request and receive a response
+ * @doe: DOE mailbox state structure
+ * @request: request data to be sent
+ * @request_sz: size of request in bytes
+ * @response: buffer into which to place the response
+ * @response_sz: size of available response buffer in bytes
+ *
+ * Return: 0 on success, < 0 on error
+ * Excess data will be discarded.
+ */
+int pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
+		      u32 *response, size_t response_sz)
+{
+	int ret;
+
+	pcie_doe_lock(doe);
+	ret = __pcie_doe_exchange(doe, request, request_sz, response, response_sz);
+	pcie_doe_unlock(doe);
 	return ret;
 }
 
@@ -11,6 +11,42 @@
 
 #ifndef LINUX_PCIE_DOE_H
 #define LINUX_PCIE_DOE_H
+
+/* Latency histogram bucket i counts exchanges taking [2^i, 2^(i+1)) ns */
+#define PCIE_DOE_LAT_BUCKETS	32
+
+/**
+ * struct pcie_doe_stats - Per-mailbox exchange counters
+ * @exchanges: Number of calls to pcie_doe_exchange() that took the lock
+ * @errors: Exchanges that failed for any reason other than a timeout
+ * @timeouts: Exchanges that never saw Data Object Ready
+ * @aborts: Aborts issued after the mailbox reported an error
+ * @lat_min_ns: Fastest exchange, lock held to response drained
+ * @lat_max_ns: Slowest exchange
+ * @lat_total_ns: Sum of all exchange latencies, for the average
+ * @lat_hist: log2 latency histogram, last bucket is open ended
+ * @lock_acquires: Number of times the mailbox was taken by pcie_doe_lock()
+ * @lock_wait_total_ns: Time spent waiting for the mailbox
+ * @lock_wait_max_ns: Longest wait for the mailbox
+ * @lock_hold_total_ns: Time the mailbox was held
+ * @lock_hold_max_ns: Longest time the mailbox was held
+ */
+struct pcie_doe_stats {
+	u64 exchanges;
+	u64 errors;
+	u64 timeouts;
+	u64 aborts;
+	u64 lat_min_ns;
+	u64 lat_max_ns;
+	u64 lat_total_ns;
+	u64 lat_hist[PCIE_DOE_LAT_BUCKETS];
+	u64 lock_acquires;
+	u64 lock_wait_total_ns;
+	u64 lock_wait_max_ns;
+	u64 lock_hold_total_ns;
+	u64 lock_hold_max_ns;
+};
+
 /**
  * struct pcie_doe - State to support use of DOE mailbox
  * @lock: Ensure users of the mailbox are serialized
@@ -18,6 +54,10 @@
  * @pdev: PCI device that hosts this DOE.
  * @c: Completion used for interrupt handling.
  * @use_int: Flage to indicate if interrupts rather than polling used.
+ * @irq: Linux IRQ number of the mailbox interrupt when @use_int is set.
+ * @stats: Exchange counters, protected by @lock.
+ * @lock_t0: When the current holder took @lock, for @stats.
+ * @debugfs: Per-mailbox debugfs directory.
  */
 struct pcie_doe {
 	struct mutex lock;
@@ -25,12 +65,24 @@ struct pcie_doe {
 	struct pci_dev *pdev;
 	struct completion c;
 	bool use_int;
+	int irq;
+	struct pcie_doe_stats stats;
+	u64 lock_t0;
+	struct dentry *debugfs;
 };
 
-void pcie_doe_fini(struct pci_dev *pdev);
+void pcie_doe_fini(struct pcie_doe *doe);
 int pcie_doe_init(struct pcie_doe *doe, struct pci_dev *dev, int doe_offset,
 		  bool use_int);
+void pcie_doe_lock(struct pcie_doe *doe);
+void pcie_doe_unlock(struct pcie_doe *doe);
+int __pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
+			u32 *response, size_t response_sz);
 int pcie_doe_exchange(struct pcie_doe *doe, u32 *request, size_t request_sz,
 		      u32 *response, size_t response_sz);
+int pcie_doe_reset(struct pcie_doe *doe);
+void pcie_doe_stats_get(struct pcie_doe *doe, struct pcie_doe_stats *st,
+			bool reset);
 int pcie_doe_protocol_check(struct pcie_doe *doe, u16 vid, u8 protocol);
+void pcie_doe_debugfs_init(struct pcie_doe *doe, struct dentry *parent);
 #endif
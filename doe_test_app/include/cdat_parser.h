@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef CDAT_PARSER_H
+#define CDAT_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cxl_cdat.h"
+
+/*
+ * CDAT parser. Works on a table already in memory (sysfs "cdat", a
+ * DOE_VEC_FOLLOW_CDAT read, ...) without copying it: the iterator hands
+ * out pointers into the buffer, after checking that the whole structure
+ * lies inside the table.
+ */
+
+/* HMAT System Locality Latency and Bandwidth data types used by DSLBIS */
+enum cdat_hmat_type {
+    CDAT_HMAT_ACCESS_LATENCY = 0,
+    CDAT_HMAT_READ_LATENCY = 1,
+    CDAT_HMAT_WRITE_LATENCY = 2,
+    CDAT_HMAT_ACCESS_BANDWIDTH = 3,
+    CDAT_HMAT_READ_BANDWIDTH = 4,
+    CDAT_HMAT_WRITE_BANDWIDTH = 5,
+    CDAT_HMAT_TYPE_MAX
+};
+
+typedef struct cdat_iter cdat_iter;
+typedef struct cdat_entry cdat_entry;
+typedef struct cdat_perf cdat_perf;
+typedef struct cdat_dsmas_perf cdat_dsmas_perf;
+
+struct cdat_iter {
+    const uint8_t *buf;
+    size_t len;
+    size_t off;
+};
+
+/* One structure of the table; the member matching @type is valid */
+struct cdat_entry {
+    uint8_t type;
+    uint16_t length;
+    size_t offset;
+    union {
+        const struct cdat_sub_header *hdr;
+        const struct cdat_dsmas *dsmas;
+        const struct cdat_dslbis *dslbis;
+        const struct cdat_dsmscis *dsmscis;
+        const struct cdat_dsis *dsis;
+        const struct cdat_dsemts *dsemts;
+        const struct cdat_sslbis_header *sslbis;
+    };
+};
+
+/* A decoded latency (picoseconds) or bandwidth (MB/s) value */
+struct cdat_perf {
+    uint8_t handle;
+    uint8_t data_type;
+    bool latency;
+    uint64_t value;
+};
+
+/*
+ * Everything the table advertises for one DSMAS range. Performance
+ * values are indexed by access/read/write and are 0 when not advertised.
+ */
+struct cdat_dsmas_perf {
+    uint8_t handle;
+    uint8_t flags;
+    uint64_t dpa_base;
+    uint64_t dpa_length;
+    uint64_t latency_ps[3];
+    uint64_t bandwidth_mbs[3];
+};
+
+int cdat_table_check(const void *buf, size_t len);
+void cdat_iter_init(cdat_iter *it, const void *buf, size_t len);
+int cdat_iter_next(cdat_iter *it, cdat_entry *ent);
+const char *cdat_type_name(uint8_t type);
+const char *cdat_hmat_type_name(uint8_t data_type);
+int cdat_dslbis_decode(const struct cdat_dslbis *dslbis, cdat_perf *perf);
+int cdat_sslbis_count(const cdat_entry *ent);
+const struct cdat_sslbe *cdat_sslbis_entry(const cdat_entry *ent, int i);
+int cdat_dsmas_perf_get(const void *buf, size_t len, cdat_dsmas_perf *perf,
+                        int max);
+int cdat_to_json(const void *buf, size_t len, FILE *out);
+#endif /* CDAT_PARSER_H */
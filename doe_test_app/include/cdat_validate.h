@@ -0,0 +1,18 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef CDAT_VALIDATE_H
+#define CDAT_VALIDATE_H
+
+#include "pcie.h"
+
+/* Largest part of each DSMAS range that is probed */
+#define CDAT_VALIDATE_MAX_BYTES     (256UL << 20)
+#define CDAT_VALIDATE_MAX_DSMAS     16
+
+int cdat_validate(pcie_dev *dev, const char *target);
+#endif /* CDAT_VALIDATE_H */
@@ -8,6 +8,8 @@
 #ifndef CXL_CDAT_H
 #define CXL_CDAT_H
 
+#include <stdio.h>
+
 #include "pcie_doe.h"
 #include "cxl.h"
 
@@ -127,8 +129,8 @@ struct cdat_dsemts {
     uint64_t DPA_length;
 } __attribute__((__packed__));
 
+/* SSLBIS entry, follows struct cdat_sslbis_header */
 struct cdat_sslbe {
-    struct cdat_sub_header header;
     uint16_t port_x_id;
     uint16_t port_y_id;
     uint16_t latency_bandwidth;
@@ -142,6 +144,8 @@ struct cdat_sslbis_header {
     uint64_t entry_base_unit;
 } __attribute__((__packed__));
 
-void do_cdat_req(pcie_dev *dev, uint32_t idx);
-void test_cdat(pcie_dev *dev);
+int do_cdat_req(pcie_dev *dev, uint32_t idx, doe_buf *buf);
+ssize_t cdat_read_table(pcie_dev *dev, void *out, size_t out_len);
+int cdat_dump_json(pcie_dev *dev, FILE *out);
+int test_cdat(pcie_dev *dev);
 #endif /* CXL_CDAT_H */
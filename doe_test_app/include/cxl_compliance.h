@@ -339,5 +339,5 @@ struct ComplianceObject {
     CompRsp response;
 } __attribute__((__packed__));
 
-void test_compliance(pcie_dev *dev);
+int test_compliance(pcie_dev *dev);
 #endif /* CXL_COMPL_H */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef CXL_TRAFFIC_H
+#define CXL_TRAFFIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pcie.h"
+
+#define COMP_TRAFFIC_TIMEOUT_MS     10000
+#define COMP_TRAFFIC_POLL_US        1000
+#define COMP_TRAFFIC_HOST_BYTES     (256UL << 20)
+#define COMP_TRAFFIC_HOST_LEN       256
+
+typedef struct comp_traffic_cfg comp_traffic_cfg;
+
+/*
+ * Device-side traffic generated through the Compliance DOE: Multiple Write
+ * Streaming (@algo CXL_COMP_MODE_MULT_WR_STREAM) or Producer-Consumer
+ * (CXL_COMP_MODE_PRO_CON). @write_addr, @writeback_addr, @inc_pattern,
+ * @virtual_addr, @self_checking and @verify_read only apply to Multiple
+ * Write Streaming, @write_semantics only to Producer-Consumer.
+ *
+ * @host, when set, is a /dev/daxX.Y or node:N target that the host reads
+ * while the device runs, to show the interference between the two.
+ */
+struct comp_traffic_cfg {
+    int algo;
+    uint8_t protocol;
+    uint8_t num_inc;
+    uint8_t num_sets;
+    uint8_t num_loops;
+    uint8_t virtual_addr;
+    uint8_t self_checking;
+    uint8_t verify_read;
+    uint8_t write_semantics;
+    uint64_t start_addr;
+    uint64_t write_addr;
+    uint64_t writeback_addr;
+    uint64_t byte_mask;
+    uint32_t addr_incr;
+    uint32_t set_offset;
+    uint32_t pattern;
+    uint32_t inc_pattern;
+    unsigned int timeout_ms;
+    unsigned int poll_us;
+    char host[COMP_TRAFFIC_HOST_LEN];
+};
+
+int comp_traffic_parse(const char *spec, comp_traffic_cfg *cfg);
+int comp_traffic_run(pcie_dev *dev, const comp_traffic_cfg *cfg);
+#endif /* CXL_TRAFFIC_H */
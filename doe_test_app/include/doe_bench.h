@@ -0,0 +1,17 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef DOE_BENCH_H
+#define DOE_BENCH_H
+
+#include <stdio.h>
+
+#include "pcie.h"
+
+int doe_bench(pcie_dev *dev, int iters, FILE *report);
+int test_bench(pcie_dev *dev);
+#endif /* DOE_BENCH_H */
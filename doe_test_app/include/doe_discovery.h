@@ -33,8 +33,11 @@ struct doe_discovery_rsp {
 
 int doe_discovery_one(pcie_dev *dev, uint32_t doe_cap, uint32_t idx,
                       doe_discovery_rsp *rsp);
-void doe_discovery_all(pcie_dev *dev);
-void test_discovery(pcie_dev *dev);
+int doe_discovery_all(pcie_dev *dev);
+void doe_discovery_cached(pcie_dev *dev);
+int doe_discovery_all_async(pcie_dev *dev);
+int test_discovery(pcie_dev *dev);
+int test_discovery_async(pcie_dev *dev);
 
 #define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
 #endif
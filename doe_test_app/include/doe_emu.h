@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef DOE_EMU_H
+#define DOE_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pcie.h"
+
+typedef struct doe_emu_cfg doe_emu_cfg;
+
+/* Response delays, from GO to Data Object Ready, in microseconds */
+enum {
+    DOE_EMU_DISCOVERY,
+    DOE_EMU_CDAT,
+    DOE_EMU_COMPLIANCE,
+    DOE_EMU_PROT_MAX,
+};
+
+struct doe_emu_cfg {
+    uint32_t delay_us[DOE_EMU_PROT_MAX];
+    uint32_t jitter_us;     /* up to this much more, random */
+    bool err_unsupported;   /* DOE Error on unknown protocols (default), else drop */
+};
+
+int doe_emu_parse(const char *spec, doe_emu_cfg *cfg);
+int doe_emu_attach(pcie_dev *dev, const doe_emu_cfg *cfg);
+#endif /* DOE_EMU_H */
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef DOE_RUNNER_H
+#define DOE_RUNNER_H
+
+#include <stdio.h>
+
+#include "pcie.h"
+
+#define DOE_PLAN_MAX        64
+#define DOE_RUN_MAX_DEVS    64
+
+typedef int (*doe_test_fn)(pcie_dev *dev);
+
+typedef struct doe_test_desc doe_test_desc;
+typedef struct doe_plan_ent doe_plan_ent;
+typedef struct doe_plan doe_plan;
+
+struct doe_test_desc {
+    const char *name;
+    doe_test_fn fn;
+    const char *desc;
+};
+
+struct doe_plan_ent {
+    const doe_test_desc *test;
+    int repeat;
+};
+
+/* Tests to run on every device, in order */
+struct doe_plan {
+    doe_plan_ent ents[DOE_PLAN_MAX];
+    int count;
+};
+
+void doe_test_list(FILE *out);
+int doe_plan_add(doe_plan *plan, const char *names);
+int doe_plan_load(doe_plan *plan, const char *path);
+int pcie_dev_open(pcie_dev *dev);
+void pcie_dev_close(pcie_dev *dev);
+int doe_run(pcie_dev *devs, int ndev, const doe_plan *plan, FILE *report);
+#endif /* DOE_RUNNER_H */
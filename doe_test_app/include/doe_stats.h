@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef DOE_STATS_H
+#define DOE_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct doe_stats doe_stats;
+typedef struct doe_stats_sum doe_stats_sum;
+
+/* Latency samples in ns, one per DOE round trip. Not thread-safe. */
+struct doe_stats {
+    uint64_t *ns;
+    uint32_t count;
+    uint32_t alloc;
+    uint32_t errors;
+};
+
+struct doe_stats_sum {
+    uint32_t count;
+    uint32_t errors;
+    uint64_t min, max, mean;
+    uint64_t p50, p90, p99;
+};
+
+uint64_t doe_stats_now(void);
+void doe_stats_add(doe_stats *st, uint64_t ns, int err);
+void doe_stats_reset(doe_stats *st);
+void doe_stats_free(doe_stats *st);
+void doe_stats_summary(const doe_stats *st, doe_stats_sum *sum);
+void doe_stats_json(const doe_stats *st, FILE *out, const char *indent);
+#endif /* DOE_STATS_H */
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef DOE_STRESS_H
+#define DOE_STRESS_H
+
+#include <stdint.h>
+
+#include "pcie.h"
+
+enum {
+    STRESS_OP_VALID,
+    STRESS_OP_INVALID,
+    STRESS_OP_ABORT,
+    STRESS_OP_MAX,
+};
+
+#define STRESS_MAX_PROCS    64
+#define STRESS_MAX_THREADS  256
+
+typedef struct doe_stress_cfg doe_stress_cfg;
+
+struct doe_stress_cfg {
+    int procs;
+    int threads;            /* per process */
+    int secs;
+    unsigned int mix[STRESS_OP_MAX];    /* relative weights */
+    uint32_t timeout_ms;    /* a valid or abort op taking longer is a timeout */
+    uint32_t starve_ms;     /* a valid op taking longer starves its thread */
+};
+
+int doe_stress_parse(const char *spec, doe_stress_cfg *cfg);
+int doe_stress_run(pcie_dev *devs, int ndev, const doe_stress_cfg *cfg);
+#endif /* DOE_STRESS_H */
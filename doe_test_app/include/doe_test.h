@@ -8,9 +8,9 @@
 #ifndef DOE_TEST_H
 #define DOE_TEST_H
 
-void test_invalid_len(pcie_dev *dev);
-void test_invalid_protocol(pcie_dev *dev);
-void test_abort(pcie_dev *dev);
-void test_error(pcie_dev *dev);
-void test_not_align(pcie_dev *dev);
+int test_invalid_len(pcie_dev *dev);
+int test_invalid_protocol(pcie_dev *dev);
+int test_abort(pcie_dev *dev);
+int test_error(pcie_dev *dev);
+int test_not_align(pcie_dev *dev);
 #endif /* DOE_TEST_H */
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#ifndef MEM_PROBE_H
+#define MEM_PROBE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEM_PROBE_MAX_THREADS   8
+
+typedef struct mem_map mem_map;
+
+struct mem_map {
+    uint8_t *addr;
+    size_t len;
+};
+
+uint64_t mem_now_ns(void);
+int mem_map_target(const char *target, uint64_t offset, size_t len, mem_map *map);
+void mem_unmap(mem_map *map);
+int mem_probe_threads(void);
+uint64_t mem_probe_latency(mem_map *map);
+uint64_t mem_probe_write_latency(mem_map *map);
+uint64_t mem_probe_bandwidth(mem_map *map, int nthreads, bool write,
+                             uint64_t min_ns, const volatile bool *stop);
+#endif /* MEM_PROBE_H */
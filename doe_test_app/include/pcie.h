@@ -9,6 +9,7 @@
 #define PCIE_H
 
 #include <inttypes.h>
+#include <stdio.h>
 #include <unistd.h>
 
 #include <uapi/linux/pci_regs.h>
@@ -23,6 +24,7 @@
 #define PCI_SIG_DOE_CMA         0x01
 
 typedef struct pcie_dev pcie_dev;
+typedef struct pcie_ops pcie_ops;
 typedef struct DOEcap DOEcap;
 typedef struct DVSECcap DVSECcap;
 typedef struct DOEprot DOEprot;
@@ -50,6 +52,21 @@ struct DVSECcap {
     DVSECcap *next;
 };
 
+/* How config space is reached, see pcie_dev.transport */
+enum {
+    PCIE_TRANSPORT_SYSFS,
+    PCIE_TRANSPORT_ECAM,
+    PCIE_TRANSPORT_EMU,
+};
+
+struct pcie_ops {
+    const char *name;
+    uint32_t (*read)(pcie_dev *dev, uint32_t addr);
+    void (*write)(pcie_dev *dev, uint32_t addr, uint32_t data);
+    void (*write8)(pcie_dev *dev, uint32_t addr, uint8_t data);
+    void (*close)(pcie_dev *dev);
+};
+
 struct pcie_dev {
     int pdev;
     int cdev;
@@ -59,9 +76,34 @@ struct pcie_dev {
     int ext_cap;
     DOEcap *doe_cap_head;
     DVSECcap *dvsec_cap_head;
+
+    /*
+     * Per-device state so several devices can be tested at once: test
+     * output goes to @out and every DOE ioctl is timed into @stats when
+     * set. Exchange buffers come from the doe_buf_get() pool.
+     */
+    FILE *out;
+    struct doe_stats *stats;
+
+    /*
+     * Config space transport: @transport is the one asked for, @ops the
+     * one pcie_dev_open() set up (ECAM falls back to sysfs) and @priv its
+     * state. An emulated device (@emu) has no DOE driver, so cdev is -1
+     * and @user stands in for the driver's mailbox state.
+     */
+    int transport;
+    const struct doe_emu_cfg *emu;
+    const pcie_ops *ops;
+    void *priv;
+    struct doe_user *user;
 };
 
 int init_cap_offset(pcie_dev *dev);
-void config_write(int fd, uint32_t addr, uint32_t data);
-uint32_t config_read(int fd, uint32_t addr);
+void free_cap_offset(pcie_dev *dev);
+void config_write(pcie_dev *dev, uint32_t addr, uint32_t data);
+void config_write8(pcie_dev *dev, uint32_t addr, uint8_t data);
+uint32_t config_read(pcie_dev *dev, uint32_t addr);
+void pcie_sysfs_attach(pcie_dev *dev);
+int pcie_ecam_attach(pcie_dev *dev);
+void pcie_detach(pcie_dev *dev);
 #endif /* PCIE_H */
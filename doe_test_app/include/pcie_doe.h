@@ -9,6 +9,9 @@
 #define PCIE_DOE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include "pcie.h"
 
 #define DATA_OBJ_BUILD_HEADER1(v, p)  ((p << 16) | v)
@@ -29,6 +32,7 @@
  *
  ******************************************************************************/
 typedef struct DOEHeader DOEHeader;
+typedef struct doe_buf doe_buf;
 
 struct DOEHeader {
     uint16_t vendor_id;
@@ -40,13 +44,49 @@ struct DOEHeader {
     };
 } __attribute__((__packed__));
 
-void doe_exchange_object(pcie_dev *dev, uint32_t doe_cap, void* buf);
+/*
+ * Exchange buffer lent by doe_buf_get(). The object (request, then the
+ * response written over it in place) starts at doe_buf_obj(); the dword
+ * before it is kept free for the DOE_MBOX_CMD cap offset.
+ */
+struct doe_buf {
+    uint32_t *mem;
+    uint32_t size_dw;       /* room for an object of this many dwords */
+    uint32_t used_dw;       /* response length after an exchange */
+    int cls;
+    doe_buf *next;
+};
+
+#define doe_buf_obj(b)  ((void *)((b)->mem + 1))
+
+int doe_exchange_object(pcie_dev *dev, uint32_t doe_cap, void* buf);
+doe_buf *doe_buf_get(uint32_t dw);
+void doe_buf_put(doe_buf *buf);
+int doe_exchange_buf(pcie_dev *dev, uint32_t doe_cap, doe_buf *buf);
 void doe_submit_object(pcie_dev *dev, uint32_t doe_cap, void* obj);
 void __doe_submit_object(pcie_dev *dev, uint32_t doe_cap, void* obj, uint32_t len);
 uint32_t doe_read_mbox(pcie_dev *dev, uint32_t doe_cap);
 bool doe_check_ready(pcie_dev *dev, uint32_t doe_cap);
 void doe_wait(pcie_dev *dev, uint32_t doe_cap);
 void doe_abort(pcie_dev *dev, uint32_t doe_cap);
-void *doe_get_object(pcie_dev *dev, uint32_t doe_cap);
+doe_buf *doe_get_object(pcie_dev *dev, uint32_t doe_cap);
+int doe_exchange_config(pcie_dev *dev, uint32_t doe_cap, void *req,
+                        uint32_t *rsp, uint32_t rsp_max_dw, uint64_t timeout_ns);
 int doe_get_cap_by_prot(pcie_dev *dev, uint32_t prot);
+int doe_open_cdev(pcie_dev *dev, char *path, size_t path_len);
+ssize_t doe_sysfs_read(pcie_dev *dev, const char *attr, void *buf, size_t len);
+int doe_submit_async(pcie_dev *dev, uint32_t doe_cap, uint64_t tag,
+                     void *obj, uint32_t rsp_max_dw);
+ssize_t doe_reap_async(pcie_dev *dev, void *buf, size_t len);
+struct doe_vec_ent;
+int doe_exchange_vec(pcie_dev *dev, uint32_t doe_cap, struct doe_vec_ent *ents,
+                     uint32_t count, uint32_t flags);
+int doe_exchange_follow(pcie_dev *dev, uint32_t doe_cap, uint32_t mode,
+                        void *buf, size_t len, size_t *used);
+int doe_mbox_abort(pcie_dev *dev, uint32_t doe_cap);
+struct doe_mbox_stats;
+int doe_mbox_stats_get(pcie_dev *dev, uint32_t doe_cap, struct doe_mbox_stats *st,
+                       bool reset);
+int doe_user_attach(pcie_dev *dev);
+void doe_user_detach(pcie_dev *dev);
 #endif /* PCIE_DOE_H */
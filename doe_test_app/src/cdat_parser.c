@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "cdat_parser.h"
+
+static const char *cdat_type_names[CDAT_TYPE_MAX] = {
+    [CDAT_TYPE_DSMAS] = "DSMAS",
+    [CDAT_TYPE_DSLBIS] = "DSLBIS",
+    [CDAT_TYPE_DSMSCIS] = "DSMSCIS",
+    [CDAT_TYPE_DSIS] = "DSIS",
+    [CDAT_TYPE_DSEMTS] = "DSEMTS",
+    [CDAT_TYPE_SSLBIS] = "SSLBIS",
+};
+
+/* Smallest valid length of each structure type */
+static const uint16_t cdat_type_min_len[CDAT_TYPE_MAX] = {
+    [CDAT_TYPE_DSMAS] = sizeof(struct cdat_dsmas),
+    [CDAT_TYPE_DSLBIS] = sizeof(struct cdat_dslbis),
+    [CDAT_TYPE_DSMSCIS] = sizeof(struct cdat_dsmscis),
+    [CDAT_TYPE_DSIS] = sizeof(struct cdat_dsis),
+    [CDAT_TYPE_DSEMTS] = sizeof(struct cdat_dsemts),
+    [CDAT_TYPE_SSLBIS] = sizeof(struct cdat_sslbis_header),
+};
+
+static const char *cdat_hmat_type_names[CDAT_HMAT_TYPE_MAX] = {
+    [CDAT_HMAT_ACCESS_LATENCY] = "access_latency",
+    [CDAT_HMAT_READ_LATENCY] = "read_latency",
+    [CDAT_HMAT_WRITE_LATENCY] = "write_latency",
+    [CDAT_HMAT_ACCESS_BANDWIDTH] = "access_bandwidth",
+    [CDAT_HMAT_READ_BANDWIDTH] = "read_bandwidth",
+    [CDAT_HMAT_WRITE_BANDWIDTH] = "write_bandwidth",
+};
+
+const char *cdat_type_name(uint8_t type)
+{
+    return type < CDAT_TYPE_MAX ? cdat_type_names[type] : "unknown";
+}
+
+const char *cdat_hmat_type_name(uint8_t data_type)
+{
+    return data_type < CDAT_HMAT_TYPE_MAX ? cdat_hmat_type_names[data_type] : "unknown";
+}
+
+/*
+ * Check the table header against the buffer and verify the checksum.
+ * Returns the table length or a negative errno.
+ */
+int cdat_table_check(const void *buf, size_t len)
+{
+    const struct cdat_table_header *hdr = buf;
+    const uint8_t *data = buf;
+    uint8_t sum = 0;
+    size_t i;
+
+    if (len < sizeof(*hdr) || hdr->length < sizeof(*hdr) || hdr->length > len) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < hdr->length; i++) {
+        sum += data[i];
+    }
+
+    return sum ? -EBADMSG : (int)hdr->length;
+}
+
+/* Iterate the structures after the header, up to the table length */
+void cdat_iter_init(cdat_iter *it, const void *buf, size_t len)
+{
+    const struct cdat_table_header *hdr = buf;
+
+    it->buf = buf;
+    it->len = len;
+    it->off = sizeof(*hdr);
+
+    if (len >= sizeof(*hdr) && hdr->length < len) {
+        it->len = hdr->length;
+    }
+}
+
+/*
+ * Return 1 and fill @ent with the next structure, 0 at the end of the
+ * table, or -EINVAL when a structure is truncated, overruns the table or
+ * is shorter than its type requires. Unknown types are returned as is.
+ */
+int cdat_iter_next(cdat_iter *it, cdat_entry *ent)
+{
+    const struct cdat_sub_header *hdr;
+    size_t left;
+
+    if (it->off >= it->len) {
+        return 0;
+    }
+
+    left = it->len - it->off;
+    if (left < sizeof(*hdr)) {
+        return -EINVAL;
+    }
+
+    hdr = (const struct cdat_sub_header *)(it->buf + it->off);
+    if (hdr->length < sizeof(*hdr) || hdr->length > left) {
+        return -EINVAL;
+    }
+    if (hdr->type < CDAT_TYPE_MAX && hdr->length < cdat_type_min_len[hdr->type]) {
+        return -EINVAL;
+    }
+    if (hdr->type == CDAT_TYPE_SSLBIS &&
+        (hdr->length - sizeof(struct cdat_sslbis_header)) % sizeof(struct cdat_sslbe)) {
+        return -EINVAL;
+    }
+
+    ent->type = hdr->type;
+    ent->length = hdr->length;
+    ent->offset = it->off;
+    ent->hdr = hdr;
+
+    it->off += hdr->length;
+    return 1;
+}
+
+/*
+ * DSLBIS values are entry_base_unit * entry[0], in picoseconds for the
+ * latency types and MB/s for the bandwidth types.
+ */
+int cdat_dslbis_decode(const struct cdat_dslbis *dslbis, cdat_perf *perf)
+{
+    uint64_t value;
+
+    if (dslbis->data_type >= CDAT_HMAT_TYPE_MAX) {
+        return -EINVAL;
+    }
+    if (__builtin_mul_overflow(dslbis->entry_base_unit, (uint64_t)dslbis->entry[0], &value)) {
+        return -ERANGE;
+    }
+
+    perf->handle = dslbis->handle;
+    perf->data_type = dslbis->data_type;
+    perf->latency = dslbis->data_type <= CDAT_HMAT_WRITE_LATENCY;
+    perf->value = value;
+    return 0;
+}
+
+int cdat_sslbis_count(const cdat_entry *ent)
+{
+    return (ent->length - sizeof(struct cdat_sslbis_header)) / sizeof(struct cdat_sslbe);
+}
+
+const struct cdat_sslbe *cdat_sslbis_entry(const cdat_entry *ent, int i)
+{
+    return (const struct cdat_sslbe *)((const uint8_t *)ent->hdr +
+           sizeof(struct cdat_sslbis_header)) + i;
+}
+
+/*
+ * Collect up to @max DSMAS ranges with the latency and bandwidth their
+ * DSLBIS entries advertise. Returns the number of ranges or a negative
+ * errno.
+ */
+int cdat_dsmas_perf_get(const void *buf, size_t len, cdat_dsmas_perf *perf,
+                        int max)
+{
+    cdat_iter it;
+    cdat_entry ent;
+    cdat_perf p;
+    int i, n = 0, rc;
+
+    cdat_iter_init(&it, buf, len);
+    while ((rc = cdat_iter_next(&it, &ent)) > 0) {
+        if (ent.type != CDAT_TYPE_DSMAS || n == max) {
+            continue;
+        }
+        memset(&perf[n], 0, sizeof(perf[n]));
+        perf[n].handle = ent.dsmas->DSMADhandle;
+        perf[n].flags = ent.dsmas->flags;
+        perf[n].dpa_base = ent.dsmas->DPA_base;
+        perf[n].dpa_length = ent.dsmas->DPA_length;
+        n++;
+    }
+    if (rc < 0) {
+        return rc;
+    }
+
+    cdat_iter_init(&it, buf, len);
+    while ((rc = cdat_iter_next(&it, &ent)) > 0) {
+        if (ent.type != CDAT_TYPE_DSLBIS || cdat_dslbis_decode(ent.dslbis, &p)) {
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            if (perf[i].handle != p.handle) {
+                continue;
+            }
+            if (p.latency) {
+                perf[i].latency_ps[p.data_type % 3] = p.value;
+            } else {
+                perf[i].bandwidth_mbs[p.data_type % 3] = p.value;
+            }
+        }
+    }
+
+    return rc < 0 ? rc : n;
+}
+
+static void cdat_json_entry(const cdat_entry *ent, FILE *out)
+{
+    const struct cdat_sslbe *sslbe;
+    cdat_perf p;
+    int i, n;
+
+    fprintf(out, "    {\"type\": \"%s\", \"type_id\": %u, \"offset\": %zu, \"length\": %u",
+            cdat_type_name(ent->type), ent->type, ent->offset, ent->length);
+
+    switch (ent->type) {
+    case CDAT_TYPE_DSMAS:
+        fprintf(out, ", \"handle\": %u, \"flags\": %u, \"dpa_base\": \"0x%" PRIx64
+                "\", \"dpa_length\": \"0x%" PRIx64 "\"",
+                ent->dsmas->DSMADhandle, ent->dsmas->flags,
+                (uint64_t)ent->dsmas->DPA_base, (uint64_t)ent->dsmas->DPA_length);
+        break;
+    case CDAT_TYPE_DSLBIS:
+        fprintf(out, ", \"handle\": %u, \"flags\": %u, \"data_type\": \"%s\""
+                ", \"entry_base_unit\": %" PRIu64 ", \"entry\": [%u, %u, %u]",
+                ent->dslbis->handle, ent->dslbis->flags,
+                cdat_hmat_type_name(ent->dslbis->data_type),
+                (uint64_t)ent->dslbis->entry_base_unit, ent->dslbis->entry[0],
+                ent->dslbis->entry[1], ent->dslbis->entry[2]);
+        if (!cdat_dslbis_decode(ent->dslbis, &p)) {
+            fprintf(out, ", \"value\": %" PRIu64 ", \"unit\": \"%s\"",
+                    p.value, p.latency ? "ps" : "MB/s");
+        }
+        break;
+    case CDAT_TYPE_DSMSCIS:
+        fprintf(out, ", \"handle\": %u, \"cache_size\": %" PRIu64
+                ", \"cache_attributes\": \"0x%x\"",
+                ent->dsmscis->DSMASH_handle,
+                (uint64_t)ent->dsmscis->memory_side_cache_size,
+                ent->dsmscis->cache_attributes);
+        break;
+    case CDAT_TYPE_DSIS:
+        fprintf(out, ", \"handle\": %u, \"flags\": %u",
+                ent->dsis->handle, ent->dsis->flags);
+        break;
+    case CDAT_TYPE_DSEMTS:
+        fprintf(out, ", \"handle\": %u, \"efi_memory_type\": %u, \"dpa_offset\": \"0x%"
+                PRIx64 "\", \"dpa_length\": \"0x%" PRIx64 "\"",
+                ent->dsemts->DSMAS_handle, ent->dsemts->EFI_memory_type_attr,
+                (uint64_t)ent->dsemts->DPA_offset, (uint64_t)ent->dsemts->DPA_length);
+        break;
+    case CDAT_TYPE_SSLBIS:
+        fprintf(out, ", \"data_type\": \"%s\", \"entry_base_unit\": %" PRIu64
+                ", \"entries\": [",
+                cdat_hmat_type_name(ent->sslbis->data_type),
+                (uint64_t)ent->sslbis->entry_base_unit);
+        n = cdat_sslbis_count(ent);
+        for (i = 0; i < n; i++) {
+            sslbe = cdat_sslbis_entry(ent, i);
+            fprintf(out, "%s{\"port_x\": %u, \"port_y\": %u, \"entry\": %u}",
+                    i ? ", " : "", sslbe->port_x_id, sslbe->port_y_id,
+                    sslbe->latency_bandwidth);
+        }
+        fprintf(out, "]");
+        break;
+    }
+
+    fprintf(out, "}");
+}
+
+/* Write the table as JSON. Returns 0 or a negative errno */
+int cdat_to_json(const void *buf, size_t len, FILE *out)
+{
+    const struct cdat_table_header *hdr = buf;
+    cdat_iter it;
+    cdat_entry ent;
+    int rc, tbl_len, n = 0;
+
+    tbl_len = cdat_table_check(buf, len);
+    if (tbl_len == -EINVAL) {
+        return tbl_len;
+    }
+
+    /* Validate the whole table first so the output is never cut short */
+    cdat_iter_init(&it, buf, len);
+    while ((rc = cdat_iter_next(&it, &ent)) > 0)
+        ;
+    if (rc < 0) {
+        return rc;
+    }
+
+    fprintf(out, "{\n  \"length\": %u,\n  \"revision\": %u,\n  \"checksum\": %u,\n"
+            "  \"checksum_ok\": %s,\n  \"sequence\": %u,\n  \"entries\": [\n",
+            hdr->length, hdr->revision, hdr->checksum,
+            tbl_len > 0 ? "true" : "false", hdr->sequence);
+
+    cdat_iter_init(&it, buf, len);
+    while (cdat_iter_next(&it, &ent) > 0) {
+        fprintf(out, "%s", n++ ? ",\n" : "");
+        cdat_json_entry(&ent, out);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "cxl_cdat.h"
+#include "cdat_parser.h"
+#include "cdat_validate.h"
+#include "mem_probe.h"
+
+/*
+ * Compare what the CDAT advertises for each DSMAS range with what the host
+ * measures (see mem_probe.c). Through device DAX the DPA is assumed to map
+ * linearly to the DAX offset (single device, no interleave); through a
+ * NUMA node the ranges cannot be told apart, so every DSMAS range is
+ * probed on the node as a whole.
+ *
+ * The DSLBIS values only cover the device, so the measured latency
+ * includes the host and link on top of the advertised figure. Write
+ * latency is timed as non-temporal line writes each followed by SFENCE
+ * (mem_probe_write_latency()); without x86 it is reported as not measured.
+ *
+ * Every probe but the read bandwidth writes to the range (the chase links,
+ * the stores), so through device DAX up to CDAT_VALIDATE_MAX_BYTES of each
+ * DSMAS range is overwritten. That needs ",destroy" after the path; a NUMA
+ * node target gets fresh anonymous memory and needs nothing.
+ */
+
+#define DESTROY_SUFFIX      ",destroy"
+
+#define CACHELINE           64
+#define BW_MIN_NS           500000000ULL
+
+static void report(const char *what, uint64_t advertised, uint64_t measured,
+                   const char *unit)
+{
+    if (!measured) {
+        printf("  %-16s not measured on this host\n", what);
+        return;
+    }
+    if (!advertised) {
+        printf("  %-16s advertised %12s       measured %12" PRIu64 " %s\n",
+               what, "-", measured, unit);
+        return;
+    }
+    printf("  %-16s advertised %12" PRIu64 " %-4s measured %12" PRIu64
+           " %-4s deviation %+.1f%%\n", what, advertised, unit, measured, unit,
+           ((double)measured - advertised) * 100.0 / advertised);
+}
+
+/* Read and write specific values, falling back to the access value */
+static uint64_t advertised(const uint64_t v[3], int rw)
+{
+    return v[rw] ? v[rw] : v[0];
+}
+
+int cdat_validate(pcie_dev *dev, const char *target)
+{
+    cdat_dsmas_perf perf[CDAT_VALIDATE_MAX_DSMAS];
+    int i, n, rc, nthreads;
+    char path[PATH_MAX];
+    ssize_t tbl_len;
+    mem_map map;
+    doe_buf *tbl;
+    size_t len;
+
+    if (strncmp(target, "node:", 5)) {
+        n = strlen(target) - strlen(DESTROY_SUFFIX);
+        if (n <= 0 || strcmp(target + n, DESTROY_SUFFIX)) {
+            printf("ERR: probing %s overwrites up to %lu MiB of every DSMAS range,\n"
+                   "     use -V %s" DESTROY_SUFFIX " if its contents may be lost\n",
+                   target, CDAT_VALIDATE_MAX_BYTES >> 20, target);
+            return -EPERM;
+        }
+        snprintf(path, sizeof(path), "%.*s", n, target);
+        target = path;
+    }
+
+    tbl = doe_buf_get(PCI_DOE_MAX_DW_SIZE);
+    if (!tbl) {
+        return -ENOMEM;
+    }
+
+    tbl_len = cdat_read_table(dev, doe_buf_obj(tbl), tbl->size_dw * sizeof(uint32_t));
+    if (tbl_len < 0) {
+        printf("ERR: CDAT read failed: %s\n", strerror(-tbl_len));
+        doe_buf_put(tbl);
+        return tbl_len;
+    }
+
+    n = cdat_dsmas_perf_get(doe_buf_obj(tbl), tbl_len, perf, CDAT_VALIDATE_MAX_DSMAS);
+    doe_buf_put(tbl);
+    if (n <= 0) {
+        printf("ERR: no DSMAS range in CDAT (%d)\n", n);
+        return n ? n : -ENOENT;
+    }
+
+    nthreads = mem_probe_threads();
+
+    for (i = 0; i < n; i++) {
+        len = perf[i].dpa_length < CDAT_VALIDATE_MAX_BYTES ?
+              perf[i].dpa_length : CDAT_VALIDATE_MAX_BYTES;
+        printf("DSMAS %u DPA 0x%" PRIx64 " + 0x%" PRIx64 " via %s, probing %zu MiB\n",
+               perf[i].handle, perf[i].dpa_base, perf[i].dpa_length, target,
+               len >> 20);
+
+        if (len < CACHELINE * nthreads) {
+            printf("  range too small, skipped\n");
+            continue;
+        }
+
+        rc = mem_map_target(target, perf[i].dpa_base, len, &map);
+        if (rc) {
+            printf("  map failed: %s, skipped\n", strerror(-rc));
+            continue;
+        }
+
+        report("read latency", advertised(perf[i].latency_ps, 1),
+               mem_probe_latency(&map), "ps");
+        report("write latency", advertised(perf[i].latency_ps, 2),
+               mem_probe_write_latency(&map), "ps");
+        report("read bandwidth", advertised(perf[i].bandwidth_mbs, 1),
+               mem_probe_bandwidth(&map, nthreads, false, BW_MIN_NS, NULL), "MB/s");
+        report("write bandwidth", advertised(perf[i].bandwidth_mbs, 2),
+               mem_probe_bandwidth(&map, nthreads, true, BW_MIN_NS, NULL), "MB/s");
+
+        mem_unmap(&map);
+    }
+
+    return 0;
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "cxl_compliance.h"
+#include "cxl_traffic.h"
+#include "doe_discovery.h"
+#include "mem_probe.h"
+#include "driver/doe_api.h"
+
+#define CACHELINE               64
+#define COMP_REQ_VERSION        0xcc
+#define HOST_BASELINE_NS        500000000ULL
+
+typedef struct host_load host_load;
+
+struct host_load {
+    pthread_t tid;
+    mem_map map;
+    int nthreads;
+    volatile bool stop;
+    uint64_t mbs;
+};
+
+/* Options of -C: "<mws|pc>[,key=value...]" */
+static const struct {
+    const char *key;
+    size_t off;
+    size_t size;
+} comp_traffic_keys[] = {
+#define KEY(k, f) { k, offsetof(comp_traffic_cfg, f), sizeof(((comp_traffic_cfg *)0)->f) }
+    KEY("protocol", protocol),
+    KEY("inc", num_inc),
+    KEY("sets", num_sets),
+    KEY("loops", num_loops),
+    KEY("virt", virtual_addr),
+    KEY("check", self_checking),
+    KEY("verify", verify_read),
+    KEY("wsem", write_semantics),
+    KEY("start", start_addr),
+    KEY("write", write_addr),
+    KEY("writeback", writeback_addr),
+    KEY("mask", byte_mask),
+    KEY("incr", addr_incr),
+    KEY("set_offset", set_offset),
+    KEY("pattern", pattern),
+    KEY("inc_pattern", inc_pattern),
+    KEY("timeout_ms", timeout_ms),
+    KEY("poll_us", poll_us),
+#undef KEY
+};
+
+int comp_traffic_parse(const char *spec, comp_traffic_cfg *cfg)
+{
+    char *str, *tok, *save, *val, *end;
+    unsigned long long v;
+    size_t i;
+    int rc = 0;
+
+    *cfg = (comp_traffic_cfg) {
+        .protocol = 2,
+        .num_inc = 1,
+        .num_sets = 1,
+        .num_loops = 1,
+        .byte_mask = ~0ULL,
+        .addr_incr = CACHELINE,
+        .timeout_ms = COMP_TRAFFIC_TIMEOUT_MS,
+        .poll_us = COMP_TRAFFIC_POLL_US,
+    };
+
+    str = strdup(spec);
+    tok = strtok_r(str, ",", &save);
+    if (tok && !strcmp(tok, "mws")) {
+        cfg->algo = CXL_COMP_MODE_MULT_WR_STREAM;
+    } else if (tok && !strcmp(tok, "pc")) {
+        cfg->algo = CXL_COMP_MODE_PRO_CON;
+    } else {
+        printf("traffic algorithm must be mws or pc\n");
+        free(str);
+        return -EINVAL;
+    }
+
+    while ((tok = strtok_r(NULL, ",", &save))) {
+        val = strchr(tok, '=');
+        if (!val) {
+            rc = -EINVAL;
+            break;
+        }
+        *val++ = 0;
+
+        if (!strcmp(tok, "host")) {
+            if (strlen(val) >= sizeof(cfg->host)) {
+                rc = -EINVAL;
+                break;
+            }
+            strcpy(cfg->host, val);
+            continue;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(comp_traffic_keys); i++) {
+            if (!strcmp(tok, comp_traffic_keys[i].key)) {
+                break;
+            }
+        }
+        if (i == ARRAY_SIZE(comp_traffic_keys)) {
+            rc = -EINVAL;
+            break;
+        }
+
+        /* the fields are narrower than the parse, loops=300 must not wrap */
+        v = strtoull(val, &end, 0);
+        if (!*val || *end ||
+            (comp_traffic_keys[i].size < 8 && v >> (comp_traffic_keys[i].size * 8))) {
+            printf("%s=%s: not a number up to %llu\n", tok, val,
+                   comp_traffic_keys[i].size < 8 ?
+                   (1ULL << (comp_traffic_keys[i].size * 8)) - 1 : ~0ULL);
+            rc = -ERANGE;
+            break;
+        }
+        switch (comp_traffic_keys[i].size) {
+        case 1:
+            *((uint8_t *)cfg + comp_traffic_keys[i].off) = v;
+            break;
+        case 4:
+            *(uint32_t *)((uint8_t *)cfg + comp_traffic_keys[i].off) = v;
+            break;
+        case 8:
+            *(uint64_t *)((uint8_t *)cfg + comp_traffic_keys[i].off) = v;
+            break;
+        }
+    }
+
+    if (rc == -EINVAL) {
+        printf("bad traffic option '%s'\n", tok);
+    } else if (!rc && (!cfg->num_inc || !cfg->num_sets || !cfg->num_loops)) {
+        printf("inc, sets and loops must be non-zero\n");
+        rc = -EINVAL;
+    }
+
+    free(str);
+    return rc;
+}
+
+/* One compliance exchange with an explicitly sized response buffer */
+static int comp_exchange(pcie_dev *dev, int doe_cap, CompReq *req, size_t req_len,
+                         void *rsp, size_t rsp_len)
+{
+    struct doe_vec_ent ent = {
+        .req_ptr = (uintptr_t)req,
+        .rsp_ptr = (uintptr_t)rsp,
+        .rsp_len = rsp_len,
+    };
+    int rc;
+
+    req->header.doe_header.vendor_id = CXL_VENDOR_ID;
+    req->header.doe_header.doe_type = CXL_DOE_COMPLIANCE;
+    req->header.doe_header.length = DIV_ROUND_UP(req_len, sizeof(uint32_t));
+    req->header.version = COMP_REQ_VERSION;
+
+    rc = doe_exchange_vec(dev, doe_cap, &ent, 1, 0);
+    if (rc < 0) {
+        return rc;
+    }
+    return ent.status;
+}
+
+static int comp_status(pcie_dev *dev, int doe_cap, uint32_t *running)
+{
+    struct cxl_compliance_mode_status_rsp rsp = {0};
+    CompReq req = {0};
+    int rc;
+
+    req.header.req_code = CXL_COMP_MODE_STATUS;
+    rc = comp_exchange(dev, doe_cap, &req, sizeof(req.status), &rsp, sizeof(rsp));
+    if (!rc) {
+        *running = rsp.cap_bitfield;
+    }
+    return rc;
+}
+
+static void comp_halt(pcie_dev *dev, int doe_cap)
+{
+    struct status_rsp rsp = {0};
+    CompReq req = {0};
+
+    req.header.req_code = CXL_COMP_MODE_HALT;
+    comp_exchange(dev, doe_cap, &req, sizeof(req.halt), &rsp, sizeof(rsp));
+}
+
+static size_t comp_build(const comp_traffic_cfg *cfg, CompReq *req)
+{
+    struct cxl_compliance_mode_multiple_write_streaming *m =
+        &req->multiple_write_streaming;
+    struct cxl_compliance_mode_producer_consumer *p = &req->producer_consumer;
+
+    memset(req, 0, sizeof(*req));
+    req->header.req_code = cfg->algo;
+
+    if (cfg->algo == CXL_COMP_MODE_MULT_WR_STREAM) {
+        m->protocol = cfg->protocol;
+        m->virtual_addr = cfg->virtual_addr;
+        m->self_checking = cfg->self_checking;
+        m->verify_read_semantics = cfg->verify_read;
+        m->num_inc = cfg->num_inc;
+        m->num_sets = cfg->num_sets;
+        m->num_loops = cfg->num_loops;
+        m->start_addr = cfg->start_addr;
+        m->write_addr = cfg->write_addr;
+        m->writeback_addr = cfg->writeback_addr;
+        m->byte_mask = cfg->byte_mask;
+        m->addr_incr = cfg->addr_incr;
+        m->set_offset = cfg->set_offset;
+        m->pattern_p = cfg->pattern;
+        m->inc_pattern_b = cfg->inc_pattern;
+        return sizeof(*m);
+    }
+
+    p->protocol = cfg->protocol;
+    p->num_inc = cfg->num_inc;
+    p->num_sets = cfg->num_sets;
+    p->num_loops = cfg->num_loops;
+    p->write_semantics = cfg->write_semantics;
+    p->start_addr = cfg->start_addr;
+    p->byte_mask = cfg->byte_mask;
+    p->addr_incr = cfg->addr_incr;
+    p->set_offset = cfg->set_offset;
+    p->pattern = cfg->pattern;
+    return sizeof(*p);
+}
+
+static void *host_load_worker(void *arg)
+{
+    host_load *h = arg;
+
+    h->mbs = mem_probe_bandwidth(&h->map, h->nthreads, false, 0, &h->stop);
+    return NULL;
+}
+
+/*
+ * Start the algorithm, poll CXL_COMP_MODE_STATUS until the device no
+ * longer reports it running and derive the achieved rate from the number
+ * of cache line writes it was asked for. The first poll goes out right
+ * after the start, later ones back off from 1 us up to @poll_us, so short
+ * runs are not rounded up to the poll interval; the end is only known to
+ * lie between the last poll that still saw the algorithm running and the
+ * one that did not, and that window is reported with the result. The
+ * optional host load reads its target alone first and then while the
+ * device runs.
+ */
+int comp_traffic_run(pcie_dev *dev, const comp_traffic_cfg *cfg)
+{
+    struct cxl_compliance_mode_cap_rsp cap_rsp = {0};
+    struct status_rsp start_rsp = {0};
+    host_load host = {0};
+    uint64_t baseline = 0, t0, t1, t_run, t_poll, lines, deadline;
+    uint32_t running = 0, polls = 0, delay_us = 1;
+    bool timed_out = false;
+    CompReq req = {0};
+    size_t req_len;
+    int doe_cap, rc;
+
+    doe_discovery_cached(dev);
+    doe_cap = doe_get_cap_by_prot(dev, CXL_DOE_PROTOCOL_COMPLIANCE);
+    if (!doe_cap) {
+        printf("ERR: no Compliance mailbox\n");
+        return -ENODEV;
+    }
+
+    req.header.req_code = CXL_COMP_MODE_CAP;
+    rc = comp_exchange(dev, doe_cap, &req, sizeof(req.cap), &cap_rsp, sizeof(cap_rsp));
+    if (rc) {
+        printf("ERR: compliance capability query failed: %s\n", strerror(-rc));
+        return rc;
+    }
+    if (!(cap_rsp.available_cap_bitmask & (1ULL << cfg->algo))) {
+        printf("ERR: device does not offer compliance mode %d (available 0x%" PRIx64 ")\n",
+               cfg->algo, (uint64_t)cap_rsp.available_cap_bitmask);
+        return -EOPNOTSUPP;
+    }
+
+    if (cfg->host[0]) {
+        rc = mem_map_target(cfg->host, 0, COMP_TRAFFIC_HOST_BYTES, &host.map);
+        if (rc) {
+            printf("ERR: cannot map %s: %s\n", cfg->host, strerror(-rc));
+            return rc;
+        }
+        host.nthreads = mem_probe_threads();
+        baseline = mem_probe_bandwidth(&host.map, host.nthreads, false,
+                                       HOST_BASELINE_NS, NULL);
+        pthread_create(&host.tid, NULL, host_load_worker, &host);
+    }
+
+    req_len = comp_build(cfg, &req);
+    t0 = mem_now_ns();
+    rc = comp_exchange(dev, doe_cap, &req, req_len, &start_rsp, sizeof(start_rsp));
+    if (!rc && start_rsp.status != CXL_COMP_MODE_RET_SUCC) {
+        printf("ERR: device refused the algorithm, status %u\n", start_rsp.status);
+        rc = -EIO;
+    }
+
+    deadline = t0 + cfg->timeout_ms * 1000000ULL;
+    t_run = t0;
+    while (!rc) {
+        t_poll = mem_now_ns();
+        rc = comp_status(dev, doe_cap, &running);
+        polls++;
+        if (rc || !(running & (1U << cfg->algo))) {
+            break;
+        }
+        /* still running when this poll sampled the status */
+        t_run = t_poll;
+        if (mem_now_ns() > deadline) {
+            comp_halt(dev, doe_cap);
+            timed_out = true;
+            break;
+        }
+        usleep(delay_us);
+        if (delay_us < cfg->poll_us) {
+            delay_us = delay_us * 2 < cfg->poll_us ? delay_us * 2 : cfg->poll_us;
+        }
+    }
+    t1 = mem_now_ns();
+
+    if (cfg->host[0]) {
+        host.stop = true;
+        pthread_join(host.tid, NULL);
+        mem_unmap(&host.map);
+    }
+
+    if (rc) {
+        printf("ERR: compliance traffic failed: %s\n", strerror(-rc));
+        return rc;
+    }
+
+    lines = (uint64_t)cfg->num_loops * cfg->num_sets * cfg->num_inc;
+    printf("%s: %" PRIu64 " lines in %.3f ms (%u status polls, end known to %.1f us)%s\n",
+           cfg->algo == CXL_COMP_MODE_MULT_WR_STREAM ? "multiple write streaming" :
+           "producer-consumer", lines, (t1 - t0) / 1e6, polls, (t1 - t_run) / 1e3,
+           timed_out ? ", timed out and halted" : "");
+    if (!timed_out) {
+        printf("device rate: %.0f lines/s, %.1f MB/s\n",
+               lines * 1e9 / (t1 - t0), lines * CACHELINE * 1e3 / (t1 - t0));
+    }
+    if (cfg->host[0]) {
+        printf("host read bandwidth on %s: alone %" PRIu64 " MB/s, with device traffic %"
+               PRIu64 " MB/s (%+.1f%%)\n", cfg->host, baseline, host.mbs,
+               baseline ? ((double)host.mbs - baseline) * 100.0 / baseline : 0.0);
+    }
+
+    return timed_out ? -ETIMEDOUT : 0;
+}
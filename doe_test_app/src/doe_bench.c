@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "doe_stats.h"
+#include "doe_bench.h"
+#include "doe_discovery.h"
+#include "cxl_cdat.h"
+#include "cxl_compliance.h"
+
+/*
+ * DOE round-trip benchmark: the same request repeated N times, through
+ * the driver (DOE_MBOX_CMD) and directly through config space
+ * (doe_exchange_config(), the __doe_submit_object() path).
+ */
+
+#define BENCH_TIMEOUT_NS    (1000ULL * 1000 * 1000)
+#define BENCH_TEST_ITERS    10
+
+typedef struct bench_proto bench_proto;
+typedef struct bench_result bench_result;
+typedef union bench_req bench_req;
+
+struct bench_proto {
+    const char *name;
+    uint32_t prot;
+    void (*build)(void *req);
+};
+
+/* Room for the largest request any bench_proto builds */
+union bench_req {
+    doe_discovery discovery;
+    struct cxl_cdat cdat;
+    CompReq comp;
+};
+
+struct bench_result {
+    const bench_proto *proto;
+    const char *transport;
+    uint64_t wall_ns;
+    doe_stats stats;
+};
+
+static void bench_build_discovery(void *buf)
+{
+    doe_discovery *req = buf;
+
+    *req = (doe_discovery) {
+        .header = {
+            .vendor_id = PCI_DOE_PCI_SIG_VID,
+            .doe_type = PCI_SIG_DOE_DISCOVERY,
+            .length = DIV_ROUND_UP(sizeof(doe_discovery), sizeof(uint32_t)),
+        },
+        .index = 0,
+    };
+}
+
+static void bench_build_cdat(void *buf)
+{
+    struct cxl_cdat *req = buf;
+
+    *req = (struct cxl_cdat) {
+        .doe_hdr = {
+            .vendor_id = CXL_VENDOR_ID,
+            .doe_type = CXL_DOE_TABLE_ACCESS,
+            .length = DIV_ROUND_UP(sizeof(*req), sizeof(uint32_t)),
+        },
+        .req_code = CXL_DOE_TAB_REQ,
+        .table_type = CXL_DOE_TAB_TYPE_CDAT,
+        .entry_handle = 0,
+    };
+}
+
+static void bench_build_comp_cap(void *buf)
+{
+    CompReq *req = buf;
+
+    memset(req, 0, sizeof(*req));
+    req->header.doe_header.vendor_id = CXL_VENDOR_ID;
+    req->header.doe_header.doe_type = CXL_DOE_COMPLIANCE;
+    req->header.doe_header.length =
+        DIV_ROUND_UP(sizeof(struct cxl_compliance_mode_cap), sizeof(uint32_t));
+    req->header.req_code = CXL_COMP_MODE_CAP;
+    req->header.version = 0xcc;
+}
+
+static const bench_proto bench_protos[] = {
+    { "discovery", PCI_DOE_PROTOCOL_DISCOVERY, bench_build_discovery },
+    { "cdat", CXL_DOE_PROTOCOL_CDAT, bench_build_cdat },
+    { "compliance", CXL_DOE_PROTOCOL_COMPLIANCE, bench_build_comp_cap },
+};
+
+/* Every mailbox answers discovery, the others go where they were found */
+static int bench_mbox(pcie_dev *dev, const bench_proto *proto)
+{
+    if (proto->prot == PCI_DOE_PROTOCOL_DISCOVERY) {
+        return dev->doe_cap_head->cap;
+    }
+    return doe_get_cap_by_prot(dev, proto->prot);
+}
+
+static void bench_ioctl(pcie_dev *dev, int doe_cap, const bench_proto *proto,
+                        int iters, doe_buf *buf, bench_result *res)
+{
+    doe_stats *saved = dev->stats;
+    uint64_t start;
+    int i;
+
+    /* warm up, not counted */
+    proto->build(doe_buf_obj(buf));
+    doe_exchange_object(dev, doe_cap, buf->mem);
+
+    dev->stats = &res->stats;
+    start = doe_stats_now();
+    for (i = 0; i < iters; i++) {
+        proto->build(doe_buf_obj(buf));
+        doe_exchange_object(dev, doe_cap, buf->mem);
+    }
+    res->wall_ns = doe_stats_now() - start;
+    dev->stats = saved;
+}
+
+static void bench_config(pcie_dev *dev, int doe_cap, const bench_proto *proto,
+                         int iters, doe_buf *buf, bench_result *res)
+{
+    bench_req req;
+    uint64_t start, t;
+    int i, rc;
+
+    proto->build(&req);
+    doe_exchange_config(dev, doe_cap, &req, doe_buf_obj(buf), buf->size_dw,
+                        BENCH_TIMEOUT_NS);
+
+    start = doe_stats_now();
+    for (i = 0; i < iters; i++) {
+        t = doe_stats_now();
+        rc = doe_exchange_config(dev, doe_cap, &req, doe_buf_obj(buf), buf->size_dw,
+                                 BENCH_TIMEOUT_NS);
+        doe_stats_add(&res->stats, doe_stats_now() - t, rc < 0 ? rc : 0);
+    }
+    res->wall_ns = doe_stats_now() - start;
+}
+
+static double bench_rate(const bench_result *res)
+{
+    return res->wall_ns ? res->stats.count * 1e9 / res->wall_ns : 0;
+}
+
+static void bench_report_json(bench_result *results, int n, int iters, FILE *out)
+{
+    int i;
+
+    fprintf(out, "{\n  \"iterations\": %d,\n  \"results\": [", iters);
+    for (i = 0; i < n; i++) {
+        fprintf(out, "%s\n    {\n", i ? "," : "");
+        fprintf(out, "      \"protocol\": \"%s\",\n", results[i].proto->name);
+        fprintf(out, "      \"transport\": \"%s\",\n", results[i].transport);
+        fprintf(out, "      \"exchanges_per_sec\": %.1f,\n", bench_rate(&results[i]));
+        fprintf(out, "      \"requests\": ");
+        doe_stats_json(&results[i].stats, out, "      ");
+        fprintf(out, "\n    }");
+    }
+    fprintf(out, "%s]\n}\n", n ? "\n  " : "");
+}
+
+/*
+ * Time @iters discovery, CDAT entry 0 and Compliance capability exchanges
+ * over both transports and print percentiles and exchanges/s, plus a JSON
+ * report to @report when given. The config space runs race with anything
+ * else using the mailbox, so keep the device otherwise idle.
+ */
+int doe_bench(pcie_dev *dev, int iters, FILE *report)
+{
+    bench_result results[2 * ARRAY_SIZE(bench_protos)], *res;
+    const bench_proto *proto;
+    doe_stats_sum sum;
+    doe_buf *buf;
+    int i, doe_cap, n = 0, errs = 0;
+
+    /* DOE_MBOX_CMD copies out whatever the device sends: largest class */
+    buf = doe_buf_get(PCI_DOE_MAX_DW_SIZE);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    memset(results, 0, sizeof(results));
+    doe_discovery_cached(dev);
+
+    for (i = 0; i < (int)ARRAY_SIZE(bench_protos); i++) {
+        proto = &bench_protos[i];
+        doe_cap = bench_mbox(dev, proto);
+        if (!doe_cap) {
+            fprintf(dev->out, "%s: no mailbox, skipped\n", proto->name);
+            continue;
+        }
+
+        res = &results[n++];
+        res->proto = proto;
+        res->transport = "ioctl";
+        bench_ioctl(dev, doe_cap, proto, iters, buf, res);
+
+        res = &results[n++];
+        res->proto = proto;
+        res->transport = "config";
+        bench_config(dev, doe_cap, proto, iters, buf, res);
+    }
+    doe_buf_put(buf);
+
+    fprintf(dev->out, "\n%-10s %-9s %7s %6s %9s %9s %9s %9s %9s %10s\n", "protocol", "transport",
+           "count", "errs", "min(ns)", "p50(ns)", "p90(ns)", "p99(ns)", "max(ns)", "exch/s");
+    for (i = 0; i < n; i++) {
+        res = &results[i];
+        doe_stats_summary(&res->stats, &sum);
+        fprintf(dev->out, "%-10s %-9s %7u %6u %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+               " %9" PRIu64 " %10.1f\n", res->proto->name, res->transport, sum.count,
+               sum.errors, sum.min, sum.p50, sum.p90, sum.p99, sum.max, bench_rate(res));
+        errs += sum.errors;
+    }
+
+    if (report) {
+        bench_report_json(results, n, iters, report);
+    }
+
+    for (i = 0; i < n; i++) {
+        doe_stats_free(&results[i].stats);
+    }
+    if (!n) {
+        return -ENODEV;
+    }
+    return errs ? -EIO : 0;
+}
+
+/* A short run for test plans: both transports must complete cleanly */
+int test_bench(pcie_dev *dev)
+{
+    return doe_bench(dev, BENCH_TEST_ITERS, NULL);
+}
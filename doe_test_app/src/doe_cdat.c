@@ -7,18 +7,20 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "utils.h"
 #include "cxl_cdat.h"
+#include "cdat_parser.h"
+#include "doe_discovery.h"
+#include "driver/doe_api.h"
 
-uint32_t buf[PCI_DOE_MAX_DW_SIZE + 1] = {0};
-uint32_t  cdat_tbl[PCI_DOE_MAX_DW_SIZE + 1] = {0};
-
-
-void do_cdat_req(pcie_dev *dev, uint32_t idx)
+/* Read one CDAT entry into @buf, which must hold the largest entry */
+int do_cdat_req(pcie_dev *dev, uint32_t idx, doe_buf *buf)
 {
     int doe_cap;
     struct cxl_cdat req = {
@@ -32,99 +34,213 @@ void do_cdat_req(pcie_dev *dev, uint32_t idx)
         .entry_handle = idx,
     };
 
-    //doe_cap = doe_get_cap_by_prot(dev,
-            //DATA_OBJ_BUILD_HEADER1(CXL_VENDOR_ID, CXL_DOE_TABLE_ACCESS));
+    doe_cap = doe_get_cap_by_prot(dev, CXL_DOE_PROTOCOL_CDAT);
+    memcpy(doe_buf_obj(buf), &req, req.doe_hdr.length * sizeof(uint32_t));
+    return doe_exchange_buf(dev, doe_cap, buf);
+}
+
+/*
+ * Read the CDAT one entry handle per ioctl into @out, for drivers without
+ * the DOE_MBOX_VEC follow mode. Returns the number of bytes stored.
+ */
+static ssize_t cdat_read_by_entry(pcie_dev *dev, void *out, size_t out_len)
+{
+    uint32_t idx = 0;
+    size_t tbl_offset = 0, payload;
+    struct cxl_cdat_rsp *rsp;
+    ssize_t rc = 0;
+    doe_buf *buf;
+
+    buf = doe_buf_get(PCI_DOE_MAX_DW_SIZE);
+    if (!buf) {
+        return -ENOMEM;
+    }
+    rsp = doe_buf_obj(buf);
+
+    while (idx != CXL_DOE_TAB_ENT_MAX) {
+        rc = do_cdat_req(dev, idx, buf);
+        if (rc) {
+            break;
+        }
 
-    doe_cap = 0xd00;
-    memcpy(buf + 1, &req, req.doe_hdr.length * sizeof(uint32_t));
-    doe_exchange_object(dev, doe_cap, buf);
+        if (buf->used_dw * sizeof(uint32_t) < sizeof(*rsp)) {
+            rc = -EIO;
+            break;
+        }
+        payload = buf->used_dw * sizeof(uint32_t) - sizeof(*rsp);
+        if (payload > out_len - tbl_offset) {
+            rc = -ENOSPC;
+            break;
+        }
+        memcpy((uint8_t *)out + tbl_offset, rsp + 1, payload);
+        tbl_offset += payload;
+
+        idx = rsp->entry_handle;
+    }
+
+    doe_buf_put(buf);
+    return rc ? rc : (ssize_t)tbl_offset;
 }
 
-static unsigned char cdat_checksum(void *buf, size_t size)
+/*
+ * Read the whole CDAT into @out: from the driver's cache when it has one,
+ * else with a single DOE_MBOX_VEC follow call, else entry by entry.
+ * Returns the number of bytes stored or a negative errno.
+ */
+ssize_t cdat_read_table(pcie_dev *dev, void *out, size_t out_len)
 {
-    unsigned char sum, *data = buf;
-    size_t i;
+    ssize_t len;
+    size_t used;
+    int doe_cap, rc;
+
+    len = doe_sysfs_read(dev, "cdat", out, out_len);
+    if (len > 0) {
+        return len;
+    }
+
+    doe_discovery_cached(dev);
+    doe_cap = doe_get_cap_by_prot(dev, CXL_DOE_PROTOCOL_CDAT);
+    if (!doe_cap) {
+        return -ENODEV;
+    }
 
-    for (sum = 0, i = 0; i < size; i++)
-       sum += data[i];
-    return sum;
+    rc = doe_exchange_follow(dev, doe_cap, DOE_VEC_FOLLOW_CDAT, out, out_len, &used);
+    if (rc == -ENOTTY) {
+        return cdat_read_by_entry(dev, out, out_len);
+    }
+    return rc < 0 ? rc : (ssize_t)used;
 }
 
-void test_cdat(pcie_dev *dev)
+static void cdat_print_entry(FILE *out, const cdat_entry *ent)
 {
+    const struct cdat_sslbe *sslbe;
+    cdat_perf perf;
     int i;
-    uint32_t idx = 0, len;
-    int tbl_size = 0;
-    static int tbl_offset = 0;
-    struct rsp_header {
-        struct cxl_cdat_rsp hdr;
-        union cdat_data     data;
-    };
-    struct rsp_header *rsp_hdr;
-
-    rsp_hdr = (struct rsp_header *)buf;
 
-    while (idx != CXL_DOE_TAB_ENT_MAX) {
-        int payload = 0;
-        do_cdat_req(dev, idx);
-        if (idx == 0) {
-            tbl_offset = 0;
-            memset(cdat_tbl, 0x00, sizeof(cdat_tbl));
-            tbl_size = rsp_hdr->data.tbl_hdr.length;
-            printf("CDAT table header(len %d):\n", tbl_size);
-        } else {
-            switch (rsp_hdr->data.tbl_entry_hdr.type) {
-            case CDAT_TYPE_DSMAS:
-                printf("DSMAS:\n");
-                break;
-            case CDAT_TYPE_DSLBIS:
-                printf("DSLBIS:\n");
-                break;
-            case CDAT_TYPE_DSMSCIS:
-                printf("DSMSCIS:\n");
-                break;
-            case CDAT_TYPE_DSIS:
-                printf("DSIS:\n");
-                break;
-            case CDAT_TYPE_DSEMTS:
-                printf("DSEMTS:\n");
-                break;
-            case CDAT_TYPE_SSLBIS:
-                printf("SSLBIS:\n");
-                break;
-            }
+    fprintf(out, "%s (len %u):\n", cdat_type_name(ent->type), ent->length);
+
+    switch (ent->type) {
+    case CDAT_TYPE_DSMAS:
+        fprintf(out, "\thandle %u flags 0x%x DPA 0x%" PRIx64 " + 0x%" PRIx64 "\n",
+                ent->dsmas->DSMADhandle, ent->dsmas->flags,
+                (uint64_t)ent->dsmas->DPA_base, (uint64_t)ent->dsmas->DPA_length);
+        break;
+    case CDAT_TYPE_DSLBIS:
+        if (cdat_dslbis_decode(ent->dslbis, &perf)) {
+            fprintf(out, "\thandle %u: undecodable data type %u\n",
+                    ent->dslbis->handle, ent->dslbis->data_type);
+            break;
         }
-        payload = (rsp_hdr->hdr.doe_hdr.length * sizeof(uint32_t)) - sizeof(struct cxl_cdat);
-	printf("doe_hdr_len %ld, cxl_cdat_hdr %ld, payloalen %d\n", (rsp_hdr->hdr.doe_hdr.length * sizeof(uint32_t)), sizeof(struct cxl_cdat), payload);
-        memcpy(((uint8_t *)(cdat_tbl)+tbl_offset), (void *) &(rsp_hdr->data.tbl_hdr), payload);
-        tbl_offset += payload;
-
-        i = sizeof(struct cxl_cdat_rsp) / 4;
-        idx = rsp_hdr->hdr.entry_handle;
-        len = rsp_hdr->hdr.doe_hdr.length;
-        for (; i < len; i++) {
-            printf("\tbuf[%02x] = %08x\n", i, buf[i]);
+        fprintf(out, "\thandle %u %s %" PRIu64 " %s\n", perf.handle,
+                cdat_hmat_type_name(perf.data_type), perf.value,
+                perf.latency ? "ps" : "MB/s");
+        break;
+    case CDAT_TYPE_DSMSCIS:
+        fprintf(out, "\thandle %u cache size 0x%" PRIx64 " attr 0x%x\n",
+                ent->dsmscis->DSMASH_handle,
+                (uint64_t)ent->dsmscis->memory_side_cache_size,
+                ent->dsmscis->cache_attributes);
+        break;
+    case CDAT_TYPE_DSIS:
+        fprintf(out, "\thandle %u flags 0x%x\n", ent->dsis->handle, ent->dsis->flags);
+        break;
+    case CDAT_TYPE_DSEMTS:
+        fprintf(out, "\thandle %u EFI type %u DPA offset 0x%" PRIx64 " + 0x%" PRIx64 "\n",
+                ent->dsemts->DSMAS_handle, ent->dsemts->EFI_memory_type_attr,
+                (uint64_t)ent->dsemts->DPA_offset, (uint64_t)ent->dsemts->DPA_length);
+        break;
+    case CDAT_TYPE_SSLBIS:
+        fprintf(out, "\t%s base unit %" PRIu64 "\n",
+                cdat_hmat_type_name(ent->sslbis->data_type),
+                (uint64_t)ent->sslbis->entry_base_unit);
+        for (i = 0; i < cdat_sslbis_count(ent); i++) {
+            sslbe = cdat_sslbis_entry(ent, i);
+            fprintf(out, "\tport %u -> %u: %u\n", sslbe->port_x_id, sslbe->port_y_id,
+                    sslbe->latency_bandwidth);
         }
+        break;
+    }
+}
+
+/* Write the CDAT as JSON, for the -j option */
+int cdat_dump_json(pcie_dev *dev, FILE *out)
+{
+    doe_buf *tbl;
+    ssize_t len;
+    int rc;
 
-        printf("next ent: %02x\n", idx);
+    tbl = doe_buf_get(PCI_DOE_MAX_DW_SIZE);
+    if (!tbl) {
+        return -ENOMEM;
     }
 
-    /*dump the cdat table*/ 
-    {
-        struct cdat_table_header *tbl_hdr = (struct cdat_table_header *)cdat_tbl;
-        printf("hdr len %d\n", tbl_hdr->length);
-        printf("hdr rev %d\n", tbl_hdr->revision);
-        printf("hdr checksum: 0x%x\n", tbl_hdr->checksum);
-        printf("hdr seq 0x%x\n", tbl_hdr->sequence);
-    
-        for ( i = 0; i < tbl_size/sizeof(uint32_t); i++) {
-                printf("\tcdat_tbl[%02x] = %08x\n", i, cdat_tbl[i]);
-            }
+    len = cdat_read_table(dev, doe_buf_obj(tbl), tbl->size_dw * sizeof(uint32_t));
+    if (len < 0) {
+        fprintf(dev->out, "ERR: CDAT read failed: %s\n", strerror(-len));
+        doe_buf_put(tbl);
+        return len;
+    }
+    rc = cdat_to_json(doe_buf_obj(tbl), len, out);
+    doe_buf_put(tbl);
+    return rc;
+}
 
+int test_cdat(pcie_dev *dev)
+{
+    struct cdat_table_header *tbl_hdr;
+    doe_buf *tbl;
+    FILE *out = dev->out;
+    cdat_iter it;
+    cdat_entry ent;
+    ssize_t len;
+    bool bad = false;
+    int rc;
+
+    tbl = doe_buf_get(PCI_DOE_MAX_DW_SIZE);
+    if (!tbl) {
+        return -ENOMEM;
+    }
+    tbl_hdr = doe_buf_obj(tbl);
+    memset(tbl_hdr, 0, sizeof(*tbl_hdr));
+
+    len = cdat_read_table(dev, tbl_hdr, tbl->size_dw * sizeof(uint32_t));
+    if (len < 0) {
+        fprintf(out, "ERR: CDAT read failed: %s\n", strerror(-len));
+        doe_buf_put(tbl);
+        return len;
+    }
+
+    fprintf(out, "CDAT table header(len %d):\n", tbl_hdr->length);
+    fprintf(out, "hdr rev %d\n", tbl_hdr->revision);
+    fprintf(out, "hdr checksum: 0x%x\n", tbl_hdr->checksum);
+    fprintf(out, "hdr seq 0x%x\n", tbl_hdr->sequence);
+    if (tbl_hdr->length != len) {
+        fprintf(out, "ERR: header length %d, read %zd bytes\n", tbl_hdr->length, len);
+        bad = true;
+    }
+
+    cdat_iter_init(&it, tbl_hdr, len);
+    while ((rc = cdat_iter_next(&it, &ent)) > 0) {
+        cdat_print_entry(out, &ent);
     }
-    if (cdat_checksum(cdat_tbl, tbl_size)) {
-        printf("ERR: cdat tbl checksum uncorrect\n");
+    if (rc < 0) {
+        fprintf(out, "ERR: malformed CDAT structure at offset %zu\n", it.off);
+        doe_buf_put(tbl);
+        return rc;
+    }
+
+    rc = cdat_table_check(tbl_hdr, len);
+    if (rc == -EBADMSG) {
+        fprintf(out, "ERR: cdat tbl checksum uncorrect\n");
+    } else if (rc < 0) {
+        fprintf(out, "ERR: cdat tbl length invalid\n");
     } else {
-	    printf("cdat tbl checksum pass\n");
-    } 
+        fprintf(out, "cdat tbl checksum pass\n");
+    }
+
+    doe_buf_put(tbl);
+    if (rc < 0) {
+        return rc;
+    }
+    return bad ? -EIO : 0;
 }
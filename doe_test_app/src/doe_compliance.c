@@ -10,14 +10,18 @@
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "utils.h"
 #include "cxl.h"
 #include "cxl_compliance.h"
+#include "doe_discovery.h"
 
-uint32_t comp_buf[PCI_DOE_MAX_DW_SIZE + 1] = {0};
+/* Compliance responses are a few dwords; anything longer is -EOVERFLOW */
+#define COMP_RSP_MAX_DW 256
 
-static void do_compliance_req(pcie_dev *dev, uint32_t idx)
+/* The response is written over the request in @buf */
+static int do_compliance_req(pcie_dev *dev, uint32_t idx, doe_buf *buf)
 {
     uint32_t req_len, doe_cap;
     CompReq req;
@@ -72,69 +76,74 @@ static void do_compliance_req(pcie_dev *dev, uint32_t idx)
     
     req.header.doe_header.length = DIV_ROUND_UP(req_len, sizeof(uint32_t)),
 
-    doe_cap = 0xd00;
-    /** doe_cap = doe_get_cap_by_prot(dev, */
-    /**         DATA_OBJ_BUILD_HEADER1(CXL_VENDOR_ID, CXL_DOE_COMPLIANCE)); */
-    memcpy(comp_buf + 1, &req, req.header.doe_header.length * sizeof(uint32_t));
-    doe_exchange_object(dev, doe_cap, comp_buf);
+    doe_discovery_cached(dev);
+    doe_cap = doe_get_cap_by_prot(dev, CXL_DOE_PROTOCOL_COMPLIANCE);
+    memcpy(doe_buf_obj(buf), &req, req.header.doe_header.length * sizeof(uint32_t));
+    return doe_exchange_buf(dev, doe_cap, buf);
 }
 
-/* TODO */
-void test_compliance(pcie_dev *dev)
+/*
+ * Run one request and print the response. Fails when the exchange does,
+ * or when the response is short or answers a different request code.
+ */
+static int test_compliance_req(pcie_dev *dev, uint32_t idx, const char *name)
 {
-    int i;
     CompRspHeader *rsp_hdr;
-
-    memset(comp_buf, 0x00, sizeof(comp_buf));
-    rsp_hdr = (CompRspHeader *)comp_buf;
-
-    printf("Compaliance Query Cap\n");
-    do_compliance_req(dev, CXL_COMP_MODE_CAP);
-
-    printf("VID = %x\n", rsp_hdr->doe_header.vendor_id);
-    printf("DOE Type = %x\n", rsp_hdr->doe_header.doe_type);
-    printf("Len(DW) = %x\n", rsp_hdr->doe_header.length);
-
-    printf("resp_code = %x\n", rsp_hdr->rsp_code);
-    printf("Ver = %x\n", rsp_hdr->version);
-    printf("Len(B) = %x\n", rsp_hdr->length);
-
-    i = DIV_ROUND_UP(sizeof(CompRspHeader), 4);
-    for (; i < rsp_hdr->doe_header.length; i++) {
-        printf("\tcomp_buf[%02x] = %08x\n", i, comp_buf[i]);
+    FILE *out = dev->out;
+    uint32_t *rsp;
+    doe_buf *buf;
+    int i, rc;
+
+    fprintf(out, "%s\n", name);
+    buf = doe_buf_get(COMP_RSP_MAX_DW);
+    if (!buf) {
+        return -ENOMEM;
+    }
+    rsp = doe_buf_obj(buf);
+    rsp_hdr = doe_buf_obj(buf);
+
+    rc = do_compliance_req(dev, idx, buf);
+    if (rc) {
+        fprintf(out, "ERR: exchange failed %d\n", rc);
+        doe_buf_put(buf);
+        return rc;
     }
 
+    fprintf(out, "VID = %x\n", rsp_hdr->doe_header.vendor_id);
+    fprintf(out, "DOE Type = %x\n", rsp_hdr->doe_header.doe_type);
+    fprintf(out, "Len(DW) = %x\n", rsp_hdr->doe_header.length);
 
-    printf("Compliance Inject Viral\n");
-    do_compliance_req(dev, CXL_COMP_MODE_INJ_VIRAL);
-
-    printf("VID = %x\n", rsp_hdr->doe_header.vendor_id);
-    printf("DOE Type = %x\n", rsp_hdr->doe_header.doe_type);
-    printf("Len(DW) = %x\n", rsp_hdr->doe_header.length);
-
-    printf("Type = %x\n", rsp_hdr->rsp_code);
-    printf("Ver = %x\n", rsp_hdr->version);
-    printf("Len(B) = %x\n", rsp_hdr->length);
+    fprintf(out, "resp_code = %x\n", rsp_hdr->rsp_code);
+    fprintf(out, "Ver = %x\n", rsp_hdr->version);
+    fprintf(out, "Len(B) = %x\n", rsp_hdr->length);
 
     i = DIV_ROUND_UP(sizeof(CompRspHeader), 4);
-    for (; i < rsp_hdr->doe_header.length; i++) {
-        printf("\tcomp_buf[%02x] = %08x\n", i, comp_buf[i]);
+    for (; i < (int)buf->used_dw; i++) {
+        fprintf(out, "\tcomp_buf[%02x] = %08x\n", i, rsp[i]);
     }
 
-    printf("Compliance Inject Media Error\n");
-    do_compliance_req(dev, CXL_COMP_MODE_INJ_MEDIA_POSION);
+    if (buf->used_dw * sizeof(uint32_t) < sizeof(CompRspHeader)) {
+        fprintf(out, "ERR: response too short\n");
+        rc = -EIO;
+    } else if (rsp_hdr->rsp_code != idx) {
+        fprintf(out, "ERR: response code %x for request %x\n", rsp_hdr->rsp_code, idx);
+        rc = -EIO;
+    }
 
-    printf("VID = %x\n", rsp_hdr->doe_header.vendor_id);
-    printf("DOE Type = %x\n", rsp_hdr->doe_header.doe_type);
-    printf("Len(DW) = %x\n", rsp_hdr->doe_header.length);
+    doe_buf_put(buf);
+    return rc;
+}
 
-    printf("Type = %x\n", rsp_hdr->rsp_code);
-    printf("Ver = %x\n", rsp_hdr->version);
-    printf("Len(B) = %x\n", rsp_hdr->length);
+int test_compliance(pcie_dev *dev)
+{
+    int rc, err = 0;
 
-    i = DIV_ROUND_UP(sizeof(CompRspHeader), 4);
-    for (; i < rsp_hdr->doe_header.length; i++) {
-        printf("\tcomp_buf[%02x] = %08x\n", i, comp_buf[i]);
-    }
+    rc = test_compliance_req(dev, CXL_COMP_MODE_CAP, "Compliance Query Cap");
+    err = err ? err : rc;
+    rc = test_compliance_req(dev, CXL_COMP_MODE_INJ_VIRAL, "Compliance Inject Viral");
+    err = err ? err : rc;
+    rc = test_compliance_req(dev, CXL_COMP_MODE_INJ_MEDIA_POSION, "Compliance Inject Media Error");
+    err = err ? err : rc;
 
+    return err;
 }
@@ -11,14 +11,17 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "doe_discovery.h"
+#include "driver/doe_api.h"
 
 int doe_discovery_one(pcie_dev *dev, uint32_t doe_cap,
                       uint32_t idx, doe_discovery_rsp *rsp)
 {
-    uint32_t buf[PCI_DOE_MAX_DW_SIZE + 1], rsp_len;
+    doe_buf *buf;
+    int rc;
     doe_discovery req = {
         .header = {
             .vendor_id = PCI_DOE_PCI_SIG_VID,
@@ -28,24 +31,131 @@ int doe_discovery_one(pcie_dev *dev, uint32_t doe_cap,
         .index = idx,
     };
 
-    memcpy(buf + 1, &req, req.header.length * sizeof(uint32_t));
-    doe_exchange_object(dev, doe_cap, buf);
+    buf = doe_buf_get(DIV_ROUND_UP(sizeof(*rsp), sizeof(uint32_t)));
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    memcpy(doe_buf_obj(buf), &req, req.header.length * sizeof(uint32_t));
+    rc = doe_exchange_buf(dev, doe_cap, buf);
+    if (!rc && buf->used_dw * sizeof(uint32_t) < sizeof(*rsp)) {
+        rc = -EIO;
+    }
+    if (!rc) {
+        memcpy(rsp, doe_buf_obj(buf), sizeof(*rsp));
+    }
 
-    rsp_len = ((DOEHeader *)buf)->length;
-    memcpy(rsp, buf, rsp_len * sizeof(uint32_t));
+    doe_buf_put(buf);
+    return rc;
+}
+
+/*
+ * Walk the whole discovery list of @doe_cap in one DOE_MBOX_VEC call.
+ * Returns -ENOTTY on drivers without it.
+ */
+static int doe_discovery_follow(pcie_dev *dev, DOEcap *doe_cap)
+{
+    uint32_t data[PCI_DOE_PROTOCOL_MAX];
+    doe_discovery_rsp rsp;
+    DOEprot **prot = &doe_cap->prot_head;
+    size_t used;
+    int i, rc;
+
+    rc = doe_exchange_follow(dev, doe_cap->cap, DOE_VEC_FOLLOW_DISCOVERY,
+                             data, sizeof(data), &used);
+    if (rc < 0) {
+        return rc;
+    }
+
+    for (i = 0; i < (int)(used / sizeof(uint32_t)); i++) {
+        rsp.data = data[i];
+        *prot = calloc(1, sizeof(DOEprot));
+        (*prot)->prot = DATA_OBJ_BUILD_HEADER1(rsp.vendor_id, rsp.doe_type);
+        prot = &(*prot)->next;
+    }
 
     return 0;
 }
 
-void doe_discovery_all(pcie_dev *dev)
+/*
+ * Take the protocol lists the driver found at probe from its "mailboxes"
+ * attribute, one line per mailbox: "<cap> <vid>:<prot> ...".
+ */
+static int doe_discovery_sysfs(pcie_dev *dev)
+{
+    char text[16384], *line, *save, *tok, *tsave;
+    unsigned int vid, type;
+    DOEcap *doe_cap;
+    DOEprot **prot;
+    ssize_t len;
+    int cap;
+
+    len = doe_sysfs_read(dev, "mailboxes", text, sizeof(text) - 1);
+    if (len < 0) {
+        return len;
+    }
+    text[len] = 0;
+
+    for (line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        tok = strtok_r(line, " ", &tsave);
+        cap = strtol(tok, NULL, 0);
+
+        for (doe_cap = dev->doe_cap_head; doe_cap; doe_cap = doe_cap->next) {
+            if (doe_cap->cap == cap) {
+                break;
+            }
+        }
+        if (!doe_cap || doe_cap->prot_head) {
+            continue;
+        }
+
+        prot = &doe_cap->prot_head;
+        while ((tok = strtok_r(NULL, " ", &tsave))) {
+            if (sscanf(tok, "%x:%x", &vid, &type) != 2) {
+                continue;
+            }
+            *prot = calloc(1, sizeof(DOEprot));
+            (*prot)->prot = DATA_OBJ_BUILD_HEADER1(vid, type);
+            prot = &(*prot)->next;
+        }
+    }
+
+    return 0;
+}
+
+/* Drop the protocol lists so discovery can run again */
+static void doe_discovery_reset(pcie_dev *dev)
+{
+    DOEcap *doe_cap;
+    DOEprot *prot, *next;
+
+    for (doe_cap = dev->doe_cap_head; doe_cap; doe_cap = doe_cap->next) {
+        for (prot = doe_cap->prot_head; prot; prot = next) {
+            next = prot->next;
+            free(prot);
+        }
+        doe_cap->prot_head = NULL;
+    }
+}
+
+/* Returns 0 or the first failing exchange's negative errno */
+int doe_discovery_all(pcie_dev *dev)
 {
     uint32_t idx;
     doe_discovery_rsp rsp = {0};
-    int rc = 0;
-    DOEcap *doe_cap = dev->doe_cap_head;
+    int rc, err = 0;
+    DOEcap *doe_cap;
     DOEprot **prot;
 
-    for (; doe_cap; doe_cap = doe_cap->next) {
+    doe_discovery_reset(dev);
+
+    for (doe_cap = dev->doe_cap_head; doe_cap; doe_cap = doe_cap->next) {
+        rc = doe_discovery_follow(dev, doe_cap);
+        if (rc != -ENOTTY) {
+            err = err ? err : rc;
+            continue;
+        }
+
         idx = 0;
         prot = &doe_cap->prot_head;
 
@@ -53,36 +163,168 @@ void doe_discovery_all(pcie_dev *dev)
             rc = doe_discovery_one(dev, doe_cap->cap, idx, &rsp);
 
             if (rc) {
+                fprintf(dev->out, "cap %x: discovery index %u failed %d\n",
+                        doe_cap->cap, idx, rc);
+                err = err ? err : rc;
                 break;
             }
 
-            *prot = malloc(sizeof(DOEprot));
+            *prot = calloc(1, sizeof(DOEprot));
             (*prot)->prot = DATA_OBJ_BUILD_HEADER1(rsp.vendor_id, rsp.doe_type);
 
-#if 0
-            if (idx == 0) {
-                assert((*prot)->prot == PCI_DOE_PROTOCOL_DISCOVERY);
-            }
-#endif
-
             prot = &(*prot)->next;
 
             idx = rsp.next_index;
         } while (idx);
     }
+
+    return err;
+}
+
+static int doe_discovery_submit(pcie_dev *dev, DOEcap *doe_cap, uint32_t idx)
+{
+    doe_discovery req = {
+        .header = {
+            .vendor_id = PCI_DOE_PCI_SIG_VID,
+            .doe_type = PCI_SIG_DOE_DISCOVERY,
+            .length = DIV_ROUND_UP(sizeof(doe_discovery), sizeof(uint32_t)),
+        },
+        .index = idx,
+    };
+
+    return doe_submit_async(dev, doe_cap->cap, (uintptr_t)doe_cap, &req,
+                            sizeof(doe_discovery_rsp) / sizeof(uint32_t));
+}
+
+/*
+ * Same result as doe_discovery_all(), but every mailbox walks its protocol
+ * list concurrently: one discovery request per mailbox stays queued and
+ * each completion submits the next index. The completion tag is the
+ * DOEcap the response belongs to.
+ */
+int doe_discovery_all_async(pcie_dev *dev)
+{
+    uint8_t buf[64 * (sizeof(struct doe_cpl) + sizeof(doe_discovery_rsp))];
+    struct pollfd pfd = { .fd = dev->cdev, .events = POLLIN };
+    DOEcap *doe_cap;
+    DOEprot **prot;
+    doe_discovery_rsp *rsp;
+    struct doe_cpl *cpl;
+    int pending = 0, rc, err = 0;
+    ssize_t len, off;
+
+    doe_discovery_reset(dev);
+
+    for (doe_cap = dev->doe_cap_head; doe_cap; doe_cap = doe_cap->next) {
+        rc = doe_discovery_submit(dev, doe_cap, 0);
+        if (rc) {
+            fprintf(dev->out, "cap %x: submit failed %d\n", doe_cap->cap, rc);
+            return rc;
+        }
+        pending++;
+    }
+
+    while (pending) {
+        /* without a driver the submission itself queued the completion */
+        if (dev->cdev >= 0 && poll(&pfd, 1, -1) < 0) {
+            return -errno;
+        }
+
+        len = doe_reap_async(dev, buf, sizeof(buf));
+        if (len < 0) {
+            return len;
+        }
+
+        for (off = 0; off < len; off += sizeof(*cpl) + cpl->rsp_dw * sizeof(uint32_t)) {
+            cpl = (struct doe_cpl *)(buf + off);
+            rsp = (doe_discovery_rsp *)(cpl + 1);
+            doe_cap = (DOEcap *)(uintptr_t)cpl->tag;
+            pending--;
+
+            if (cpl->status) {
+                fprintf(dev->out, "cap %x: discovery failed %d\n", doe_cap->cap, cpl->status);
+                err = err ? err : cpl->status;
+                continue;
+            }
+
+            for (prot = &doe_cap->prot_head; *prot; prot = &(*prot)->next)
+                ;
+            *prot = calloc(1, sizeof(DOEprot));
+            (*prot)->prot = DATA_OBJ_BUILD_HEADER1(rsp->vendor_id, rsp->doe_type);
+
+            if (rsp->next_index) {
+                rc = doe_discovery_submit(dev, doe_cap, rsp->next_index);
+                if (rc) {
+                    fprintf(dev->out, "cap %x: submit failed %d\n", doe_cap->cap, rc);
+                    err = err ? err : rc;
+                    continue;
+                }
+                pending++;
+            }
+        }
+    }
+
+    return err;
+}
+
+/*
+ * Fill the protocol lists for users that only need to find a mailbox:
+ * from the driver's cache when it has one, by discovery otherwise.
+ */
+void doe_discovery_cached(pcie_dev *dev)
+{
+    if (dev->doe_cap_head && dev->doe_cap_head->prot_head) {
+        return;
+    }
+
+    if (doe_discovery_sysfs(dev)) {
+        doe_discovery_all(dev);
+    }
 }
 
-void test_discovery(pcie_dev *dev)
+/* Print the protocol lists; fails when a mailbox reported none */
+static int doe_discovery_show(pcie_dev *dev)
 {
     DOEcap *doe_cap;
     DOEprot *prot;
-
-    doe_discovery_all(dev);
+    int rc = 0;
 
     for (doe_cap = dev->doe_cap_head; doe_cap; doe_cap = doe_cap->next) {
-        printf("cap off = %x\n", doe_cap->cap);
+        fprintf(dev->out, "cap off = %x\n", doe_cap->cap);
         for (prot = doe_cap->prot_head; prot; prot = prot->next) {
-            printf("\tprotocol = %08x\n", prot->prot);
+            fprintf(dev->out, "\tprotocol = %08x\n", prot->prot);
         }
+        if (!doe_cap->prot_head) {
+            fprintf(dev->out, "ERR: cap %x has no protocols\n", doe_cap->cap);
+            rc = -ENODATA;
+        }
+    }
+
+    return rc;
+}
+
+int test_discovery_async(pcie_dev *dev)
+{
+    int rc;
+
+    rc = doe_discovery_all_async(dev);
+    if (rc) {
+        fprintf(dev->out, "async discovery failed\n");
+        return rc;
     }
+
+    return doe_discovery_show(dev);
+}
+
+int test_discovery(pcie_dev *dev)
+{
+    int rc;
+
+    rc = doe_discovery_all(dev);
+    if (rc) {
+        fprintf(dev->out, "discovery failed %d\n", rc);
+        return rc;
+    }
+
+    return doe_discovery_show(dev);
 }
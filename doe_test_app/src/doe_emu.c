@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "pcie.h"
+#include "cxl.h"
+#include "cxl_cdat.h"
+#include "cxl_compliance.h"
+#include "cdat_parser.h"
+#include "doe_discovery.h"
+#include "doe_stats.h"
+#include "doe_emu.h"
+
+/*
+ * DOE mailbox emulator, a config space transport for pcie_dev. It models
+ * a CXL type 3 function with a CXL DVSEC and two DOE mailboxes, one for
+ * CDAT and one for Compliance, both answering Discovery. Each mailbox runs
+ * the DOE register protocol: dwords written to the Write Data Mailbox
+ * collect a request, GO hands it to the responder and sets Busy until the
+ * configured delay has passed, then Data Object Ready is set and the
+ * response is read dword by dword, each advanced by a write to the Read
+ * Data Mailbox. Abort drops everything and clears Error.
+ *
+ * Error is set for malformed requests (length not matching the dwords
+ * written, or over EMU_OBJ_MAX_DW), for reads past the response, and for
+ * unknown protocols unless err_unsupported is cleared (unsupported=drop),
+ * which drops them silently as the spec also allows and leaves the
+ * requester to time out. While Error is set writes are ignored.
+ */
+
+#define EMU_OBJ_MAX_DW      64
+#define EMU_CFG_SIZE        4096
+
+#define EMU_PCIE_CAP        0x40
+#define EMU_DVSEC_CAP       0x100
+#define EMU_DVSEC_LEN       0x38
+#define EMU_CDAT_MBOX       0x150
+#define EMU_COMP_MBOX       0x170
+#define EMU_DOE_CAP_LEN     0x18
+
+#define EMU_CDAT_ENTRIES    6   /* header, DSMAS, 4 DSLBIS */
+
+typedef struct emu_mbox emu_mbox;
+typedef struct doe_emu doe_emu;
+
+struct emu_mbox {
+    uint32_t cap;
+    const uint32_t *prots;
+    int nprot;
+
+    bool error;
+    bool pending;               /* GO accepted, response not yet consumed */
+    uint64_t ready_ns;
+    uint32_t req[EMU_OBJ_MAX_DW];
+    uint32_t req_dw;
+    uint32_t rsp[EMU_OBJ_MAX_DW];
+    uint32_t rsp_dw, rd_pos;
+};
+
+struct doe_emu {
+    doe_emu_cfg cfg;
+    pthread_mutex_t lock;
+    uint64_t seed;
+
+    uint32_t cfg_space[EMU_CFG_SIZE / sizeof(uint32_t)];
+    emu_mbox mbox[2];
+
+    /* CDAT as served by entry handle */
+    uint8_t cdat[256];
+    uint32_t cdat_off[EMU_CDAT_ENTRIES + 1];
+};
+
+static const uint32_t emu_cdat_prots[] = {
+    PCI_DOE_PROTOCOL_DISCOVERY,
+    CXL_DOE_PROTOCOL_CDAT,
+};
+
+static const uint32_t emu_comp_prots[] = {
+    PCI_DOE_PROTOCOL_DISCOVERY,
+    CXL_DOE_PROTOCOL_COMPLIANCE,
+};
+
+/*
+ * Spec: comma separated key=value, delay_us (all protocols), discovery_us,
+ * cdat_us, compliance_us, jitter_us, unsupported=error|drop (default error).
+ */
+int doe_emu_parse(const char *spec, doe_emu_cfg *cfg)
+{
+    char *str, *tok, *save, *val;
+    uint32_t us;
+    int i, rc = 0;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->err_unsupported = true;
+
+    str = strdup(spec);
+    for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        val = strchr(tok, '=');
+        if (!val) {
+            rc = -EINVAL;
+            break;
+        }
+        *val++ = 0;
+        us = strtoul(val, NULL, 0);
+
+        if (!strcmp(tok, "delay_us")) {
+            for (i = 0; i < DOE_EMU_PROT_MAX; i++) {
+                cfg->delay_us[i] = us;
+            }
+        } else if (!strcmp(tok, "discovery_us")) {
+            cfg->delay_us[DOE_EMU_DISCOVERY] = us;
+        } else if (!strcmp(tok, "cdat_us")) {
+            cfg->delay_us[DOE_EMU_CDAT] = us;
+        } else if (!strcmp(tok, "compliance_us")) {
+            cfg->delay_us[DOE_EMU_COMPLIANCE] = us;
+        } else if (!strcmp(tok, "jitter_us")) {
+            cfg->jitter_us = us;
+        } else if (!strcmp(tok, "unsupported")) {
+            if (strcmp(val, "drop") && strcmp(val, "error")) {
+                rc = -EINVAL;
+                break;
+            }
+            cfg->err_unsupported = !strcmp(val, "error");
+        } else {
+            rc = -EINVAL;
+            break;
+        }
+    }
+
+    if (rc) {
+        printf("bad emulator option '%s'\n", tok);
+    }
+    free(str);
+    return rc;
+}
+
+static void emu_cdat_add(doe_emu *emu, int *n, const void *ent, size_t len)
+{
+    memcpy(emu->cdat + emu->cdat_off[*n], ent, len);
+    emu->cdat_off[*n + 1] = emu->cdat_off[*n] + len;
+    (*n)++;
+}
+
+/* One 256 MiB DSMAS range with read/write latency and bandwidth */
+static void emu_cdat_init(doe_emu *emu)
+{
+    static const struct { uint8_t type; uint16_t val; } perf[] = {
+        { CDAT_HMAT_READ_LATENCY, 150 },    /* ns */
+        { CDAT_HMAT_WRITE_LATENCY, 200 },
+        { CDAT_HMAT_READ_BANDWIDTH, 20000 },   /* MB/s */
+        { CDAT_HMAT_WRITE_BANDWIDTH, 16000 },
+    };
+    struct cdat_table_header *hdr = (struct cdat_table_header *)emu->cdat;
+    struct cdat_dsmas dsmas = {
+        .header = { .type = CDAT_TYPE_DSMAS, .length = sizeof(dsmas) },
+        .DSMADhandle = 0,
+        .DPA_base = 0,
+        .DPA_length = 256ULL << 20,
+    };
+    struct cdat_dslbis dslbis = {
+        .header = { .type = CDAT_TYPE_DSLBIS, .length = sizeof(dslbis) },
+    };
+    struct cdat_table_header th = {
+        .revision = CXL_CDAT_REV,
+    };
+    uint8_t sum = 0;
+    int i, n = 0;
+
+    emu_cdat_add(emu, &n, &th, sizeof(th));
+    emu_cdat_add(emu, &n, &dsmas, sizeof(dsmas));
+    for (i = 0; i < (int)(sizeof(perf) / sizeof(perf[0])); i++) {
+        dslbis.data_type = perf[i].type;
+        dslbis.entry_base_unit = perf[i].type <= CDAT_HMAT_WRITE_LATENCY ? 1000 : 1;
+        dslbis.entry[0] = perf[i].val;
+        emu_cdat_add(emu, &n, &dslbis, sizeof(dslbis));
+    }
+
+    hdr->length = emu->cdat_off[n];
+    for (i = 0; i < (int)hdr->length; i++) {
+        sum += emu->cdat[i];
+    }
+    hdr->checksum = -sum;
+}
+
+static void emu_cfg_init(doe_emu *emu)
+{
+    uint32_t *cfg = emu->cfg_space;
+    int i;
+
+    cfg[PCI_VENDOR_ID / 4] = 0x000d1b36;                /* QEMU CXL type 3 */
+    cfg[PCI_COMMAND / 4] = PCI_STATUS_CAP_LIST << 16;
+    cfg[PCI_CLASS_REVISION / 4] = 0x05021000;           /* CXL memory device */
+    cfg[PCI_CAPABILITY_LIST / 4] = EMU_PCIE_CAP;
+    cfg[EMU_PCIE_CAP / 4] = 2 << 16 | PCI_CAP_ID_EXP;       /* version 2 */
+
+    cfg[EMU_DVSEC_CAP / 4] = PCI_EXT_CAP_ID_DVSEC | 1 << 16 | EMU_CDAT_MBOX << 20;
+    cfg[(EMU_DVSEC_CAP + PCI_DVSEC_HEADER1) / 4] = CXL_VENDOR_ID | 1 << 16 |
+                                                    EMU_DVSEC_LEN << 20;
+    cfg[(EMU_DVSEC_CAP + PCI_DVSEC_HEADER2) / 4] = 0 |
+        (PCI_CXL_CAP_IO | PCI_CXL_CAP_MEM) << 16;
+
+    emu->mbox[0].cap = EMU_CDAT_MBOX;
+    emu->mbox[0].prots = emu_cdat_prots;
+    emu->mbox[0].nprot = sizeof(emu_cdat_prots) / sizeof(emu_cdat_prots[0]);
+    emu->mbox[1].cap = EMU_COMP_MBOX;
+    emu->mbox[1].prots = emu_comp_prots;
+    emu->mbox[1].nprot = sizeof(emu_comp_prots) / sizeof(emu_comp_prots[0]);
+
+    for (i = 0; i < 2; i++) {
+        cfg[emu->mbox[i].cap / 4] = PCI_EXT_CAP_ID_DOE | 1 << 16 |
+                                    (i ? 0 : EMU_COMP_MBOX) << 20;
+    }
+}
+
+static emu_mbox *emu_find_mbox(doe_emu *emu, uint32_t addr)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (addr >= emu->mbox[i].cap && addr < emu->mbox[i].cap + EMU_DOE_CAP_LEN) {
+            return &emu->mbox[i];
+        }
+    }
+    return NULL;
+}
+
+static void emu_rsp_header(emu_mbox *mb, uint32_t len_dw)
+{
+    mb->rsp[0] = mb->req[0];    /* same vendor ID and type */
+    mb->rsp[1] = len_dw;
+    mb->rsp_dw = len_dw;
+}
+
+static void emu_discovery(emu_mbox *mb)
+{
+    doe_discovery *req = (doe_discovery *)mb->req;
+    doe_discovery_rsp *rsp = (doe_discovery_rsp *)mb->rsp;
+    int idx = req->index < mb->nprot ? req->index : 0;
+    uint32_t prot = mb->prots[idx];
+
+    emu_rsp_header(mb, sizeof(*rsp) / sizeof(uint32_t));
+    rsp->vendor_id = prot & 0xffff;
+    rsp->doe_type = prot >> 16;
+    rsp->next_index = idx + 1 < mb->nprot ? idx + 1 : 0;
+}
+
+static void emu_cdat(doe_emu *emu, emu_mbox *mb)
+{
+    struct cxl_cdat *req = (struct cxl_cdat *)mb->req;
+    struct cxl_cdat_rsp *rsp = (struct cxl_cdat_rsp *)mb->rsp;
+    uint16_t idx = req->entry_handle;
+    uint32_t len;
+
+    if (req->table_type != CXL_DOE_TAB_TYPE_CDAT || idx >= EMU_CDAT_ENTRIES) {
+        idx = 0;
+    }
+    len = emu->cdat_off[idx + 1] - emu->cdat_off[idx];
+
+    emu_rsp_header(mb, (sizeof(*rsp) + len) / sizeof(uint32_t));
+    rsp->req_code = CXL_DOE_TAB_RSP;
+    rsp->table_type = CXL_DOE_TAB_TYPE_CDAT;
+    rsp->entry_handle = idx + 1 < EMU_CDAT_ENTRIES ? idx + 1 : CXL_DOE_TAB_ENT_MAX;
+    memcpy(rsp + 1, emu->cdat + emu->cdat_off[idx], len);
+}
+
+/* Capability query gets every request type; the rest succeed */
+static void emu_compliance(emu_mbox *mb)
+{
+    CompReqHeader *req = (CompReqHeader *)mb->req;
+    struct cxl_compliance_mode_cap_rsp *cap = (void *)mb->rsp;
+    struct cxl_compliance_mode_status_rsp *st = (void *)mb->rsp;
+    struct status_rsp *rsp = (void *)mb->rsp;
+    uint8_t code = req->req_code;
+    size_t len;
+
+    memset(mb->rsp, 0, sizeof(mb->rsp));
+    switch (code) {
+    case CXL_COMP_MODE_CAP:
+        len = sizeof(*cap);
+        cap->available_cap_bitmask = (1ULL << (CXL_COMP_MODE_INJ_MEDIA_POSION + 1)) - 1;
+        cap->enabled_cap_bitmask = cap->available_cap_bitmask;
+        break;
+    case CXL_COMP_MODE_STATUS:
+        len = sizeof(*st);
+        break;
+    default:
+        len = sizeof(*rsp);
+        rsp->status = CXL_COMP_MODE_RET_SUCC;
+        break;
+    }
+
+    emu_rsp_header(mb, DIV_ROUND_UP(len, sizeof(uint32_t)));
+    rsp->header.rsp_code = code;
+    rsp->header.version = req->version;
+    rsp->header.length = len;
+}
+
+static void emu_go(doe_emu *emu, emu_mbox *mb)
+{
+    DOEHeader *hdr = (DOEHeader *)mb->req;
+    uint32_t prot, delay_us;
+    int i, which = -1;
+
+    if (mb->req_dw < 2 || hdr->length != mb->req_dw) {
+        mb->error = true;
+        return;
+    }
+
+    prot = DATA_OBJ_BUILD_HEADER1(hdr->vendor_id, (uint32_t)hdr->doe_type);
+    for (i = 0; i < mb->nprot; i++) {
+        if (mb->prots[i] == prot) {
+            break;
+        }
+    }
+
+    if (i == mb->nprot) {
+        mb->error = emu->cfg.err_unsupported;
+        mb->req_dw = 0;
+        return;
+    }
+
+    if (prot == PCI_DOE_PROTOCOL_DISCOVERY) {
+        which = DOE_EMU_DISCOVERY;
+        emu_discovery(mb);
+    } else if (prot == CXL_DOE_PROTOCOL_CDAT) {
+        which = DOE_EMU_CDAT;
+        emu_cdat(emu, mb);
+    } else {
+        which = DOE_EMU_COMPLIANCE;
+        emu_compliance(mb);
+    }
+
+    delay_us = emu->cfg.delay_us[which];
+    if (emu->cfg.jitter_us) {
+        emu->seed = emu->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        delay_us += (emu->seed >> 33) % (emu->cfg.jitter_us + 1);
+    }
+
+    mb->req_dw = 0;
+    mb->rd_pos = 0;
+    mb->pending = true;
+    mb->ready_ns = doe_stats_now() + delay_us * 1000ULL;
+}
+
+static void emu_abort(emu_mbox *mb)
+{
+    mb->error = false;
+    mb->pending = false;
+    mb->req_dw = 0;
+    mb->rsp_dw = 0;
+    mb->rd_pos = 0;
+}
+
+static bool emu_ready(emu_mbox *mb)
+{
+    return mb->pending && doe_stats_now() >= mb->ready_ns;
+}
+
+static uint32_t emu_mbox_read(emu_mbox *mb, uint32_t reg)
+{
+    uint32_t st = 0;
+
+    switch (reg) {
+    case PCIE_DOE_STATUS:
+        if (mb->error) {
+            st |= PCIE_DOE_STATUS_ERR;
+        }
+        if (mb->pending) {
+            st |= emu_ready(mb) ? PCIE_DOE_STATUS_DO_RDY : PCIE_DOE_STATUS_BUSY;
+        }
+        return st;
+    case PCIE_DOE_RD_DATA_MBOX:
+        return emu_ready(mb) ? mb->rsp[mb->rd_pos] : 0;
+    default:
+        return 0;
+    }
+}
+
+static void emu_mbox_write(doe_emu *emu, emu_mbox *mb, uint32_t reg, uint32_t data)
+{
+    switch (reg) {
+    case PCIE_DOE_CTRL:
+        if (data & PCIE_DOE_CTRL_ABORT) {
+            emu_abort(mb);
+        } else if ((data & PCIE_DOE_CTRL_GO) && !mb->error && !mb->pending) {
+            emu_go(emu, mb);
+        }
+        break;
+    case PCIE_DOE_WR_DATA_MBOX:
+        if (mb->error || mb->pending) {
+            break;
+        }
+        if (mb->req_dw == EMU_OBJ_MAX_DW) {
+            mb->error = true;
+            break;
+        }
+        mb->req[mb->req_dw++] = data;
+        break;
+    case PCIE_DOE_RD_DATA_MBOX:
+        if (!emu_ready(mb)) {
+            mb->error = true;
+            break;
+        }
+        if (++mb->rd_pos == mb->rsp_dw) {
+            mb->pending = false;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static uint32_t emu_read(pcie_dev *dev, uint32_t addr)
+{
+    doe_emu *emu = dev->priv;
+    emu_mbox *mb;
+    uint32_t data;
+
+    addr &= EMU_CFG_SIZE - 4;
+
+    pthread_mutex_lock(&emu->lock);
+    mb = emu_find_mbox(emu, addr);
+    if (mb && addr - mb->cap >= PCIE_DOE_CTRL) {
+        data = emu_mbox_read(mb, addr - mb->cap);
+    } else {
+        data = emu->cfg_space[addr / 4];
+    }
+    pthread_mutex_unlock(&emu->lock);
+
+    return data;
+}
+
+/* Only the DOE registers are writable */
+static void emu_write(pcie_dev *dev, uint32_t addr, uint32_t data)
+{
+    doe_emu *emu = dev->priv;
+    emu_mbox *mb;
+
+    addr &= EMU_CFG_SIZE - 4;
+
+    pthread_mutex_lock(&emu->lock);
+    mb = emu_find_mbox(emu, addr);
+    if (mb) {
+        emu_mbox_write(emu, mb, addr - mb->cap, data);
+    }
+    pthread_mutex_unlock(&emu->lock);
+}
+
+static void emu_write8(pcie_dev *dev, uint32_t addr, uint8_t data)
+{
+    emu_write(dev, addr, (uint32_t)data << (addr & 3) * 8);
+}
+
+static void emu_close(pcie_dev *dev)
+{
+    doe_emu *emu = dev->priv;
+
+    pthread_mutex_destroy(&emu->lock);
+    free(emu);
+}
+
+static const pcie_ops doe_emu_ops = {
+    .name = "emu",
+    .read = emu_read,
+    .write = emu_write,
+    .write8 = emu_write8,
+    .close = emu_close,
+};
+
+/* Attach a fresh emulated function to @dev, no file descriptors needed */
+int doe_emu_attach(pcie_dev *dev, const doe_emu_cfg *cfg)
+{
+    doe_emu *emu;
+
+    emu = calloc(1, sizeof(*emu));
+    if (!emu) {
+        return -ENOMEM;
+    }
+
+    emu->cfg = *cfg;
+    emu->seed = 0x9e3779b97f4a7c15ULL ^ (uintptr_t)dev;
+    pthread_mutex_init(&emu->lock, NULL);
+    emu_cfg_init(emu);
+    emu_cdat_init(emu);
+
+    dev->ops = &doe_emu_ops;
+    dev->priv = emu;
+    return 0;
+}
@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "pcie_doe.h"
+#include "doe_stats.h"
+#include "doe_runner.h"
+
+#include "doe_test.h"
+#include "doe_discovery.h"
+#include "cxl_cdat.h"
+#include "cxl_compliance.h"
+#include "doe_emu.h"
+#include "doe_bench.h"
+
+/*
+ * Runs a test plan on several devices at once, one worker thread per
+ * device. A worker's output is kept in memory and printed once all are
+ * done, so logs of different devices never interleave.
+ */
+
+/* The config space tests are not implemented in Avery BFM CXL Device yet */
+static const doe_test_desc doe_tests[] = {
+    { "discovery", test_discovery, "discovery on every mailbox" },
+    { "discovery_async", test_discovery_async, "discovery through DOE_MBOX_SUBMIT" },
+    { "cdat", test_cdat, "read, parse and checksum the CDAT" },
+    { "compliance", test_compliance, "Compliance DOE cap, viral and poison requests" },
+    { "bench", test_bench, "short round-trip benchmark over ioctl and config space" },
+    { "error", test_error, "error bit on an extra mailbox read (config space)" },
+    { "invalid_len", test_invalid_len, "request shorter than its header (config space)" },
+    { "invalid_protocol", test_invalid_protocol, "request for an unknown protocol (config space)" },
+    { "abort", test_abort, "abort with a response pending (config space)" },
+    { "not_align", test_not_align, "byte writes to DOE control (config space)" },
+};
+
+typedef struct doe_result doe_result;
+typedef struct doe_worker doe_worker;
+
+struct doe_result {
+    const doe_test_desc *test;
+    int iter;
+    int rc;
+    bool ran;
+    uint64_t duration_ns;
+    doe_stats stats;
+};
+
+struct doe_worker {
+    pthread_t tid;
+    pcie_dev *dev;
+    const doe_plan *plan;
+    FILE *out;
+    char *log;
+    size_t log_len;
+    int open_rc;
+    doe_result *results;
+    int nresults;
+};
+
+void doe_test_list(FILE *out)
+{
+    int i;
+
+    for (i = 0; i < (int)ARRAY_SIZE(doe_tests); i++) {
+        fprintf(out, "  %-18s %s\n", doe_tests[i].name, doe_tests[i].desc);
+    }
+}
+
+static const doe_test_desc *doe_test_find(const char *name)
+{
+    int i;
+
+    if (!strncmp(name, "test_", 5)) {
+        name += 5;
+    }
+
+    for (i = 0; i < (int)ARRAY_SIZE(doe_tests); i++) {
+        if (!strcmp(doe_tests[i].name, name)) {
+            return &doe_tests[i];
+        }
+    }
+    return NULL;
+}
+
+/* One plan entry, "<name>[:<repeat>]" */
+static int doe_plan_add_one(doe_plan *plan, char *name)
+{
+    const doe_test_desc *test;
+    char *colon, *e;
+    long repeat = 1;
+
+    colon = strchr(name, ':');
+    if (colon) {
+        *colon++ = 0;
+        repeat = strtol(colon, &e, 0);
+        if (*e || repeat < 1) {
+            printf("Invalid repeat count for %s\n", name);
+            return -EINVAL;
+        }
+    }
+
+    test = doe_test_find(name);
+    if (!test) {
+        printf("Unknown test %s\n", name);
+        return -EINVAL;
+    }
+    if (plan->count == DOE_PLAN_MAX) {
+        printf("More than %d plan entries\n", DOE_PLAN_MAX);
+        return -E2BIG;
+    }
+
+    plan->ents[plan->count].test = test;
+    plan->ents[plan->count].repeat = repeat;
+    plan->count++;
+    return 0;
+}
+
+/* Append a comma separated list of "<name>[:<repeat>]" */
+int doe_plan_add(doe_plan *plan, const char *names)
+{
+    char *str, *tok, *save;
+    int rc = 0;
+
+    str = strdup(names);
+    if (!str) {
+        return -ENOMEM;
+    }
+
+    for (tok = strtok_r(str, ",", &save); tok && !rc; tok = strtok_r(NULL, ",", &save)) {
+        rc = doe_plan_add_one(plan, tok);
+    }
+
+    free(str);
+    return rc;
+}
+
+/*
+ * Append the tests of a plan file: one "<name> [<repeat>]" per line,
+ * blank lines and '#' comments are ignored.
+ */
+int doe_plan_load(doe_plan *plan, const char *path)
+{
+    char line[256], entry[256], *p, *name, *repeat;
+    int rc = 0, lineno = 0;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        printf("Fail to open %s: %s\n", path, strerror(errno));
+        return -errno;
+    }
+
+    while (!rc && fgets(line, sizeof(line), f)) {
+        lineno++;
+        p = strchr(line, '#');
+        if (p) {
+            *p = 0;
+        }
+
+        name = strtok_r(line, " \t\r\n", &p);
+        if (!name) {
+            continue;
+        }
+        repeat = strtok_r(NULL, " \t\r\n", &p);
+
+        snprintf(entry, sizeof(entry), "%s%s%s", name, repeat ? ":" : "",
+                 repeat ? repeat : "");
+        rc = doe_plan_add_one(plan, entry);
+        if (rc) {
+            printf("%s:%d: bad plan entry\n", path, lineno);
+        }
+    }
+
+    fclose(f);
+    return rc;
+}
+
+/*
+ * Open config space and the DOE cdev of the BDF in @dev and check it is a
+ * CXL device with a DOE mailbox. An emulated device only gets its config
+ * space transport. Messages go to dev->out.
+ */
+int pcie_dev_open(pcie_dev *dev)
+{
+    char filename[64], cdev_path[300];
+    DVSECcap *dvsec;
+    bool found = false;
+    int rc;
+
+    dev->pdev = -1;
+    dev->cdev = -1;
+    if (!dev->out) {
+        dev->out = stdout;
+    }
+
+    if (dev->transport == PCIE_TRANSPORT_EMU) {
+        rc = doe_emu_attach(dev, dev->emu);
+        if (rc) {
+            return rc;
+        }
+    } else {
+        snprintf(filename, sizeof(filename),
+                 "/sys/bus/pci/devices/%04x:%02x:%02x.%01x/config",
+                 dev->domain, dev->bus, dev->slot, dev->func);
+        dev->pdev = open(filename, O_RDWR);
+        if (dev->pdev < 0) {
+            rc = -errno;
+            fprintf(dev->out, "Fail to open %s\n", filename);
+            return rc;
+        }
+        pcie_sysfs_attach(dev);
+    }
+
+    if (dev->transport == PCIE_TRANSPORT_ECAM) {
+        rc = pcie_ecam_attach(dev);
+        if (rc) {
+            fprintf(dev->out, "ECAM not mapped (%s), using sysfs config\n", strerror(-rc));
+        }
+    }
+
+    init_cap_offset(dev);
+
+    /* check cap */
+    if (!dev->doe_cap_head) {
+        fprintf(dev->out, "DOE not found\n");
+        return -ENODEV;
+    }
+
+    for (dvsec = dev->dvsec_cap_head; dvsec; dvsec = dvsec->next) {
+        found |= (dvsec->vendor_id == CXL_VENDOR_ID && dvsec->id == 0x0);
+    }
+    if (!found) {
+        fprintf(dev->out, "CXL DVSEC #0 not found\n");
+        return -ENODEV;
+    }
+
+    if (dev->transport == PCIE_TRANSPORT_EMU) {
+        return doe_user_attach(dev);
+    }
+
+    if (doe_open_cdev(dev, cdev_path, sizeof(cdev_path)) < 0) {
+        rc = -errno;
+        fprintf(dev->out, "Failed to open %s: %s!\n", cdev_path, strerror(errno));
+        fprintf(dev->out, "Try loading DOE driver first.\n");
+        return rc;
+    }
+
+    return 0;
+}
+
+void pcie_dev_close(pcie_dev *dev)
+{
+    if (dev->cdev >= 0) {
+        close(dev->cdev);
+    }
+    if (dev->pdev >= 0) {
+        close(dev->pdev);
+    }
+    dev->cdev = -1;
+    dev->pdev = -1;
+
+    doe_user_detach(dev);
+    pcie_detach(dev);
+    free_cap_offset(dev);
+}
+
+static void *doe_worker_fn(void *arg)
+{
+    doe_worker *w = arg;
+    pcie_dev *dev = w->dev;
+    doe_result *res = w->results;
+    uint64_t start;
+    int i, j;
+
+    dev->out = w->out;
+    w->open_rc = pcie_dev_open(dev);
+    if (w->open_rc) {
+        pcie_dev_close(dev);
+        return NULL;
+    }
+
+    for (i = 0; i < w->plan->count; i++) {
+        for (j = 0; j < w->plan->ents[i].repeat; j++, res++) {
+            fprintf(dev->out, "--- %s #%d\n", res->test->name, j);
+
+            dev->stats = &res->stats;
+            start = doe_stats_now();
+            res->rc = res->test->fn(dev);
+            res->duration_ns = doe_stats_now() - start;
+            res->ran = true;
+            dev->stats = NULL;
+
+            fprintf(dev->out, "--- %s #%d: %s (%d)\n", res->test->name, j,
+                    res->rc ? "FAIL" : "PASS", res->rc);
+        }
+    }
+
+    pcie_dev_close(dev);
+    return NULL;
+}
+
+static void doe_bdf(const pcie_dev *dev, char *bdf, size_t len)
+{
+    snprintf(bdf, len, "%04x:%02x:%02x.%x", dev->domain, dev->bus, dev->slot, dev->func);
+}
+
+static const char *doe_result_str(const doe_result *res)
+{
+    if (!res->ran) {
+        return "skip";
+    }
+    return res->rc ? "fail" : "pass";
+}
+
+static void doe_report_json(doe_worker *workers, int ndev, int passed, int failed,
+                            FILE *out)
+{
+    doe_worker *w;
+    doe_result *res;
+    char bdf[16];
+    int i, j;
+
+    fprintf(out, "{\n  \"devices\": [\n");
+    for (i = 0; i < ndev; i++) {
+        w = &workers[i];
+        doe_bdf(w->dev, bdf, sizeof(bdf));
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"bdf\": \"%s\",\n", bdf);
+        fprintf(out, "      \"open\": %d,\n", w->open_rc);
+        fprintf(out, "      \"tests\": [");
+        for (j = 0; j < w->nresults; j++) {
+            res = &w->results[j];
+            fprintf(out, "%s\n        {\n", j ? "," : "");
+            fprintf(out, "          \"name\": \"%s\",\n", res->test->name);
+            fprintf(out, "          \"iteration\": %d,\n", res->iter);
+            fprintf(out, "          \"result\": \"%s\",\n", doe_result_str(res));
+            fprintf(out, "          \"rc\": %d,\n", res->rc);
+            fprintf(out, "          \"duration_ns\": %" PRIu64 ",\n", res->duration_ns);
+            fprintf(out, "          \"requests\": ");
+            doe_stats_json(&res->stats, out, "          ");
+            fprintf(out, "\n        }");
+        }
+        fprintf(out, "%s]\n    }%s\n", w->nresults ? "\n      " : "",
+                i < ndev - 1 ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    fprintf(out, "  \"passed\": %d,\n", passed);
+    fprintf(out, "  \"failed\": %d\n", failed);
+    fprintf(out, "}\n");
+}
+
+/*
+ * Run @plan on @ndev devices in parallel, print every device's log and a
+ * summary (on stderr when @report is stdout), and write a JSON report to
+ * @report when given. Returns the number of failed tests, counting a
+ * device that could not be opened as failing all of them, or a negative
+ * errno.
+ */
+int doe_run(pcie_dev *devs, int ndev, const doe_plan *plan, FILE *report)
+{
+    doe_worker *workers, *w;
+    doe_result *res;
+    doe_stats_sum sum;
+    int i, j, k, n, total = 0, passed = 0, failed = 0, rc = 0;
+    char bdf[16];
+    /* a JSON report on stdout keeps the logs and the summary off it */
+    FILE *log = report == stdout ? stderr : stdout;
+
+    for (i = 0; i < plan->count; i++) {
+        total += plan->ents[i].repeat;
+    }
+
+    workers = calloc(ndev, sizeof(*workers));
+    if (!workers) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < ndev; i++) {
+        w = &workers[i];
+        w->dev = &devs[i];
+        w->plan = plan;
+        w->nresults = total;
+        w->results = calloc(total ? total : 1, sizeof(*w->results));
+        if (!w->results) {
+            rc = -ENOMEM;
+            goto out;
+        }
+        for (j = 0, n = 0; j < plan->count; j++) {
+            for (k = 0; k < plan->ents[j].repeat; k++, n++) {
+                w->results[n].test = plan->ents[j].test;
+                w->results[n].iter = k;
+            }
+        }
+
+        /* A single device keeps printing live */
+        w->out = ndev > 1 ? open_memstream(&w->log, &w->log_len) : log;
+        if (!w->out) {
+            rc = -errno;
+            goto out;
+        }
+    }
+
+    for (i = 0; i < ndev; i++) {
+        rc = -pthread_create(&workers[i].tid, NULL, doe_worker_fn, &workers[i]);
+        if (rc) {
+            while (i--) {
+                pthread_join(workers[i].tid, NULL);
+            }
+            goto out;
+        }
+    }
+    for (i = 0; i < ndev; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+
+    for (i = 0; i < ndev; i++) {
+        w = &workers[i];
+        if (w->out != log) {
+            fclose(w->out);
+            w->out = NULL;
+            doe_bdf(w->dev, bdf, sizeof(bdf));
+            fprintf(log, "==== %s ====\n", bdf);
+            fwrite(w->log, 1, w->log_len, log);
+        }
+    }
+
+    fprintf(log, "\n%-14s %-18s %4s %-4s %6s %6s %10s %10s %10s\n", "device", "test", "iter",
+            "res", "reqs", "errs", "p50(ns)", "p99(ns)", "total(ns)");
+    for (i = 0; i < ndev; i++) {
+        w = &workers[i];
+        doe_bdf(w->dev, bdf, sizeof(bdf));
+        if (w->open_rc) {
+            fprintf(log, "%-14s open failed: %s\n", bdf, strerror(-w->open_rc));
+        }
+        for (j = 0; j < w->nresults; j++) {
+            res = &w->results[j];
+            doe_stats_summary(&res->stats, &sum);
+            fprintf(log, "%-14s %-18s %4d %-4s %6u %6u %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+                    "\n", bdf, res->test->name, res->iter, doe_result_str(res),
+                    sum.count, sum.errors, sum.p50, sum.p99, res->duration_ns);
+            if (res->ran && !res->rc) {
+                passed++;
+            } else {
+                failed++;
+            }
+        }
+    }
+    fprintf(log, "%d passed, %d failed\n", passed, failed);
+
+    if (report) {
+        doe_report_json(workers, ndev, passed, failed, report);
+    }
+    rc = failed;
+
+out:
+    for (i = 0; i < ndev; i++) {
+        w = &workers[i];
+        if (w->out && w->out != log) {
+            fclose(w->out);
+        }
+        free(w->log);
+        for (j = 0; w->results && j < w->nresults; j++) {
+            doe_stats_free(&w->results[j].stats);
+        }
+        free(w->results);
+    }
+    free(workers);
+    return rc;
+}
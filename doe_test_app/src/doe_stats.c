@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "doe_stats.h"
+
+uint64_t doe_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Record one round trip. Failed exchanges are only counted, their time
+ * says nothing about the mailbox.
+ */
+void doe_stats_add(doe_stats *st, uint64_t ns, int err)
+{
+    uint64_t *ns_new;
+    uint32_t alloc;
+
+    if (err) {
+        st->errors++;
+        return;
+    }
+
+    if (st->count == st->alloc) {
+        alloc = st->alloc ? st->alloc * 2 : 64;
+        ns_new = realloc(st->ns, alloc * sizeof(*st->ns));
+        if (!ns_new) {
+            return;
+        }
+        st->ns = ns_new;
+        st->alloc = alloc;
+    }
+    st->ns[st->count++] = ns;
+}
+
+void doe_stats_reset(doe_stats *st)
+{
+    st->count = 0;
+    st->errors = 0;
+}
+
+void doe_stats_free(doe_stats *st)
+{
+    free(st->ns);
+    memset(st, 0, sizeof(*st));
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of the sorted samples */
+static uint64_t percentile(const uint64_t *sorted, uint32_t count, int pct)
+{
+    uint32_t rank = (uint32_t)(((uint64_t)count * pct + 99) / 100);
+
+    return sorted[rank ? rank - 1 : 0];
+}
+
+void doe_stats_summary(const doe_stats *st, doe_stats_sum *sum)
+{
+    uint64_t *sorted, total = 0;
+    uint32_t i;
+
+    memset(sum, 0, sizeof(*sum));
+    sum->count = st->count;
+    sum->errors = st->errors;
+    if (!st->count) {
+        return;
+    }
+
+    sorted = malloc(st->count * sizeof(*sorted));
+    if (!sorted) {
+        return;
+    }
+    memcpy(sorted, st->ns, st->count * sizeof(*sorted));
+    qsort(sorted, st->count, sizeof(*sorted), cmp_u64);
+
+    for (i = 0; i < st->count; i++) {
+        total += sorted[i];
+    }
+
+    sum->min = sorted[0];
+    sum->max = sorted[st->count - 1];
+    sum->mean = total / st->count;
+    sum->p50 = percentile(sorted, st->count, 50);
+    sum->p90 = percentile(sorted, st->count, 90);
+    sum->p99 = percentile(sorted, st->count, 99);
+    free(sorted);
+}
+
+/* Summary plus the raw samples as a JSON object, without trailing newline */
+void doe_stats_json(const doe_stats *st, FILE *out, const char *indent)
+{
+    doe_stats_sum sum;
+    uint32_t i;
+
+    doe_stats_summary(st, &sum);
+
+    fprintf(out, "{\n");
+    fprintf(out, "%s  \"count\": %u,\n", indent, sum.count);
+    fprintf(out, "%s  \"errors\": %u,\n", indent, sum.errors);
+    fprintf(out, "%s  \"min_ns\": %" PRIu64 ",\n", indent, sum.min);
+    fprintf(out, "%s  \"mean_ns\": %" PRIu64 ",\n", indent, sum.mean);
+    fprintf(out, "%s  \"p50_ns\": %" PRIu64 ",\n", indent, sum.p50);
+    fprintf(out, "%s  \"p90_ns\": %" PRIu64 ",\n", indent, sum.p90);
+    fprintf(out, "%s  \"p99_ns\": %" PRIu64 ",\n", indent, sum.p99);
+    fprintf(out, "%s  \"max_ns\": %" PRIu64 ",\n", indent, sum.max);
+    fprintf(out, "%s  \"rtt_ns\": [", indent);
+    for (i = 0; i < st->count; i++) {
+        fprintf(out, "%s%" PRIu64, i ? ", " : "", st->ns[i]);
+    }
+    fprintf(out, "]\n%s}", indent);
+}
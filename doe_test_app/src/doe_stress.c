@@ -0,0 +1,557 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "pcie_doe.h"
+#include "doe_stats.h"
+#include "doe_stress.h"
+#include "doe_runner.h"
+#include "doe_discovery.h"
+#include "doe_emu.h"
+#include "driver/doe_api.h"
+
+/*
+ * Concurrent mailbox stress. procs processes with threads threads each
+ * drive the DOE mailboxes of all -s devices through the driver, every
+ * thread bound to one mailbox, with a weighted mix of
+ *   valid    discovery of a random index, checked against a reference
+ *            walk taken before the run (a mismatch is corruption)
+ *   invalid  an object with the reserved vendor ID 0xFFFF
+ *   abort    DOE_MBOX_ABORT
+ * Results live in shared memory. Afterwards the harness reports
+ * throughput, Jain's fairness index over the threads of each mailbox and
+ * the driver's lock wait/hold times. It fails on corruption, timeouts,
+ * failed aborts and starved threads.
+ *
+ * A device that silently drops invalid objects holds the mailbox for the
+ * driver's DOE timeout each time, which shows up as starvation of the
+ * valid requests queued behind; use mix=<v>:0:<a> to leave them out. The
+ * emulator (-E) answers them with DOE Error, so the default mix passes
+ * there; with unsupported=drop it behaves like such a device, and the run
+ * says so up front.
+ */
+
+#define STRESS_HIST_BUCKETS     40
+#define STRESS_RSP_DW           16
+
+typedef struct stress_target stress_target;
+typedef struct stress_slot stress_slot;
+typedef struct stress_shared stress_shared;
+typedef struct stress_thread stress_thread;
+
+struct stress_target {
+    pcie_dev *dev;
+    uint32_t cap;
+    uint32_t disc[PCI_DOE_PROTOCOL_MAX];
+    int ndisc;
+    struct doe_mbox_stats drv;
+};
+
+/* Written by one worker thread only, read by the parent after the run */
+struct stress_slot {
+    int target;
+    uint64_t ops[STRESS_OP_MAX];
+    uint64_t fails[STRESS_OP_MAX];
+    uint64_t corrupt;
+    uint64_t timeouts;
+    uint64_t lat_max_ns;                   /* valid ops */
+    uint64_t hist[STRESS_HIST_BUCKETS];    /* log2 ns, valid ops */
+};
+
+struct stress_shared {
+    volatile int go;
+    volatile int stop;
+    stress_slot slots[];
+};
+
+struct stress_thread {
+    pthread_t tid;
+    pcie_dev dev;
+    const doe_stress_cfg *cfg;
+    stress_target *target;
+    stress_slot *slot;
+    uint64_t seed;
+    volatile int *go, *stop;
+};
+
+int doe_stress_parse(const char *spec, doe_stress_cfg *cfg)
+{
+    char *str, *tok, *save, *val;
+    int rc = 0;
+
+    *cfg = (doe_stress_cfg) {
+        .procs = 1,
+        .threads = 4,
+        .secs = 10,
+        .mix = { 90, 5, 5 },
+        .timeout_ms = 15000,
+        .starve_ms = 1000,
+    };
+
+    str = strdup(spec);
+    for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        val = strchr(tok, '=');
+        if (!val) {
+            rc = -EINVAL;
+            break;
+        }
+        *val++ = 0;
+
+        if (!strcmp(tok, "procs")) {
+            cfg->procs = strtol(val, NULL, 0);
+        } else if (!strcmp(tok, "threads")) {
+            cfg->threads = strtol(val, NULL, 0);
+        } else if (!strcmp(tok, "secs")) {
+            cfg->secs = strtol(val, NULL, 0);
+        } else if (!strcmp(tok, "timeout_ms")) {
+            cfg->timeout_ms = strtoul(val, NULL, 0);
+        } else if (!strcmp(tok, "starve_ms")) {
+            cfg->starve_ms = strtoul(val, NULL, 0);
+        } else if (!strcmp(tok, "mix")) {
+            if (sscanf(val, "%u:%u:%u", &cfg->mix[STRESS_OP_VALID],
+                       &cfg->mix[STRESS_OP_INVALID], &cfg->mix[STRESS_OP_ABORT]) != 3) {
+                rc = -EINVAL;
+                break;
+            }
+        } else {
+            rc = -EINVAL;
+            break;
+        }
+    }
+
+    if (rc) {
+        printf("bad stress option '%s'\n", tok);
+    } else if (cfg->procs < 1 || cfg->procs > STRESS_MAX_PROCS ||
+               cfg->threads < 1 || cfg->threads > STRESS_MAX_THREADS ||
+               cfg->secs < 1) {
+        printf("need 1..%d procs, 1..%d threads and secs > 0\n",
+               STRESS_MAX_PROCS, STRESS_MAX_THREADS);
+        rc = -EINVAL;
+    } else if (!cfg->mix[STRESS_OP_VALID]) {
+        printf("the mix needs valid requests\n");
+        rc = -EINVAL;
+    }
+
+    free(str);
+    return rc;
+}
+
+static uint64_t stress_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int stress_pick(const doe_stress_cfg *cfg, uint64_t *seed)
+{
+    unsigned int total = 0, r;
+    int i;
+
+    for (i = 0; i < STRESS_OP_MAX; i++) {
+        total += cfg->mix[i];
+    }
+    r = stress_rand(seed) % total;
+    for (i = 0; r >= cfg->mix[i]; i++) {
+        r -= cfg->mix[i];
+    }
+    return i;
+}
+
+static int stress_discovery(pcie_dev *dev, uint32_t cap, uint32_t vid_type,
+                            uint32_t idx, uint32_t *rsp, uint32_t *rsp_used)
+{
+    uint32_t req[3] = { vid_type, 3, idx };
+    struct doe_vec_ent ent = {
+        .req_ptr = (uintptr_t)req,
+        .rsp_ptr = (uintptr_t)rsp,
+        .rsp_len = STRESS_RSP_DW * sizeof(uint32_t),
+    };
+    int rc;
+
+    rc = doe_exchange_vec(dev, cap, &ent, 1, 0);
+    *rsp_used = ent.rsp_used;
+    return rc < 0 ? rc : ent.status;
+}
+
+/*
+ * One operation. Returns 0 when it went as expected, -EBADMSG for a wrong
+ * response, else the failing errno.
+ */
+static int stress_op(stress_thread *t, int op)
+{
+    stress_target *tgt = t->target;
+    uint32_t rsp[STRESS_RSP_DW], used, idx;
+    int rc;
+
+    switch (op) {
+    case STRESS_OP_VALID:
+        idx = stress_rand(&t->seed) % tgt->ndisc;
+        rc = stress_discovery(&t->dev, tgt->cap, PCI_DOE_PROTOCOL_DISCOVERY, idx,
+                              rsp, &used);
+        if (rc) {
+            return rc;
+        }
+        if (used != 3 * sizeof(uint32_t) || rsp[0] != PCI_DOE_PROTOCOL_DISCOVERY ||
+            (rsp[1] & 0x3ffff) != 3 || rsp[2] != tgt->disc[idx]) {
+            return -EBADMSG;
+        }
+        return 0;
+    case STRESS_OP_INVALID:
+        /* Any outcome is fine as long as the valid requests stay intact */
+        stress_discovery(&t->dev, tgt->cap, 0xffffffff, 0, rsp, &used);
+        return 0;
+    case STRESS_OP_ABORT:
+        return doe_mbox_abort(&t->dev, tgt->cap);
+    }
+    return -EINVAL;
+}
+
+static void *stress_thread_fn(void *arg)
+{
+    stress_thread *t = arg;
+    stress_slot *slot = t->slot;
+    uint64_t start, lat, limit = t->cfg->timeout_ms * 1000000ULL;
+    int op, rc;
+
+    while (!*t->go) {
+        usleep(1000);
+    }
+
+    while (!*t->stop) {
+        op = stress_pick(t->cfg, &t->seed);
+
+        start = doe_stats_now();
+        rc = stress_op(t, op);
+        lat = doe_stats_now() - start;
+
+        slot->ops[op]++;
+        if (rc) {
+            slot->fails[op]++;
+        }
+        if (rc == -EBADMSG) {
+            slot->corrupt++;
+        }
+        if (op == STRESS_OP_INVALID) {
+            continue;
+        }
+        if (rc == -ETIMEDOUT || lat > limit) {
+            slot->timeouts++;
+        }
+        if (op == STRESS_OP_VALID) {
+            if (lat > slot->lat_max_ns) {
+                slot->lat_max_ns = lat;
+            }
+            op = 63 - __builtin_clzll(lat | 1);
+            slot->hist[op < STRESS_HIST_BUCKETS ? op : STRESS_HIST_BUCKETS - 1]++;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Child process @proc: its own file descriptors on every device so the
+ * driver sees separate users, and cfg->threads workers.
+ */
+static int stress_child(int proc, pcie_dev *devs, int ndev, stress_target *targets,
+                        int ntargets, const doe_stress_cfg *cfg, stress_shared *sh)
+{
+    stress_thread *threads;
+    char path[64];
+    int fds[DOE_RUN_MAX_DEVS], i, n, rc = 0;
+
+    for (i = 0; i < ndev; i++) {
+        /* emulated, each process has its own copy after the fork */
+        if (devs[i].cdev < 0) {
+            fds[i] = -1;
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", devs[i].cdev);
+        fds[i] = open(path, O_RDWR);
+        if (fds[i] < 0) {
+            printf("proc %d: reopen %s: %s\n", proc, path, strerror(errno));
+            return 1;
+        }
+    }
+
+    threads = calloc(cfg->threads, sizeof(*threads));
+    if (!threads) {
+        return 1;
+    }
+
+    for (n = 0; n < cfg->threads; n++) {
+        stress_thread *t = &threads[n];
+        int id = proc * cfg->threads + n;
+
+        t->cfg = cfg;
+        t->slot = &sh->slots[id];
+        t->target = &targets[id % ntargets];
+        t->slot->target = id % ntargets;
+        t->dev = *t->target->dev;
+        t->dev.cdev = fds[t->target->dev - devs];
+        t->dev.stats = NULL;
+        t->seed = 0x9e3779b97f4a7c15ULL * (id + 1);
+        t->go = &sh->go;
+        t->stop = &sh->stop;
+
+        if (pthread_create(&t->tid, NULL, stress_thread_fn, t)) {
+            printf("proc %d: pthread_create failed\n", proc);
+            sh->stop = 1;
+            rc = 1;
+            break;
+        }
+    }
+
+    while (n--) {
+        pthread_join(threads[n].tid, NULL);
+    }
+
+    free(threads);
+    return rc;
+}
+
+/* Reference discovery list of every mailbox, taken before the run */
+static int stress_targets(pcie_dev *devs, int ndev, stress_target **out)
+{
+    stress_target *targets = NULL, *tgt, *tmp;
+    doe_discovery_rsp rsp;
+    DOEcap *cap;
+    uint32_t idx;
+    int i, n = 0, rc;
+
+    for (i = 0; i < ndev; i++) {
+        for (cap = devs[i].doe_cap_head; cap; cap = cap->next) {
+            tmp = realloc(targets, (n + 1) * sizeof(*targets));
+            if (!tmp) {
+                free(targets);
+                return -ENOMEM;
+            }
+            targets = tmp;
+            tgt = &targets[n++];
+            memset(tgt, 0, sizeof(*tgt));
+            tgt->dev = &devs[i];
+            tgt->cap = cap->cap;
+
+            idx = 0;
+            do {
+                rc = doe_discovery_one(&devs[i], cap->cap, idx, &rsp);
+                if (rc) {
+                    printf("cap %x: reference discovery failed %d\n", cap->cap, rc);
+                    free(targets);
+                    return rc;
+                }
+                tgt->disc[tgt->ndisc++] = rsp.data;
+                idx = rsp.next_index;
+            } while (idx && tgt->ndisc < PCI_DOE_PROTOCOL_MAX);
+        }
+    }
+
+    *out = targets;
+    return n;
+}
+
+static uint64_t stress_hist_pct(const uint64_t *hist, uint64_t count, int pct)
+{
+    uint64_t rank = (count * pct + 99) / 100, seen = 0;
+    int i;
+
+    for (i = 0; i < STRESS_HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= rank && seen) {
+            return 1ULL << (i + 1);
+        }
+    }
+    return 0;
+}
+
+static uint64_t stress_slot_ops(const stress_slot *slot)
+{
+    return slot->ops[STRESS_OP_VALID] + slot->ops[STRESS_OP_INVALID] +
+           slot->ops[STRESS_OP_ABORT];
+}
+
+static int stress_report(stress_target *targets, int ntargets,
+                         const doe_stress_cfg *cfg, stress_shared *sh, uint64_t wall_ns)
+{
+    int nslots = cfg->procs * cfg->threads, i, t, n, starved = 0;
+    uint64_t hist[STRESS_HIST_BUCKETS] = {0}, ops = 0, valid = 0, corrupt = 0;
+    uint64_t timeouts = 0, abort_fails = 0, x;
+    double sum, sum_sq;
+    stress_target *tgt;
+    stress_slot *slot;
+    struct doe_mbox_stats *d;
+
+    printf("\n%-5s %-5s %-20s %9s %9s %9s %7s %7s %7s %12s\n", "proc", "thr", "mailbox",
+           "valid", "invalid", "abort", "fails", "corrupt", "tmo", "max(ns)");
+    for (i = 0; i < nslots; i++) {
+        slot = &sh->slots[i];
+        tgt = &targets[slot->target];
+        printf("%-5d %-5d %04x:%02x:%02x.%x@%-5x %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+               " %7" PRIu64 " %7" PRIu64 " %7" PRIu64 " %12" PRIu64 "%s\n",
+               i / cfg->threads, i % cfg->threads, tgt->dev->domain, tgt->dev->bus,
+               tgt->dev->slot, tgt->dev->func, tgt->cap,
+               slot->ops[STRESS_OP_VALID], slot->ops[STRESS_OP_INVALID],
+               slot->ops[STRESS_OP_ABORT],
+               slot->fails[STRESS_OP_VALID] + slot->fails[STRESS_OP_ABORT],
+               slot->corrupt, slot->timeouts, slot->lat_max_ns,
+               (!slot->ops[STRESS_OP_VALID] ||
+                slot->lat_max_ns > cfg->starve_ms * 1000000ULL) ? "  STARVED" : "");
+
+        ops += stress_slot_ops(slot);
+        valid += slot->ops[STRESS_OP_VALID] - slot->fails[STRESS_OP_VALID];
+        corrupt += slot->corrupt;
+        timeouts += slot->timeouts;
+        abort_fails += slot->fails[STRESS_OP_ABORT];
+        starved += !slot->ops[STRESS_OP_VALID] ||
+                   slot->lat_max_ns > cfg->starve_ms * 1000000ULL;
+        for (n = 0; n < STRESS_HIST_BUCKETS; n++) {
+            hist[n] += slot->hist[n];
+        }
+    }
+
+    printf("\n%-20s %8s %10s %10s %10s %10s %10s %8s\n", "mailbox", "fairness",
+           "locks", "wait avg", "wait max", "hold avg", "hold max", "aborts");
+    for (t = 0; t < ntargets; t++) {
+        tgt = &targets[t];
+        sum = sum_sq = 0;
+        n = 0;
+        for (i = 0; i < nslots; i++) {
+            if (sh->slots[i].target != t) {
+                continue;
+            }
+            x = stress_slot_ops(&sh->slots[i]);
+            sum += x;
+            sum_sq += (double)x * x;
+            n++;
+        }
+
+        d = &tgt->drv;
+        if (doe_mbox_stats_get(tgt->dev, tgt->cap, d, false)) {
+            memset(d, 0, sizeof(*d));
+        }
+        printf("%04x:%02x:%02x.%x@%-5x %8.3f %10llu %10llu %10llu %10llu %10llu %8llu\n",
+               tgt->dev->domain, tgt->dev->bus, tgt->dev->slot, tgt->dev->func, tgt->cap,
+               (n && sum_sq) ? sum * sum / (n * sum_sq) : 0.0, d->lock_acquires,
+               d->lock_acquires ? d->lock_wait_total_ns / d->lock_acquires : 0,
+               d->lock_wait_max_ns,
+               d->lock_acquires ? d->lock_hold_total_ns / d->lock_acquires : 0,
+               d->lock_hold_max_ns, d->aborts);
+    }
+
+    printf("\n%" PRIu64 " operations in %.2f s: %.1f ops/s, %.1f valid/s\n", ops,
+           wall_ns / 1e9, ops * 1e9 / wall_ns, valid * 1e9 / wall_ns);
+    printf("valid latency p50 <= %" PRIu64 " ns, p99 <= %" PRIu64 " ns\n",
+           stress_hist_pct(hist, valid ? valid : 1, 50),
+           stress_hist_pct(hist, valid ? valid : 1, 99));
+    printf("corrupt %" PRIu64 ", timeouts %" PRIu64 ", failed aborts %" PRIu64
+           ", starved threads %d\n", corrupt, timeouts, abort_fails, starved);
+
+    if (corrupt || timeouts || abort_fails || starved) {
+        printf("STRESS FAIL\n");
+        return -EIO;
+    }
+    printf("STRESS PASS\n");
+    return 0;
+}
+
+/*
+ * Stress the mailboxes of @devs (already opened) as described by @cfg.
+ * Returns 0 when no corruption, timeout, failed abort or starvation was
+ * seen.
+ */
+int doe_stress_run(pcie_dev *devs, int ndev, const doe_stress_cfg *cfg)
+{
+    int nslots = cfg->procs * cfg->threads, ntargets, i, status, rc = 0;
+    size_t sh_len = sizeof(stress_shared) + nslots * sizeof(stress_slot);
+    stress_target *targets;
+    stress_shared *sh;
+    pid_t pids[STRESS_MAX_PROCS];
+    uint64_t start;
+
+    if (ndev > DOE_RUN_MAX_DEVS) {
+        return -E2BIG;
+    }
+
+    ntargets = stress_targets(devs, ndev, &targets);
+    if (ntargets <= 0) {
+        return ntargets ? ntargets : -ENODEV;
+    }
+
+    for (i = 0; i < ntargets; i++) {
+        doe_mbox_stats_get(targets[i].dev, targets[i].cap, &targets[i].drv, true);
+    }
+
+    sh = mmap(NULL, sh_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED) {
+        free(targets);
+        return -errno;
+    }
+
+    printf("stress: %d procs x %d threads on %d mailboxes for %d s, mix %u:%u:%u\n",
+           cfg->procs, cfg->threads, ntargets, cfg->secs, cfg->mix[STRESS_OP_VALID],
+           cfg->mix[STRESS_OP_INVALID], cfg->mix[STRESS_OP_ABORT]);
+    if (cfg->mix[STRESS_OP_INVALID] && devs[0].transport == PCIE_TRANSPORT_EMU &&
+        !devs[0].emu->err_unsupported) {
+        printf("note: unsupported=drop makes every invalid object wait out the "
+               "timeout, expect starvation\n");
+    }
+    fflush(stdout);
+
+    for (i = 0; i < cfg->procs; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            rc = -errno;
+            sh->stop = 1;
+            sh->go = 1;
+            break;
+        }
+        if (!pids[i]) {
+            status = stress_child(i, devs, ndev, targets, ntargets, cfg, sh);
+            fflush(stdout);
+            _exit(status);
+        }
+    }
+
+    start = doe_stats_now();
+    sh->go = 1;
+    if (!rc) {
+        sleep(cfg->secs);
+    }
+    sh->stop = 1;
+
+    while (i--) {
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status)) {
+            printf("stress process %d failed\n", i);
+            rc = rc ? rc : -ECHILD;
+        }
+    }
+
+    if (!rc) {
+        rc = stress_report(targets, ntargets, cfg, sh, doe_stats_now() - start);
+    }
+
+    munmap(sh, sh_len);
+    free(targets);
+    return rc;
+}
@@ -17,31 +17,20 @@
 #include "utils.h"
 #include "pcie_doe.h"
 
-#include "doe_test.h"
-#include "doe_discovery.h"
+#include "doe_runner.h"
+#include "doe_bench.h"
+#include "doe_stress.h"
 #include "cxl_cdat.h"
-#include "cxl_compliance.h"
+#include "cdat_validate.h"
+#include "cxl_traffic.h"
+#include "doe_emu.h"
 
 #ifndef PROGNAME
 #define PROGNAME "test.exe"
 #endif
 
-typedef void (*Testcase)(pcie_dev *);
-
-/* The commented test_list is not implemented
- * in Avery BFM CXL Device yet */
-static Testcase test_list[] = {
-    //test_discovery,
-    test_compliance,
-    //test_cdat,
-    /*
-    test_error,
-    test_invalid_len,
-    test_invalid_protocol,
-    test_abort,
-    test_not_align,
-    */
-};
+/* Run when no -t/-f is given */
+#define DEFAULT_PLAN    "compliance"
 
 /* Ref: pciutils/lib/filter.c */
 /* Slot filter syntax: [[[domain]:][bus]:][slot][.[func]] */
@@ -103,73 +92,225 @@ static char *pci_filter_parse_slot(pcie_dev *f, char *str)
 
 static void usage(void)
 {
-    printf("Usage: " PROGNAME " -s [[[[<domain>]:]<bus>]:][<device>][.[<func>]]\n");
+    printf("Usage: " PROGNAME " -s [[[[<domain>]:]<bus>]:][<device>][.[<func>]] [-s ...]\n"
+           "       [-t <test>[:<repeat>][,...]] [-f <plan>] [-r <report>] [-l]\n"
+           "       [-j <file>] [-V <target>] [-C <mws|pc>[,key=value...]] [-B <N>]\n"
+           "       [-S key=value[,...]] [-e | -E key=value[,...]]\n");
+    printf("  -s  device to test, repeat for several; each gets its own worker\n"
+           "  -t  tests to run (default " DEFAULT_PLAN "), see -l\n"
+           "  -f  read tests from a plan file, one \"<test> [<repeat>]\" per line\n"
+           "  -r  write a JSON report with per-request round-trip times to <report>,\n"
+           "      - for stdout (the log then goes to stderr)\n"
+           "  -l  list the tests\n");
+    printf("  -j  write the CDAT table as JSON to <file> (- for stdout) instead of\n"
+           "      running the tests\n");
+    printf("  -V  compare the CDAT DSLBIS latency/bandwidth with measurements on\n"
+           "      <target>, a device DAX path (/dev/daxX.Y) or node:<N>. Through\n"
+           "      DAX this overwrites up to 256 MiB of every DSMAS range, so the\n"
+           "      path needs \",destroy\" appended: -V /dev/dax0.0,destroy\n");
+    printf("  -C  run device-side compliance traffic, Multiple Write Streaming or\n"
+           "      Producer-Consumer. Keys: start, write, writeback, incr, set_offset,\n"
+           "      inc, sets, loops, pattern, inc_pattern, mask, protocol, virt, check,\n"
+           "      verify, wsem, timeout_ms, poll_us, host=<dax path|node:N> to read\n"
+           "      from the host at the same time\n");
+    printf("  -B  benchmark: time N discovery, CDAT entry and Compliance capability\n"
+           "      exchanges through the driver ioctl and through config space; -r\n"
+           "      writes the results as JSON\n");
+    printf("  -S  stress the mailboxes of all -s devices from several processes and\n"
+           "      threads. Keys: procs, threads (per process), secs, mix=<valid>:\n"
+           "      <invalid>:<abort> weights, timeout_ms, starve_ms\n");
+    printf("  -e  access config space through the ECAM window from the ACPI MCFG\n"
+           "      table (needs /dev/mem), falling back to sysfs; not with -E\n");
+    printf("  -E  emulate the -s devices (default one) in user space, no hardware or\n"
+           "      driver needed. Keys: delay_us, discovery_us, cdat_us, compliance_us,\n"
+           "      jitter_us, unsupported=error|drop (default error)\n");
+    printf("-j, -V, -C and -B use the first -s device only.\n");
 }
 
-int main(int argc, char **argv)
+/* -S: all devices open in this process, the harness forks the workers */
+static int run_stress(pcie_dev *devs, int ndev, const doe_stress_cfg *cfg)
 {
-    pcie_dev dev = {0};
-    int i, cmd_opt = 0;
-    char filename[41], *err;
-    DVSECcap *dvsec;
-    bool found = false;
-
-    cmd_opt = getopt(argc, argv, "hs:");
-
-    switch (cmd_opt) {
-    case 's':
-        err = pci_filter_parse_slot(&dev, optarg);
-        if (err) {
-            printf("%s\n", err);
+    int i, rc = 0;
+
+    for (i = 0; i < ndev && !rc; i++) {
+        rc = pcie_dev_open(&devs[i]);
+    }
+    if (!rc) {
+        rc = doe_stress_run(devs, ndev, cfg);
+    }
+
+    while (i--) {
+        pcie_dev_close(&devs[i]);
+    }
+    return rc;
+}
+
+/* -j, -V, -C and -B: one device, no test plan */
+static int run_single(pcie_dev *dev, const char *json, const char *validate,
+                      comp_traffic_cfg *traffic_cfg, int bench, FILE *report)
+{
+    FILE *out;
+    int rc;
+
+    /* JSON on stdout: the device log (capability scan etc.) goes to stderr */
+    if ((json && !strcmp(json, "-")) || report == stdout) {
+        dev->out = stderr;
+    }
+
+    rc = pcie_dev_open(dev);
+    if (rc) {
+        pcie_dev_close(dev);
+        return rc;
+    }
+
+    if (json) {
+        out = strcmp(json, "-") ? fopen(json, "w") : stdout;
+        if (!out) {
+            printf("Fail to open %s: %s\n", json, strerror(errno));
+            pcie_dev_close(dev);
             return -1;
         }
-        sprintf(filename, "/sys/bus/pci/devices/%04x:%02x:%02x.%01x/config",
-                dev.domain, dev.bus, dev.slot, dev.func);
-        break;
-    case 'h':
-        usage();
-        return 0;
-    default:
-        usage();
-        return -1;
+        rc = cdat_dump_json(dev, out);
+        if (out != stdout) {
+            fclose(out);
+        }
+    } else if (validate) {
+        rc = cdat_validate(dev, validate);
+    } else if (bench) {
+        rc = doe_bench(dev, bench, report);
+    } else {
+        rc = comp_traffic_run(dev, traffic_cfg);
     }
 
-    dev.pdev = open(filename, O_RDWR);
-    if (dev.pdev < 0) {
-        printf("Fail to open %s\n", filename);
-        return -1;
-    }
+    pcie_dev_close(dev);
+    return rc;
+}
 
-    init_cap_offset(&dev);
+int main(int argc, char **argv)
+{
+    static pcie_dev devs[DOE_RUN_MAX_DEVS];
+    static doe_plan plan;
+    int i, rc, ndev = 0, bench = 0, cmd_opt = 0;
+    char *err, *e;
+    char *json = NULL, *validate = NULL, *traffic = NULL, *report = NULL;
+    comp_traffic_cfg traffic_cfg;
+    doe_stress_cfg stress_cfg;
+    bool stress = false;
+    int transport = PCIE_TRANSPORT_SYSFS;
+    doe_emu_cfg emu_cfg;
+    FILE *report_out = NULL;
 
-    /* check cap */
-    if (!dev.doe_cap_head) {
-        printf("DOE not found\n");
-        return -1;
+    while ((cmd_opt = getopt(argc, argv, "hels:t:f:r:j:V:C:B:S:E:")) != -1) {
+        switch (cmd_opt) {
+        case 's':
+            if (ndev == DOE_RUN_MAX_DEVS) {
+                printf("At most %d devices\n", DOE_RUN_MAX_DEVS);
+                return -1;
+            }
+            err = pci_filter_parse_slot(&devs[ndev], optarg);
+            if (err) {
+                printf("%s\n", err);
+                return -1;
+            }
+            ndev++;
+            break;
+        case 't':
+            if (doe_plan_add(&plan, optarg)) {
+                return -1;
+            }
+            break;
+        case 'f':
+            if (doe_plan_load(&plan, optarg)) {
+                return -1;
+            }
+            break;
+        case 'r':
+            report = optarg;
+            break;
+        case 'l':
+            doe_test_list(stdout);
+            return 0;
+        case 'j':
+            json = optarg;
+            break;
+        case 'V':
+            validate = optarg;
+            break;
+        case 'C':
+            traffic = optarg;
+            if (comp_traffic_parse(traffic, &traffic_cfg)) {
+                return -1;
+            }
+            break;
+        case 'B':
+            bench = strtol(optarg, &e, 0);
+            if (*e || bench < 1) {
+                printf("Invalid iteration count %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'S':
+            if (doe_stress_parse(optarg, &stress_cfg)) {
+                return -1;
+            }
+            stress = true;
+            break;
+        case 'e':
+        case 'E':
+            /* ECAM and the emulator are both transports, one at most */
+            if (transport != PCIE_TRANSPORT_SYSFS) {
+                printf("give one -e or -E, not both or twice\n");
+                usage();
+                return -1;
+            }
+            if (cmd_opt == 'E' && doe_emu_parse(optarg, &emu_cfg)) {
+                return -1;
+            }
+            transport = cmd_opt == 'e' ? PCIE_TRANSPORT_ECAM : PCIE_TRANSPORT_EMU;
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return -1;
+        }
     }
 
-    for (dvsec = dev.dvsec_cap_head; dvsec; dvsec = dvsec->next) {
-        found |= (dvsec->vendor_id == CXL_VENDOR_ID && dvsec->id == 0x0);
+    if (!ndev && transport == PCIE_TRANSPORT_EMU) {
+        ndev = 1;
     }
-    if (!found) {
-        printf("CXL DVSEC #0 not found\n");
+    if (!ndev) {
+        usage();
         return -1;
     }
 
-    dev.cdev = open("/dev/doe0", O_RDWR | O_SYNC);
+    for (i = 0; i < ndev; i++) {
+        devs[i].transport = transport;
+        devs[i].emu = &emu_cfg;
+    }
 
-    if (dev.cdev < 0) {
-        printf("Failed to open /dev/doe0: %s!\n", strerror(errno));
-        printf("Try loading DOE driver first.\n");
-        return errno;
+    if (report) {
+        report_out = strcmp(report, "-") ? fopen(report, "w") : stdout;
+        if (!report_out) {
+            printf("Fail to open %s: %s\n", report, strerror(errno));
+            return -1;
+        }
     }
 
-    /* test */
-    for (i = 0; i < ARRAY_SIZE(test_list); i++) {
-        test_list[i](&dev);
+    if (stress) {
+        rc = run_stress(devs, ndev, &stress_cfg);
+    } else if (json || validate || traffic || bench) {
+        rc = run_single(&devs[0], json, validate, &traffic_cfg, bench, report_out);
+    } else {
+        if (!plan.count) {
+            doe_plan_add(&plan, DEFAULT_PLAN);
+        }
+        rc = doe_run(devs, ndev, &plan, report_out);
     }
 
-    close(dev.cdev);
-    close(dev.pdev);
-    return 0;
+    if (report_out && report_out != stdout) {
+        fclose(report_out);
+    }
+    return rc ? -1 : 0;
 }
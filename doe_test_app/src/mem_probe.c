@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2021 Avery Design Systems, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the LICENSE file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "mem_probe.h"
+
+/*
+ * Host side memory probes over device memory, reached through either
+ *   /dev/daxX.Y  device DAX, mapped at the given offset
+ *   node:N       anonymous memory bound to NUMA node N (the offset is
+ *                meaningless there)
+ */
+
+#define CACHELINE           64
+#define MPOL_BIND           2
+#define MPOL_MF_STRICT      (1 << 0)
+#define MPOL_MF_MOVE        (1 << 1)
+
+typedef struct bw_thread bw_thread;
+
+struct bw_thread {
+    pthread_t tid;
+    uint8_t *addr;
+    size_t len;
+    bool write;
+    uint64_t min_ns;
+    const volatile bool *stop;
+    uint64_t bytes;
+    uint64_t sink;
+};
+
+uint64_t mem_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int map_dax(const char *path, uint64_t offset, size_t len, mem_map *map)
+{
+    int fd = open(path, O_RDWR);
+
+    if (fd < 0) {
+        return -errno;
+    }
+
+    map->addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    close(fd);
+    if (map->addr == MAP_FAILED) {
+        return -errno;
+    }
+    map->len = len;
+    return 0;
+}
+
+/* mbind through syscall, no libnuma */
+static int map_node(int node, size_t len, mem_map *map)
+{
+    unsigned long mask[16] = {0};
+
+    if (node < 0 || node >= (int)(sizeof(mask) * 8)) {
+        return -EINVAL;
+    }
+    mask[node / (sizeof(long) * 8)] = 1UL << (node % (sizeof(long) * 8));
+
+    map->addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map->addr == MAP_FAILED) {
+        return -errno;
+    }
+    if (syscall(SYS_mbind, map->addr, len, MPOL_BIND, mask, sizeof(mask) * 8,
+                MPOL_MF_STRICT | MPOL_MF_MOVE)) {
+        munmap(map->addr, len);
+        return -errno;
+    }
+
+    memset(map->addr, 0, len);
+    map->len = len;
+    return 0;
+}
+
+int mem_map_target(const char *target, uint64_t offset, size_t len, mem_map *map)
+{
+    if (!strncmp(target, "node:", 5)) {
+        return map_node(atoi(target + 5), len, map);
+    }
+    return map_dax(target, offset, len, map);
+}
+
+void mem_unmap(mem_map *map)
+{
+    munmap(map->addr, map->len);
+}
+
+int mem_probe_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > MEM_PROBE_MAX_THREADS) {
+        n = MEM_PROBE_MAX_THREADS;
+    }
+    return n < 1 ? 1 : n;
+}
+
+/* Average load-to-use latency in picoseconds, from a dependent chase */
+uint64_t mem_probe_latency(mem_map *map)
+{
+    size_t lines = map->len / CACHELINE, i, j, tmp;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL, t0, t1, loads;
+    size_t *order;
+    void **p;
+
+    order = malloc(lines * sizeof(*order));
+    if (!order) {
+        return 0;
+    }
+
+    /* Sattolo's shuffle gives a single cycle through every line */
+    for (i = 0; i < lines; i++) {
+        order[i] = i;
+    }
+    for (i = lines - 1; i > 0; i--) {
+        j = xorshift64(&seed) % i;
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (i = 0; i < lines; i++) {
+        *(void **)(map->addr + order[i] * CACHELINE) =
+            map->addr + order[(i + 1) % lines] * CACHELINE;
+    }
+    free(order);
+
+    loads = lines < 4000000 ? 4000000 : lines;
+    p = (void **)map->addr;
+    t0 = mem_now_ns();
+    for (i = 0; i < loads; i++) {
+        p = *p;
+    }
+    t1 = mem_now_ns();
+
+    /* Keep the chase from being optimized away */
+    __asm__ volatile("" : : "r"(p));
+    return (t1 - t0) * 1000 / loads;
+}
+
+/*
+ * Average write latency in picoseconds: a whole line written with
+ * non-temporal stores to a random place, then SFENCE, which waits until
+ * the line has left the core for memory. No read for ownership is mixed
+ * in, but the figure still includes the host side of the write path.
+ */
+uint64_t mem_probe_write_latency(mem_map *map)
+{
+#if defined(__x86_64__)
+    size_t lines = map->len / CACHELINE, i, k;
+    uint64_t seed = 0x2545f4914f6cdd1dULL, t0, t1, stores;
+    long long *line;
+
+    stores = lines < 1000000 ? 1000000 : lines;
+    t0 = mem_now_ns();
+    for (i = 0; i < stores; i++) {
+        line = (long long *)(map->addr + xorshift64(&seed) % lines * CACHELINE);
+        for (k = 0; k < CACHELINE / sizeof(*line); k++) {
+            __builtin_ia32_movnti64(&line[k], i);
+        }
+        __builtin_ia32_sfence();
+    }
+    t1 = mem_now_ns();
+
+    return (t1 - t0) * 1000 / stores;
+#else
+    (void)map;
+    return 0;
+#endif
+}
+
+static void *bw_worker(void *arg)
+{
+    bw_thread *t = arg;
+    volatile uint64_t *q;
+    uint64_t sum = 0, t0 = mem_now_ns();
+    size_t i;
+
+    do {
+        if (t->write) {
+            memset(t->addr, (int)t->bytes, t->len);
+        } else {
+            q = (volatile uint64_t *)t->addr;
+            for (i = 0; i < t->len / sizeof(uint64_t); i++) {
+                sum += q[i];
+            }
+        }
+        t->bytes += t->len;
+    } while (t->stop ? !*t->stop : mem_now_ns() - t0 < t->min_ns);
+
+    t->sink = sum;
+    return NULL;
+}
+
+/*
+ * Aggregate sequential bandwidth in MB/s. Each thread sweeps its slice of
+ * the map for at least @min_ns, or until *@stop is set when given.
+ */
+uint64_t mem_probe_bandwidth(mem_map *map, int nthreads, bool write,
+                             uint64_t min_ns, const volatile bool *stop)
+{
+    bw_thread t[MEM_PROBE_MAX_THREADS] = {0};
+    size_t slice;
+    uint64_t t0, t1, bytes = 0;
+    int i;
+
+    if (nthreads > MEM_PROBE_MAX_THREADS) {
+        nthreads = MEM_PROBE_MAX_THREADS;
+    }
+    slice = map->len / nthreads / CACHELINE * CACHELINE;
+
+    t0 = mem_now_ns();
+    for (i = 0; i < nthreads; i++) {
+        t[i].addr = map->addr + i * slice;
+        t[i].len = slice;
+        t[i].write = write;
+        t[i].min_ns = min_ns;
+        t[i].stop = stop;
+        pthread_create(&t[i].tid, NULL, bw_worker, &t[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(t[i].tid, NULL);
+        bytes += t[i].bytes;
+    }
+    t1 = mem_now_ns();
+
+    return t1 > t0 ? bytes * 1000 / (t1 - t0) : 0;
+}
@@ -17,12 +17,12 @@ int init_cap_offset(pcie_dev *dev)
     DOEcap **doe = &dev->doe_cap_head;
     DVSECcap **dvsec = &dev->dvsec_cap_head;
 
-    printf("Reading config space of PCI device\n");
+    fprintf(dev->out, "Reading config space of PCI device\n");
 
-    for (cap_offset = config_read(dev->pdev, PCI_CAPABILITY_LIST);
+    for (cap_offset = config_read(dev, PCI_CAPABILITY_LIST);
          cap_offset; cap_offset = PCI_CAP_NEXT(reg_val)) {
-        reg_val = config_read(dev->pdev, cap_offset);
-	printf("reg_val 0x%x\n", reg_val);
+        reg_val = config_read(dev, cap_offset);
+	fprintf(dev->out, "reg_val 0x%x\n", reg_val);
 
         switch (PCI_CAP_ID(reg_val)) {
         case PCI_CAP_ID_EXP:
@@ -35,26 +35,26 @@ int init_cap_offset(pcie_dev *dev)
 
     for (cap_offset = PCIE_EXT_CAP_OFFSET; cap_offset;
          cap_offset = PCI_EXT_CAP_NEXT(reg_val)) {
-        reg_val = config_read(dev->pdev, cap_offset);
-	printf("reg_val[0x%0x] 0x%x\n", cap_offset, reg_val);
+        reg_val = config_read(dev, cap_offset);
+	fprintf(dev->out, "reg_val[0x%0x] 0x%x\n", cap_offset, reg_val);
 
         switch (PCI_EXT_CAP_ID(reg_val)) {
         case PCI_EXT_CAP_ID_DVSEC:
-            *dvsec = malloc(sizeof(DVSECcap));
+            *dvsec = calloc(1, sizeof(DVSECcap));
             (*dvsec)->cap = cap_offset;
 
-            reg_val2 = config_read(dev->pdev, cap_offset + PCI_DVSEC_HEADER1);
+            reg_val2 = config_read(dev, cap_offset + PCI_DVSEC_HEADER1);
             (*dvsec)->vendor_id = PCI_EXT_DVSEC_VEN_ID(reg_val2);
             (*dvsec)->revision = PCI_EXT_DVSEC_REV(reg_val2);
             (*dvsec)->length = PCI_EXT_DVSEC_LEN(reg_val2);
 
-            reg_val2 = config_read(dev->pdev, cap_offset + PCI_DVSEC_HEADER2);
+            reg_val2 = config_read(dev, cap_offset + PCI_DVSEC_HEADER2);
             (*dvsec)->id = PCI_EXT_DVSEC_ID(reg_val2);
 
             dvsec = &(*dvsec)->next;
             break;
         case PCI_EXT_CAP_ID_DOE:
-            *doe = malloc(sizeof(DOEcap));
+            *doe = calloc(1, sizeof(DOEcap));
             (*doe)->cap = cap_offset;
             doe = &(*doe)->next;
             break;
@@ -63,22 +63,88 @@ int init_cap_offset(pcie_dev *dev)
         }
     }
 
-    printf("End scan cap\n");
+    fprintf(dev->out, "End scan cap\n");
     return 0;
 }
 
-void config_write(int fd, uint32_t addr, uint32_t data)
+void free_cap_offset(pcie_dev *dev)
 {
-    pwrite(fd, &data, sizeof(uint32_t), addr);
-    /* printf("[write] addr: %03x, data: %08x\n", addr, data); */
+    DOEcap *doe, *doe_next;
+    DOEprot *prot, *prot_next;
+    DVSECcap *dvsec, *dvsec_next;
+
+    for (doe = dev->doe_cap_head; doe; doe = doe_next) {
+        doe_next = doe->next;
+        for (prot = doe->prot_head; prot; prot = prot_next) {
+            prot_next = prot->next;
+            free(prot);
+        }
+        free(doe);
+    }
+    dev->doe_cap_head = NULL;
+
+    for (dvsec = dev->dvsec_cap_head; dvsec; dvsec = dvsec_next) {
+        dvsec_next = dvsec->next;
+        free(dvsec);
+    }
+    dev->dvsec_cap_head = NULL;
 }
 
-uint32_t config_read(int fd, uint32_t addr)
+static uint32_t sysfs_read(pcie_dev *dev, uint32_t addr)
 {
     uint32_t data;
 
-    pread(fd, &data, sizeof(uint32_t), addr);
+    pread(dev->pdev, &data, sizeof(uint32_t), addr);
     /* printf("[read] addr: %03x, data: %08x\n", addr, data); */
 
     return data;
 }
+
+static void sysfs_write(pcie_dev *dev, uint32_t addr, uint32_t data)
+{
+    pwrite(dev->pdev, &data, sizeof(uint32_t), addr);
+    /* printf("[write] addr: %03x, data: %08x\n", addr, data); */
+}
+
+static void sysfs_write8(pcie_dev *dev, uint32_t addr, uint8_t data)
+{
+    pwrite(dev->pdev, &data, sizeof(uint8_t), addr);
+}
+
+static const pcie_ops pcie_sysfs_ops = {
+    .name = "sysfs",
+    .read = sysfs_read,
+    .write = sysfs_write,
+    .write8 = sysfs_write8,
+};
+
+/* Config space through the sysfs config file open at dev->pdev */
+void pcie_sysfs_attach(pcie_dev *dev)
+{
+    dev->ops = &pcie_sysfs_ops;
+    dev->priv = NULL;
+}
+
+void pcie_detach(pcie_dev *dev)
+{
+    if (dev->ops && dev->ops->close) {
+        dev->ops->close(dev);
+    }
+    dev->ops = NULL;
+    dev->priv = NULL;
+}
+
+void config_write(pcie_dev *dev, uint32_t addr, uint32_t data)
+{
+    dev->ops->write(dev, addr, data);
+}
+
+void config_write8(pcie_dev *dev, uint32_t addr, uint8_t data)
+{
+    dev->ops->write8(dev, addr, data);
+}
+
+uint32_t config_read(pcie_dev *dev, uint32_t addr)
+{
+    return dev->ops->read(dev, addr);
+}
@@ -11,12 +11,107 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include "pcie.h"
 #include "pcie_doe.h"
+#include "doe_stats.h"
 #include "driver/doe_api.h"
 
+/*
+ * The driver creates one /dev/doe<N> per probed function, parented to the
+ * PCI device, so the node for a BDF is listed under its sysfs "doe" class
+ * directory. Older drivers only ever created /dev/doe0.
+ */
+static int doe_find_node(pcie_dev *dev, char *node, size_t node_len)
+{
+    char dir_path[64];
+    struct dirent *de;
+    DIR *dir;
+    int rc = -ENOENT;
+
+    snprintf(dir_path, sizeof(dir_path), "/sys/bus/pci/devices/%04x:%02x:%02x.%01x/doe",
+             dev->domain, dev->bus, dev->slot, dev->func);
+    dir = opendir(dir_path);
+    if (!dir) {
+        return -errno;
+    }
+
+    while ((de = readdir(dir))) {
+        if (!strncmp(de->d_name, "doe", 3)) {
+            snprintf(node, node_len, "%s", de->d_name);
+            rc = 0;
+            break;
+        }
+    }
+
+    closedir(dir);
+    return rc;
+}
+
+int doe_open_cdev(pcie_dev *dev, char *path, size_t path_len)
+{
+    char node[32];
+
+    if (doe_find_node(dev, node, sizeof(node))) {
+        snprintf(node, sizeof(node), "doe0");
+    }
+
+    snprintf(path, path_len, "/dev/%s", node);
+    dev->cdev = open(path, O_RDWR | O_SYNC);
+    return dev->cdev;
+}
+
+/*
+ * Read a whole attribute of the function's DOE class device, e.g.
+ * "mailboxes" or "cdat". The driver serves these from its discovery and
+ * CDAT caches without touching the mailbox. Returns the number of bytes
+ * read or a negative errno, -ENOENT when the driver does not provide it
+ * or there is no driver.
+ */
+ssize_t doe_sysfs_read(pcie_dev *dev, const char *attr, void *buf, size_t len)
+{
+    char node[32], path[128];
+    ssize_t rc, total = 0;
+    int fd;
+
+    if (dev->cdev < 0) {
+        return -ENOENT;
+    }
+
+    rc = doe_find_node(dev, node, sizeof(node));
+    if (rc) {
+        return rc;
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/doe/%s/%s", node, attr);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    while ((size_t)total < len) {
+        rc = read(fd, (uint8_t *)buf + total, len - total);
+        if (rc < 0) {
+            rc = -errno;
+            close(fd);
+            return rc;
+        }
+        if (rc == 0) {
+            break;
+        }
+        total += rc;
+    }
+
+    close(fd);
+    return total;
+}
+
 int doe_get_cap_by_prot(pcie_dev *dev, uint32_t prot)
 {
     DOEcap *cap;
@@ -34,10 +129,630 @@ int doe_get_cap_by_prot(pcie_dev *dev, uint32_t prot)
     return 0;
 }
 
-void doe_exchange_object(pcie_dev *dev, uint32_t doe_cap, void *buf)
+/*
+ * Without a DOE driver, as for an emulated device, the exchange ioctls are
+ * carried out here over config accesses. A small set of locks, picked by
+ * transport state and mailbox, stands in for the driver's mailbox lock.
+ */
+#define DOE_USER_TIMEOUT_NS (1000ULL * 1000 * 1000)
+#define DOE_USER_LOCKS      16
+
+static pthread_mutex_t doe_user_locks[DOE_USER_LOCKS] = {
+    [0 ... DOE_USER_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_mutex_t *doe_user_lock(pcie_dev *dev, uint32_t doe_cap)
+{
+    return &doe_user_locks[((uintptr_t)dev->priv / 64 + doe_cap) % DOE_USER_LOCKS];
+}
+
+/*
+ * The rest of the driver's state: DOE_MBOX_STATS counters per mailbox, in
+ * shared memory so the processes of a stress run add to the same ones,
+ * and DOE_MBOX_SUBMIT completions waiting to be read(). A submission is
+ * exchanged on the spot, so its completion is queued before it returns.
+ */
+#define DOE_USER_MBOXES     8
+
+typedef struct doe_user_cpl doe_user_cpl;
+
+struct doe_user_cpl {
+    doe_user_cpl *next;
+    struct doe_cpl cpl;
+    uint32_t rsp[];
+};
+
+struct doe_user {
+    struct doe_mbox_stats *st;      /* DOE_USER_MBOXES, MAP_SHARED */
+    pthread_mutex_t lock;
+    doe_user_cpl *head, **tail;
+    int inflight;
+};
+
+int doe_user_attach(pcie_dev *dev)
+{
+    struct doe_user *u;
+    DOEcap *doe_cap;
+    int i = 0;
+
+    u = calloc(1, sizeof(*u));
+    if (!u) {
+        return -ENOMEM;
+    }
+    u->st = mmap(NULL, DOE_USER_MBOXES * sizeof(*u->st), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (u->st == MAP_FAILED) {
+        free(u);
+        return -ENOMEM;
+    }
+    for (doe_cap = dev->doe_cap_head; doe_cap && i < DOE_USER_MBOXES;
+         doe_cap = doe_cap->next) {
+        u->st[i++].cap_offset = doe_cap->cap;
+    }
+    pthread_mutex_init(&u->lock, NULL);
+    u->tail = &u->head;
+    dev->user = u;
+    return 0;
+}
+
+void doe_user_detach(pcie_dev *dev)
+{
+    struct doe_user *u = dev->user;
+    doe_user_cpl *c;
+
+    if (!u) {
+        return;
+    }
+    while ((c = u->head)) {
+        u->head = c->next;
+        free(c);
+    }
+    munmap(u->st, DOE_USER_MBOXES * sizeof(*u->st));
+    pthread_mutex_destroy(&u->lock);
+    free(u);
+    dev->user = NULL;
+}
+
+static struct doe_mbox_stats *doe_user_stats(pcie_dev *dev, uint32_t doe_cap)
+{
+    int i;
+
+    for (i = 0; dev->user && i < DOE_USER_MBOXES; i++) {
+        if (dev->user->st[i].cap_offset == doe_cap) {
+            return &dev->user->st[i];
+        }
+    }
+    return NULL;
+}
+
+static void doe_user_max(__u64 *max, uint64_t v)
+{
+    __u64 cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (v > cur && !__atomic_compare_exchange_n(max, &cur, v, true, __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+        ;
+}
+
+static void doe_user_min(__u64 *min, uint64_t v)
+{
+    __u64 cur = __atomic_load_n(min, __ATOMIC_RELAXED);
+
+    while ((!cur || v < cur) &&
+           !__atomic_compare_exchange_n(min, &cur, v, true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+
+/* Count one exchange the way the driver's pcie_doe_stats do */
+static void doe_user_account(struct doe_mbox_stats *st, uint64_t wait_ns,
+                             uint64_t hold_ns, int rc)
+{
+    __atomic_fetch_add(&st->exchanges, 1, __ATOMIC_RELAXED);
+    if (rc == -ETIMEDOUT) {
+        __atomic_fetch_add(&st->timeouts, 1, __ATOMIC_RELAXED);
+    } else if (rc < 0) {
+        __atomic_fetch_add(&st->errors, 1, __ATOMIC_RELAXED);
+    }
+    doe_user_min(&st->lat_min_ns, hold_ns);
+    doe_user_max(&st->lat_max_ns, hold_ns);
+    __atomic_fetch_add(&st->lat_total_ns, hold_ns, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&st->lock_acquires, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->lock_wait_total_ns, wait_ns, __ATOMIC_RELAXED);
+    doe_user_max(&st->lock_wait_max_ns, wait_ns);
+    __atomic_fetch_add(&st->lock_hold_total_ns, hold_ns, __ATOMIC_RELAXED);
+    doe_user_max(&st->lock_hold_max_ns, hold_ns);
+}
+
+/* One exchange, the response cut to @rsp_dw like the driver does */
+static int doe_user_exchange(pcie_dev *dev, uint32_t doe_cap, void *req,
+                             void *rsp, uint32_t rsp_dw, uint32_t *used_dw)
+{
+    struct doe_mbox_stats *st = doe_user_stats(dev, doe_cap);
+    uint64_t t0, t1, t2;
+    pthread_mutex_t *lock;
+    doe_buf *tmp;
+    int rc;
+
+    tmp = doe_buf_get(PCI_DOE_MAX_DW_SIZE);
+    if (!tmp) {
+        return -ENOMEM;
+    }
+
+    lock = doe_user_lock(dev, doe_cap);
+    t0 = doe_stats_now();
+    pthread_mutex_lock(lock);
+    t1 = doe_stats_now();
+    rc = doe_exchange_config(dev, doe_cap, req, doe_buf_obj(tmp), tmp->size_dw,
+                             DOE_USER_TIMEOUT_NS);
+    t2 = doe_stats_now();
+    pthread_mutex_unlock(lock);
+    if (st) {
+        doe_user_account(st, t1 - t0, t2 - t1, rc);
+    }
+
+    if (rc >= 0) {
+        *used_dw = (uint32_t)rc < rsp_dw ? (uint32_t)rc : rsp_dw;
+        memcpy(rsp, doe_buf_obj(tmp), *used_dw * sizeof(uint32_t));
+        rc = 0;
+    }
+    doe_buf_put(tmp);
+    return rc;
+}
+
+static int doe_user_vec(pcie_dev *dev, struct doe_vec *vec)
+{
+    struct doe_vec_ent *ents = (struct doe_vec_ent *)(uintptr_t)vec->ents_ptr;
+    uint32_t i, used, n = 0;
+    int rc = 0;
+
+    if (vec->mode != DOE_VEC_LIST) {
+        return -ENOTTY;
+    }
+    if (!vec->count || vec->count > DOE_VEC_MAX) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < vec->count; i++) {
+        ents[i].status = -ECANCELED;
+        ents[i].rsp_used = 0;
+    }
+
+    for (i = 0; i < vec->count; i++) {
+        struct doe_vec_ent *ent = &ents[i];
+
+        if (ent->rsp_len < 2 * sizeof(uint32_t)) {
+            ent->status = -EINVAL;
+        } else {
+            ent->status = doe_user_exchange(dev, vec->cap_offset,
+                                            (void *)(uintptr_t)ent->req_ptr,
+                                            (void *)(uintptr_t)ent->rsp_ptr,
+                                            ent->rsp_len / sizeof(uint32_t), &used);
+            if (!ent->status) {
+                ent->rsp_used = used * sizeof(uint32_t);
+            }
+        }
+        n++;
+
+        if (ent->status && !rc) {
+            rc = ent->status;
+        }
+        if (ent->status && !(vec->flags & DOE_VEC_F_CONTINUE)) {
+            break;
+        }
+    }
+
+    vec->count = n;
+    return rc;
+}
+
+static int doe_user_submit(pcie_dev *dev, struct doe_submit *sub)
+{
+    struct doe_user *u = dev->user;
+    DOEHeader *hdr = (DOEHeader *)(uintptr_t)sub->req_ptr;
+    doe_user_cpl *c;
+    uint32_t used = 0;
+
+    if (!u) {
+        return -ENOTTY;
+    }
+    if (sub->rsp_max_dw < 2 || sub->rsp_max_dw > PCI_DOE_MAX_DW_SIZE ||
+        hdr->length < 2 || hdr->length > PCI_DOE_MAX_DW_SIZE) {
+        return -EINVAL;
+    }
+    if (!doe_user_stats(dev, sub->cap_offset)) {
+        return -ENODEV;
+    }
+
+    pthread_mutex_lock(&u->lock);
+    if (u->inflight >= DOE_MAX_INFLIGHT) {
+        pthread_mutex_unlock(&u->lock);
+        return -EAGAIN;
+    }
+    u->inflight++;
+    pthread_mutex_unlock(&u->lock);
+
+    c = malloc(sizeof(*c) + sub->rsp_max_dw * sizeof(uint32_t));
+    if (!c) {
+        pthread_mutex_lock(&u->lock);
+        u->inflight--;
+        pthread_mutex_unlock(&u->lock);
+        return -ENOMEM;
+    }
+    c->next = NULL;
+    c->cpl.tag = sub->tag;
+    c->cpl.status = doe_user_exchange(dev, sub->cap_offset, hdr, c->rsp, sub->rsp_max_dw,
+                                      &used);
+    c->cpl.rsp_dw = c->cpl.status ? 0 : used;
+
+    pthread_mutex_lock(&u->lock);
+    *u->tail = c;
+    u->tail = &c->next;
+    pthread_mutex_unlock(&u->lock);
+    return 0;
+}
+
+/* Like the driver's read(), but never blocks: nothing queued is -EAGAIN */
+static ssize_t doe_user_read(pcie_dev *dev, void *buf, size_t len)
+{
+    struct doe_user *u = dev->user;
+    size_t rec_sz, copied = 0;
+    doe_user_cpl *c;
+    ssize_t rc = -EAGAIN;
+
+    if (!u) {
+        return -EBADF;
+    }
+
+    pthread_mutex_lock(&u->lock);
+    while ((c = u->head)) {
+        rec_sz = sizeof(c->cpl) + c->cpl.rsp_dw * sizeof(uint32_t);
+        if (rec_sz > len - copied) {
+            rc = -EINVAL;
+            break;
+        }
+        memcpy((uint8_t *)buf + copied, &c->cpl, sizeof(c->cpl));
+        memcpy((uint8_t *)buf + copied + sizeof(c->cpl), c->rsp,
+               c->cpl.rsp_dw * sizeof(uint32_t));
+        copied += rec_sz;
+
+        u->head = c->next;
+        if (!u->head) {
+            u->tail = &u->head;
+        }
+        u->inflight--;
+        free(c);
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    return copied ? (ssize_t)copied : rc;
+}
+
+static int doe_user_stats_get(pcie_dev *dev, struct doe_mbox_stats *ust)
+{
+    struct doe_mbox_stats *st = doe_user_stats(dev, ust->cap_offset);
+    uint32_t flags = ust->flags;
+
+    if (flags & ~DOE_STATS_F_RESET) {
+        return -EINVAL;
+    }
+    if (!st) {
+        return -ENODEV;
+    }
+
+    *ust = *st;
+    ust->flags = flags;
+    if (flags & DOE_STATS_F_RESET) {
+        memset(st, 0, sizeof(*st));
+        st->cap_offset = ust->cap_offset;
+    }
+    return 0;
+}
+
+static int doe_user_ioctl(pcie_dev *dev, unsigned long cmd, void *arg)
+{
+    struct doe_mbox_stats *st;
+    uint32_t *buf = arg, used;
+
+    switch (cmd) {
+    case DOE_MBOX_CMD:
+        return doe_user_exchange(dev, buf[0], buf + 1, buf + 1, PCI_DOE_MAX_DW_SIZE, &used);
+    case DOE_MBOX_SUBMIT:
+        return doe_user_submit(dev, arg);
+    case DOE_MBOX_VEC:
+        return doe_user_vec(dev, arg);
+    case DOE_MBOX_ABORT:
+        pthread_mutex_lock(doe_user_lock(dev, *buf));
+        doe_abort(dev, *buf);
+        pthread_mutex_unlock(doe_user_lock(dev, *buf));
+        st = doe_user_stats(dev, *buf);
+        if (st) {
+            __atomic_fetch_add(&st->aborts, 1, __ATOMIC_RELAXED);
+        }
+        return 0;
+    case DOE_MBOX_STATS:
+        return doe_user_stats_get(dev, arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+/*
+ * ioctl on the DOE cdev, timed into dev->stats. -ENOTTY is not counted:
+ * it is a driver without that request, which the caller probes for and
+ * falls back from, not a failed exchange. Returns 0 or -errno.
+ */
+static int doe_ioctl(pcie_dev *dev, unsigned long cmd, void *arg)
+{
+    uint64_t start = 0;
+    int rc;
+
+    if (dev->stats) {
+        start = doe_stats_now();
+    }
+
+    if (dev->cdev < 0) {
+        rc = doe_user_ioctl(dev, cmd, arg);
+    } else {
+        rc = ioctl(dev->cdev, cmd, arg) < 0 ? -errno : 0;
+    }
+
+    if (dev->stats && rc != -ENOTTY) {
+        doe_stats_add(dev->stats, doe_stats_now() - start, rc);
+    }
+    return rc;
+}
+
+int doe_exchange_object(pcie_dev *dev, uint32_t doe_cap, void *buf)
 {
     *(uint32_t *)buf = doe_cap;
-    ioctl(dev->cdev, DOE_MBOX_CMD, buf);
+    return doe_ioctl(dev, DOE_MBOX_CMD, buf);
+}
+
+/*
+ * Exchange buffer pool. Buffers come in a few size classes and go back on
+ * a per-class free list when put, so repeated exchanges of the same kind
+ * reuse one allocation. Only DOE_BUF_CACHE buffers per class are kept.
+ */
+#define DOE_BUF_CACHE   4
+
+static const uint32_t doe_buf_class[] = {
+    16, 256, 4096, 65536, PCI_DOE_MAX_DW_SIZE,
+};
+
+#define DOE_BUF_CLASSES (sizeof(doe_buf_class) / sizeof(doe_buf_class[0]))
+
+static struct {
+    pthread_mutex_t lock;
+    doe_buf *free[DOE_BUF_CLASSES];
+    int nr_free[DOE_BUF_CLASSES];
+} doe_buf_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * Borrow a buffer with room for an object of at least @dw dwords. The
+ * contents are not cleared. Returns NULL when out of memory or when @dw is
+ * larger than a DOE object can be.
+ */
+doe_buf *doe_buf_get(uint32_t dw)
+{
+    doe_buf *buf;
+    int cls;
+
+    for (cls = 0; cls < (int)DOE_BUF_CLASSES; cls++) {
+        if (dw <= doe_buf_class[cls]) {
+            break;
+        }
+    }
+    if (cls == DOE_BUF_CLASSES) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&doe_buf_pool.lock);
+    buf = doe_buf_pool.free[cls];
+    if (buf) {
+        doe_buf_pool.free[cls] = buf->next;
+        doe_buf_pool.nr_free[cls]--;
+    }
+    pthread_mutex_unlock(&doe_buf_pool.lock);
+
+    if (!buf) {
+        buf = malloc(sizeof(*buf));
+        if (!buf) {
+            return NULL;
+        }
+        buf->mem = malloc((doe_buf_class[cls] + 1) * sizeof(uint32_t));
+        if (!buf->mem) {
+            free(buf);
+            return NULL;
+        }
+        buf->size_dw = doe_buf_class[cls];
+        buf->cls = cls;
+    }
+
+    buf->used_dw = 0;
+    buf->next = NULL;
+    return buf;
+}
+
+void doe_buf_put(doe_buf *buf)
+{
+    if (!buf) {
+        return;
+    }
+
+    pthread_mutex_lock(&doe_buf_pool.lock);
+    if (doe_buf_pool.nr_free[buf->cls] < DOE_BUF_CACHE) {
+        buf->next = doe_buf_pool.free[buf->cls];
+        doe_buf_pool.free[buf->cls] = buf;
+        doe_buf_pool.nr_free[buf->cls]++;
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&doe_buf_pool.lock);
+
+    if (buf) {
+        free(buf->mem);
+        free(buf);
+    }
+}
+
+/*
+ * Exchange the request at doe_buf_obj(@buf) and receive the response over
+ * it, bounded by the buffer size; @buf->used_dw gets the response length.
+ * Returns 0 or a negative errno, -EOVERFLOW when the response did not fit.
+ * Drivers without DOE_MBOX_VEC copy out the whole response unchecked, so
+ * there the exchange goes through a borrowed buffer of the largest class.
+ */
+int doe_exchange_buf(pcie_dev *dev, uint32_t doe_cap, doe_buf *buf)
+{
+    DOEHeader *hdr = doe_buf_obj(buf);
+    struct doe_vec_ent ent = {
+        .req_ptr = (uintptr_t)hdr,
+        .rsp_ptr = (uintptr_t)hdr,
+        .rsp_len = buf->size_dw * sizeof(uint32_t),
+    };
+    uint32_t len;
+    doe_buf *big;
+    int rc;
+
+    rc = doe_exchange_vec(dev, doe_cap, &ent, 1, 0);
+    if (rc != -ENOTTY) {
+        if (rc < 0) {
+            return rc;
+        }
+        if (ent.status) {
+            return ent.status;
+        }
+        buf->used_dw = ent.rsp_used / sizeof(uint32_t);
+        return hdr->length > buf->size_dw ? -EOVERFLOW : 0;
+    }
+
+    if (buf->size_dw == PCI_DOE_MAX_DW_SIZE) {
+        rc = doe_exchange_object(dev, doe_cap, buf->mem);
+        buf->used_dw = rc ? 0 : hdr->length;
+        return rc;
+    }
+
+    big = doe_buf_get(PCI_DOE_MAX_DW_SIZE);
+    if (!big) {
+        return -ENOMEM;
+    }
+    memcpy(doe_buf_obj(big), hdr, hdr->length * sizeof(uint32_t));
+    rc = doe_exchange_object(dev, doe_cap, big->mem);
+    if (!rc) {
+        len = ((DOEHeader *)doe_buf_obj(big))->length;
+        buf->used_dw = len < buf->size_dw ? len : buf->size_dw;
+        memcpy(hdr, doe_buf_obj(big), buf->used_dw * sizeof(uint32_t));
+        rc = len > buf->size_dw ? -EOVERFLOW : 0;
+    }
+    doe_buf_put(big);
+    return rc;
+}
+
+/*
+ * Queue @obj on the mailbox without waiting. The response comes back
+ * through doe_reap_async() as a struct doe_cpl carrying @tag. Returns 0 or
+ * a negative errno, -EAGAIN when DOE_MAX_INFLIGHT completions are unread.
+ */
+int doe_submit_async(pcie_dev *dev, uint32_t doe_cap, uint64_t tag,
+                     void *obj, uint32_t rsp_max_dw)
+{
+    struct doe_submit sub = {
+        .tag = tag,
+        .req_ptr = (uintptr_t)obj,
+        .cap_offset = doe_cap,
+        .rsp_max_dw = rsp_max_dw,
+    };
+
+    return doe_ioctl(dev, DOE_MBOX_SUBMIT, &sub);
+}
+
+/*
+ * Run @count exchanges on one mailbox in a single call. Per-entry status
+ * and response lengths are filled in. Returns the number of exchanges run
+ * or a negative errno; -ENOTTY means the driver predates DOE_MBOX_VEC.
+ */
+int doe_exchange_vec(pcie_dev *dev, uint32_t doe_cap, struct doe_vec_ent *ents,
+                     uint32_t count, uint32_t flags)
+{
+    struct doe_vec vec = {
+        .cap_offset = doe_cap,
+        .mode = DOE_VEC_LIST,
+        .flags = flags,
+        .count = count,
+        .ents_ptr = (uintptr_t)ents,
+    };
+
+    int rc;
+
+    rc = doe_ioctl(dev, DOE_MBOX_VEC, &vec);
+    return rc ? rc : (int)vec.count;
+}
+
+/*
+ * Let the driver walk a discovery list or a CDAT table (@mode is
+ * DOE_VEC_FOLLOW_DISCOVERY or DOE_VEC_FOLLOW_CDAT) into @buf. @used gets
+ * the number of bytes stored, also on failure. Returns the number of
+ * exchanges run or a negative errno.
+ */
+int doe_exchange_follow(pcie_dev *dev, uint32_t doe_cap, uint32_t mode,
+                        void *buf, size_t len, size_t *used)
+{
+    struct doe_vec vec = {
+        .cap_offset = doe_cap,
+        .mode = mode,
+        .rsp_ptr = (uintptr_t)buf,
+        .rsp_len = len,
+    };
+    int rc;
+
+    rc = doe_ioctl(dev, DOE_MBOX_VEC, &vec);
+    if (!rc) {
+        rc = vec.count;
+    }
+    *used = vec.rsp_used;
+    return rc;
+}
+
+/* Abort the mailbox through the driver, serialized with its exchanges */
+int doe_mbox_abort(pcie_dev *dev, uint32_t doe_cap)
+{
+    return doe_ioctl(dev, DOE_MBOX_ABORT, &doe_cap);
+}
+
+/*
+ * Read the driver's counters for one mailbox, including lock wait and hold
+ * times; @reset clears them afterwards. Returns 0 or a negative errno.
+ */
+int doe_mbox_stats_get(pcie_dev *dev, uint32_t doe_cap, struct doe_mbox_stats *st,
+                       bool reset)
+{
+    memset(st, 0, sizeof(*st));
+    st->cap_offset = doe_cap;
+    st->flags = reset ? DOE_STATS_F_RESET : 0;
+
+    if (dev->cdev < 0) {
+        return doe_user_ioctl(dev, DOE_MBOX_STATS, st);
+    }
+    return ioctl(dev->cdev, DOE_MBOX_STATS, st) < 0 ? -errno : 0;
+}
+
+/*
+ * Read completed exchanges into @buf, each a struct doe_cpl followed by
+ * its response dwords. Blocks unless the cdev was opened O_NONBLOCK.
+ * Returns the number of bytes filled or a negative errno.
+ */
+ssize_t doe_reap_async(pcie_dev *dev, void *buf, size_t len)
+{
+    ssize_t rc;
+
+    if (dev->cdev < 0) {
+        return doe_user_read(dev, buf, len);
+    }
+    rc = read(dev->cdev, buf, len);
+    return rc < 0 ? -errno : rc;
 }
 
 void doe_submit_object(pcie_dev *dev, uint32_t doe_cap, void *obj)
@@ -48,61 +763,136 @@ void doe_submit_object(pcie_dev *dev, uint32_t doe_cap, void *obj)
 
 void __doe_submit_object(pcie_dev *dev, uint32_t doe_cap, void *obj, uint32_t len)
 {
-    uint32_t go = 0x80;
     int i;
 
     for (i = 0; i < (int)len; i++) {
-        config_write(dev->pdev, doe_cap + PCIE_DOE_WR_DATA_MBOX,
+        config_write(dev, doe_cap + PCIE_DOE_WR_DATA_MBOX,
                      *(uint32_t *)(obj + i * sizeof(uint32_t)));
     }
 
     /* Set GO */
     /*
-    config_write(dev->pdev, dev->doe_cap + PCIE_DOE_CTRL,
+    config_write(dev, dev->doe_cap + PCIE_DOE_CTRL,
                  PCIE_DOE_CTRL_GO);
     */
-    pwrite(dev->pdev, &go, sizeof(uint32_t), doe_cap + PCIE_DOE_CTRL + 3);
+    config_write8(dev, doe_cap + PCIE_DOE_CTRL + 3, 0x80);
 }
 
-void *doe_get_object(pcie_dev *dev, uint32_t doe_cap)
+/*
+ * Read a response left in the mailbox into a pooled buffer sized from its
+ * header. Returns NULL when none is ready or it is malformed; release the
+ * buffer with doe_buf_put().
+ */
+doe_buf *doe_get_object(pcie_dev *dev, uint32_t doe_cap)
 {
-    uint32_t buf[PCI_DOE_MAX_DW_SIZE] = {0};
-    uint32_t len, rd_cnt = 0;
-    void *obj;
+    uint32_t hdr[2], len, rd_cnt = 0;
+    uint32_t *obj;
+    doe_buf *buf;
 
-    /* Read Discovery response */
-    while (doe_check_ready(dev, doe_cap)) {
-        buf[rd_cnt++] = doe_read_mbox(dev, doe_cap);
+    while (rd_cnt < 2 && doe_check_ready(dev, doe_cap)) {
+        hdr[rd_cnt++] = doe_read_mbox(dev, doe_cap);
     }
 
     if (rd_cnt * sizeof(uint32_t) < sizeof(DOEHeader)) {
-        printf("mbox buffer size smaller than DOEHeader size 0x%0lx\n",
+        fprintf(dev->out, "mbox buffer size smaller than DOEHeader size 0x%0lx\n",
                sizeof(DOEHeader));
         return NULL;
     }
 
-    len = ((DOEHeader *)buf)->length;
+    len = ((DOEHeader *)hdr)->length;
+    buf = doe_buf_get(len > 2 ? len : 2);
+    if (!buf) {
+        fprintf(dev->out, "no buffer for a 0x%0x dword object\n", len);
+        doe_abort(dev, doe_cap);
+        return NULL;
+    }
+
+    obj = doe_buf_obj(buf);
+    obj[0] = hdr[0];
+    obj[1] = hdr[1];
+    while (rd_cnt < len && doe_check_ready(dev, doe_cap)) {
+        obj[rd_cnt++] = doe_read_mbox(dev, doe_cap);
+    }
+
+    /* whatever is left over belongs to no object */
+    while (doe_check_ready(dev, doe_cap)) {
+        doe_read_mbox(dev, doe_cap);
+        rd_cnt++;
+    }
 
     if (len != rd_cnt) {
-        printf("len 0x%0x does not match number of reads 0x%0x\n", len, rd_cnt);
+        fprintf(dev->out, "len 0x%0x does not match number of reads 0x%0x\n", len, rd_cnt);
+        doe_buf_put(buf);
         return NULL;
     }
 
-    obj = malloc(len * sizeof(uint32_t));
+    buf->used_dw = len;
+    return buf;
+}
 
-    memcpy(obj, buf, len * sizeof(uint32_t));
+/*
+ * One exchange straight through config space, bypassing the driver: write
+ * @req, busy-poll Data Object Ready for up to @timeout_ns and read the
+ * response into @rsp. Returns the response length in dwords or a negative
+ * errno, aborting the mailbox on errors. Nothing else may use the mailbox
+ * meanwhile, including the driver.
+ */
+int doe_exchange_config(pcie_dev *dev, uint32_t doe_cap, void *req,
+                        uint32_t *rsp, uint32_t rsp_max_dw, uint64_t timeout_ns)
+{
+    uint64_t start;
+    uint32_t st, len, i;
+
+    st = config_read(dev, doe_cap + PCIE_DOE_STATUS);
+    if (st & PCIE_DOE_STATUS_BUSY) {
+        return -EBUSY;
+    }
+
+    doe_submit_object(dev, doe_cap, req);
+
+    start = doe_stats_now();
+    for (;;) {
+        st = config_read(dev, doe_cap + PCIE_DOE_STATUS);
+        if (st & PCIE_DOE_STATUS_ERR) {
+            doe_abort(dev, doe_cap);
+            return -EIO;
+        }
+        if (st & PCIE_DOE_STATUS_DO_RDY) {
+            break;
+        }
+        if (doe_stats_now() - start > timeout_ns) {
+            doe_abort(dev, doe_cap);
+            return -ETIMEDOUT;
+        }
+    }
+
+    if (rsp_max_dw < 2) {
+        doe_abort(dev, doe_cap);
+        return -EOVERFLOW;
+    }
+    rsp[0] = doe_read_mbox(dev, doe_cap);
+    rsp[1] = doe_read_mbox(dev, doe_cap);
+    len = ((DOEHeader *)rsp)->length;
+    if (len < 2 || len > rsp_max_dw) {
+        doe_abort(dev, doe_cap);
+        return len < 2 ? -EIO : -EOVERFLOW;
+    }
+
+    for (i = 2; i < len; i++) {
+        rsp[i] = doe_read_mbox(dev, doe_cap);
+    }
 
-    return obj;
+    return len;
 }
 
 uint32_t doe_read_mbox(pcie_dev *dev, uint32_t doe_cap)
 {
     uint32_t data = 0;
 
-    data = config_read(dev->pdev, doe_cap + PCIE_DOE_RD_DATA_MBOX);
+    data = config_read(dev, doe_cap + PCIE_DOE_RD_DATA_MBOX);
 
     /* Write Discovery response success */
-    config_write(dev->pdev, doe_cap + PCIE_DOE_RD_DATA_MBOX,
+    config_write(dev, doe_cap + PCIE_DOE_RD_DATA_MBOX,
                  0x1/* arbitrary value */);
 
     return data;
@@ -111,7 +901,7 @@ uint32_t doe_read_mbox(pcie_dev *dev, uint32_t doe_cap)
 void doe_abort(pcie_dev *dev, uint32_t doe_cap)
 {
     /* Abort */
-    config_write(dev->pdev, doe_cap + PCIE_DOE_CTRL,
+    config_write(dev, doe_cap + PCIE_DOE_CTRL,
                  PCIE_DOE_CTRL_ABORT);
 }
 
@@ -119,7 +909,7 @@ void doe_wait(pcie_dev *dev, uint32_t doe_cap)
 {
     /* Polling */
     while (!doe_check_ready(dev, doe_cap)) {
-        printf("wait for 1 sec\n");
+        fprintf(dev->out, "wait for 1 sec\n");
         sleep(1);
     }
 }
@@ -128,5 +918,5 @@ bool doe_check_ready(pcie_dev *dev, uint32_t doe_cap)
 {
     /* check status READY is set */
     return PCIE_DOE_STATUS_DO_RDY &
-           config_read(dev->pdev, doe_cap + PCIE_DOE_STATUS);
+           config_read(dev, doe_cap + PCIE_DOE_STATUS);
 }
@@ -0,0 +1,496 @@
+/*************************************************************************
+@File Name: cxlmem.c
+@Desc: fio external ioengine for CXL memory, /dev/dax or a NUMA node.
+
+    Like the stock dev-dax engine, every I/O is a CPU copy between the
+    fio buffer and a mapping of the device, completed inside ->queue()
+    so fio's completion latency is the copy plus whatever makes it
+    durable. Unlike dev-dax it says how the data moves:
+
+      cxl_copy=nt|temporal      streaming (movnt / movntdqa) or ordinary
+                                stores and loads on the device side
+      cxl_flush=none|clwb|clflushopt
+                                writes: write back every line after the
+                                copy, then sfence. reads: flush the lines
+                                first so the load goes to the device
+      cxl_width=8|16|32|64      bytes per load/store: GPR, SSE, AVX,
+                                AVX-512
+      cxl_mem_node=<n>          no device: target anonymous memory bound
+                                to NUMA node n (a kmem-onlined CXL node)
+      cxl_buf_node=<n>          bind fio's I/O buffers to node n
+
+    NT writes are always followed by an sfence before the I/O completes.
+    Offsets and block sizes must be multiples of 64. Under CXL_EMU (see
+    memTest/emu_mem.h) /dev/dax* is emulated and its lat_ns / bw_mbs
+    delays apply per I/O.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <cpuid.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+#include "fio.h"
+#include "optgroup.h"
+
+#include "emu_mem.h"
+
+#define CXL_LINE                64
+#define CXL_MPOL_BIND           2
+#define CXL_MPOL_MF_MOVE        (1 << 1)
+
+enum {
+    CXL_COPY_NT,
+    CXL_COPY_TEMPORAL,
+};
+
+enum {
+    CXL_FLUSH_NONE,
+    CXL_FLUSH_CLWB,
+    CXL_FLUSH_CLFLUSHOPT,
+};
+
+enum {
+    CXL_W8,
+    CXL_W16,
+    CXL_W32,
+    CXL_W64,
+    CXL_NR_WIDTHS,
+};
+
+struct cxlmem_options {
+    void *pad;                  /* keeps ->off1 of the first option non-zero */
+    unsigned int copy;
+    unsigned int flush;
+    unsigned int width;
+    char *mem_node;
+    char *buf_node;
+    size_t iomem_len;           /* not an option: what iomem_alloc mapped */
+};
+
+struct cxlmem_file {
+    void *base;
+    size_t len;
+    int anon;
+};
+
+typedef void (*cxl_copy_fn)(void *dst, const void *src, size_t len);
+
+/* copy kernels, one 64-byte line per iteration */
+
+#define CXL_COPY(name, attr, type, load, store)                         \
+static attr void name(void *dst, const void *src, size_t len)          \
+{                                                                       \
+    type *d = dst;                                                      \
+    const type *s = src;                                                \
+    size_t i;                                                           \
+    int j;                                                              \
+                                                                        \
+    for (i = 0; i < len; i += CXL_LINE) {                               \
+        for (j = 0; j < (int)(CXL_LINE / sizeof(type)); j++) {          \
+            store(d + j, load(s + j));                                  \
+        }                                                               \
+        d += CXL_LINE / sizeof(type);                                   \
+        s += CXL_LINE / sizeof(type);                                   \
+    }                                                                   \
+}
+
+#define LD8(p)          (*(const volatile uint64_t *)(p))
+#define ST8(p, v)       (*(volatile uint64_t *)(p) = (v))
+#define NTST8(p, v)     _mm_stream_si64((long long *)(p), (long long)(v))
+#define LD16(p)         _mm_load_si128(p)
+#define ST16(p, v)      _mm_store_si128(p, v)
+#define NTST16(p, v)    _mm_stream_si128(p, v)
+#define NTLD16(p)       _mm_stream_load_si128((__m128i *)(p))
+#define LD32(p)         _mm256_load_si256(p)
+#define ST32(p, v)      _mm256_store_si256(p, v)
+#define NTST32(p, v)    _mm256_stream_si256(p, v)
+#define NTLD32(p)       _mm256_stream_load_si256(p)
+#define LD64(p)         _mm512_load_si512(p)
+#define ST64(p, v)      _mm512_store_si512(p, v)
+#define NTST64(p, v)    _mm512_stream_si512(p, v)
+#define NTLD64(p)       _mm512_stream_load_si512((void *)(p))
+
+/* buffer -> device */
+CXL_COPY(wr_t8, , uint64_t, LD8, ST8)
+CXL_COPY(wr_nt8, , uint64_t, LD8, NTST8)
+CXL_COPY(wr_t16, , __m128i, LD16, ST16)
+CXL_COPY(wr_nt16, , __m128i, LD16, NTST16)
+CXL_COPY(wr_t32, __attribute__((target("avx"))), __m256i, LD32, ST32)
+CXL_COPY(wr_nt32, __attribute__((target("avx"))), __m256i, LD32, NTST32)
+CXL_COPY(wr_t64, __attribute__((target("avx512f"))), __m512i, LD64, ST64)
+CXL_COPY(wr_nt64, __attribute__((target("avx512f"))), __m512i, LD64, NTST64)
+
+/* device -> buffer; there is no 8-byte streaming load */
+CXL_COPY(rd_t8, , uint64_t, LD8, ST8)
+CXL_COPY(rd_t16, , __m128i, LD16, ST16)
+CXL_COPY(rd_nt16, __attribute__((target("sse4.1"))), __m128i, NTLD16, ST16)
+CXL_COPY(rd_t32, __attribute__((target("avx"))), __m256i, LD32, ST32)
+CXL_COPY(rd_nt32, __attribute__((target("avx2"))), __m256i, NTLD32, ST32)
+CXL_COPY(rd_t64, __attribute__((target("avx512f"))), __m512i, LD64, ST64)
+CXL_COPY(rd_nt64, __attribute__((target("avx512f"))), __m512i, NTLD64, ST64)
+
+/* [ddir][copy][width] */
+static const cxl_copy_fn cxl_copy[2][2][CXL_NR_WIDTHS] = {
+    [DDIR_READ] = {
+        [CXL_COPY_NT] = { NULL, rd_nt16, rd_nt32, rd_nt64 },
+        [CXL_COPY_TEMPORAL] = { rd_t8, rd_t16, rd_t32, rd_t64 },
+    },
+    [DDIR_WRITE] = {
+        [CXL_COPY_NT] = { wr_nt8, wr_nt16, wr_nt32, wr_nt64 },
+        [CXL_COPY_TEMPORAL] = { wr_t8, wr_t16, wr_t32, wr_t64 },
+    },
+};
+
+static __attribute__((target("clwb"))) void flush_clwb(void *addr, size_t len)
+{
+    char *p = addr;
+    size_t i;
+
+    for (i = 0; i < len; i += CXL_LINE) {
+        _mm_clwb(p + i);
+    }
+}
+
+static __attribute__((target("clflushopt"))) void flush_clflushopt(void *addr, size_t len)
+{
+    char *p = addr;
+    size_t i;
+
+    for (i = 0; i < len; i += CXL_LINE) {
+        _mm_clflushopt(p + i);
+    }
+}
+
+static int cpu_has(int flush, int width, int copy)
+{
+    unsigned int a, b, c, d;
+
+    __builtin_cpu_init();
+    /* vmovntdqa ymm needs AVX2, the rest of the 32-byte kernels AVX */
+    if (width == CXL_W32 && !(copy == CXL_COPY_NT ? __builtin_cpu_supports("avx2")
+                                                  : __builtin_cpu_supports("avx"))) {
+        return 0;
+    }
+    if (width == CXL_W64 && !__builtin_cpu_supports("avx512f")) {
+        return 0;
+    }
+    if (width == CXL_W16 && copy == CXL_COPY_NT && !__builtin_cpu_supports("sse4.1")) {
+        return 0;
+    }
+    if (flush == CXL_FLUSH_NONE) {
+        return 1;
+    }
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        return 0;
+    }
+    return flush == CXL_FLUSH_CLWB ? !!(b & bit_CLWB) : !!(b & bit_CLFLUSHOPT);
+}
+
+/* Parse a node option; -1 when unset */
+static int node_opt(const char *val)
+{
+    return val && *val ? atoi(val) : -1;
+}
+
+/* Bind @addr to @node, the same mbind() emu_mem.c does */
+static int bind_node(struct thread_data *td, void *addr, size_t len, int node)
+{
+    unsigned long mask[4] = { 0 };
+
+    if (node < 0 || node >= (int)(sizeof(mask) * 8)) {
+        log_err("cxlmem: bad NUMA node %d\n", node);
+        return 1;
+    }
+    mask[node / (sizeof(long) * 8)] = 1UL << (node % (sizeof(long) * 8));
+    if (syscall(SYS_mbind, addr, len, CXL_MPOL_BIND, mask, sizeof(mask) * 8 + 1,
+                CXL_MPOL_MF_MOVE)) {
+        td_verror(td, errno, "mbind");
+        return 1;
+    }
+    return 0;
+}
+
+static int fio_cxlmem_init(struct thread_data *td)
+{
+    struct cxlmem_options *o = td->eo;
+
+    if (o->copy == CXL_COPY_NT && o->width == CXL_W8 && td_read(td)) {
+        log_err("cxlmem: there is no 8-byte streaming load, use cxl_width=16 or more "
+                "for nt reads\n");
+        return 1;
+    }
+    if (!cpu_has(o->flush, o->width, o->copy)) {
+        log_err("cxlmem: this CPU cannot do cxl_width=%d with cxl_copy=%s "
+                "cxl_flush=%s\n", 8 << o->width,
+                o->copy == CXL_COPY_NT ? "nt" : "temporal",
+                o->flush == CXL_FLUSH_CLWB ? "clwb" :
+                o->flush == CXL_FLUSH_CLFLUSHOPT ? "clflushopt" : "none");
+        return 1;
+    }
+    return 0;
+}
+
+static enum fio_q_status fio_cxlmem_queue(struct thread_data *td, struct io_u *io_u)
+{
+    struct cxlmem_options *o = td->eo;
+    struct cxlmem_file *cf = FILE_ENG_DATA(io_u->file);
+    size_t len = io_u->xfer_buflen;
+    char *dev;
+
+    fio_ro_check(td, io_u);
+
+    if (ddir_sync(io_u->ddir)) {
+        _mm_sfence();
+        return FIO_Q_COMPLETED;
+    }
+    if (io_u->ddir != DDIR_READ && io_u->ddir != DDIR_WRITE) {
+        io_u->error = EINVAL;
+        return FIO_Q_COMPLETED;
+    }
+    if ((io_u->offset | len | (uintptr_t)io_u->xfer_buf) % CXL_LINE ||
+        io_u->offset + len > cf->len) {
+        io_u->error = EINVAL;
+        return FIO_Q_COMPLETED;
+    }
+    dev = (char *)cf->base + io_u->offset;
+
+    if (io_u->ddir == DDIR_READ) {
+        if (o->flush == CXL_FLUSH_CLWB) {
+            flush_clwb(dev, len);
+            _mm_mfence();
+        } else if (o->flush == CXL_FLUSH_CLFLUSHOPT) {
+            flush_clflushopt(dev, len);
+            _mm_mfence();
+        }
+        cxl_copy[DDIR_READ][o->copy][o->width](io_u->xfer_buf, dev, len);
+    } else {
+        cxl_copy[DDIR_WRITE][o->copy][o->width](dev, io_u->xfer_buf, len);
+        if (o->flush == CXL_FLUSH_CLWB) {
+            flush_clwb(dev, len);
+        } else if (o->flush == CXL_FLUSH_CLFLUSHOPT) {
+            flush_clflushopt(dev, len);
+        }
+        if (o->copy == CXL_COPY_NT || o->flush != CXL_FLUSH_NONE) {
+            _mm_sfence();
+        }
+    }
+    if (!cf->anon) {
+        emu_mem_access(len);
+    }
+    return FIO_Q_COMPLETED;
+}
+
+static int fio_cxlmem_open_file(struct thread_data *td, struct fio_file *f)
+{
+    struct cxlmem_options *o = td->eo;
+    struct cxlmem_file *cf;
+    int node = node_opt(o->mem_node);
+
+    cf = calloc(1, sizeof(*cf));
+    if (!cf) {
+        td_verror(td, ENOMEM, "calloc");
+        return 1;
+    }
+    cf->len = f->real_file_size;
+    if (node >= 0) {
+        cf->anon = 1;
+        cf->base = mmap(NULL, cf->len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (cf->base != MAP_FAILED && bind_node(td, cf->base, cf->len, node)) {
+            munmap(cf->base, cf->len);
+            free(cf);
+            return 1;
+        }
+    } else {
+        cf->base = emu_mem_map(f->file_name, cf->len, 0);
+    }
+    if (cf->base == MAP_FAILED) {
+        td_verror(td, errno, "mmap");
+        free(cf);
+        return 1;
+    }
+    /* fault everything in now, on the bound node, not in the first I/Os */
+    if (cf->anon) {
+        memset(cf->base, 0, cf->len);
+    }
+    FILE_SET_ENG_DATA(f, cf);
+    return 0;
+}
+
+static int fio_cxlmem_close_file(struct thread_data *td, struct fio_file *f)
+{
+    struct cxlmem_file *cf = FILE_ENG_DATA(f);
+
+    if (cf) {
+        if (cf->anon) {
+            munmap(cf->base, cf->len);
+        } else {
+            emu_mem_unmap(cf->base, cf->len);
+        }
+        free(cf);
+        FILE_SET_ENG_DATA(f, NULL);
+    }
+    return 0;
+}
+
+/* /dev/daxX.Y size from sysfs, like dev-dax; size= for node memory or CXL_EMU */
+static int fio_cxlmem_get_file_size(struct thread_data *td, struct fio_file *f)
+{
+    struct cxlmem_options *o = td->eo;
+    unsigned long long size = 0;
+    char path[PATH_MAX];
+    struct stat st;
+    FILE *fp;
+
+    if (node_opt(o->mem_node) < 0 && !stat(f->file_name, &st) && S_ISCHR(st.st_mode)) {
+        snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/size", major(st.st_rdev),
+                 minor(st.st_rdev));
+        fp = fopen(path, "r");
+        if (!fp || fscanf(fp, "%llu", &size) != 1) {
+            size = 0;
+        }
+        if (fp) {
+            fclose(fp);
+        }
+    }
+    if (!size) {
+        size = td->o.size / td->o.nr_files;
+    }
+    if (!size) {
+        log_err("cxlmem: %s: size unknown, set size=\n", f->file_name);
+        return 1;
+    }
+    f->real_file_size = size;
+    fio_file_set_size_known(f);
+    return 0;
+}
+
+/* I/O buffers on cxl_buf_node, else where fio would have put them */
+static int fio_cxlmem_iomem_alloc(struct thread_data *td, size_t total_mem)
+{
+    struct cxlmem_options *o = td->eo;
+    int node = node_opt(o->buf_node);
+
+    td->orig_buffer = mmap(NULL, total_mem, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (td->orig_buffer == MAP_FAILED) {
+        td->orig_buffer = NULL;
+        td_verror(td, errno, "mmap");
+        return 1;
+    }
+    if (node >= 0 && bind_node(td, td->orig_buffer, total_mem, node)) {
+        munmap(td->orig_buffer, total_mem);
+        td->orig_buffer = NULL;
+        return 1;
+    }
+    memset(td->orig_buffer, 0, total_mem);
+    o->iomem_len = total_mem;
+    return 0;
+}
+
+/* total_mem can be larger than orig_buffer_size (alignment, huge pages) */
+static void fio_cxlmem_iomem_free(struct thread_data *td)
+{
+    struct cxlmem_options *o = td->eo;
+
+    if (td->orig_buffer) {
+        munmap(td->orig_buffer, o->iomem_len);
+        td->orig_buffer = NULL;
+    }
+}
+
+static struct fio_option options[] = {
+    {
+        .name = "cxl_copy",
+        .lname = "CXL copy type",
+        .type = FIO_OPT_STR,
+        .off1 = offsetof(struct cxlmem_options, copy),
+        .help = "Loads/stores on the device side",
+        .def = "nt",
+        .posval = {
+            { .ival = "nt", .oval = CXL_COPY_NT,
+              .help = "Non-temporal stores (writes) or loads (reads)" },
+            { .ival = "temporal", .oval = CXL_COPY_TEMPORAL,
+              .help = "Ordinary cached loads and stores" },
+        },
+        .category = FIO_OPT_C_ENGINE,
+        .group = FIO_OPT_G_INVALID,
+    },
+    {
+        .name = "cxl_flush",
+        .lname = "CXL cache flush",
+        .type = FIO_OPT_STR,
+        .off1 = offsetof(struct cxlmem_options, flush),
+        .help = "Cache line flush per I/O",
+        .def = "none",
+        .posval = {
+            { .ival = "none", .oval = CXL_FLUSH_NONE, .help = "No flush" },
+            { .ival = "clwb", .oval = CXL_FLUSH_CLWB, .help = "clwb every line" },
+            { .ival = "clflushopt", .oval = CXL_FLUSH_CLFLUSHOPT,
+              .help = "clflushopt every line" },
+        },
+        .category = FIO_OPT_C_ENGINE,
+        .group = FIO_OPT_G_INVALID,
+    },
+    {
+        .name = "cxl_width",
+        .lname = "CXL access width",
+        .type = FIO_OPT_STR,
+        .off1 = offsetof(struct cxlmem_options, width),
+        .help = "Bytes per load/store",
+        .def = "32",
+        .posval = {
+            { .ival = "8", .oval = CXL_W8, .help = "64-bit registers" },
+            { .ival = "16", .oval = CXL_W16, .help = "SSE" },
+            { .ival = "32", .oval = CXL_W32, .help = "AVX" },
+            { .ival = "64", .oval = CXL_W64, .help = "AVX-512" },
+        },
+        .category = FIO_OPT_C_ENGINE,
+        .group = FIO_OPT_G_INVALID,
+    },
+    {
+        .name = "cxl_mem_node",
+        .lname = "CXL memory NUMA node",
+        .type = FIO_OPT_STR_STORE,
+        .off1 = offsetof(struct cxlmem_options, mem_node),
+        .help = "Target anonymous memory bound to this node instead of the file",
+        .category = FIO_OPT_C_ENGINE,
+        .group = FIO_OPT_G_INVALID,
+    },
+    {
+        .name = "cxl_buf_node",
+        .lname = "I/O buffer NUMA node",
+        .type = FIO_OPT_STR_STORE,
+        .off1 = offsetof(struct cxlmem_options, buf_node),
+        .help = "Bind the I/O buffers to this node",
+        .category = FIO_OPT_C_ENGINE,
+        .group = FIO_OPT_G_INVALID,
+    },
+    {
+        .name = NULL,
+    },
+};
+
+/* ioengine=external:<path>/cxlmem.so finds the engine by this symbol */
+struct ioengine_ops ioengine = {
+    .name = "cxlmem",
+    .version = FIO_IOOPS_VERSION,
+    .init = fio_cxlmem_init,
+    .queue = fio_cxlmem_queue,
+    .open_file = fio_cxlmem_open_file,
+    .close_file = fio_cxlmem_close_file,
+    .get_file_size = fio_cxlmem_get_file_size,
+    .iomem_alloc = fio_cxlmem_iomem_alloc,
+    .iomem_free = fio_cxlmem_iomem_free,
+    .flags = FIO_SYNCIO | FIO_DISKLESSIO | FIO_NOEXTEND | FIO_NODISKUTIL,
+    .options = options,
+    .option_struct_size = sizeof(struct cxlmem_options),
+};
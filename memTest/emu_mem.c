@@ -0,0 +1,211 @@
+/*************************************************************************
+@File Name: emu_mem.c
+@Desc: Emulated CXL memory backend, see emu_mem.h.
+************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "emu_mem.h"
+
+#define EMU_DEFAULT_SIZE    (1ULL << 30)
+#define EMU_DEFAULT_FILE    "/dev/shm/cxl_emu"
+
+/* from <numaif.h>, to avoid needing libnuma */
+#define EMU_MPOL_BIND       2
+#define EMU_MPOL_MF_MOVE    (1 << 1)
+
+struct emu_mem_cfg emu_mem;
+
+static struct {
+    int parsed;
+    uint64_t size;
+    char file[256];
+    int hugepage;
+    int node;
+} emu_opt;
+
+static uint64_t emu_parse_size(const char *val)
+{
+    char *e;
+    uint64_t n = strtoull(val, &e, 0);
+
+    switch (*e) {
+    case 'G': case 'g': n <<= 10; /* fall through */
+    case 'M': case 'm': n <<= 10; /* fall through */
+    case 'K': case 'k': n <<= 10; break;
+    default: break;
+    }
+    return n;
+}
+
+/* Read CXL_EMU once; returns 0 when emulation is off */
+static int emu_parse(void)
+{
+    char *spec, *tok, *save, *val;
+    const char *env;
+
+    if (emu_opt.parsed) {
+        return emu_mem.active;
+    }
+    emu_opt.parsed = 1;
+
+    env = getenv("CXL_EMU");
+    if (!env) {
+        return 0;
+    }
+
+    emu_mem.active = 1;
+    emu_opt.size = EMU_DEFAULT_SIZE;
+    snprintf(emu_opt.file, sizeof(emu_opt.file), "%s", EMU_DEFAULT_FILE);
+    emu_opt.hugepage = 1;
+    emu_opt.node = -1;
+
+    spec = strdup(env);
+    for (tok = strtok_r(spec, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        val = strchr(tok, '=');
+        if (!val) {
+            fprintf(stderr, "CXL_EMU: ignoring '%s'\n", tok);
+            continue;
+        }
+        *val++ = 0;
+
+        if (!strcmp(tok, "size")) {
+            emu_opt.size = emu_parse_size(val);
+        } else if (!strcmp(tok, "file")) {
+            snprintf(emu_opt.file, sizeof(emu_opt.file), "%s", val);
+        } else if (!strcmp(tok, "hugepage")) {
+            emu_opt.hugepage = atoi(val);
+        } else if (!strcmp(tok, "node")) {
+            emu_opt.node = atoi(val);
+        } else if (!strcmp(tok, "lat_ns")) {
+            emu_mem.lat_ns = strtoull(val, NULL, 0);
+        } else if (!strcmp(tok, "bw_mbs")) {
+            emu_mem.bw_mbs = strtoull(val, NULL, 0);
+        } else {
+            fprintf(stderr, "CXL_EMU: unknown key '%s'\n", tok);
+        }
+    }
+    free(spec);
+
+    if (emu_opt.size < 4096) {
+        emu_opt.size = EMU_DEFAULT_SIZE;
+    }
+    emu_opt.size &= ~4095ULL;
+
+    fprintf(stderr, "CXL_EMU: %llu MiB on %s, lat %llu ns, bw %llu MB/s\n",
+            (unsigned long long)(emu_opt.size >> 20), emu_opt.file,
+            (unsigned long long)emu_mem.lat_ns, (unsigned long long)emu_mem.bw_mbs);
+    return 1;
+}
+
+static void emu_bind(void *addr, size_t len)
+{
+    unsigned long mask[4] = { 0 };
+
+    if (emu_opt.node < 0 || emu_opt.node >= (int)(sizeof(mask) * 8)) {
+        return;
+    }
+    mask[emu_opt.node / (sizeof(long) * 8)] = 1UL << (emu_opt.node % (sizeof(long) * 8));
+    if (syscall(SYS_mbind, addr, len, EMU_MPOL_BIND, mask, sizeof(mask) * 8 + 1,
+                EMU_MPOL_MF_MOVE)) {
+        fprintf(stderr, "CXL_EMU: mbind to node %d failed: %s\n", emu_opt.node,
+                strerror(errno));
+    }
+}
+
+/*
+ * Map @len bytes at offset @off of @path, like open() + mmap(MAP_SHARED)
+ * + close(). Under CXL_EMU the offset wraps at the emulated size, the
+ * range must end within it, and the mapping comes from the backing file
+ * or anonymous memory instead. Returns MAP_FAILED with errno set on
+ * failure.
+ */
+void *emu_mem_map(const char *path, size_t len, off_t off)
+{
+    void *addr;
+    int fd, err;
+
+    if (!emu_parse()) {
+        fd = open(path, O_RDWR | O_SYNC);
+        if (fd < 0) {
+            return MAP_FAILED;
+        }
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, off);
+        err = errno;
+        close(fd);
+        errno = err;
+        return addr;
+    }
+
+    off = (uint64_t)off % emu_opt.size;
+    if ((uint64_t)off + len > emu_opt.size) {
+        fprintf(stderr, "CXL_EMU: 0x%zx bytes at 0x%llx run past size=%llu MiB\n",
+                len, (unsigned long long)off, (unsigned long long)(emu_opt.size >> 20));
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    if (!strcmp(emu_opt.file, "anon")) {
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+    } else {
+        fd = open(emu_opt.file, O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+            return MAP_FAILED;
+        }
+        if (ftruncate(fd, emu_opt.size)) {
+            err = errno;
+            close(fd);
+            errno = err;
+            return MAP_FAILED;
+        }
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, off);
+        err = errno;
+        close(fd);
+        errno = err;
+    }
+    if (addr == MAP_FAILED) {
+        return addr;
+    }
+
+    if (emu_opt.hugepage) {
+        madvise(addr, len, MADV_HUGEPAGE);
+    }
+    emu_bind(addr, len);
+    return addr;
+}
+
+int emu_mem_unmap(void *addr, size_t len)
+{
+    return munmap(addr, len);
+}
+
+static uint64_t emu_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void __emu_mem_delay(size_t bytes)
+{
+    uint64_t end = emu_now_ns() + emu_mem.lat_ns;
+
+    /* 1 MB/s moves one byte per microsecond */
+    if (emu_mem.bw_mbs) {
+        end += bytes * 1000ULL / emu_mem.bw_mbs;
+    }
+    while (emu_now_ns() < end) {
+        ;
+    }
+}
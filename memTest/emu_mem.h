@@ -0,0 +1,63 @@
+/*************************************************************************
+@File Name: emu_mem.h
+@Desc: Emulated CXL memory backend for memTest, memTestDax and iotest.
+
+    With CXL_EMU set in the environment, emu_mem_map() maps ordinary
+    memory instead of /dev/mem, /dev/dax* or a BAR, so the tools run on
+    any Linux box. CXL_EMU is a comma separated key=value list:
+
+      size=<n>[K|M|G]   emulated capacity, default 1G; device offsets
+                        wrap at this size, and a mapping that would run
+                        past it fails with EINVAL
+      file=<path>       backing file, default /dev/shm/cxl_emu, kept so
+                        values survive between runs (test.sh relies on
+                        that); file=anon for private anonymous memory
+      hugepage=0|1      ask for transparent huge pages, default 1
+      node=<n>          bind the backing memory to NUMA node n, e.g. a
+                        remote socket to get real extra latency
+      lat_ns=<n>        delay added by emu_mem_access() per access
+      bw_mbs=<n>        per-thread bandwidth cap applied by emu_mem_access()
+
+    Without CXL_EMU everything goes to the real device unchanged.
+************************************************************************/
+
+#ifndef EMU_MEM_H
+#define EMU_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct emu_mem_cfg {
+    int active;
+    uint64_t lat_ns;
+    uint64_t bw_mbs;
+};
+
+extern struct emu_mem_cfg emu_mem;
+
+void *emu_mem_map(const char *path, size_t len, off_t off);
+int emu_mem_unmap(void *addr, size_t len);
+void __emu_mem_delay(size_t bytes);
+
+/*
+ * Call around each access of @bytes to emulated memory: it spins for
+ * lat_ns plus the time bw_mbs needs to move @bytes. A no-op unless
+ * CXL_EMU asked for a delay.
+ */
+static inline void emu_mem_access(size_t bytes)
+{
+    if (emu_mem.lat_ns || emu_mem.bw_mbs) {
+        __emu_mem_delay(bytes);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMU_MEM_H */
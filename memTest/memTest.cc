@@ -10,7 +10,8 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <stdint.h>
-  
+#include "emu_mem.h"
+
 #define FATAL do { fprintf(stderr, "Error at line %d, file %s (%d) [%s]\n", \
   __LINE__, __FILE__, errno, strerror(errno)); exit(1); } while(0)
  
@@ -68,10 +69,12 @@ rwTest(void *addr, uint64_t *bytes)
     
     if (gWR) {
         *((volatile T*) addr) = wdat;
+        emu_mem_access(sizeof(T));
     }
 
     if (gRD) {
         rdat = *((volatile T*) addr);
+        emu_mem_access(sizeof(T));
     }
 
     if (gCH) {
@@ -193,9 +196,6 @@ main(int argc, char **argv)
     }
     
 
-    int fd;
-    if ((fd = open(devFile, O_RDWR | O_SYNC)) == -1) FATAL;
-    
     // Map one page
     unsigned int mapped_size    = 4096UL;
     unsigned int page_size      = mapped_size;
@@ -207,10 +207,8 @@ main(int argc, char **argv)
         mapped_size *= 2;
     }
     
-    void *map_base = mmap(NULL, mapped_size,
-                          PROT_READ | PROT_WRITE,
-                          MAP_SHARED, fd,
-                          physAddr & ~(off_t)(page_size - 1));
+    void *map_base = emu_mem_map(devFile, mapped_size,
+                                 physAddr & ~(off_t)(page_size - 1));
     if (map_base == NULL || map_base == (void *) -1) FATAL;
     
     void* virt_addr = ADDPTR(map_base, offset_in_page);
@@ -228,7 +226,9 @@ main(int argc, char **argv)
         for (unsigned int i = 0; i < nBytes; i++) wdat[i] = i;
         
         if (gRD) memcpy(rdat, virt_addr, nBytes);
+        if (gRD) emu_mem_access(nBytes);
         if (gWR) memcpy(virt_addr, wdat, nBytes);
+        if (gWR) emu_mem_access(nBytes);
 
         if (gCH) {
             for (unsigned int i = 0; i < nBytes; i++) {
@@ -240,8 +240,7 @@ main(int argc, char **argv)
         }
     }
 
-    if (munmap(map_base, mapped_size) == -1) FATAL;
-    close(fd);
+    if (emu_mem_unmap(map_base, mapped_size) == -1) FATAL;
 
     return (pass) ? 0 : -1;
 }
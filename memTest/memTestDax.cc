@@ -10,7 +10,7 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <stdint.h>
-
+#include "emu_mem.h"
 
 #if 0
 #define FATAL do { fprintf(stderr, "Error at line %d, file %s (%d) [%s]\n", \
@@ -22,6 +22,8 @@
 #define DEFAULT_MEM_FILE "/dev/dax0.0"
 #endif
 
+#define DAX_MAP_SIZE	536870912
+
 #define INCPTR(p,n) p = (void*) ( ((unsigned long) p) + ((unsigned long) n) )
 #define ADDPTR(p,n)     (void*) ( ((unsigned long) p) + ((unsigned long) n) )
 
@@ -74,11 +76,13 @@ rwTest(void *addr, uint64_t *bytes)
 	if (gWR) {
 		fprintf(stdout, "[WR] *(u%ld *)%p=0x%llx\n", sizeof(T) * 8, addr, (unsigned long long)wdat);
 		*((volatile T*) addr) = wdat;
+		emu_mem_access(sizeof(T));
 	}
 
 	if (gRD) {
 		fprintf(stdout, "[RD] rdat=*(u%ld *)%p\n", sizeof(T) * 8, addr);
 		rdat = *((volatile T*) addr);
+		emu_mem_access(sizeof(T));
 	}
 
 	if (gCH) {
@@ -103,7 +107,6 @@ int main(int argc, char **argv)
 	unsigned int nBytes = 0;
 	const char* q = NULL;
 	uint8_t *p = NULL;
-	int fd = -1;
 	void *map_base = NULL;
 	unsigned int mapped_size;
 	unsigned int page_size;
@@ -207,8 +210,6 @@ int main(int argc, char **argv)
 		usage(argv[0]);
 	}
 
-	if ((fd = open(devFile, O_RDWR | O_SYNC)) == -1) FATAL;
-
 	// Map one page
 	mapped_size    = 4096UL;
 	page_size      = mapped_size;
@@ -220,16 +221,13 @@ int main(int argc, char **argv)
 		mapped_size *= 2;
 	}
 
-	map_base = mmap(NULL, 536870912,
-			PROT_READ | PROT_WRITE,
-			MAP_SHARED, fd,
+	map_base = emu_mem_map(devFile, DAX_MAP_SIZE,
 			//physAddr & ~(off_t)(page_size - 1));
 	     		0);
 	if (map_base == NULL || map_base == (void *) -1) FATAL;
 
 #if 1
 	virt_addr = ADDPTR(map_base, offset_in_page);
-	fprintf(stdout, "fd = %d\n", fd);
 	fprintf(stdout, "map_base = %p\n", map_base);
 	fprintf(stdout, "virt_addr = %p\n", virt_addr);
 	fprintf(stdout, "nBytes = %d\n", nBytes);
@@ -245,7 +243,9 @@ int main(int argc, char **argv)
 		for (unsigned int i = 0; i < nBytes; i++) wdat[i] = i;
 
 		if (gRD) memcpy(rdat, virt_addr, nBytes);
+		if (gRD) emu_mem_access(nBytes);
 		if (gWR) memcpy(virt_addr, wdat, nBytes);
+		if (gWR) emu_mem_access(nBytes);
 
 		if (gCH) {
 			for (unsigned int i = 0; i < nBytes; i++) {
@@ -258,15 +258,10 @@ int main(int argc, char **argv)
 	}
 #endif
 
-	if (munmap(map_base, mapped_size) == -1) FATAL;
-	close(fd);
+	if (emu_mem_unmap(map_base, DAX_MAP_SIZE) == -1) FATAL;
 	return (pass) ? 0 : -1;
 
 fatal_out:
-	if (fd != -1) {
-		close(fd);
-	}
-	fprintf(stdout, "fd = %d\n", fd);
 	fprintf(stdout, "map_base = %p\n", map_base);
 	fprintf(stdout, "virt_addr = %p\n", virt_addr);
 	fprintf(stdout, "nBytes = %d\n", nBytes);
@@ -13,31 +13,30 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <x86intrin.h>
 
+#include "emu_mem.h"
+
 
 #define PAGE_SIZE   (8 * 1024* 1024 * 1024ULL)
 #define BUF_SIZE  (2*1024*1024)
-#define FILLLOOP PAGE_SIZE / (BUF_SIZE * sizeof(int))
 unsigned int buf[BUF_SIZE];
-int main()
+/* usage: iotest [map size], default PAGE_SIZE; CXL_EMU=... runs without a device */
+int main(int argc, char **argv)
 {
     int i = 0, loop = 0; 
+    unsigned long long map_size = argc > 1 ? strtoull(argv[1], NULL, 0) : PAGE_SIZE;
+    int fillloop = map_size / sizeof(buf);
     /* DAX mapping requires a 2MiB alignment */
-    int fd = open("/dev/dax0.0", O_RDWR | O_SYNC);
-    if (fd == -1) {
-        perror("open() failed");
-        return 1;
-    } 
-    void *dax_addr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void *dax_addr = emu_mem_map("/dev/dax0.0", map_size, 0);
     if (dax_addr == MAP_FAILED) {
         perror("mmap() failed");
-        close(fd);
         return 1;
 
     } 
-    printf("map size 0x%llx, buf size 0x%x, base %p\n", PAGE_SIZE, BUF_SIZE, dax_addr);
-    for (loop = 0; loop < FILLLOOP; loop++)
+    printf("map size 0x%llx, buf size 0x%x, base %p\n", map_size, BUF_SIZE, dax_addr);
+    for (loop = 0; loop < fillloop; loop++)
     {
         char * dst_addr = dax_addr + loop * sizeof(buf);
 	    memset(buf, 0x00, sizeof(buf));
@@ -49,6 +48,7 @@ int main()
         /** printf("proc %p, buf[]:0x%08x...\n", dst_addr, buf[0]); */
         /* Write something to the memory */
         memcpy(dst_addr, buf, sizeof(buf));
+        emu_mem_access(sizeof(buf));
 
    	//int result = msync((void *)dst_addr, sizeof(buf), MS_SYNC);
       	//if (result == -1) {
@@ -69,7 +69,6 @@ int main()
     memcpy(buf, dax_addr, 4096);
 
 
-    munmap(dax_addr, PAGE_SIZE);
-    close(fd);
+    emu_mem_unmap(dax_addr, map_size);
     return 0;
 }
@@ -1,8 +1,9 @@
 # Make sure debug is turned on
 
-setpci -s 81:00.0 0x008.l=0x00000001
+# CXL_EMU=... runs against emulated memory instead (see emu_mem.h)
+[ -z "$CXL_EMU" ] && setpci -s 81:00.0 0x008.l=0x00000001
 
-gcc -o memTest memTest.cc
+make -s memTest || exit 1
 ./memTest    0x4000000000 DEADBEEF
 ./memTest    0x4000000004 01234567
 # This should cause the line to be read and merged with the two WR above
@@ -4,6 +4,8 @@ import sys
 import argparse
 import re
 import subprocess
+import mmap
+import struct
 
 def normalize_slot(slot):
     """标准化PCI设备地址格式"""
@@ -86,6 +88,31 @@ def read_with_devmem(address, size, width=32, busybox_path="./busybox"):
         print(f"读取0x{address:x}失败: {str(e)}")
         return None
 
+def read_with_resource(path, offset, size):
+    """读取资源文件（sysfs resourceN或cxl_regemu文件），按32位访问"""
+    try:
+        with open(path, 'rb') as f:
+            length = os.fstat(f.fileno()).st_size
+            if offset >= length:
+                print(f"错误: 偏移量0x{offset:x}超出{path}大小 (0x{length:x})")
+                return None
+            size = min(size, length - offset)
+            m = mmap.mmap(f.fileno(), length, mmap.MAP_SHARED, mmap.PROT_READ)
+            data = bytearray()
+            # MMIO需要对齐的32位读取，不能按字节拷贝
+            for off in range(offset & ~3, offset + size, 4):
+                # 普通文件可能在双字中间结束（resourceN按页对齐），剩余字节直接拷贝
+                if off + 4 > length:
+                    data.extend(m[off:length])
+                    break
+                data.extend(struct.pack('<I', struct.unpack_from('<I', m, off)[0]))
+            m.close()
+            skip = offset & 3
+            return bytes(data[skip:skip + size])
+    except Exception as e:
+        print(f"读取{path}失败: {str(e)}")
+        return None
+
 def format_hex_dump(data, base_address, bytes_per_line=16):
     """格式化十六进制输出"""
     result = []
@@ -102,7 +129,7 @@ def main():
         description="PCIe BAR空间解析工具（基于lspci和devmem）",
         formatter_class=argparse.RawTextHelpFormatter
     )
-    parser.add_argument("slot", 
+    parser.add_argument("slot", nargs="?",
         help="PCI设备位置，支持以下格式：\n"
              " - 简短格式: 01:00.0\n"
              " - 完整格式: 0000:01:00.0")
@@ -114,9 +141,30 @@ def main():
         help="指定要dump的长度（字节数，支持十六进制，默认128)")
     parser.add_argument("--busybox", default="./busybox",
         help="指定busybox路径（默认当前目录）")
+    parser.add_argument("--resource",
+        help="从文件读取BAR，不使用lspci和devmem：\n"
+             " - /sys/bus/pci/devices/<slot>/resource<bar>\n"
+             " - cxltools的cxl_regemu寄存器文件（不需要root）")
 
     args = parser.parse_args()
 
+    if args.resource:
+        print(f"\n资源文件 {args.resource}:")
+        print(f"  本次读取范围: 0x{args.offset:x}-0x{args.offset+args.dump_len:x}")
+        data = read_with_resource(args.resource, args.offset, args.dump_len)
+        if data:
+            print("\nHex dump:")
+            print(format_hex_dump(data, args.offset))
+        else:
+            print("无法读取BAR内容")
+        return
+
+    if not args.slot:
+        parser.error("没有--resource时必须指定slot")
+    if os.geteuid() != 0:
+        print("错误：需要root权限运行 (使用sudo执行)", file=sys.stderr)
+        sys.exit(1)
+
     # 标准化设备地址
     normalized_slot = normalize_slot(args.slot)
     
@@ -166,9 +214,6 @@ def main():
             print("无法读取BAR内容")
 
 if __name__ == "__main__":
-    if os.geteuid() != 0:
-        print("错误：需要root权限运行 (使用sudo执行)", file=sys.stderr)
-        sys.exit(1)
     try:
         main()
     except KeyboardInterrupt:
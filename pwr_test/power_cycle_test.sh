@@ -10,6 +10,14 @@
 LOG_FILE="/var/log/power_cycle.log"
 CYCLE_COUNT_FILE="/var/log/power_cycle_count.txt"
 
+# 可选: 检查设备内容是否在power cycle后保留 (cxltools/bin/cxlfp)
+# FP_DEV=/dev/dax0.0 时, 每次power cycle前写入以循环计数为generation的pattern
+# 并记录指纹, 重启后校验. FP_EXPECT=zero 时重启后要求内容已被清零(sanitize)
+FP_DEV=${FP_DEV:-}
+FP_EXPECT=${FP_EXPECT:-persist}
+FP_TOOL=${FP_TOOL:-/usr/local/bin/cxlfp}
+FP_SNAP="/var/log/power_cycle_fp.snap"
+
 # 初始化循环计数
 if [ -f "$CYCLE_COUNT_FILE" ]; then
     CYCLE_COUNT=$(cat "$CYCLE_COUNT_FILE")
@@ -39,11 +47,49 @@ check_device() {
     fi
 }
 
+# 重启后校验设备内容, 第一次循环前没有写过则跳过
+check_content() {
+    [ -z "$FP_DEV" ] || [ ! -f "$FP_SNAP" ] && return 0
+
+    # 等待region/dax上线
+    for ((t=0; t<60; t++)); do
+        [ -e "$FP_DEV" ] && break
+        sleep 1
+    done
+    if [ "$FP_EXPECT" = zero ]; then
+        $FP_TOOL verify -z $FP_DEV >> $LOG_FILE 2>&1
+    else
+        $FP_TOOL verify -f $FP_SNAP $FP_DEV >> $LOG_FILE 2>&1
+    fi
+}
+
+# power cycle前写入pattern并记录指纹
+write_content() {
+    [ -z "$FP_DEV" ] && return 0
+    $FP_TOOL write -g $CYCLE_COUNT -f $FP_SNAP $FP_DEV >> $LOG_FILE 2>&1
+}
+
 # 主循环
 while true; do
     if check_device; then
+        check_content
+        rc=$?
+        if [ $rc -ne 0 ]; then
+            rm $CYCLE_COUNT_FILE
+            # cxlfp verify: 1 内容不一致, 其他(2 参数/大小错误, 崩溃) 没能校验
+            if [ $rc -eq 1 ]; then
+                log_message "$FP_DEV content check failed, see cxlfp output above"
+            else
+                log_message "cxlfp could not check $FP_DEV (exit $rc), see its output above"
+            fi
+            break
+        fi
         CYCLE_COUNT=$((CYCLE_COUNT + 1))
         echo "$CYCLE_COUNT" > "$CYCLE_COUNT_FILE"  # 将计数写回文件
+        if ! write_content; then
+            log_message "cxlfp write to $FP_DEV failed"
+            break
+        fi
         log_message "CXL DVSEC ID 0 memor Enabled, probe success, power cycle"
         sleep 120
         sudo ipmitool power cycle
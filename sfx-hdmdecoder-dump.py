@@ -4,6 +4,8 @@ import sys
 import argparse
 import re
 import subprocess
+import mmap
+import struct
 
 def normalize_slot(slot):
     """Standardize PCI device address format"""
@@ -86,6 +88,31 @@ def read_with_devmem(address, size, width=32, busybox_path="./busybox"):
         print(f"Failed to read 0x{address:x}: {str(e)}")
         return None
 
+def read_with_resource(path, offset, size):
+    """Read a mapped resource file (sysfs resourceN or a cxl_regemu file) in dwords"""
+    try:
+        with open(path, 'rb') as f:
+            length = os.fstat(f.fileno()).st_size
+            if offset >= length:
+                print(f"Error: offset 0x{offset:x} past the end of {path} (0x{length:x})")
+                return None
+            size = min(size, length - offset)
+            m = mmap.mmap(f.fileno(), length, mmap.MAP_SHARED, mmap.PROT_READ)
+            data = bytearray()
+            # MMIO wants aligned 32-bit loads, not a byte copy
+            for off in range(offset & ~3, offset + size, 4):
+                # a plain file can end inside a dword (resourceN is page sized): copy the tail
+                if off + 4 > length:
+                    data.extend(m[off:length])
+                    break
+                data.extend(struct.pack('<I', struct.unpack_from('<I', m, off)[0]))
+            m.close()
+            skip = offset & 3
+            return bytes(data[skip:skip + size])
+    except Exception as e:
+        print(f"Failed to read {path}: {str(e)}")
+        return None
+
 def format_hex_dump(data, base_address, bytes_per_line=16):
     """Format hexadecimal output"""
     result = []
@@ -271,7 +298,7 @@ def main():
         description="PCIe BAR space parsing tool (based on lspci and devmem)",
         formatter_class=argparse.RawTextHelpFormatter
     )
-    parser.add_argument("slot", 
+    parser.add_argument("slot", nargs="?",
         help="PCI device location, formats:\n"
              " - Short: 01:00.0\n"
              " - Full: 0000:01:00.0")
@@ -285,9 +312,33 @@ def main():
         help="Specify busybox path (default: current directory)")
     parser.add_argument("--dump-raw", action="store_true",
         help="Enable dumping of raw hex data and analysis")
+    parser.add_argument("--resource",
+        help="Read the BAR from a file instead of lspci and devmem:\n"
+             " - /sys/bus/pci/devices/<slot>/resource<bar>\n"
+             " - a cxltools cxl_regemu register file (no root needed)")
     
     args = parser.parse_args()
     
+    if args.resource:
+        print(f"\nResource {args.resource}:")
+        print(f"  Read range: 0x{args.offset:x}-0x{args.offset+args.dump_len:x}")
+        data = read_with_resource(args.resource, args.offset, args.dump_len)
+        if data:
+            if args.dump_raw:
+                print("\nHex dump:")
+                print(format_hex_dump(data, args.offset))
+                analyze_dumped_data(data, dump_raw=args.dump_raw)
+            parse_cxl_header(data)
+        else:
+            print("Cannot read BAR content")
+        return
+    
+    if not args.slot:
+        parser.error("slot is required without --resource")
+    if os.geteuid() != 0:
+        print("Error: Requires root privileges to run (use sudo)")
+        sys.exit(1)
+    
     # Standardize device address
     normalized_slot = normalize_slot(args.slot)
     
@@ -338,9 +389,6 @@ def main():
             print("Cannot read BAR content")
 
 if __name__ == "__main__":
-    if os.geteuid() != 0:
-        print("Error: Requires root privileges to run (use sudo)")
-        sys.exit(1)
     try:
         main()
     except KeyboardInterrupt: